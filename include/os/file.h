@@ -41,4 +41,25 @@ int OSFileLoadAll(const char *pszFilename, void **ppv, size_t *pcb);
  */
 int OSFileLoadAllFree(void *pv, size_t cb);
 
+/**
+ * Maps the given file private (copy on write) and writable into the process memory space.
+ *
+ * @returns Status code.
+ * @param   pszFilename             The filename to map.
+ * @param   ppv                     Where to store the pointer to the start of the mapping on success (page aligned).
+ * @param   pcb                     Where to store the size of the mapping on success.
+ *
+ * @note Changes to the mapping are never written back to the file.
+ */
+int OSFileMapPrivate(const char *pszFilename, void **ppv, size_t *pcb);
+
+/**
+ * Unmaps a file mapped with OSFileMapPrivate().
+ *
+ * @returns Status code.
+ * @param   pv                      Pointer to the start of the mapping as returned by OSFileMapPrivate().
+ * @param   cb                      Size of the mapping as returned by OSFileMapPrivate().
+ */
+int OSFileUnmap(void *pv, size_t cb);
+
 #endif /* !INCLUDED_os_file_h */
@@ -61,4 +61,12 @@ int OSThreadCreate(POSTHREAD phThread, PFNOSTHREADMAIN pfnMain, void *pvUser);
 int OSThreadDestroy(OSTHREAD hThread, int *prcThread);
 
 
+/**
+ * Gives up the remaining time slice of the calling thread.
+ *
+ * @returns nothing.
+ */
+void OSThreadYield(void);
+
+
 #endif /* !INCLUDED_os_thread_h */
@@ -27,6 +27,8 @@
 
 #include <psp-cfg.h>
 #include <psp-core.h>
+#include <psp-cov.h>
+#include <psp-evtq.h>
 #include <psp-iom.h>
 
 
@@ -77,6 +79,28 @@ int PSPEmuCcdQueryCore(PSPCCD hCcd, PPSPCORE phPspCore);
 int PSPEmuCcdQueryIoMgr(PSPCCD hCcd, PPSPIOM phIoMgr);
 
 
+/**
+ * Queries the event queue handle from the given CCD.
+ *
+ * @returns Status code.
+ * @param   hCcd                The CCD handle.
+ * @param   phEvtQ              Where to store the handle to the event queue on success.
+ */
+int PSPEmuCcdQueryEvtQ(PSPCCD hCcd, PPSPEVTQ phEvtQ);
+
+
+/**
+ * Sets all CCDs of the emulated system so SMN accesses targeting another die get routed
+ * to the I/O manager of the owning CCD.
+ *
+ * @returns Status code.
+ * @param   hCcd                The CCD handle.
+ * @param   pahCcds             Array of all CCDs in the system, must stay valid for the lifetime of the CCD.
+ * @param   cCcds               Number of CCDs in the array.
+ */
+int PSPEmuCcdPeersSet(PSPCCD hCcd, PSPCCD *pahCcds, uint32_t cCcds);
+
+
 /**
  * Resets the given CCD instance to the initial state right after creation, including all device states.
  *
@@ -86,11 +110,83 @@ int PSPEmuCcdQueryIoMgr(PSPCCD hCcd, PPSPIOM phIoMgr);
 int PSPEmuCcdReset(PSPCCD hCcd);
 
 
+/**
+ * Saves the complete state of the given CCD (SRAM, core, I/O manager, interrupt controller
+ * and device states) to the given snapshot file.
+ *
+ * @returns Status code.
+ * @param   hCcd                The CCD handle.
+ * @param   pszFilename         The file to write the snapshot to.
+ */
+int PSPEmuCcdSnapshotSave(PSPCCD hCcd, const char *pszFilename);
+
+
+/**
+ * Restores the state of the given CCD from the given snapshot file.
+ *
+ * @returns Status code.
+ * @param   hCcd                The CCD handle.
+ * @param   pszFilename         The snapshot file to restore from.
+ *
+ * @note The SRAM is mapped copy on write from the snapshot file instead of being copied, so
+ *       restoring is cheap regardless of the SRAM size.
+ */
+int PSPEmuCcdSnapshotRestore(PSPCCD hCcd, const char *pszFilename);
+
+
+/**
+ * Executes the given CCD until the given address is about to be executed.
+ *
+ * @returns Status code.
+ * @retval  STS_ERR_NOT_FOUND if execution stopped before reaching the address.
+ * @param   hCcd                The CCD handle.
+ * @param   PspAddrUpTo         The address to stop at.
+ */
+int PSPEmuCcdRunUpTo(PSPCCD hCcd, PSPADDR PspAddrUpTo);
+
+
+/**
+ * Returns the coverage tracer of the given CCD.
+ *
+ * @returns Status code.
+ * @retval  STS_ERR_NOT_FOUND if coverage tracing is not enabled.
+ * @param   hCcd                The CCD handle.
+ * @param   phCov               Where to store the coverage tracer handle on success.
+ */
+int PSPEmuCcdQueryCov(PSPCCD hCcd, PPSPCOV phCov);
+
+
+/**
+ * Writes out everything buffered for the trace log and I/O log of the given CCD.
+ *
+ * @returns Status code.
+ * @param   hCcd                The CCD handle.
+ *
+ * @note Required before forking so buffered data is not duplicated and before a child
+ *       exits with _exit() so its data does not get lost.
+ */
+int PSPEmuCcdFlush(PSPCCD hCcd);
+
+
+/**
+ * Asks the given CCD to stop executing as soon as possible.
+ *
+ * @returns Status code.
+ * @param   hCcd                The CCD handle.
+ *
+ * @note This is safe to call from any thread. If the CCD is not running yet a later PSPEmuCcdRun()
+ *       returns immediately.
+ */
+int PSPEmuCcdStop(PSPCCD hCcd);
+
+
 /**
  * Let the given CCD instance run.
  *
  * @returns Status code.
  * @param   hCcd                The CCD handle.
+ *
+ * @note Different CCDs can run concurrently on different threads.
  */
 int PSPEmuCcdRun(PSPCCD hCcd);
 
@@ -225,11 +225,19 @@ typedef struct PSPEMUCFG
     bool                    fTraceSvcs;
     /** Flag whether the timer should tick in real time. */
     bool                    fTimerRealtime;
+    /** Number of instructions per second for the virtual clock, 0 to use the default. */
+    uint64_t                cVirtClockIps;
+    /** Flag whether page table writes are tracked by write protecting the pages instead of unicorn write hooks. */
+    bool                    fMmuPgTblWrProt;
+    /** Flag whether to detect polling loops and fast forward the virtual clock. */
+    bool                    fPollFastForward;
     /** Flag whether any loaded boot ROM sevrice page should be taken as is or modified to match the CCD
      * it is implanted on. */
     bool                    fBootRomSvcPageModify;
     /** Flag whether the i/O manager should log all I/O accesses to all regions. */
     bool                    fIomLogAllAccesses;
+    /** Flag whether the I/O manager should collect per region access statistics. */
+    bool                    fIomStats;
     /** Flag whether the proxy should try to buffer certain writes to speed up data transfers. */
     bool                    fProxyWrBuffer;
     /** Flag whether to proxy certain CCP requests - requires the proxy to be enabled of course. */
@@ -271,8 +279,26 @@ typedef struct PSPEMUCFG
     const char              *pszIoLog;
     /** Pointer to the I/O log file to replay. */
     const char              *pszIoLogReplay;
+    /** Pointer to the interrupt log file to write. */
+    const char              *pszIrqLog;
+    /** Pointer to the interrupt log file to replay. */
+    const char              *pszIrqLogReplay;
     /** Coverage tracing filename if enabled. */
     const char              *pszCovTrace;
+    /** Binary instruction trace filename if enabled. */
+    const char              *pszInsnTrace;
+    /** Profiler folded stack output filename if enabled. */
+    const char              *pszProfile;
+    /** Symbol map to symbolize the profiler output with, optional. */
+    const char              *pszProfSymMap;
+    /** Number of retired instructions between two profiler samples. */
+    uint64_t                cProfInsnsInterval;
+    /** Maximum number of frames recorded per profiler sample. */
+    uint32_t                cProfFramesMax;
+    /** Page access heatmap output filename if enabled. */
+    const char              *pszHeatmap;
+    /** Length of a working set epoch in virtual microseconds. */
+    uint64_t                cUsHeatmapEpoch;
     /** Number of sockets in the system to emulate. */
     uint32_t                cSockets;
     /** Number of CCDs per socket to emulate. */
@@ -315,6 +341,24 @@ typedef struct PSPEMUCFG
     /** size of the UEFI image in bytes. */
     size_t                  cbUefi;
     /** @} */
+
+    /** @name Snapshot related config items.
+     * @{*/
+    /** Filename of the snapshot to write, NULL if disabled. */
+    const char              *pszSnapshotSave;
+    /** PSP address at which to write the snapshot. */
+    PSPADDR                 PspAddrSnapshotSave;
+    /** Filename of the snapshot to restore before starting emulation, NULL if disabled. */
+    const char              *pszSnapshotRestore;
+    /** @} */
+
+    /** @name Fork server related config items.
+     * @{*/
+    /** Path of the UNIX domain socket to serve fork server requests on, NULL if disabled. */
+    const char              *pszForkSrv;
+    /** Maximum time a single fork server run may take in milliseconds before the child gets killed, 0 for no limit. */
+    uint32_t                cMsForkSrvTimeout;
+    /** @} */
 } PSPEMUCFG;
 /** Pointer to a PSPEmu config. */
 typedef PSPEMUCFG *PPSPEMUCFG;
@@ -25,6 +25,8 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include <psp-snapshot.h>
+
 /** An ARM ASID. */
 typedef uint32_t ARMASID;
 
@@ -90,10 +92,163 @@ typedef int (FNPSPCOREWFI)(PSPCORE hCore, PSPADDR PspAddrPc, uint32_t fFlags, bo
 /** Pointer to a WFI reached callback. */
 typedef FNPSPCOREWFI *PFNPSPCOREWFI;
 
-/** Just check for a pending interrupt but don't block. */
+
+/**
+ * Virtual clock deadline reached callback.
+ *
+ * @returns nothing.
+ * @param   hCore                   The PSP core handle which reached the deadline.
+ * @param   tsNowNs                 The current virtual time in nanoseconds.
+ * @param   pvUser                  Opaque user data passed during callback registration.
+ *
+ * @note The callback is expected to set a new deadline with PSPEmuCoreDeadlineSet().
+ */
+typedef void (FNPSPCOREDEADLINE)(PSPCORE hCore, uint64_t tsNowNs, void *pvUser);
+/** Pointer to a deadline reached callback. */
+typedef FNPSPCOREDEADLINE *PFNPSPCOREDEADLINE;
+
+
+/**
+ * Polling loop deadline query callback.
+ *
+ * @returns Virtual time in nanoseconds at which the polled value might change on its own, UINT64_MAX if unknown.
+ * @param   hCore                   The PSP core handle which detected the polling loop.
+ * @param   PspAddrMmio             The physical MMIO address being polled.
+ * @param   cbRead                  Size of the read in bytes.
+ * @param   pvUser                  Opaque user data passed during callback registration.
+ */
+typedef uint64_t (FNPSPCOREPOLLDEADLINE)(PSPCORE hCore, PSPADDR PspAddrMmio, size_t cbRead, void *pvUser);
+/** Pointer to a polling loop deadline query callback. */
+typedef FNPSPCOREPOLLDEADLINE *PFNPSPCOREPOLLDEADLINE;
+
+
+/**
+ * Page access notification callback, called from the memory fault path whenever a page gets mapped in.
+ *
+ * @returns nothing.
+ * @param   hCore                   The PSP core handle.
+ * @param   PspPAddrPg              The physical address of the page being accessed.
+ * @param   fAccess                 The access type causing the fault, one of PSPEMU_CORE_TRACE_F_READ,
+ *                                  PSPEMU_CORE_TRACE_F_WRITE or PSPEMU_CORE_TRACE_F_EXEC.
+ * @param   pvUser                  Opaque user data passed during callback registration.
+ */
+typedef void (FNPSPCOREMEMACCESS)(PSPCORE hCore, PSPPADDR PspPAddrPg, uint32_t fAccess, void *pvUser);
+/** Pointer to a page access notification callback. */
+typedef FNPSPCOREMEMACCESS *PFNPSPCOREMEMACCESS;
+
+
+/**
+ * Interrupt line record callback, called whenever the state of the IRQ or FIQ line changes.
+ *
+ * @returns nothing.
+ * @param   hCore                   The PSP core handle.
+ * @param   cInsns                  Number of instructions retired when the change happened.
+ * @param   tsVirtNs                The virtual time in nanoseconds when the change happened, this can be ahead
+ *                                  of the instruction count if the core was idling in WFI.
+ * @param   PspAddrBb               Start address of the last basic block executed.
+ * @param   fIrq                    The new IRQ line state.
+ * @param   fFiq                    The new FIQ line state.
+ * @param   pvUser                  Opaque user data passed during callback registration.
+ */
+typedef void (FNPSPCOREIRQRECORD)(PSPCORE hCore, uint64_t cInsns, uint64_t tsVirtNs, PSPADDR PspAddrBb, bool fIrq, bool fFiq,
+                                  void *pvUser);
+/** Pointer to an interrupt line record callback. */
+typedef FNPSPCOREIRQRECORD *PFNPSPCOREIRQRECORD;
+
+
+/**
+ * Interrupt line replay callback, called once the instruction count of the next change is reached.
+ *
+ * @returns Instruction count of the following change, UINT64_MAX if there is none.
+ * @param   hCore                   The PSP core handle.
+ * @param   cInsns                  Number of instructions retired so far.
+ * @param   PspAddrBb               Start address of the last basic block executed.
+ * @param   ptsVirtNs               Where to store the virtual time in nanoseconds the change happened at,
+ *                                  holds the current virtual time on input.
+ * @param   pfIrq                   Where to store the new IRQ line state, holds the current state on input.
+ * @param   pfFiq                   Where to store the new FIQ line state, holds the current state on input.
+ * @param   pvUser                  Opaque user data passed during callback registration.
+ */
+typedef uint64_t (FNPSPCOREIRQREPLAY)(PSPCORE hCore, uint64_t cInsns, PSPADDR PspAddrBb, uint64_t *ptsVirtNs,
+                                      bool *pfIrq, bool *pfFiq, void *pvUser);
+/** Pointer to an interrupt line replay callback. */
+typedef FNPSPCOREIRQREPLAY *PFNPSPCOREIRQREPLAY;
+
+
+/**
+ * Kick callback, called on the thread executing the core after PSPEmuCoreKick() was called.
+ *
+ * @returns nothing.
+ * @param   hCore                   The PSP core handle.
+ * @param   pvUser                  Opaque user data passed during callback registration.
+ */
+typedef void (FNPSPCOREKICK)(PSPCORE hCore, void *pvUser);
+/** Pointer to a kick callback. */
+typedef FNPSPCOREKICK *PFNPSPCOREKICK;
+
+
+/**
+ * PSP core execution statistics.
+ */
+typedef struct PSPCORESTATS
+{
+    /** Number of instructions retired. */
+    uint64_t                        cInsnsRetired;
+    /** Current virtual time in nanoseconds. */
+    uint64_t                        tsVirtNs;
+    /** Number of uc_emu_start() round trips. */
+    uint64_t                        cEmuStarts;
+    /** Number of MMIO reads. */
+    uint64_t                        cMmioReads;
+    /** Number of MMIO writes. */
+    uint64_t                        cMmioWrites;
+    /** Number of MMU translation faults (accesses to not yet mapped virtual addresses). */
+    uint64_t                        cMmuFaults;
+    /** Number of MMU mappings created. */
+    uint64_t                        cMmuMappingsCreated;
+    /** Number of MMU mappings merged with adjacent ones. */
+    uint64_t                        cMmuMappingsMerged;
+    /** Number of MMU mappings invalidated due to page table writes. */
+    uint64_t                        cMmuMappingsInvalidated;
+    /** Number of full MMU mapping flushes. */
+    uint64_t                        cMmuFlushes;
+    /** Number of full MMU mapping flushes avoided. */
+    uint64_t                        cMmuFlushesAvoided;
+    /** Number of writes to tracked page tables. */
+    uint64_t                        cMmuPgTblWrites;
+    /** Number of write protection faults on pages containing tracked page tables. */
+    uint64_t                        cMmuPgTblWrProtFaults;
+    /** Number of software TLB hits in the host side virtual memory accessors. */
+    uint64_t                        cTlbHits;
+    /** Number of software TLB misses (full page table walks) in the host side virtual memory accessors. */
+    uint64_t                        cTlbMisses;
+    /** Number of exceptions injected. */
+    uint64_t                        cExcpsInjected;
+    /** Number of SVC instructions executed. */
+    uint64_t                        cSvcs;
+    /** Number of SMC instructions executed. */
+    uint64_t                        cSmcs;
+    /** Number of times the virtual clock was fast forwarded while idling in WFI. */
+    uint64_t                        cWfiFastForwards;
+    /** Number of nanoseconds skipped while idling in WFI. */
+    uint64_t                        cNsWfiFastForwarded;
+    /** Number of times the virtual clock was fast forwarded in a polling loop. */
+    uint64_t                        cPollFastForwards;
+    /** Number of nanoseconds skipped in polling loops. */
+    uint64_t                        cNsPollFastForwarded;
+} PSPCORESTATS;
+/** Pointer to PSP core execution statistics. */
+typedef PSPCORESTATS *PPSPCORESTATS;
+
+/** Just check for a pending interrupt but don't block (not used by the core anymore, interrupt
+ * lines are expected to be updated through PSPEmuCoreIrqSet()/PSPEmuCoreFiqSet()). */
 #define PSPEMU_CORE_WFI_CHECK                   BIT(0)
 
 
+/** Default number of instructions per second the virtual clock of a core runs at. */
+#define PSPEMU_CORE_VIRT_CLOCK_IPS_DEFAULT      UINT64_C(100000000)
+
+
 /**
  * ARM core mode.
  */
@@ -433,6 +588,10 @@ int PSPEmuCoreQueryReg(PSPCORE hCore, PSPCOREREG enmReg, uint32_t *puVal);
  * @param   paenmReg                Array of registers to query.
  * @param   cRegs                   Number of registers in the array.
  * @param   pauVal                  Where to store the values of the registers on success.
+ *
+ * @note While the core is stopped all register accesses are served from a cache filled with a single batched
+ *       read, modified registers are written back in one batch before the execution resumes (CPSR and SPSR are
+ *       written through). Accesses from within hooks always go to the emulation engine directly.
  */
 int PSPEmuCoreQueryRegBatch(PSPCORE hCore, const PSPCOREREG *paenmReg, uint32_t cRegs, uint32_t *pauVal);
 
@@ -465,6 +624,27 @@ int PSPEmuCoreExecRun(PSPCORE hCore, uint32_t fFlags, uint32_t cInsnExec, uint32
  */
 int PSPEmuCoreExecStop(PSPCORE hCore);
 
+/**
+ * Sets the callback to call when the core gets kicked.
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ * @param   pfnKick                 The kick callback, NULL to remove it.
+ * @param   pvUser                  Opaque user data to pass to the callback.
+ */
+int PSPEmuCoreKickCallbackSet(PSPCORE hCore, PFNPSPCOREKICK pfnKick, void *pvUser);
+
+/**
+ * Makes the thread executing the core call the kick callback as soon as possible without stopping the execution.
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ *
+ * @note This is safe to call from any thread. A kick arriving right before the core enters the emulation
+ *       might only be noticed at the next exit, so callers waiting for the callback should kick repeatedly.
+ */
+int PSPEmuCoreKick(PSPCORE hCore);
+
 /**
  * Performs a CPU state reset.
  *
@@ -542,6 +722,10 @@ int PSPEmuCoreWfiSet(PSPCORE hCore, PFNPSPCOREWFI pfnWfiReached, void *pvUser);
  * @returns Status code.
  * @param   hCore                   The PSP core handle.
  * @param   fAssert                 Flag whether the IRQ line is asserted or not.
+ *
+ * @note The interrupt is delivered as soon as the line gets asserted and it isn't masked in CPSR,
+ *       otherwise it gets delivered once the guest unmasks it. This is the only way to deliver
+ *       interrupts, the core doesn't poll for pending interrupts.
  */
 int PSPEmuCoreIrqSet(PSPCORE hCore, bool fAssert);
 
@@ -551,9 +735,183 @@ int PSPEmuCoreIrqSet(PSPCORE hCore, bool fAssert);
  * @returns Status code.
  * @param   hCore                   The PSP core handle.
  * @param   fAssert                 Flag whether the FIQ line is asserted or not.
+ *
+ * @note The interrupt is delivered as soon as the line gets asserted and it isn't masked in CPSR,
+ *       otherwise it gets delivered once the guest unmasks it. This is the only way to deliver
+ *       interrupts, the core doesn't poll for pending interrupts.
  */
 int PSPEmuCoreFiqSet(PSPCORE hCore, bool fAssert);
 
+/**
+ * Sets the callback to record all interrupt line changes with.
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ * @param   pfnIrqRecord            The interrupt line record callback, NULL to stop recording.
+ * @param   pvUser                  Opaque user data to pass to the callback.
+ */
+int PSPEmuCoreIrqRecordCallbackSet(PSPCORE hCore, PFNPSPCOREIRQRECORD pfnIrqRecord, void *pvUser);
+
+/**
+ * Sets the callback to replay recorded interrupt line changes from.
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ * @param   pfnIrqReplay            The interrupt line replay callback, NULL to stop replaying.
+ * @param   pvUser                  Opaque user data to pass to the callback.
+ * @param   cInsnsFirst             Instruction count of the first change to replay.
+ *
+ * @note While replaying, PSPEmuCoreIrqSet() and PSPEmuCoreFiqSet() are ignored. The changes are applied
+ *       at basic block granularity, once the first block reaching the instruction count has finished.
+ *       If the change happened later in virtual time (while idling in WFI) the virtual clock is fast
+ *       forwarded to it first, expiring all deadlines on the way.
+ */
+int PSPEmuCoreIrqReplayCallbackSet(PSPCORE hCore, PFNPSPCOREIRQREPLAY pfnIrqReplay, void *pvUser, uint64_t cInsnsFirst);
+
+/**
+ * Sets the rate of the virtual clock derived from the number of retired instructions.
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ * @param   cIps                    Number of instructions per second, must not be 0.
+ *
+ * @note The virtual time continues from the current value, it doesn't jump.
+ */
+int PSPEmuCoreVirtClockSetIps(PSPCORE hCore, uint64_t cIps);
+
+/**
+ * Selects how writes to the page tables are tracked while the MMU is enabled.
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ * @param   fWrProt                 Flag whether to write protect the pages containing the page tables and handle
+ *                                  the resulting faults instead of installing a unicorn write hook per table.
+ *
+ * @note Write protection avoids the per write hook overhead for everything else when the guest keeps
+ *       its page tables in pages which are rarely written otherwise, the hooks are the default.
+ */
+int PSPEmuCoreMmuPgTblTrackingSetWrProt(PSPCORE hCore, bool fWrProt);
+
+/**
+ * Advances the virtual clock by the given amount of time without executing anything,
+ * used to fast forward when the core is idle.
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ * @param   cNs                     Number of nanoseconds to advance the virtual clock.
+ */
+int PSPEmuCoreVirtClockAdvanceNs(PSPCORE hCore, uint64_t cNs);
+
+/**
+ * Returns the current virtual time of the given core in nanoseconds.
+ *
+ * @returns Virtual time in nanoseconds since the core was created.
+ * @param   hCore                   The PSP core handle.
+ *
+ * @note The virtual time only depends on the number of retired instructions (and any fast forwarding),
+ *       so it is reproducible between runs unlike the host time.
+ */
+uint64_t PSPEmuCoreQueryVirtTimeNs(PSPCORE hCore);
+
+/**
+ * Returns the number of instructions retired by the given core so far.
+ *
+ * @returns Number of retired instructions.
+ * @param   hCore                   The PSP core handle.
+ */
+uint64_t PSPEmuCoreQueryInsnsRetired(PSPCORE hCore);
+
+/**
+ * Returns the ASID (CONTEXTIDR) the given core currently runs with.
+ *
+ * @returns Current ASID.
+ * @param   hCore                   The PSP core handle.
+ */
+ARMASID PSPEmuCoreQueryAsid(PSPCORE hCore);
+
+/**
+ * Sets the callback to call whenever the virtual clock reaches the deadline set with PSPEmuCoreDeadlineSet().
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ * @param   pfnDeadline             The deadline callback, NULL to deregister.
+ * @param   pvUser                  Opaque user data to pass to the callback.
+ */
+int PSPEmuCoreDeadlineCallbackSet(PSPCORE hCore, PFNPSPCOREDEADLINE pfnDeadline, void *pvUser);
+
+/**
+ * Sets the callback to query when a value polled by the guest might change, enabling polling loop detection.
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ * @param   pfnPollDeadline         The polling loop deadline query callback, NULL to disable polling loop detection.
+ * @param   pvUser                  Opaque user data to pass to the callback.
+ *
+ * @note Once the same basic block keeps reading the same value from the same MMIO address without any
+ *       MMIO writes in between, the virtual clock gets fast forwarded to the earlier of the time returned
+ *       by the callback and the next deadline set with PSPEmuCoreDeadlineSet().
+ */
+int PSPEmuCorePollDeadlineCallbackSet(PSPCORE hCore, PFNPSPCOREPOLLDEADLINE pfnPollDeadline, void *pvUser);
+
+/**
+ * Sets the callback to notify whenever a page gets mapped in from the memory fault path.
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ * @param   pfnMemAccess            The page access notification callback, NULL to disable.
+ * @param   pvUser                  Opaque user data to pass to the callback.
+ *
+ * @note While the callback is set RAM is mapped without any access rights and every access type (read, write, exec)
+ *       is granted per page on the first protection fault, so each access type gets reported once per page
+ *       until PSPEmuCoreMemAccessRearm() is called. MMU mappings are created one page at a time then.
+ */
+int PSPEmuCoreMemAccessCallbackSet(PSPCORE hCore, PFNPSPCOREMEMACCESS pfnMemAccess, void *pvUser);
+
+/**
+ * Revokes the access granted to all pages (dropping all MMU mappings if enabled) so every page touched
+ * afterwards gets reported again through the callback set with PSPEmuCoreMemAccessCallbackSet().
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ *
+ * @note Must not be called while the core is executing, use a deadline or event queue timer.
+ */
+int PSPEmuCoreMemAccessRearm(PSPCORE hCore);
+
+/**
+ * Sets the next virtual clock deadline.
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ * @param   tsDeadlineNs            The virtual time in nanoseconds to call the deadline callback at,
+ *                                  UINT64_MAX if there is no deadline.
+ *
+ * @note The deadline is checked at basic block granularity. If the core reaches a WFI instruction
+ *       and no WFI callback is registered the virtual clock is fast forwarded to the deadline
+ *       as long as no interrupt is pending.
+ */
+int PSPEmuCoreDeadlineSet(PSPCORE hCore, uint64_t tsDeadlineNs);
+
+/**
+ * Queries the execution statistics of the given core.
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ * @param   pStats                  Where to store the statistics.
+ *
+ * @note The counters are always collected, they are cheap enough to not need an option. Per device
+ *       statistics are collected by the I/O manager, see PSPEmuIoMgrStatsSet().
+ */
+int PSPEmuCoreQueryStats(PSPCORE hCore, PPSPCORESTATS pStats);
+
+/**
+ * Dumps the execution statistics to stdout.
+ *
+ * @returns nothing.
+ * @param   hCore                   The PSP core handle.
+ */
+void PSPEmuCoreStatsDump(PSPCORE hCore);
+
 /**
  * Dumps the emulation core state to stdout.
  *
@@ -585,4 +943,27 @@ int PSPEmuCoreQueryState(PSPCORE hCore, PPSPCORESTATE pState);
 int PSPEmuCoreQueryPAddrFromVAddr(PSPCORE hCore, PSPVADDR PspVAddr, PSPPADDR *pPspPAddr,
                                   PPSPCOREPGTBLWALKSTS penmPgTblWalk);
 
+/**
+ * Saves the CPU state (registers, CP15 and MMU state) to the given snapshot.
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ * @param   hSnap                   The snapshot handle, the core unit is already opened for writing.
+ *
+ * @note Memory content is not part of the core state and must be saved by the owner of the memory regions.
+ */
+int PSPEmuCoreStateSave(PSPCORE hCore, PSPSNAPSHOT hSnap);
+
+/**
+ * Loads the CPU state from the given snapshot.
+ *
+ * @returns Status code.
+ * @param   hCore                   The PSP core handle.
+ * @param   hSnap                   The snapshot handle, positioned at the start of the core unit.
+ *
+ * @note The memory content (especially the page tables) must be restored before calling this
+ *       as the MMU state is re-established from the restored registers.
+ */
+int PSPEmuCoreStateLoad(PSPCORE hCore, PSPSNAPSHOT hSnap);
+
 #endif /* __psp_core_h */
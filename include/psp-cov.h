@@ -76,4 +76,23 @@ void PSPEmuCovReset(PSPCOV hCov);
  */
 int PSPEmuCovDumpToFile(PSPCOV hCov, const char *pszFilename);
 
+
+/**
+ * Returns the number of distinct basic blocks recorded so far.
+ *
+ * @returns Number of basic blocks.
+ * @param   hCov                    The coverage tracer handle.
+ */
+uint32_t PSPEmuCovQueryBbCount(PSPCOV hCov);
+
+
+/**
+ * Returns the bitmap of covered addresses, one bit for every two bytes starting at the begin address.
+ *
+ * @returns Pointer to the bitmap, valid until the tracer gets destroyed.
+ * @param   hCov                    The coverage tracer handle.
+ * @param   pcbBm                   Where to store the size of the bitmap in bytes.
+ */
+const uint8_t *PSPEmuCovQueryHitBitmap(PSPCOV hCov, size_t *pcbBm);
+
 #endif /* __psp_cov_h */
@@ -24,6 +24,8 @@
 
 #include <psp-cfg.h>
 #include <psp-iom.h>
+#include <psp-evtq.h>
+#include <psp-snapshot.h>
 
 /** Pointer to a const PSP device registration record. */
 typedef const struct PSPDEVREG *PCPSPDEVREG;
@@ -51,6 +53,14 @@ typedef struct PSPDEVIF
      */
     int (*pfnIrqSet)(PCPSPDEVIF pDevIf, uint32_t idPrio, uint8_t idIrq, bool fAssert);
 
+    /**
+     * Returns the current virtual time of the core the device is attached to.
+     *
+     * @returns Virtual time in nanoseconds.
+     * @param   pDevIf              Pointer to this table.
+     */
+    uint64_t (*pfnQueryVirtTimeNs)(PCPSPDEVIF pDevIf);
+
 } PSPDEVIF;
 /** Pointer to a device interface callback table. */
 typedef PSPDEVIF *PPSPDEVIF;
@@ -69,6 +79,8 @@ typedef struct PSPDEV
     PCPSPDEVIF             pDevIf;
     /** The I/O manager the device is attached to. */
     PSPIOM                 hIoMgr;
+    /** The event queue for scheduling timed events. */
+    PSPEVTQ                hEvtQ;
     /** The global config structure. */
     PCPSPEMUCFG            pCfg;
     /** Instance data - variable in size. */
@@ -111,6 +123,41 @@ typedef struct PSPDEVREG
      * @param   pDev                The device instance to reset.s
      */
     int    (*pfnReset) (PPSPDEV pDev);
+
+    /**
+     * Saves the device state to the given snapshot, optional.
+     *
+     * @returns Status code.
+     * @param   pDev                The device instance to save.
+     * @param   hSnap               The snapshot handle, the device unit is already opened for writing.
+     */
+    int    (*pfnSave) (PPSPDEV pDev, PSPSNAPSHOT hSnap);
+
+    /**
+     * Loads the device state from the given snapshot, optional.
+     *
+     * @returns Status code.
+     * @param   pDev                The device instance to load the state for.
+     * @param   hSnap               The snapshot handle, positioned at the start of the device unit.
+     */
+    int    (*pfnLoad) (PPSPDEV pDev, PSPSNAPSHOT hSnap);
+
+    /**
+     * Queries when the value of a register the guest is polling might change without the guest
+     * accessing the device, optional. Devices without the callback are assumed to change their
+     * state only on guest accesses and timers.
+     *
+     * @returns Status code.
+     * @retval  STS_ERR_NOT_FOUND if the region doesn't belong to the device.
+     * @param   pDev                The device instance.
+     * @param   hRegion             The I/O manager region being polled.
+     * @param   offRegion           Offset of the polled register into the region.
+     * @param   cbRead              Size of the read in bytes.
+     * @param   ptsChangeNs         Where to store the virtual time in nanoseconds the value might change at,
+     *                              UINT64_MAX if it only changes through timers or guest accesses.
+     */
+    int    (*pfnPollDeadlineQuery) (PPSPDEV pDev, PSPIOMREGIONHANDLE hRegion, uint64_t offRegion, size_t cbRead,
+                                    uint64_t *ptsChangeNs);
 } PSPDEVREG;
 
 
@@ -120,12 +167,13 @@ typedef struct PSPDEVREG
  *
  * @returns Status code.
  * @param   hIoMgr                  The I/O manager handle this device will be attached to.
+ * @param   hEvtQ                   The event queue handle the device can schedule timed events with.
  * @param   pDevReg                 The device template to use.
  * @param   pDevIf                  The device interface callback table to use.
  * @param   pCfg                    The config to use for the device.
  * @param   ppDev                   Where to store the device on success.
  */
-int PSPEmuDevCreate(PSPIOM hIoMgr, PCPSPDEVREG pDevReg, PCPSPDEVIF pDevIf, PCPSPEMUCFG pCfg, PPSPDEV *ppDev);
+int PSPEmuDevCreate(PSPIOM hIoMgr, PSPEVTQ hEvtQ, PCPSPDEVREG pDevReg, PCPSPDEVIF pDevIf, PCPSPEMUCFG pCfg, PPSPDEV *ppDev);
 
 
 /**
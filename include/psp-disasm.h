@@ -20,8 +20,17 @@
 #ifndef __psp_disasm_h
 #define __psp_disasm_h
 
+#include <stdio.h>
+
 #include <common/types.h>
 
+
+/** Opaque disassembler handle with persistent capstone handles and a decode cache. */
+typedef struct PSPDISASMINT *PSPDISASM;
+/** Pointer to a disassembler handle. */
+typedef PSPDISASM *PPSPDISASM;
+
+
 /**
  * Disassembles a bunch of instructions and formats them into the given destination buffer.
  *
@@ -36,4 +45,62 @@
  */
 int PSPEmuDisasm(char *pchDst, size_t cch, uint32_t cInsnsDisasm, uint8_t *pbCode, size_t cbCode, PSPADDR uAddrStart, bool fThumb);
 
+/**
+ * Creates a new disassembler instance keeping the capstone handles for ARM and THUMB mode open
+ * and caching the formatted result per physical address.
+ *
+ * @returns Status code.
+ * @param   phDisasm                Where to store the disassembler handle on success.
+ */
+int PSPEmuDisasmCreate(PPSPDISASM phDisasm);
+
+/**
+ * Destroys the given disassembler instance.
+ *
+ * @returns nothing.
+ * @param   hDisasm                 The disassembler handle to destroy.
+ */
+void PSPEmuDisasmDestroy(PSPDISASM hDisasm);
+
+/**
+ * Disassembles a bunch of instructions like PSPEmuDisasm() but returns the cached result if the
+ * same code was disassembled at the same location before.
+ *
+ * @returns Status code.
+ * @param   hDisasm                 The disassembler handle.
+ * @param   pchDst                  Pointer to the character buffer holding the zero terminated string on success.
+ * @param   cch                     Size of the destination buffer.
+ * @param   cInsnsDisasm            Maximum number of instructions to disassemble, 0 for as much as possible.
+ * @param   pbCode                  The code to disassemble.
+ * @param   cbCode                  Number of code bytes.
+ * @param   uAddrStart              The address of the first instruction.
+ * @param   PspPAddrStart           The physical address of the first instruction, used as the cache key.
+ * @param   fThumb                  Flag whether to disassemble in THUMB or ARM mode.
+ *
+ * @note The code bytes are part of the cache entry, so a stale entry is never returned even if the
+ *       write modifying the code didn't go through PSPEmuDisasmCacheInvalidate().
+ */
+int PSPEmuDisasmCached(PSPDISASM hDisasm, char *pchDst, size_t cch, uint32_t cInsnsDisasm, const uint8_t *pbCode, size_t cbCode,
+                       PSPADDR uAddrStart, PSPPADDR PspPAddrStart, bool fThumb);
+
+/**
+ * Drops all cache entries overlapping the given physical range.
+ *
+ * @returns nothing.
+ * @param   hDisasm                 The disassembler handle.
+ * @param   PspPAddrStart           Start of the physical range being modified.
+ * @param   cb                      Size of the range in bytes.
+ */
+void PSPEmuDisasmCacheInvalidate(PSPDISASM hDisasm, PSPPADDR PspPAddrStart, size_t cb);
+
+/**
+ * Decodes the given binary instruction trace (see psp-itrace.h) and writes the disassembled
+ * basic blocks along with the register changes to the given output stream.
+ *
+ * @returns Status code.
+ * @param   pszFilename             The instruction trace file to decode.
+ * @param   pOut                    The stream to write the decoded trace to.
+ */
+int PSPEmuDisasmITraceDecode(const char *pszFilename, FILE *pOut);
+
 #endif /* __psp_disasm_h */
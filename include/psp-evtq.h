@@ -0,0 +1,148 @@
+/** @file
+ * PSP Emulator - Virtual clock event queue API.
+ */
+
+/*
+ * Copyright (C) 2020 Alexander Eichner <alexander.eichner@campus.tu-berlin.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDED_psp_evtq_h
+#define INCLUDED_psp_evtq_h
+
+#include <common/types.h>
+
+#include <psp-core.h>
+
+
+/** Opaque event queue handle. */
+typedef struct PSPEVTQINT *PSPEVTQ;
+/** Pointer to an event queue handle. */
+typedef PSPEVTQ *PPSPEVTQ;
+
+/** Opaque event queue timer handle. */
+typedef struct PSPEVTQTIMERINT *PSPEVTQTIMER;
+/** Pointer to an event queue timer handle. */
+typedef PSPEVTQTIMER *PPSPEVTQTIMER;
+
+
+/**
+ * Timer expired callback.
+ *
+ * @returns nothing.
+ * @param   hTimer                  The timer handle which expired, the timer is disarmed and can be armed again
+ *                                  from within the callback.
+ * @param   tsNowNs                 The current virtual time in nanoseconds.
+ * @param   pvUser                  Opaque user data given during timer creation.
+ */
+typedef void (FNPSPEVTQTIMER)(PSPEVTQTIMER hTimer, uint64_t tsNowNs, void *pvUser);
+/** Pointer to a timer expired callback. */
+typedef FNPSPEVTQTIMER *PFNPSPEVTQTIMER;
+
+
+/**
+ * Creates a new event queue for the given PSP core, driven by the virtual clock of the core.
+ *
+ * @returns Status code.
+ * @param   phEvtQ                  Where to store the event queue handle on success.
+ * @param   hPspCore                The PSP core the event queue is attached to.
+ *
+ * @note The core calls into the event queue whenever the earliest deadline is reached and
+ *       fast forwards the virtual clock to the earliest deadline when idling in WFI.
+ */
+int PSPEmuEvtQCreate(PPSPEVTQ phEvtQ, PSPCORE hPspCore);
+
+/**
+ * Destroys the given event queue, all timers must have been destroyed already.
+ *
+ * @returns nothing.
+ * @param   hEvtQ                   The event queue handle to destroy.
+ */
+void PSPEmuEvtQDestroy(PSPEVTQ hEvtQ);
+
+/**
+ * Creates a new timer for the given event queue, the timer starts disarmed.
+ *
+ * @returns Status code.
+ * @param   hEvtQ                   The event queue handle.
+ * @param   pfnExpired              The callback to call when the timer expires.
+ * @param   pvUser                  Opaque user data to pass to the callback.
+ * @param   pszDesc                 Description of the timer.
+ * @param   phTimer                 Where to store the timer handle on success.
+ */
+int PSPEmuEvtQTimerCreate(PSPEVTQ hEvtQ, PFNPSPEVTQTIMER pfnExpired, void *pvUser, const char *pszDesc,
+                          PPSPEVTQTIMER phTimer);
+
+/**
+ * Destroys the given timer, disarming it if required.
+ *
+ * @returns Status code.
+ * @param   hTimer                  The timer handle to destroy.
+ */
+int PSPEmuEvtQTimerDestroy(PSPEVTQTIMER hTimer);
+
+/**
+ * Arms the given timer to expire at the given absolute virtual time.
+ *
+ * @returns Status code.
+ * @param   hTimer                  The timer handle.
+ * @param   tsDeadlineNs            The virtual time in nanoseconds the timer expires at, a deadline in the past
+ *                                  expires as soon as possible.
+ *
+ * @note Re-arming an already armed timer replaces the previous deadline. When called from a timer callback
+ *       a deadline at or before the current time is moved 1ns past it.
+ */
+int PSPEmuEvtQTimerArm(PSPEVTQTIMER hTimer, uint64_t tsDeadlineNs);
+
+/**
+ * Arms the given timer to expire after the given amount of virtual time from now.
+ *
+ * @returns Status code.
+ * @param   hTimer                  The timer handle.
+ * @param   cNs                     Number of nanoseconds from now the timer expires.
+ */
+int PSPEmuEvtQTimerArmRelative(PSPEVTQTIMER hTimer, uint64_t cNs);
+
+/**
+ * Disarms the given timer, doing nothing if the timer is not armed.
+ *
+ * @returns Status code.
+ * @param   hTimer                  The timer handle.
+ */
+int PSPEmuEvtQTimerDisarm(PSPEVTQTIMER hTimer);
+
+/**
+ * Returns whether the given timer is armed.
+ *
+ * @returns Flag whether the timer is armed.
+ * @param   hTimer                  The timer handle.
+ */
+bool PSPEmuEvtQTimerIsArmed(PSPEVTQTIMER hTimer);
+
+/**
+ * Returns the deadline of the given timer.
+ *
+ * @returns Virtual time in nanoseconds the timer expires at, UINT64_MAX if the timer is not armed.
+ * @param   hTimer                  The timer handle.
+ */
+uint64_t PSPEmuEvtQTimerDeadlineGet(PSPEVTQTIMER hTimer);
+
+/**
+ * Returns the earliest deadline of all armed timers.
+ *
+ * @returns Virtual time in nanoseconds of the earliest deadline, UINT64_MAX if no timer is armed.
+ * @param   hEvtQ                   The event queue handle.
+ */
+uint64_t PSPEmuEvtQNextDeadlineGet(PSPEVTQ hEvtQ);
+
+#endif /* !INCLUDED_psp_evtq_h */
@@ -0,0 +1,71 @@
+/** @file
+ * PSP Emulator - Page access heatmap and working set profiler API.
+ */
+
+/*
+ * Copyright (C) 2020 Alexander Eichner <alexander.eichner@campus.tu-berlin.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __psp_heatmap_h
+#define __psp_heatmap_h
+
+#include <common/types.h>
+#include <common/cdefs.h>
+
+#include <psp-core.h>
+#include <psp-iom.h>
+#include <psp-evtq.h>
+
+
+/** Opaque PSP heatmap profiler handle. */
+typedef struct PSPHEATMAPINT *PSPHEATMAP;
+/** Pointer to a PSP heatmap profiler handle. */
+typedef PSPHEATMAP *PPSPHEATMAP;
+
+
+/**
+ * Creates a new page access heatmap profiler.
+ *
+ * @returns Status code.
+ * @param   phHeatmap               Where to store the heatmap profiler handle on success.
+ * @param   hPspCore                PSP core handle to collect memory faults from.
+ * @param   hIoMgr                  I/O manager handle to collect MMIO, SMN and x86 accesses from.
+ * @param   hEvtQ                   Event queue used to drive the working set epochs.
+ * @param   cNsEpoch                Length of a working set epoch in virtual nanoseconds.
+ *
+ * @note Memory accesses are collected from the core's fault path, so a memory page counts at most once
+ *       per access type and epoch (the page access is revoked at the end of each epoch), I/O accesses
+ *       are counted individually.
+ */
+int PSPEmuHeatmapCreate(PPSPHEATMAP phHeatmap, PSPCORE hPspCore, PSPIOM hIoMgr, PSPEVTQ hEvtQ, uint64_t cNsEpoch);
+
+/**
+ * Destroys a given heatmap profiler handle.
+ *
+ * @returns nothing.
+ * @param   hHeatmap                The heatmap profiler handle to destroy.
+ */
+void PSPEmuHeatmapDestroy(PSPHEATMAP hHeatmap);
+
+/**
+ * Dumps the collected information to the given files.
+ *
+ * @returns Status code.
+ * @param   hHeatmap                The heatmap profiler handle.
+ * @param   pszHeatmap              The file to write the per page heatmap to (CSV: space,page,reads,writes,execs,epochs).
+ * @param   pszWorkingSet           The file to write the working set summary to (CSV, one line per epoch), optional.
+ */
+int PSPEmuHeatmapDumpToFile(PSPHEATMAP hHeatmap, const char *pszHeatmap, const char *pszWorkingSet);
+
+#endif /* __psp_heatmap_h */
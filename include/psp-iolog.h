@@ -88,6 +88,15 @@ int PSPEmuIoLogWrCreate(PPSPIOLOGWR phIoLogWr, uint32_t fFlags, const char *pszF
 void PSPEmuIoLogWrDestroy(PSPIOLOGWR hIoLogWr);
 
 
+/**
+ * Writes out any data buffered for the given I/O log.
+ *
+ * @returns Status code.
+ * @param   hIoLogWr                The I/O log writer handle.
+ */
+int PSPEmuIoLogWrFlush(PSPIOLOGWR hIoLogWr);
+
+
 /**
  * Add a SMN access to the I/O log.
  *
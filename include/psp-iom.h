@@ -71,6 +71,21 @@ typedef void (FNPSPIOMSMNWRITE)(SMNADDR offSmn, size_t cbWrite, const void *pvVa
 typedef FNPSPIOMSMNWRITE *PFNPSPIOMSMNWRITE;
 
 
+/**
+ * SMN routing handler, called before any SMN access gets dispatched locally.
+ *
+ * @returns Flag whether the access was handled (routed elsewhere), false to dispatch it locally.
+ * @param   SmnAddr                 The absolute SMN address being accessed.
+ * @param   cbAccess                Number of bytes being accessed.
+ * @param   pvVal                   The data to write or where to store the read data.
+ * @param   fWrite                  Flag whether this is a write access, the data must not be modified then.
+ * @param   pvUser                  Opaque user data passed during registration.
+ */
+typedef bool (FNPSPIOMSMNROUTE)(SMNADDR SmnAddr, size_t cbAccess, void *pvVal, bool fWrite, void *pvUser);
+/** SMN routing handler pointer. */
+typedef FNPSPIOMSMNROUTE *PFNPSPIOMSMNROUTE;
+
+
 /**
  * SMN address access handler.
  *
@@ -288,6 +303,18 @@ int PSPEmuIoMgrDestroy(PSPIOM hIoMgr);
 int PSPEmuIoMgrTraceAllAccessesSet(PSPIOM hIoMgr, bool fEnable);
 
 
+/**
+ * Enables or disables collecting access statistics for every region.
+ *
+ * @returns Status code.
+ * @param   hIoMgr                  The I/O manager handle.
+ * @param   fEnable                 true to count the accesses and the host time spent in the handlers per region.
+ *
+ * @note Disabled by default because timing every access costs two host clock reads.
+ */
+int PSPEmuIoMgrStatsSet(PSPIOM hIoMgr, bool fEnable);
+
+
 /**
  * Sets callbacks for intercepting accesses to unassigned MMIO regions.
  *
@@ -322,6 +349,17 @@ int PSPEmuIoMgrSmnUnassignedSet(PSPIOM hIoMgr, PFNPSPIOMSMNREAD pfnRead, PFNPSPI
                                 void *pvUser);
 
 
+/**
+ * Sets the callback for routing SMN accesses to a different I/O manager (cross die accesses for example).
+ *
+ * @returns Status code.
+ * @param   hIoMgr                  The I/O manager handle.
+ * @param   pfnRoute                The routing callback.
+ * @param   pvUser                  Opaque user data passed in the callback.
+ */
+int PSPEmuIoMgrSmnRouteSet(PSPIOM hIoMgr, PFNPSPIOMSMNROUTE pfnRoute, void *pvUser);
+
+
 /**
  * Sets callbacks for intercepting accesses to unassigned X86 address regions.
  *
@@ -541,6 +579,49 @@ int PSPEmuIoMgrPspAddrRead(PSPIOM hIoMgr, PSPADDR PspAddr, void *pvDst, size_t c
 int PSPEmuIoMgrPspAddrWrite(PSPIOM hIoMgr, PSPADDR PspAddr, const void *pvSrc, size_t cbWrite);
 
 
+/**
+ * Returns the region handling accesses to the given PSP physical address, resolving the SMN and x86 mapping slots.
+ *
+ * @returns Status code.
+ * @retval  STS_ERR_NOT_FOUND if the address isn't covered by any registered MMIO, SMN or x86 region.
+ * @param   hIoMgr                  The I/O manager handle.
+ * @param   PspAddr                 The PSP physical address to resolve.
+ * @param   phRegion                Where to store the region handle on success.
+ * @param   poffRegion              Where to store the offset of the address into the region on success.
+ */
+int PSPEmuIoMgrPspAddrQueryRegion(PSPIOM hIoMgr, PSPADDR PspAddr, PPSPIOMREGIONHANDLE phRegion, uint64_t *poffRegion);
+
+
+/**
+ * Reads from the given SMN address, calling the device handlers without routing.
+ *
+ * @returns Status code.
+ * @param   hIoMgr                  The I/O manager handle.
+ * @param   SmnAddr                 The absolute SMN address to read from.
+ * @param   pvDst                   Where to store the read data.
+ * @param   cbRead                  How many bytes to read.
+ *
+ * @note The device handlers and the interrupt delivery are not thread safe, so this must be called from the thread
+ *       executing the owning PSP core or while that core is not executing at all (see PSPEmuCcdPeersSet()).
+ */
+int PSPEmuIoMgrSmnRead(PSPIOM hIoMgr, SMNADDR SmnAddr, void *pvDst, size_t cbRead);
+
+
+/**
+ * Writes to the given SMN address, calling the device handlers without routing.
+ *
+ * @returns Status code.
+ * @param   hIoMgr                  The I/O manager handle.
+ * @param   SmnAddr                 The absolute SMN address to write to.
+ * @param   pvSrc                   The data to write.
+ * @param   cbWrite                 How many bytes to write.
+ *
+ * @note The device handlers and the interrupt delivery are not thread safe, so this must be called from the thread
+ *       executing the owning PSP core or while that core is not executing at all (see PSPEmuCcdPeersSet()).
+ */
+int PSPEmuIoMgrSmnWrite(PSPIOM hIoMgr, SMNADDR SmnAddr, const void *pvSrc, size_t cbWrite);
+
+
 /**
  * Reads from the given x86 physical address, honoring MMIO access handlers.
  *
@@ -587,5 +668,34 @@ int PSPEmuIoMgrX86MapSlotDump(PSPIOM hIoMgr, uint32_t idxSlotStart, uint32_t idx
 int PSPEmuIoMgrSmnMapSlotDump(PSPIOM hIoMgr, uint32_t idxSlotStart, uint32_t idxSlotEnd);
 
 
+/**
+ * Dumps the access statistics of every accessed region to stdout.
+ *
+ * @returns Status code.
+ * @param   hIoMgr                  The I/O manager handle.
+ */
+int PSPEmuIoMgrStatsDump(PSPIOM hIoMgr);
+
+
+/**
+ * Saves the SMN and x86 mapping slot state to the given snapshot.
+ *
+ * @returns Status code.
+ * @param   hIoMgr                  The I/O manager handle.
+ * @param   hSnap                   The snapshot handle, the I/O manager unit is already opened for writing.
+ */
+int PSPEmuIoMgrStateSave(PSPIOM hIoMgr, PSPSNAPSHOT hSnap);
+
+
+/**
+ * Loads the SMN and x86 mapping slot state from the given snapshot.
+ *
+ * @returns Status code.
+ * @param   hIoMgr                  The I/O manager handle.
+ * @param   hSnap                   The snapshot handle, positioned at the start of the I/O manager unit.
+ */
+int PSPEmuIoMgrStateLoad(PSPIOM hIoMgr, PSPSNAPSHOT hSnap);
+
+
 #endif /* __psp_iom_h */
 
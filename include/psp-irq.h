@@ -24,6 +24,7 @@
 
 #include <psp-core.h>
 #include <psp-iom.h>
+#include <psp-snapshot.h>
 
 
 /** Opaque PSP interrupt controller handle. */
@@ -73,4 +74,26 @@ void PSPIrqReset(PSPIRQ hIrq);
  */
 int PSPIrqSet(PSPIRQ hIrq, uint32_t uPrioGrp, uint8_t uIrq, bool fAssert);
 
+
+/**
+ * Saves the interrupt controller state to the given snapshot.
+ *
+ * @returns Status code.
+ * @param   hIrq                    The interrupt controller handle.
+ * @param   hSnap                   The snapshot handle, the interrupt controller unit is already opened for writing.
+ */
+int PSPIrqStateSave(PSPIRQ hIrq, PSPSNAPSHOT hSnap);
+
+
+/**
+ * Loads the interrupt controller state from the given snapshot.
+ *
+ * @returns Status code.
+ * @param   hIrq                    The interrupt controller handle.
+ * @param   hSnap                   The snapshot handle, positioned at the start of the interrupt controller unit.
+ *
+ * @note This doesn't touch the IRQ line of the PSP core, it is part of the core state.
+ */
+int PSPIrqStateLoad(PSPIRQ hIrq, PSPSNAPSHOT hSnap);
+
 #endif /* !INCLUDED_psp_irq_h */
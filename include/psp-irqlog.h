@@ -0,0 +1,65 @@
+/** @file
+ * PSP Emulator - Interrupt line record/replay API.
+ */
+
+/*
+ * Copyright (C) 2020 Alexander Eichner <alexander.eichner@campus.tu-berlin.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __psp_irqlog_h
+#define __psp_irqlog_h
+
+#include <common/types.h>
+#include <common/cdefs.h>
+
+#include <psp-core.h>
+
+
+/** Opaque PSP interrupt log handle. */
+typedef struct PSPIRQLOGINT *PSPIRQLOG;
+/** Pointer to a PSP interrupt log handle. */
+typedef PSPIRQLOG *PPSPIRQLOG;
+
+
+/**
+ * Creates a new interrupt log recording every IRQ/FIQ line change of the given core
+ * along with the retired instruction count and virtual time it happened at.
+ *
+ * @returns Status code.
+ * @param   phIrqLog                Where to store the interrupt log handle on success.
+ * @param   hPspCore                PSP core handle to record.
+ * @param   pszFilename             The file to write the log to.
+ */
+int PSPEmuIrqLogRecordCreate(PPSPIRQLOG phIrqLog, PSPCORE hPspCore, const char *pszFilename);
+
+/**
+ * Creates a new interrupt log replaying the given log into the given core, interrupt line changes
+ * coming from devices or the proxy are ignored from now on.
+ *
+ * @returns Status code.
+ * @param   phIrqLog                Where to store the interrupt log handle on success.
+ * @param   hPspCore                PSP core handle to replay into.
+ * @param   pszFilename             The log file to replay.
+ */
+int PSPEmuIrqLogReplayCreate(PPSPIRQLOG phIrqLog, PSPCORE hPspCore, const char *pszFilename);
+
+/**
+ * Destroys the given interrupt log, flushing everything recorded and detaching from the core.
+ *
+ * @returns nothing.
+ * @param   hIrqLog                 The interrupt log handle to destroy.
+ */
+void PSPEmuIrqLogDestroy(PSPIRQLOG hIrqLog);
+
+#endif /* __psp_irqlog_h */
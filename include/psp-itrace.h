@@ -0,0 +1,137 @@
+/** @file
+ * PSP Emulator - Compact binary instruction trace API.
+ */
+
+/*
+ * Copyright (C) 2020 Alexander Eichner <alexander.eichner@campus.tu-berlin.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __psp_itrace_h
+#define __psp_itrace_h
+
+#include <common/types.h>
+#include <common/cdefs.h>
+
+#include <psp-core.h>
+
+
+/** The instruction trace file magic. */
+#define PSP_ITRACE_HDR_MAGIC                "PSPITRC"
+/** The current instruction trace file version. */
+#define PSP_ITRACE_HDR_VERSION              1
+
+/** Code record, holds the code bytes of a basic block the first time it is executed. */
+#define PSP_ITRACE_REC_TYPE_CODE            1
+/** Basic block record, holds the start address, size and changed registers upon entering the basic block. */
+#define PSP_ITRACE_REC_TYPE_BB              2
+
+/** Number of registers tracked in the register delta bitmap (R0 - R12, SP, LR and CPSR). */
+#define PSP_ITRACE_REGS                     16
+/** Index of the CPSR in the register delta bitmap. */
+#define PSP_ITRACE_REG_IDX_CPSR             15
+
+/**
+ * The instruction trace file header.
+ */
+typedef struct PSPITRACEHDR
+{
+    /** Magic identifying the file, PSP_ITRACE_HDR_MAGIC. */
+    char                            achMagic[8];
+    /** Version of the format, PSP_ITRACE_HDR_VERSION. */
+    uint32_t                        u32Version;
+    /** Number of registers in the register delta bitmap. */
+    uint32_t                        cRegs;
+} PSPITRACEHDR;
+/** Pointer to the instruction trace file header. */
+typedef PSPITRACEHDR *PPSPITRACEHDR;
+/** Pointer to a const instruction trace file header. */
+typedef const PSPITRACEHDR *PCPSPITRACEHDR;
+
+
+/**
+ * Code record, followed by cbCode bytes of code.
+ */
+#pragma pack(1)
+typedef struct PSPITRACERECCODE
+{
+    /** Record type, PSP_ITRACE_REC_TYPE_CODE. */
+    uint8_t                         bType;
+    /** Start address of the code. */
+    uint32_t                        PspAddr;
+    /** Number of code bytes following. */
+    uint16_t                        cbCode;
+} PSPITRACERECCODE;
+#pragma pack()
+/** Pointer to a code record. */
+typedef PSPITRACERECCODE *PPSPITRACERECCODE;
+/** Pointer to a const code record. */
+typedef const PSPITRACERECCODE *PCPSPITRACERECCODE;
+
+
+/**
+ * Basic block record, followed by one 32bit value for every bit set in the register delta bitmap
+ * (lowest bit first).
+ */
+#pragma pack(1)
+typedef struct PSPITRACERECBB
+{
+    /** Record type, PSP_ITRACE_REC_TYPE_BB. */
+    uint8_t                         bType;
+    /** Start address of the basic block. */
+    uint32_t                        PspAddr;
+    /** Size of the basic block in bytes. */
+    uint16_t                        cbBb;
+    /** Bitmap of registers changed since the last basic block record. */
+    uint16_t                        bmRegsChanged;
+} PSPITRACERECBB;
+#pragma pack()
+/** Pointer to a basic block record. */
+typedef PSPITRACERECBB *PPSPITRACERECBB;
+/** Pointer to a const basic block record. */
+typedef const PSPITRACERECBB *PCPSPITRACERECBB;
+
+
+/** Opaque PSP instruction trace writer handle. */
+typedef struct PSPITRACEINT *PSPITRACE;
+/** Pointer to a PSP instruction trace writer handle. */
+typedef PSPITRACE *PPSPITRACE;
+
+
+/**
+ * Creates a new instruction trace writer recording every basic block executed by the given core.
+ *
+ * @returns Status code.
+ * @param   phITrace                Where to store the instruction trace writer handle on success.
+ * @param   hPspCore                PSP core handle to trace.
+ * @param   pszFilename             The file to write the trace to.
+ */
+int PSPEmuITraceCreate(PPSPITRACE phITrace, PSPCORE hPspCore, const char *pszFilename);
+
+/**
+ * Flushes all outstanding records and destroys the given instruction trace writer.
+ *
+ * @returns nothing.
+ * @param   hITrace                 The instruction trace writer handle to destroy.
+ */
+void PSPEmuITraceDestroy(PSPITRACE hITrace);
+
+/**
+ * Returns the number of basic blocks recorded so far.
+ *
+ * @returns Number of basic block records written.
+ * @param   hITrace                 The instruction trace writer handle.
+ */
+uint64_t PSPEmuITraceQueryBbCount(PSPITRACE hITrace);
+
+#endif /* __psp_itrace_h */
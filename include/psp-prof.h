@@ -0,0 +1,84 @@
+/** @file
+ * PSP Emulator - PC sampling profiler API.
+ */
+
+/*
+ * Copyright (C) 2020 Alexander Eichner <alexander.eichner@campus.tu-berlin.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __psp_prof_h
+#define __psp_prof_h
+
+#include <common/types.h>
+#include <common/cdefs.h>
+
+#include <psp-core.h>
+
+
+/** Maximum number of frames recorded for a single sample. */
+#define PSP_PROF_FRAMES_MAX                 32
+
+
+/** Opaque PSP profiler handle. */
+typedef struct PSPPROFINT *PSPPROF;
+/** Pointer to a PSP profiler handle. */
+typedef PSPPROF *PPSPPROF;
+
+
+/**
+ * Creates a new PC sampling profiler for the given core.
+ *
+ * @returns Status code.
+ * @param   phProf                  Where to store the profiler handle on success.
+ * @param   hPspCore                PSP core handle to profile.
+ * @param   cInsnsInterval          Number of retired instructions between two samples.
+ * @param   cFramesMax              Maximum number of frames to record per sample, 1 records only the PC,
+ *                                  2 adds the LR and anything above unwinds the frame pointer chain.
+ *
+ * @note The PC is sampled at the start of the basic block crossing the interval boundary.
+ */
+int PSPEmuProfCreate(PPSPPROF phProf, PSPCORE hPspCore, uint64_t cInsnsInterval, uint32_t cFramesMax);
+
+/**
+ * Destroys a given profiler handle.
+ *
+ * @returns nothing.
+ * @param   hProf                   The profiler handle to destroy.
+ */
+void PSPEmuProfDestroy(PSPPROF hProf);
+
+/**
+ * Dumps the collected samples in the folded stack format understood by flamegraph.pl.
+ *
+ * @returns Status code.
+ * @param   hProf                   The profiler handle.
+ * @param   pszFilename             Filename to dump the samples to.
+ * @param   pszSymMap               Optional symbol map used to symbolize addresses, NULL to print raw addresses.
+ *
+ * @note Each line of the symbol map starts with the hexadecimal address and ends with the symbol name,
+ *       so the output of nm can be used directly. Each stack starts with the ASID it was sampled in.
+ * @note When the frame pointer chain yields a caller the LR is only kept if it resolves to a different
+ *       symbol than the PC, so without a symbol map it is dropped in that case.
+ */
+int PSPEmuProfDumpFolded(PSPPROF hProf, const char *pszFilename, const char *pszSymMap);
+
+/**
+ * Returns the number of samples taken so far.
+ *
+ * @returns Number of samples.
+ * @param   hProf                   The profiler handle.
+ */
+uint64_t PSPEmuProfQuerySampleCount(PSPPROF hProf);
+
+#endif /* __psp_prof_h */
@@ -0,0 +1,192 @@
+/** @file
+ * PSP Emulator - Snapshot (checkpoint) file API.
+ */
+
+/*
+ * Copyright (C) 2020 Alexander Eichner <alexander.eichner@campus.tu-berlin.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDED_psp_snapshot_h
+#define INCLUDED_psp_snapshot_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <common/types.h>
+
+
+/** Opaque snapshot handle. */
+typedef struct PSPSNAPSHOTINT *PSPSNAPSHOT;
+/** Pointer to a snapshot handle. */
+typedef PSPSNAPSHOT *PPSPSNAPSHOT;
+
+
+/**
+ * Creates a new snapshot file for writing.
+ *
+ * @returns Status code.
+ * @param   phSnap                  Where to store the snapshot handle on success.
+ * @param   pszFilename             The file to write the snapshot to.
+ */
+int PSPEmuSnapshotCreate(PPSPSNAPSHOT phSnap, const char *pszFilename);
+
+/**
+ * Opens an existing snapshot file for reading.
+ *
+ * @returns Status code.
+ * @param   phSnap                  Where to store the snapshot handle on success.
+ * @param   pszFilename             The snapshot file to open.
+ *
+ * @note The file gets mapped private (copy on write), memory returned by PSPEmuSnapshotGetPages()
+ *       stays valid until the snapshot is closed.
+ */
+int PSPEmuSnapshotOpen(PPSPSNAPSHOT phSnap, const char *pszFilename);
+
+/**
+ * Closes the given snapshot, finishing the file if it was opened for writing.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle to close.
+ */
+int PSPEmuSnapshotClose(PSPSNAPSHOT hSnap);
+
+/**
+ * Starts a new data unit when writing a snapshot.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle.
+ * @param   pszName                 The unit name.
+ * @param   uInstance               The instance number of the unit.
+ * @param   uVersion                Unit version.
+ */
+int PSPEmuSnapshotUnitBegin(PSPSNAPSHOT hSnap, const char *pszName, uint32_t uInstance, uint32_t uVersion);
+
+/**
+ * Finishes the current data unit when writing a snapshot.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle.
+ */
+int PSPEmuSnapshotUnitEnd(PSPSNAPSHOT hSnap);
+
+/**
+ * Seeks to the given data unit when reading a snapshot.
+ *
+ * @returns Status code.
+ * @retval  STS_ERR_NOT_FOUND if the unit doesn't exist in the snapshot.
+ * @param   hSnap                   The snapshot handle.
+ * @param   pszName                 The unit name.
+ * @param   uInstance               The instance number of the unit.
+ * @param   puVersion               Where to store the version of the unit, optional.
+ */
+int PSPEmuSnapshotUnitSeek(PSPSNAPSHOT hSnap, const char *pszName, uint32_t uInstance, uint32_t *puVersion);
+
+/**
+ * Writes data to the current unit.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle.
+ * @param   pvData                  The data to write.
+ * @param   cbData                  Number of bytes to write.
+ */
+int PSPEmuSnapshotPutData(PSPSNAPSHOT hSnap, const void *pvData, size_t cbData);
+
+/**
+ * Reads data from the current unit.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle.
+ * @param   pvData                  Where to store the read data.
+ * @param   cbData                  Number of bytes to read.
+ */
+int PSPEmuSnapshotGetData(PSPSNAPSHOT hSnap, void *pvData, size_t cbData);
+
+/**
+ * Writes a 32bit unsigned integer to the current unit.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle.
+ * @param   u32                     The value to write.
+ */
+int PSPEmuSnapshotPutU32(PSPSNAPSHOT hSnap, uint32_t u32);
+
+/**
+ * Reads a 32bit unsigned integer from the current unit.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle.
+ * @param   pu32                    Where to store the value.
+ */
+int PSPEmuSnapshotGetU32(PSPSNAPSHOT hSnap, uint32_t *pu32);
+
+/**
+ * Writes a 64bit unsigned integer to the current unit.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle.
+ * @param   u64                     The value to write.
+ */
+int PSPEmuSnapshotPutU64(PSPSNAPSHOT hSnap, uint64_t u64);
+
+/**
+ * Reads a 64bit unsigned integer from the current unit.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle.
+ * @param   pu64                    Where to store the value.
+ */
+int PSPEmuSnapshotGetU64(PSPSNAPSHOT hSnap, uint64_t *pu64);
+
+/**
+ * Writes a boolean to the current unit.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle.
+ * @param   f                       The value to write.
+ */
+int PSPEmuSnapshotPutBool(PSPSNAPSHOT hSnap, bool f);
+
+/**
+ * Reads a boolean from the current unit.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle.
+ * @param   pf                      Where to store the value.
+ */
+int PSPEmuSnapshotGetBool(PSPSNAPSHOT hSnap, bool *pf);
+
+/**
+ * Writes a page aligned block of memory to the current unit, the data is placed
+ * on a page boundary inside the file so it can be mapped directly when restoring.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle.
+ * @param   pvPages                 The memory to write.
+ * @param   cbPages                 Number of bytes to write.
+ */
+int PSPEmuSnapshotPutPages(PSPSNAPSHOT hSnap, const void *pvPages, size_t cbPages);
+
+/**
+ * Returns a pointer to the page aligned memory block written with PSPEmuSnapshotPutPages()
+ * without copying anything.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle.
+ * @param   ppvPages                Where to store the pointer to the memory block on success,
+ *                                  the memory is private to the process and writable.
+ * @param   cbPages                 Expected size of the memory block.
+ */
+int PSPEmuSnapshotGetPages(PSPSNAPSHOT hSnap, void **ppvPages, size_t cbPages);
+
+#endif /* !INCLUDED_psp_snapshot_h */
@@ -197,11 +197,21 @@ int PSPEmuTraceCreateForFile(PPSPTRACE phTrace, uint32_t fFlags, PSPCORE hPspCor
  */
 void PSPEmuTraceDestroy(PSPTRACE hTrace);
 
+/**
+ * Writes out all events buffered so far.
+ *
+ * @returns Status code.
+ * @param   hTrace                  The trace handle, NULL means default.
+ */
+int PSPEmuTraceFlush(PSPTRACE hTrace);
+
 /**
  * Sets the default tracer (used when NULL is given in the actual tracing methods).
  *
  * @returns Status code.
  * @param   hTrace                  The new default tracer.
+ *
+ * @note The default tracer is per thread, so this needs to be called on the thread doing the tracing.
  */
 int PSPEmuTraceSetDefault(PSPTRACE hTrace);
 
@@ -23,6 +23,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <os/file.h>
 
@@ -84,3 +88,49 @@ int OSFileLoadAllFree(void *pv, size_t cb)
     return 0;
 }
 
+
+int OSFileMapPrivate(const char *pszFilename, void **ppv, size_t *pcb)
+{
+    int rc = 0;
+    int iFd = open(pszFilename, O_RDONLY);
+    if (iFd != -1)
+    {
+        struct stat StatBuf;
+        rc = fstat(iFd, &StatBuf);
+        if (!rc)
+        {
+            if (StatBuf.st_size)
+            {
+                void *pv = mmap(NULL, StatBuf.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, iFd, 0);
+                if (pv != MAP_FAILED)
+                {
+                    *ppv = pv;
+                    *pcb = StatBuf.st_size;
+                }
+                else
+                    rc = errno;
+            }
+            else
+                rc = -1;
+        }
+        else
+            rc = errno;
+
+        /* The mapping stays valid after the descriptor is closed. */
+        close(iFd);
+    }
+    else
+        rc = errno;
+
+    return rc;
+}
+
+
+int OSFileUnmap(void *pv, size_t cb)
+{
+    int rc = munmap(pv, cb);
+    if (rc)
+        rc = errno;
+
+    return rc;
+}
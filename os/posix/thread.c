@@ -21,6 +21,7 @@
 *   Header Files                                                                                                                 *
 *********************************************************************************************************************************/
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 
 #include <common/status.h>
@@ -119,3 +120,8 @@ int OSThreadDestroy(OSTHREAD hThread, int *prcThread)
     return rc;
 }
 
+
+void OSThreadYield(void)
+{
+    sched_yield();
+}
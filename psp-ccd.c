@@ -27,18 +27,26 @@
 #include <common/status.h>
 
 #include <os/file.h>
+#include <os/lock.h>
+#include <os/thread.h>
 
 #include <psp-ccd.h>
 #include <psp-brsp.h>
 #include <psp-flash.h>
 #include <psp-iom.h>
 #include <psp-irq.h>
+#include <psp-evtq.h>
 #include <psp-devs.h>
 #include <psp-cfg.h>
 #include <psp-svc.h>
 #include <psp-trace.h>
 #include <psp-cov.h>
+#include <psp-itrace.h>
+#include <psp-prof.h>
+#include <psp-heatmap.h>
+#include <psp-irqlog.h>
 #include <psp-iolog.h>
+#include <psp-snapshot.h>
 
 
 /**
@@ -60,6 +68,28 @@ typedef PSPCCDMEMREGION *PPSPCCDMEMREGION;
 /**
  * A single CCD instance.
  */
+/**
+ * A cross die SMN access queued for the thread running the owning CCD.
+ */
+typedef struct PSPCCDSMNREQ
+{
+    /** Next request in the queue. */
+    struct PSPCCDSMNREQ         *pNext;
+    /** The SMN address to access (local to the owning CCD). */
+    SMNADDR                     SmnAddr;
+    /** Number of bytes to access. */
+    size_t                      cbAccess;
+    /** The value to write or where to store the value read. */
+    void                        *pvVal;
+    /** Flag whether this is a write. */
+    bool                        fWrite;
+    /** Flag whether the request was completed, set by the owning thread. */
+    bool                        fDone;
+} PSPCCDSMNREQ;
+/** Pointer to a queued SMN access. */
+typedef PSPCCDSMNREQ *PPSPCCDSMNREQ;
+
+
 typedef struct PSPCCDINT
 {
     /** The device interface to use for instantiated devices. */
@@ -70,6 +100,8 @@ typedef struct PSPCCDINT
     PSPCORE                     hPspCore;
     /** The I/O manager handling I/O accesses. */
     PSPIOM                      hIoMgr;
+    /** The event queue driven by the virtual clock of the core. */
+    PSPEVTQ                     hEvtQ;
     /** The interrupt controller state. */
     PSPIRQ                      hIrq;
     /** Emulated supervisor mode state for app emulation mode. */
@@ -86,6 +118,14 @@ typedef struct PSPCCDINT
     PSPIOMTP                    hIoTpIoLogX86;
     /** The coverage trace handle. */
     PSPCOV                      hCov;
+    /** The binary instruction trace handle. */
+    PSPITRACE                   hITrace;
+    /** The PC sampling profiler handle. */
+    PSPPROF                     hProf;
+    /** The page access heatmap profiler handle. */
+    PSPHEATMAP                  hHeatmap;
+    /** The interrupt record/replay log handle. */
+    PSPIRQLOG                   hIrqLog;
     /** The SMN region handle for the ID register. */
     PSPIOMREGIONHANDLE          hSmnRegId;
     /** Head of the instantiated devices. */
@@ -102,6 +142,26 @@ typedef struct PSPCCDINT
     void                        *pvSram;
     /** Size of the SRAM in bytes. */
     size_t                      cbSram;
+    /** The snapshot the SRAM is mapped from, NULL if the SRAM was allocated from the heap. */
+    PSPSNAPSHOT                 hSnapSram;
+    /** The trace point handle triggering the snapshot save. */
+    PSPCORETP                   hTpSnapshotSave;
+    /** Flag whether a snapshot save is pending. */
+    bool                        fSnapshotSavePending;
+    /** Flag whether the address given to PSPEmuCcdRunUpTo() was reached. */
+    bool                        fRunUpToReached;
+    /** All CCDs of the system (including this one) for routing cross die SMN accesses, NULL if not set. */
+    PSPCCD                      *pahCcdPeers;
+    /** Number of entries in the CCD array. */
+    uint32_t                    cCcdPeers;
+    /** Lock protecting the SMN request queue and the running flag. */
+    OSLOCK                      hLockSmnReq;
+    /** Cross die SMN accesses queued by other CCDs for this one. */
+    PPSPCCDSMNREQ               pSmnReqHead;
+    /** Flag whether a thread is currently running this CCD through PSPEmuCcdRun(). */
+    bool                        fRunning;
+    /** Flag whether the CCD was asked to stop through PSPEmuCcdStop(). */
+    bool                        fStop;
 } PSPCCDINT;
 /** Pointer to a single CCD instance. */
 typedef PSPCCDINT *PPSPCCDINT;
@@ -112,6 +172,23 @@ static bool pspEmuSvcDbgLog(PSPCORE hCore, uint32_t idxSyscall, uint32_t fFlags,
 
 static bool pspEmuSmcTrace(PSPCORE hCore, uint32_t idxCall, uint32_t fFlags, void *pvUser);
 
+/** The version of the CCD snapshot units, snapshots with a different version are rejected. */
+#define PSP_CCD_SNAPSHOT_UNIT_VERSION                3
+
+/** @name Cross die SMN address layout.
+ * @todo The exact encoding used by the hardware is unknown, the die is selected through the upper 4 address
+ *       bits for now which are unused by all known local SMN devices.
+ * @{ */
+/** Flag marking an SMN address targeting the die encoded in the remaining bits. */
+#define PSP_CCD_SMN_REMOTE_F                         UINT32_C(0x80000000)
+/** Mask of all bits selecting the remote die. */
+#define PSP_CCD_SMN_REMOTE_MASK                      UINT32_C(0xf0000000)
+/** Returns the socket ID from the given remote SMN address. */
+#define PSP_CCD_SMN_REMOTE_SOCKET_GET(a_SmnAddr)     (((a_SmnAddr) >> 30) & 0x1)
+/** Returns the CCD ID from the given remote SMN address. */
+#define PSP_CCD_SMN_REMOTE_CCD_GET(a_SmnAddr)        (((a_SmnAddr) >> 28) & 0x3)
+/** @} */
+
 #define PSPEMU_CORE_SVMC_INIT_NULL                   { NULL, NULL, 0 }
 #define PSPEMU_CORE_SVMC_INIT_DEF(a_Name, a_Handler) { a_Name, a_Handler, PSPEMU_CORE_SVMC_F_BEFORE }
 
@@ -192,6 +269,12 @@ const PSPDEVREG g_DevRegCcd =
     /** pfnDestruct */
     NULL,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    NULL,
+    /** pfnLoad */
+    NULL,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
@@ -403,6 +486,52 @@ static int pspCcdIrqSet(PCPSPDEVIF pDevIf, uint32_t idPrio, uint8_t idIrq, bool
 }
 
 
+/**
+ * @copydoc{PSPDEVIF::pfnQueryVirtTimeNs, Device virtual clock callback handler}
+ */
+static uint64_t pspCcdQueryVirtTimeNs(PCPSPDEVIF pDevIf)
+{
+    PPSPCCDINT pThis = (PPSPCCDINT)pDevIf;
+
+    return PSPEmuCoreQueryVirtTimeNs(pThis->hPspCore);
+}
+
+
+/**
+ * @copydoc{FNPSPCOREPOLLDEADLINE, Asks the device owning the polled register when its value might change}
+ */
+static uint64_t pspEmuCcdPollDeadline(PSPCORE hCore, PSPADDR PspAddrMmio, size_t cbRead, void *pvUser)
+{
+    PPSPCCDINT pThis = (PPSPCCDINT)pvUser;
+    PSPIOMREGIONHANDLE hRegion = NULL;
+    uint64_t offRegion = 0;
+    uint64_t tsChangeNs = UINT64_MAX; /* Unassigned regions and devices without a callback only change through timers. */
+
+    int rc = PSPEmuIoMgrPspAddrQueryRegion(pThis->hIoMgr, PspAddrMmio, &hRegion, &offRegion);
+    if (STS_SUCCESS(rc))
+    {
+        PPSPDEV pDev = pThis->pDevsHead;
+        while (pDev)
+        {
+            if (pDev->pReg->pfnPollDeadlineQuery)
+            {
+                rc = pDev->pReg->pfnPollDeadlineQuery(pDev, hRegion, offRegion, cbRead, &tsChangeNs);
+                if (rc != STS_ERR_NOT_FOUND)
+                {
+                    if (STS_FAILURE(rc))
+                        tsChangeNs = 0; /* Don't skip anything if the owner can't tell. */
+                    break;
+                }
+            }
+
+            pDev = pDev->pNext;
+        }
+    }
+
+    return tsChangeNs;
+}
+
+
 /**
  * Returns the device registration record with the given name or NULL if not found.
  *
@@ -438,7 +567,7 @@ static int pspEmuCcdDeviceInstantiate(PPSPCCDINT pThis, PCPSPDEVREG pDevReg, PCP
     else
     {
         PPSPDEV pDev = NULL;
-        rc = PSPEmuDevCreate(pThis->hIoMgr, pDevReg, &pThis->DevIf, pCfg, &pDev);
+        rc = PSPEmuDevCreate(pThis->hIoMgr, pThis->hEvtQ, pDevReg, &pThis->DevIf, pCfg, &pDev);
         if (!rc)
         {
             pDev->pNext = pThis->pDevsHead;
@@ -535,6 +664,126 @@ static int pspEmuCcdDevicesReset(PPSPCCDINT pThis)
 }
 
 
+/**
+ * Trace point callback which triggers saving a snapshot after the execution loop stopped.
+ */
+static void pspEmuCcdSnapshotSaveTp(PSPCORE hCore, PSPCORETP hTp, uint32_t fTpFlags, PSPADDR uPspAddr, uint32_t cb, const void *pvVal, void *pvUser)
+{
+    PPSPCCDINT pThis = (PPSPCCDINT)pvUser;
+
+    (void)hTp;
+    (void)fTpFlags;
+    (void)uPspAddr;
+    (void)cb;
+    (void)pvVal;
+
+    pThis->fSnapshotSavePending = true;
+    PSPEmuCoreExecStop(hCore);
+}
+
+
+/**
+ * Trace point callback which stops execution when the address given to PSPEmuCcdRunUpTo() is reached.
+ */
+static void pspEmuCcdRunUpToTp(PSPCORE hCore, PSPCORETP hTp, uint32_t fTpFlags, PSPADDR uPspAddr, uint32_t cb, const void *pvVal, void *pvUser)
+{
+    PPSPCCDINT pThis = (PPSPCCDINT)pvUser;
+
+    (void)hTp;
+    (void)fTpFlags;
+    (void)uPspAddr;
+    (void)cb;
+    (void)pvVal;
+
+    pThis->fRunUpToReached = true;
+    PSPEmuCoreExecStop(hCore);
+}
+
+
+/**
+ * Seeks to the given snapshot unit and checks that it was written with the current unit version.
+ *
+ * @returns Status code.
+ * @param   hSnap                   The snapshot handle to read from.
+ * @param   pszUnit                 The unit name.
+ */
+static int pspEmuCcdSnapshotUnitSeek(PSPSNAPSHOT hSnap, const char *pszUnit)
+{
+    uint32_t uVersion = 0;
+
+    int rc = PSPEmuSnapshotUnitSeek(hSnap, pszUnit, 0 /*uInstance*/, &uVersion);
+    if (   STS_SUCCESS(rc)
+        && uVersion != PSP_CCD_SNAPSHOT_UNIT_VERSION)
+    {
+        fprintf(stderr, "Snapshot unit \"%s\" has version %u but only version %u is supported\n",
+                pszUnit, uVersion, PSP_CCD_SNAPSHOT_UNIT_VERSION);
+        rc = STS_ERR_INVALID_PARAMETER;
+    }
+
+    return rc;
+}
+
+
+/**
+ * Saves the state of all devices having a save callback, each device gets its own unit.
+ *
+ * @returns Status code.
+ * @param   pThis                   The CCD instance.
+ * @param   hSnap                   The snapshot handle to write to.
+ */
+static int pspEmuCcdDevicesSave(PPSPCCDINT pThis, PSPSNAPSHOT hSnap)
+{
+    int rc = STS_INF_SUCCESS;
+
+    PPSPDEV pDev = pThis->pDevsHead;
+    while (   pDev
+           && STS_SUCCESS(rc))
+    {
+        if (pDev->pReg->pfnSave)
+        {
+            rc = PSPEmuSnapshotUnitBegin(hSnap, pDev->pReg->pszName, 0 /*uInstance*/, PSP_CCD_SNAPSHOT_UNIT_VERSION);
+            if (STS_SUCCESS(rc))
+                rc = pDev->pReg->pfnSave(pDev, hSnap);
+            if (STS_SUCCESS(rc))
+                rc = PSPEmuSnapshotUnitEnd(hSnap);
+        }
+        pDev = pDev->pNext;
+    }
+
+    return rc;
+}
+
+
+/**
+ * Loads the state of all devices having a load callback.
+ *
+ * @returns Status code.
+ * @param   pThis                   The CCD instance.
+ * @param   hSnap                   The snapshot handle to read from.
+ */
+static int pspEmuCcdDevicesLoad(PPSPCCDINT pThis, PSPSNAPSHOT hSnap)
+{
+    int rc = STS_INF_SUCCESS;
+
+    PPSPDEV pDev = pThis->pDevsHead;
+    while (   pDev
+           && STS_SUCCESS(rc))
+    {
+        if (pDev->pReg->pfnLoad)
+        {
+            rc = pspEmuCcdSnapshotUnitSeek(hSnap, pDev->pReg->pszName);
+            if (STS_SUCCESS(rc))
+                rc = pDev->pReg->pfnLoad(pDev, hSnap);
+            else if (rc == STS_ERR_NOT_FOUND)
+                fprintf(stderr, "Snapshot doesn't contain a state for device \"%s\"\n", pDev->pReg->pszName);
+        }
+        pDev = pDev->pNext;
+    }
+
+    return rc;
+}
+
+
 /**
  * Create temporary memory regions given on the command line.
  *
@@ -822,6 +1071,40 @@ static int pspEmuCcdExecEnvInit(PPSPCCDINT pThis, PCPSPEMUCFG pCfg)
 }
 
 
+/**
+ * Returns whether the given config emulates more than one CCD.
+ *
+ * @returns Flag whether multiple CCDs are emulated.
+ * @param   pCfg                    The global config.
+ */
+static bool pspEmuCcdCfgIsMulti(PCPSPEMUCFG pCfg)
+{
+    return    (   pCfg->idSocketSingle == UINT32_MAX
+               || pCfg->idCcdSingle == UINT32_MAX)
+           && pCfg->cSockets * pCfg->cCcdsPerSocket > 1;
+}
+
+
+/**
+ * Returns the filename to use for the given per CCD output file, appending the socket and CCD ID
+ * if multiple CCDs are emulated so they don't overwrite each other.
+ *
+ * @returns Pointer to the filename to use.
+ * @param   pThis                   The CCD instance.
+ * @param   pszFilename             The configured filename.
+ * @param   pszBuf                  Buffer for constructing the filename.
+ * @param   cbBuf                   Size of the buffer in bytes.
+ */
+static const char *pspEmuCcdFilenameGet(PPSPCCDINT pThis, const char *pszFilename, char *pszBuf, size_t cbBuf)
+{
+    if (!pspEmuCcdCfgIsMulti(pThis->pCfg))
+        return pszFilename;
+
+    snprintf(pszBuf, cbBuf, "%s.%u.%u", pszFilename, pThis->idSocket, pThis->idCcd);
+    return pszBuf;
+}
+
+
 /**
  * Initializes the tracing if configured.
  *
@@ -829,16 +1112,18 @@ static int pspEmuCcdExecEnvInit(PPSPCCDINT pThis, PCPSPEMUCFG pCfg)
  * @param   pThis                   The CCD instance to initialize the debugger for.
  * @param   pCfg                    The global config.
  *
- * @todo Tracing for multiple CCDs is not working right now.
+ * @note Each CCD gets its own tracer (and file) when multiple CCDs are emulated, the default tracer is
+ *       set on the thread running the CCD in PSPEmuCcdRun().
  */
 static int pspEmuCcdTraceInit(PPSPCCDINT pThis, PCPSPEMUCFG pCfg)
 {
     int rc = 0;
+    char szFilename[512];
 
     if (pCfg->pszTraceLog)
     {
         rc = PSPEmuTraceCreateForFile(&pThis->hTrace, PSPEMU_TRACE_F_DEFAULT, pThis->hPspCore,
-                                      0, pCfg->pszTraceLog);
+                                      0, pspEmuCcdFilenameGet(pThis, pCfg->pszTraceLog, &szFilename[0], sizeof(szFilename)));
         if (STS_SUCCESS(rc))
             rc = PSPEmuTraceSetDefault(pThis->hTrace);
         if (   STS_SUCCESS(rc)
@@ -888,10 +1173,34 @@ static int pspEmuCcdTraceInit(PPSPCCDINT pThis, PCPSPEMUCFG pCfg)
             rc = PSPEmuCovCreate(&pThis->hCov, pThis->hPspCore, PspAddrBegin, PspAddrEnd);
     }
 
+    if (   STS_SUCCESS(rc)
+        && pCfg->pszInsnTrace)
+        rc = PSPEmuITraceCreate(&pThis->hITrace, pThis->hPspCore,
+                                pspEmuCcdFilenameGet(pThis, pCfg->pszInsnTrace, &szFilename[0], sizeof(szFilename)));
+
+    if (   STS_SUCCESS(rc)
+        && pCfg->pszProfile)
+        rc = PSPEmuProfCreate(&pThis->hProf, pThis->hPspCore, pCfg->cProfInsnsInterval, pCfg->cProfFramesMax);
+
+    if (   STS_SUCCESS(rc)
+        && pCfg->pszHeatmap)
+        rc = PSPEmuHeatmapCreate(&pThis->hHeatmap, pThis->hPspCore, pThis->hIoMgr, pThis->hEvtQ,
+                                 pCfg->cUsHeatmapEpoch * 1000);
+
+    if (   STS_SUCCESS(rc)
+        && pCfg->pszIrqLog)
+        rc = PSPEmuIrqLogRecordCreate(&pThis->hIrqLog, pThis->hPspCore,
+                                      pspEmuCcdFilenameGet(pThis, pCfg->pszIrqLog, &szFilename[0], sizeof(szFilename)));
+    else if (   STS_SUCCESS(rc)
+             && pCfg->pszIrqLogReplay)
+        rc = PSPEmuIrqLogReplayCreate(&pThis->hIrqLog, pThis->hPspCore,
+                                      pspEmuCcdFilenameGet(pThis, pCfg->pszIrqLogReplay, &szFilename[0], sizeof(szFilename)));
+
     if (pCfg->pszIoLog)
     {
         /* Create an I/O log writer instance and register trace points for all access spaces with IOM. */
-        rc = PSPEmuIoLogWrCreate(&pThis->hIoLogWr, 0 /*fFlags*/, pCfg->pszIoLog);
+        rc = PSPEmuIoLogWrCreate(&pThis->hIoLogWr, 0 /*fFlags*/,
+                                 pspEmuCcdFilenameGet(pThis, pCfg->pszIoLog, &szFilename[0], sizeof(szFilename)));
         if (STS_SUCCESS(rc))
         {
             uint32_t fTpFlags = PSPEMU_IOM_TRACE_F_READ | PSPEMU_IOM_TRACE_F_WRITE | PSPEMU_IOM_TRACE_F_AFTER;
@@ -932,6 +1241,129 @@ static void pspEmuCcdDevicesDestroy(PPSPCCDINT pThis)
 }
 
 
+/**
+ * Executes all SMN accesses queued for the given CCD, must be called on the thread running it.
+ *
+ * @returns nothing.
+ * @param   pThis               The CCD instance.
+ */
+static void pspEmuCcdSmnReqProcess(PPSPCCDINT pThis)
+{
+    OSLockAcquire(pThis->hLockSmnReq);
+    PPSPCCDSMNREQ pReq = pThis->pSmnReqHead;
+    pThis->pSmnReqHead = NULL;
+    OSLockRelease(pThis->hLockSmnReq);
+
+    while (pReq)
+    {
+        /* The requester frees the request as soon as it is marked done. */
+        PPSPCCDSMNREQ pNext = pReq->pNext;
+
+        if (pReq->fWrite)
+            PSPEmuIoMgrSmnWrite(pThis->hIoMgr, pReq->SmnAddr, pReq->pvVal, pReq->cbAccess);
+        else
+            PSPEmuIoMgrSmnRead(pThis->hIoMgr, pReq->SmnAddr, pReq->pvVal, pReq->cbAccess);
+        __atomic_store_n(&pReq->fDone, true, __ATOMIC_SEQ_CST);
+        pReq = pNext;
+    }
+}
+
+
+/**
+ * @copydoc{FNPSPCOREKICK, Processes queued SMN accesses and stop requests on the thread running the CCD}
+ */
+static void pspEmuCcdKick(PSPCORE hCore, void *pvUser)
+{
+    PPSPCCDINT pThis = (PPSPCCDINT)pvUser;
+
+    pspEmuCcdSmnReqProcess(pThis);
+    if (__atomic_load_n(&pThis->fStop, __ATOMIC_SEQ_CST))
+        PSPEmuCoreExecStop(hCore);
+}
+
+
+/**
+ * Executes a SMN access on the given peer CCD.
+ *
+ * The device handlers and the interrupt delivery of a CCD are only ever invoked from the thread
+ * running it, so the access is queued for that thread if it is currently executing. Otherwise
+ * the peer is idle and the access is carried out directly while holding the queue lock which
+ * keeps the peer from starting in the meantime.
+ *
+ * @returns nothing.
+ * @param   pThis               The CCD instance doing the access.
+ * @param   pPeer               The CCD owning the SMN address.
+ * @param   SmnAddr             The SMN address local to the peer.
+ * @param   cbAccess            Number of bytes to access.
+ * @param   pvVal               The value to write or where to store the value read.
+ * @param   fWrite              Flag whether this is a write.
+ */
+static void pspEmuCcdSmnPeerAccess(PPSPCCDINT pThis, PPSPCCDINT pPeer, SMNADDR SmnAddr, size_t cbAccess,
+                                   void *pvVal, bool fWrite)
+{
+    PSPCCDSMNREQ Req;
+
+    Req.pNext    = NULL;
+    Req.SmnAddr  = SmnAddr;
+    Req.cbAccess = cbAccess;
+    Req.pvVal    = pvVal;
+    Req.fWrite   = fWrite;
+    Req.fDone    = false;
+
+    OSLockAcquire(pPeer->hLockSmnReq);
+    if (!pPeer->fRunning)
+    {
+        if (fWrite)
+            PSPEmuIoMgrSmnWrite(pPeer->hIoMgr, SmnAddr, pvVal, cbAccess);
+        else
+            PSPEmuIoMgrSmnRead(pPeer->hIoMgr, SmnAddr, pvVal, cbAccess);
+        OSLockRelease(pPeer->hLockSmnReq);
+        return;
+    }
+
+    Req.pNext = pPeer->pSmnReqHead;
+    pPeer->pSmnReqHead = &Req;
+    OSLockRelease(pPeer->hLockSmnReq);
+
+    while (!__atomic_load_n(&Req.fDone, __ATOMIC_SEQ_CST))
+    {
+        /* Keep serving our own queue, the peer might wait for us at the same time. */
+        pspEmuCcdSmnReqProcess(pThis);
+        PSPEmuCoreKick(pPeer->hPspCore);
+        OSThreadYield();
+    }
+}
+
+
+/**
+ * @copydoc{FNPSPIOMSMNROUTE, Routes cross die SMN accesses to the I/O manager of the owning CCD}
+ */
+static bool pspEmuCcdSmnRoute(SMNADDR SmnAddr, size_t cbAccess, void *pvVal, bool fWrite, void *pvUser)
+{
+    PPSPCCDINT pThis = (PPSPCCDINT)pvUser;
+
+    if (!(SmnAddr & PSP_CCD_SMN_REMOTE_F))
+        return false;
+
+    uint32_t idSocket = PSP_CCD_SMN_REMOTE_SOCKET_GET(SmnAddr);
+    uint32_t idCcd    = PSP_CCD_SMN_REMOTE_CCD_GET(SmnAddr);
+    for (uint32_t i = 0; i < pThis->cCcdPeers; i++)
+    {
+        PPSPCCDINT pPeer = pThis->pahCcdPeers[i];
+
+        if (   pPeer->idSocket == idSocket
+            && pPeer->idCcd == idCcd)
+        {
+            pspEmuCcdSmnPeerAccess(pThis, pPeer, SmnAddr & ~PSP_CCD_SMN_REMOTE_MASK, cbAccess, pvVal, fWrite);
+            return true;
+        }
+    }
+
+    /* Not existing die, handle as unassigned access. */
+    return false;
+}
+
+
 int PSPEmuCcdCreate(PPSPCCD phCcd, uint32_t idSocket, uint32_t idCcd, PCPSPEMUCFG pCfg)
 {
     int rc = 0;
@@ -939,20 +1371,42 @@ int PSPEmuCcdCreate(PPSPCCD phCcd, uint32_t idSocket, uint32_t idCcd, PCPSPEMUCF
     if (pThis)
     {
         pThis->DevIf.pfnIrqSet    = pspCcdIrqSet;
+        pThis->DevIf.pfnQueryVirtTimeNs = pspCcdQueryVirtTimeNs;
         pThis->pCfg               = pCfg;
         pThis->idSocket           = idSocket;
         pThis->idCcd              = idCcd;
         pThis->fRegSmnHandlers    = false;
         pThis->hCov               = NULL;
+        pThis->hITrace            = NULL;
+        pThis->hProf              = NULL;
+        pThis->hHeatmap           = NULL;
+        pThis->hIrqLog            = NULL;
         pThis->pMemRegionsTmpHead = NULL;
 
         rc = PSPEmuCoreCreate(&pThis->hPspCore);
         if (!rc)
         {
-            rc = PSPEmuIoMgrCreate(&pThis->hIoMgr, pThis->hPspCore);
+            if (pCfg->cVirtClockIps)
+                rc = PSPEmuCoreVirtClockSetIps(pThis->hPspCore, pCfg->cVirtClockIps);
+            if (   !rc
+                && pCfg->fMmuPgTblWrProt)
+                rc = PSPEmuCoreMmuPgTblTrackingSetWrProt(pThis->hPspCore, true /*fWrProt*/);
+            if (!rc)
+                rc = OSLockCreate(&pThis->hLockSmnReq);
+            if (!rc)
+                rc = PSPEmuCoreKickCallbackSet(pThis->hPspCore, pspEmuCcdKick, pThis);
+            if (!rc)
+                rc = PSPEmuEvtQCreate(&pThis->hEvtQ, pThis->hPspCore);
+            if (!rc)
+                rc = PSPEmuIoMgrCreate(&pThis->hIoMgr, pThis->hPspCore);
             if (!rc)
             {
                 rc = PSPEmuIoMgrTraceAllAccessesSet(pThis->hIoMgr, pCfg->fIomLogAllAccesses);
+                if (!rc)
+                    rc = PSPEmuIoMgrStatsSet(pThis->hIoMgr, pCfg->fIomStats);
+                if (   !rc
+                    && pCfg->fPollFastForward)
+                    rc = PSPEmuCorePollDeadlineCallbackSet(pThis->hPspCore, pspEmuCcdPollDeadline, pThis);
                 if (!rc)
                 {
                      /** @todo Make IRQ controller handle passthrough as well (think of mixing real and emulated devices). */
@@ -994,6 +1448,10 @@ int PSPEmuCcdCreate(PPSPCCD phCcd, uint32_t idSocket, uint32_t idCcd, PCPSPEMUCF
                 PSPEmuIoMgrDestroy(pThis->hIoMgr);
             }
 
+            if (pThis->hEvtQ)
+                PSPEmuEvtQDestroy(pThis->hEvtQ);
+            if (pThis->hLockSmnReq)
+                OSLockDestroy(pThis->hLockSmnReq);
             PSPEmuCoreDestroy(pThis->hPspCore);
         }
 
@@ -1052,6 +1510,49 @@ void PSPEmuCcdDestroy(PSPCCD hCcd)
         pThis->hCov = NULL;
     }
 
+    if (pThis->hITrace)
+    {
+        printf("Recorded %llu basic blocks in the instruction trace\n", PSPEmuITraceQueryBbCount(pThis->hITrace));
+        PSPEmuITraceDestroy(pThis->hITrace);
+        pThis->hITrace = NULL;
+    }
+
+    if (pThis->hProf)
+    {
+        char szFilename[512];
+        const char *pszFilename = pspEmuCcdFilenameGet(pThis, pThis->pCfg->pszProfile, &szFilename[0], sizeof(szFilename));
+
+        int rc = PSPEmuProfDumpFolded(pThis->hProf, pszFilename, pThis->pCfg->pszProfSymMap);
+        if (STS_FAILURE(rc))
+            printf("Dumping the profile to %s failed with %d\n", pszFilename, rc);
+        else
+            printf("Dumped %llu profiler samples successfully to %s\n", PSPEmuProfQuerySampleCount(pThis->hProf), pszFilename);
+        PSPEmuProfDestroy(pThis->hProf);
+        pThis->hProf = NULL;
+    }
+
+    if (pThis->hHeatmap)
+    {
+        char szFilename[512];
+        char szFilenameWs[512 + 4];
+        const char *pszFilename = pspEmuCcdFilenameGet(pThis, pThis->pCfg->pszHeatmap, &szFilename[0], sizeof(szFilename));
+
+        snprintf(&szFilenameWs[0], sizeof(szFilenameWs), "%s.ws", pszFilename);
+        int rc = PSPEmuHeatmapDumpToFile(pThis->hHeatmap, pszFilename, &szFilenameWs[0]);
+        if (STS_FAILURE(rc))
+            printf("Dumping the heatmap to %s failed with %d\n", pszFilename, rc);
+        else
+            printf("Dumped the heatmap successfully to %s\n", pszFilename);
+        PSPEmuHeatmapDestroy(pThis->hHeatmap);
+        pThis->hHeatmap = NULL;
+    }
+
+    if (pThis->hIrqLog)
+    {
+        PSPEmuIrqLogDestroy(pThis->hIrqLog);
+        pThis->hIrqLog = NULL;
+    }
+
     if (pThis->hSvc)
     {
         PSPEmuSvcStateDestroy(pThis->hSvc);
@@ -1066,10 +1567,14 @@ void PSPEmuCcdDestroy(PSPCCD hCcd)
         pThis->hIrq = NULL;
     }
 
-    /* Destroy the I/O manager and then the emulation core and last this structure. */
+    /* Destroy the I/O manager, the event queue and then the emulation core and last this structure. */
     PSPEmuIoMgrDestroy(pThis->hIoMgr);
+    PSPEmuEvtQDestroy(pThis->hEvtQ);
+    OSLockDestroy(pThis->hLockSmnReq);
     PSPEmuCoreDestroy(pThis->hPspCore);
-    if (pThis->pvSram)
+    if (pThis->hSnapSram)
+        PSPEmuSnapshotClose(pThis->hSnapSram);
+    else if (pThis->pvSram)
         free(pThis->pvSram);
     free(pThis);
 }
@@ -1093,6 +1598,69 @@ int PSPEmuCcdQueryIoMgr(PSPCCD hCcd, PPSPIOM phIoMgr)
 }
 
 
+int PSPEmuCcdQueryEvtQ(PSPCCD hCcd, PPSPEVTQ phEvtQ)
+{
+    PPSPCCDINT pThis = hCcd;
+
+    *phEvtQ = pThis->hEvtQ;
+    return 0;
+}
+
+
+int PSPEmuCcdQueryCov(PSPCCD hCcd, PPSPCOV phCov)
+{
+    PPSPCCDINT pThis = hCcd;
+
+    if (!pThis->hCov)
+        return STS_ERR_NOT_FOUND;
+
+    *phCov = pThis->hCov;
+    return STS_INF_SUCCESS;
+}
+
+
+int PSPEmuCcdFlush(PSPCCD hCcd)
+{
+    PPSPCCDINT pThis = hCcd;
+    int rc = STS_INF_SUCCESS;
+
+    if (pThis->hTrace)
+        rc = PSPEmuTraceFlush(pThis->hTrace);
+    if (   STS_SUCCESS(rc)
+        && pThis->hIoLogWr)
+        rc = PSPEmuIoLogWrFlush(pThis->hIoLogWr);
+
+    return rc;
+}
+
+
+int PSPEmuCcdPeersSet(PSPCCD hCcd, PSPCCD *pahCcds, uint32_t cCcds)
+{
+    PPSPCCDINT pThis = hCcd;
+
+    if (pThis->pahCcdPeers)
+        return STS_ERR_INVALID_PARAMETER;
+
+    int rc = PSPEmuIoMgrSmnRouteSet(pThis->hIoMgr, pspEmuCcdSmnRoute, pThis);
+    if (STS_SUCCESS(rc))
+    {
+        pThis->pahCcdPeers = pahCcds;
+        pThis->cCcdPeers   = cCcds;
+    }
+
+    return rc;
+}
+
+
+int PSPEmuCcdStop(PSPCCD hCcd)
+{
+    PPSPCCDINT pThis = hCcd;
+
+    __atomic_store_n(&pThis->fStop, true, __ATOMIC_SEQ_CST);
+    return PSPEmuCoreKick(pThis->hPspCore);
+}
+
+
 int PSPEmuCcdReset(PSPCCD hCcd)
 {
     PPSPCCDINT pThis = hCcd;
@@ -1109,18 +1677,249 @@ int PSPEmuCcdReset(PSPCCD hCcd)
 }
 
 
+int PSPEmuCcdSnapshotSave(PSPCCD hCcd, const char *pszFilename)
+{
+    PPSPCCDINT pThis = hCcd;
+    PSPSNAPSHOT hSnap = NULL;
+
+    int rc = PSPEmuSnapshotCreate(&hSnap, pszFilename);
+    if (STS_SUCCESS(rc))
+    {
+        rc = PSPEmuSnapshotUnitBegin(hSnap, "ccd", 0 /*uInstance*/, PSP_CCD_SNAPSHOT_UNIT_VERSION);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU32(hSnap, pThis->idSocket);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU32(hSnap, pThis->idCcd);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU64(hSnap, pThis->cbSram);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotUnitEnd(hSnap);
+
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotUnitBegin(hSnap, "sram", 0 /*uInstance*/, PSP_CCD_SNAPSHOT_UNIT_VERSION);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutPages(hSnap, pThis->pvSram, pThis->cbSram);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotUnitEnd(hSnap);
+
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotUnitBegin(hSnap, "core", 0 /*uInstance*/, PSP_CCD_SNAPSHOT_UNIT_VERSION);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuCoreStateSave(pThis->hPspCore, hSnap);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotUnitEnd(hSnap);
+
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotUnitBegin(hSnap, "iom", 0 /*uInstance*/, PSP_CCD_SNAPSHOT_UNIT_VERSION);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuIoMgrStateSave(pThis->hIoMgr, hSnap);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotUnitEnd(hSnap);
+
+        if (   STS_SUCCESS(rc)
+            && pThis->hIrq)
+        {
+            rc = PSPEmuSnapshotUnitBegin(hSnap, "irq", 0 /*uInstance*/, PSP_CCD_SNAPSHOT_UNIT_VERSION);
+            if (STS_SUCCESS(rc))
+                rc = PSPIrqStateSave(pThis->hIrq, hSnap);
+            if (STS_SUCCESS(rc))
+                rc = PSPEmuSnapshotUnitEnd(hSnap);
+        }
+
+        if (STS_SUCCESS(rc))
+            rc = pspEmuCcdDevicesSave(pThis, hSnap);
+
+        int rc2 = PSPEmuSnapshotClose(hSnap);
+        if (STS_SUCCESS(rc))
+            rc = rc2;
+    }
+
+    return rc;
+}
+
+
+int PSPEmuCcdSnapshotRestore(PSPCCD hCcd, const char *pszFilename)
+{
+    PPSPCCDINT pThis = hCcd;
+    PSPSNAPSHOT hSnap = NULL;
+
+    int rc = PSPEmuSnapshotOpen(&hSnap, pszFilename);
+    if (STS_FAILURE(rc))
+        return rc;
+
+    uint32_t idSocket = 0;
+    uint32_t idCcd = 0;
+    uint64_t cbSram = 0;
+    void *pvSram = NULL;
+
+    rc = pspEmuCcdSnapshotUnitSeek(hSnap, "ccd");
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetU32(hSnap, &idSocket);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetU32(hSnap, &idCcd);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetU64(hSnap, &cbSram);
+    if (   STS_SUCCESS(rc)
+        && cbSram != pThis->cbSram)
+    {
+        fprintf(stderr, "Snapshot SRAM size %llu doesn't match the emulated PSP (%zu)\n",
+                (unsigned long long)cbSram, pThis->cbSram);
+        rc = STS_ERR_INVALID_PARAMETER;
+    }
+    if (   STS_SUCCESS(rc)
+        && (   idSocket != pThis->idSocket
+            || idCcd != pThis->idCcd))
+        printf("Restoring snapshot of socket %u CCD %u into socket %u CCD %u\n",
+               idSocket, idCcd, pThis->idSocket, pThis->idCcd);
+
+    /* Map the SRAM content straight from the snapshot file, no copy involved. */
+    if (STS_SUCCESS(rc))
+        rc = pspEmuCcdSnapshotUnitSeek(hSnap, "sram");
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetPages(hSnap, &pvSram, pThis->cbSram);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuCoreMemRegionRemove(pThis->hPspCore, 0x0, pThis->cbSram);
+    if (STS_SUCCESS(rc))
+    {
+        rc = PSPEmuCoreMemRegionAdd(pThis->hPspCore, 0x0, pThis->cbSram,
+                                    PSPEMU_CORE_MEM_REGION_PROT_F_EXEC | PSPEMU_CORE_MEM_REGION_PROT_F_READ | PSPEMU_CORE_MEM_REGION_PROT_F_WRITE,
+                                    pvSram);
+        if (STS_SUCCESS(rc))
+        {
+            if (pThis->hSnapSram)
+                PSPEmuSnapshotClose(pThis->hSnapSram);
+            else
+                free(pThis->pvSram);
+
+            pThis->pvSram    = pvSram;
+            pThis->hSnapSram = hSnap;
+        }
+        else /* Try to restore the old mapping, we are in trouble anyway. */
+            PSPEmuCoreMemRegionAdd(pThis->hPspCore, 0x0, pThis->cbSram,
+                                   PSPEMU_CORE_MEM_REGION_PROT_F_EXEC | PSPEMU_CORE_MEM_REGION_PROT_F_READ | PSPEMU_CORE_MEM_REGION_PROT_F_WRITE,
+                                   pThis->pvSram);
+    }
+
+    if (STS_SUCCESS(rc))
+    {
+        rc = pspEmuCcdSnapshotUnitSeek(hSnap, "iom");
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuIoMgrStateLoad(pThis->hIoMgr, hSnap);
+
+        if (   STS_SUCCESS(rc)
+            && pThis->hIrq)
+        {
+            rc = pspEmuCcdSnapshotUnitSeek(hSnap, "irq");
+            if (STS_SUCCESS(rc))
+                rc = PSPIrqStateLoad(pThis->hIrq, hSnap);
+        }
+
+        if (STS_SUCCESS(rc))
+            rc = pspEmuCcdDevicesLoad(pThis, hSnap);
+
+        /* The core comes last as the MMU state is derived from the restored page tables. */
+        if (STS_SUCCESS(rc))
+            rc = pspEmuCcdSnapshotUnitSeek(hSnap, "core");
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuCoreStateLoad(pThis->hPspCore, hSnap);
+    }
+    else
+        PSPEmuSnapshotClose(hSnap);
+
+    return rc;
+}
+
+
+int PSPEmuCcdRunUpTo(PSPCCD hCcd, PSPADDR PspAddrUpTo)
+{
+    PPSPCCDINT pThis = hCcd;
+    PSPCORETP hTpRunUpTo = NULL;
+
+    if (pThis->hTrace)
+        PSPEmuTraceSetDefault(pThis->hTrace);
+
+    pThis->fRunUpToReached = false;
+    int rc = PSPEmuCoreTraceRegister(pThis->hPspCore, PspAddrUpTo, PspAddrUpTo,
+                                     PSPEMU_CORE_TRACE_F_EXEC, ARMASID_ANY, pspEmuCcdRunUpToTp, pThis,
+                                     &hTpRunUpTo);
+    if (STS_SUCCESS(rc))
+    {
+        rc = PSPEmuCoreExecRun(pThis->hPspCore, PSPEMU_CORE_EXEC_F_DEFAULT, 0, PSPEMU_CORE_EXEC_INDEFINITE);
+        if (!pThis->fRunUpToReached)
+            rc = STS_FAILURE(rc) ? rc : STS_ERR_NOT_FOUND;
+        else
+            rc = STS_INF_SUCCESS;
+
+        PSPEmuCoreTraceDeregister(hTpRunUpTo);
+    }
+
+    return rc;
+}
+
+
 int PSPEmuCcdRun(PSPCCD hCcd)
 {
     PPSPCCDINT pThis = hCcd;
+    int rc = STS_INF_SUCCESS;
+
+    /* The default tracer is per thread and we might run on a different one than the creator. */
+    if (pThis->hTrace)
+        PSPEmuTraceSetDefault(pThis->hTrace);
 
-    int rc = PSPEmuCoreExecRun(pThis->hPspCore,
+    if (pThis->pCfg->pszSnapshotSave)
+        rc = PSPEmuCoreTraceRegister(pThis->hPspCore, pThis->pCfg->PspAddrSnapshotSave, pThis->pCfg->PspAddrSnapshotSave,
+                                     PSPEMU_CORE_TRACE_F_EXEC, ARMASID_ANY, pspEmuCcdSnapshotSaveTp, pThis,
+                                     &pThis->hTpSnapshotSave);
+    if (STS_FAILURE(rc))
+        return rc;
+
+    /* From now on cross die SMN accesses from other CCDs get queued for this thread. */
+    OSLockAcquire(pThis->hLockSmnReq);
+    pThis->fRunning = true;
+    OSLockRelease(pThis->hLockSmnReq);
+
+    while (!__atomic_load_n(&pThis->fStop, __ATOMIC_SEQ_CST))
+    {
+        rc = PSPEmuCoreExecRun(pThis->hPspCore,
                                  pThis->pCfg->fSingleStepDumpCoreState
                                ? PSPEMU_CORE_EXEC_F_DUMP_CORE_STATE
                                : PSPEMU_CORE_EXEC_F_DEFAULT,
                                0, PSPEMU_CORE_EXEC_INDEFINITE);
+        if (!pThis->fSnapshotSavePending)
+            break;
+
+        /* Only one snapshot is taken, the trace point is not needed anymore. */
+        pThis->fSnapshotSavePending = false;
+        PSPEmuCoreTraceDeregister(pThis->hTpSnapshotSave);
+        pThis->hTpSnapshotSave = NULL;
+
+        rc = PSPEmuCcdSnapshotSave(pThis, pThis->pCfg->pszSnapshotSave);
+        if (STS_FAILURE(rc))
+        {
+            fprintf(stderr, "Saving the snapshot to %s failed with %d\n", pThis->pCfg->pszSnapshotSave, rc);
+            break;
+        }
+
+        printf("Saved snapshot to %s, continuing...\n", pThis->pCfg->pszSnapshotSave);
+    }
+
+    /* Serve accesses queued until the flag got cleared, later ones are carried out by the requester directly. */
+    OSLockAcquire(pThis->hLockSmnReq);
+    pThis->fRunning = false;
+    OSLockRelease(pThis->hLockSmnReq);
+    pspEmuCcdSmnReqProcess(pThis);
+
     if (rc == STS_INF_PSP_EMU_CORE_INSN_WFI_REACHED)
         printf("WFI instruction reached and no WFI handler is set, exiting...\n");
-    PSPEmuCoreStateDump(pThis->hPspCore, PSPEMU_CORE_STATE_DUMP_F_DEFAULT, 0 /*cInsns*/);
+
+    /* Fork server children run over and over, dumping the state for each would just flood the output. */
+    if (!pThis->pCfg->pszForkSrv)
+    {
+        PSPEmuCoreStateDump(pThis->hPspCore, PSPEMU_CORE_STATE_DUMP_F_DEFAULT, 0 /*cInsns*/);
+        PSPEmuCoreStatsDump(pThis->hPspCore);
+        if (pThis->pCfg->fIomStats)
+            PSPEmuIoMgrStatsDump(pThis->hIoMgr);
+    }
     return rc;
 }
 
@@ -111,16 +111,29 @@ static struct option g_aOptions[] =
     {"acpi-state",                   required_argument, 0, 'i'},
     {"uart-remote-addr",             required_argument, 0, 'u'},
     {"timer-real-time",              no_argument      , 0, 'r'},
+    {"virt-clock-ips",               required_argument, 0, 'q'},
+    {"mmu-pgtbl-write-protect",      no_argument,       0, 'w'},
+    {"poll-fast-forward",            no_argument,       0, '7'},
     {"spi-flash-trace",              required_argument, 0, 'F'},
     {"coverage-trace",               required_argument, 0, 'V'},
+    {"insn-trace",                   required_argument, 0, 'j'},
+    {"profile",                      required_argument, 0, 'J'},
+    {"profile-interval",             required_argument, 0, 'l'},
+    {"profile-sym-map",              required_argument, 0, '1'},
+    {"profile-unwind",               required_argument, 0, '2'},
+    {"heatmap",                      required_argument, 0, 'y'},
+    {"heatmap-epoch",                required_argument, 0, '3'},
     {"sockets",                      required_argument, 0, 'S'},
     {"ccds-per-socket",              required_argument, 0, 'C'},
     {"emulate-single-socket-id",     required_argument, 0, 'O'},
     {"emulate-single-die-id",        required_argument, 0, 'D'},
     {"emulate-devices",              required_argument, 0, 'E'},
     {"iom-log-all-accesses",         no_argument      , 0, 'I'},
+    {"iom-stats",                    no_argument      , 0, '4'},
     {"io-log-write",                 required_argument, 0, 'L'},
     {"io-log-replay",                required_argument, 0, 'Y'},
+    {"irq-record",                   required_argument, 0, 'Z'},
+    {"irq-replay",                   required_argument, 0, '9'},
     {"proxy-buffer-writes",          no_argument      , 0, 'P'},
     {"dbg-step-count",               required_argument, 0, 'G'},
     {"dbg-run-up-to",                required_argument, 0, 'U'},
@@ -133,6 +146,10 @@ static struct option g_aOptions[] =
     {"single-step-dump-core-state",  no_argument,       0, 'A'},
     {"enable-x86-ice",               required_argument, 0, 'e'},
     {"enable-x86-stub",              required_argument, 0, 'B'},
+    {"snapshot-save",                required_argument, 0, 'k'},
+    {"snapshot-restore",             required_argument, 0, 'K'},
+    {"fork-server",                  required_argument, 0, 'z'},
+    {"fork-server-timeout",          required_argument, 0, '5'},
 
     {"help",                         no_argument,       0, 'H'},
     {0, 0, 0, 0}
@@ -162,8 +179,15 @@ static const PSPCFGARG g_aCfgArgsGeneral[] =
     {"acpi-state",                   'i', "[s0|s1|s1|s2|s3|s4|s5]",           "Selects the ACPI system state to start emulation from, default is S5"},
     {"uart-remote-addr",             'u', "[<port>|<address:port>]",          "When the emulated UART is used connect either to given address/port pair or listen for incoming connections on the given port"},
     {"timer-real-time",              'r', NULL,                               "Emulated timers tick in host real-time"},
+    {"virt-clock-ips",               'q', "<instructions per second>",        "Rate of the virtual clock derived from the number of executed instructions, which drives the emulated timers"},
+    {"mmu-pgtbl-write-protect",      'w', NULL,                               "Track page table writes by write protecting the pages containing them instead of hooking every write to them"},
+    {"poll-fast-forward",            '7', NULL,                               "Detect loops polling a device register and fast forward the virtual clock to when the value might change"},
     {"memory-preload",               'M', "<addrspace>:<address>:<filename>", "Preloads a given address space address with data from the given file, can be given multiple times on the command line"},
     {"memory-create",                'R', "<addrspace>:<address>:<sz>",       "Creates a memory region for the given address space address, can be given multiple times on the command line"},
+    {"snapshot-save",                'k', "<addr>:<path/to/snapshot>",        "Saves a snapshot of the emulated PSP state to the given file when the given address is hit for the first time"},
+    {"snapshot-restore",             'K', "<path/to/snapshot>",               "Restores the emulated PSP state from the given snapshot file before starting emulation"},
+    {"fork-server",                  'z', "<path/to/socket>",                 "Initializes once, runs up to the --dbg-run-up-to address if given and then forks a child for every run requested on the given UNIX domain socket"},
+    {"fork-server-timeout",          '5', "<milliseconds>",                   "Kills a fork server child and reports a timeout if a single run takes longer than the given time, 0 (default) for no limit"},
     {"help",                         'H', NULL,                               "Prints this help text"}
 };
 
@@ -204,10 +228,20 @@ static const PSPCFGARG g_aCfgArgsTraceLog[] =
     {"trace-svcs",                   'v', NULL,                               "Trace all syscalls being made along with the arguments"},
     {"spi-flash-trace",              'F', "<path/to/flash/trace>",            "Generates a trace compatible with psptrace when the emulated flash device is used" },
     {"coverage-trace",               'V', "<path/to/coverage/trace/file>",    "Create a coverage trace compatible to DrCov and dump it to the given file when the emulator exits"},
+    {"insn-trace",                   'j', "<path/to/insn/trace/file>",        "Record a compact binary trace of every executed basic block with register changes, decode with psp-itrace-tool"},
+    {"profile",                      'J', "<path/to/folded/stacks>",          "Sample the PC periodically and dump the stacks in folded format (flamegraph.pl) to the given file when the emulator exits"},
+    {"profile-interval",             'l', "<insns>",                          "Number of retired instructions between two profiler samples, defaults to 10000"},
+    {"profile-sym-map",              '1', "<path/to/symbol/map>",             "Symbolize the profiler output with the given map, each line starts with the hex address and ends with the name (nm output works)"},
+    {"profile-unwind",               '2', "<frames>",                         "Maximum number of frames the profiler records per sample by following LR and the frame pointer chain, defaults to 1 (PC only)"},
+    {"heatmap",                      'y', "<path/to/heatmap.csv>",            "Record memory, MMIO, SMN and x86 accesses per 4K page and dump the heatmap (CSV) along with a working set summary per epoch (<path>.ws) when the emulator exits"},
+    {"heatmap-epoch",                '3', "<us>",                             "Length of a working set epoch in virtual microseconds for --heatmap, defaults to 1000"},
     {"iom-log-all-accesses",         'I', NULL,                               "I/O manager logs all device accesses not only the ones to unassigned regions"},
+    {"iom-stats",                    '4', NULL,                               "I/O manager counts the accesses and host time spent per device and dumps them when the emulator exits"},
     {"io-log-write",                 'L', "<path/to/io/log>",                 "Writes a log of all I/O accesses for later replay"},
     {"io-log-replay",                'Y', "<path/to/io/log>",                 "Replays the given I/O log, mutually exclusive with proxy mode"},
-    {"single-step-dump-core-state",  'A', NULL,                               "Single step execution, dumping the core state after each instruction"}
+    {"irq-record",                   'Z', "<path/to/irq/log>",                "Records every IRQ/FIQ line change with the retired instruction count it happened at, combine with --io-log-write to capture all external input"},
+    {"irq-replay",                   '9', "<path/to/irq/log>",                "Replays the IRQ/FIQ line changes from the given log at the recorded instruction counts, ignoring the devices, mutually exclusive with proxy mode"},
+    {"single-step-dump-core-state",  'A', NULL,                               "Single step execution, dumping the core state after each instruction (very slow, consider --insn-trace)"}
 };
 
 
@@ -755,6 +789,37 @@ static int pspCfgParseX86Stub(PPSPEMUCFG pCfg, const char *pszX86StubCfg)
 }
 
 
+/**
+ * Parse the snapshot save config.
+ *
+ * @returns Status code.
+ * @param   pCfg                    The config to set the snapshot save parameters in upon success.
+ * @param   pszSnapshotSave         The argument string to parse.
+ */
+static int pspCfgParseSnapshotSave(PPSPEMUCFG pCfg, const char *pszSnapshotSave)
+{
+    int rc = STS_INF_SUCCESS;
+    char *pszSep = strchr(pszSnapshotSave, ':');
+    if (pszSep)
+    {
+        char *pszEndPtr;
+
+        errno = 0;
+        pCfg->PspAddrSnapshotSave = strtoul(pszSnapshotSave, &pszEndPtr, 0);
+        if (   !errno
+            && pszEndPtr == pszSep
+            && *(pszSep + 1) != '\0')
+            pCfg->pszSnapshotSave = pszSep + 1;
+        else
+            rc = STS_ERR_INVALID_PARAMETER;
+    }
+    else
+        rc = STS_ERR_INVALID_PARAMETER;
+
+    return rc;
+}
+
+
 /**
  * Verifies the given config for some basic sanity.
  *
@@ -826,6 +891,20 @@ static int pspCfgVerify(PCPSPEMUCFG pCfg)
         return STS_ERR_GENERAL_ERROR;
     }
 
+    if (   pCfg->pszIrqLogReplay
+        && pCfg->pszPspProxyAddr)
+    {
+        fprintf(stderr, "Proxy mode and interrupt replay are mutually exclusive\n");
+        return STS_ERR_GENERAL_ERROR;
+    }
+
+    if (   pCfg->pszIrqLogReplay
+        && pCfg->pszIrqLog)
+    {
+        fprintf(stderr, "Interrupt recording and replay are mutually exclusive\n");
+        return STS_ERR_GENERAL_ERROR;
+    }
+
     return STS_INF_SUCCESS;
 }
 
@@ -895,8 +974,12 @@ void PSPCfgInit(PPSPEMUCFG pCfg)
     pCfg->fIncptSvc6            = false;
     pCfg->fTraceSvcs            = false;
     pCfg->fTimerRealtime        = false;
+    pCfg->cVirtClockIps         = 0;
+    pCfg->fMmuPgTblWrProt       = false;
+    pCfg->fPollFastForward      = false;
     pCfg->fBootRomSvcPageModify = true;
     pCfg->fIomLogAllAccesses    = false;
+    pCfg->fIomStats             = false;
     pCfg->fProxyWrBuffer        = false;
     pCfg->fCcpProxy             = false;
     pCfg->fProxyBlockX86CoreRelease = false;
@@ -916,7 +999,16 @@ void PSPCfgInit(PPSPEMUCFG pCfg)
     pCfg->pszSpiFlashTrace      = NULL;
     pCfg->pszIoLog              = NULL;
     pCfg->pszIoLogReplay        = NULL;
+    pCfg->pszIrqLog             = NULL;
+    pCfg->pszIrqLogReplay       = NULL;
     pCfg->pszCovTrace           = NULL;
+    pCfg->pszInsnTrace          = NULL;
+    pCfg->pszProfile            = NULL;
+    pCfg->pszProfSymMap         = NULL;
+    pCfg->cProfInsnsInterval    = 10000;
+    pCfg->cProfFramesMax        = 1;
+    pCfg->pszHeatmap            = NULL;
+    pCfg->cUsHeatmapEpoch       = 1000;
     pCfg->cSockets              = 1;
     pCfg->cCcdsPerSocket        = 1;
     pCfg->idSocketSingle        = UINT32_MAX;
@@ -936,6 +1028,11 @@ void PSPCfgInit(PPSPEMUCFG pCfg)
     pCfg->pszX86StubFilename       = NULL,
     pCfg->PhysX86AddrUefiStart     = 0;
     pCfg->cbUefi                   = 0;
+    pCfg->pszSnapshotSave          = NULL;
+    pCfg->PspAddrSnapshotSave      = 0;
+    pCfg->pszSnapshotRestore       = NULL;
+    pCfg->pszForkSrv               = NULL;
+    pCfg->cMsForkSrvTimeout        = 0;
 }
 
 
@@ -989,7 +1086,7 @@ int PSPCfgParse(PPSPEMUCFG pCfg, int cArgs, const char * const *papszArgs)
 
     PSPCfgInit(pCfg);
 
-    while ((ch = getopt_long (cArgs, (char * const *)papszArgs, "hpbr8N:m:f:o:d:s:x:a:c:u:S:C:O:D:E:V:U:P:T:M:R:L:Y:W:e:IA", &g_aOptions[0], &idxOption)) != -1)
+    while ((ch = getopt_long (cArgs, (char * const *)papszArgs, "hpbr8N:m:f:o:d:s:x:a:c:u:S:C:O:D:E:V:U:P:T:M:R:L:Y:W:e:k:K:q:z:j:J:l:1:2:y:3:Z:9:I4Aw75:", &g_aOptions[0], &idxOption)) != -1)
     {
         switch (ch)
         {
@@ -1100,6 +1197,15 @@ int PSPCfgParse(PPSPEMUCFG pCfg, int cArgs, const char * const *papszArgs)
             case 'r':
                 pCfg->fTimerRealtime = true;
                 break;
+            case 'q':
+                pCfg->cVirtClockIps = strtoull(optarg, NULL, 10);
+                break;
+            case 'w':
+                pCfg->fMmuPgTblWrProt = true;
+                break;
+            case '7':
+                pCfg->fPollFastForward = true;
+                break;
             case 'S':
                 pCfg->cSockets = strtoul(optarg, NULL, 10);
                 break;
@@ -1121,9 +1227,39 @@ int PSPCfgParse(PPSPEMUCFG pCfg, int cArgs, const char * const *papszArgs)
             case 'V':
                 pCfg->pszCovTrace = optarg;
                 break;
+            case 'j':
+                pCfg->pszInsnTrace = optarg;
+                break;
+            case 'J':
+                pCfg->pszProfile = optarg;
+                break;
+            case 'l':
+                pCfg->cProfInsnsInterval = strtoull(optarg, NULL, 10);
+                break;
+            case '1':
+                pCfg->pszProfSymMap = optarg;
+                break;
+            case '2':
+                pCfg->cProfFramesMax = strtoul(optarg, NULL, 10);
+                break;
+            case 'Z':
+                pCfg->pszIrqLog = optarg;
+                break;
+            case '9':
+                pCfg->pszIrqLogReplay = optarg;
+                break;
+            case 'y':
+                pCfg->pszHeatmap = optarg;
+                break;
+            case '3':
+                pCfg->cUsHeatmapEpoch = strtoull(optarg, NULL, 10);
+                break;
             case 'I':
                 pCfg->fIomLogAllAccesses = true;
                 break;
+            case '4':
+                pCfg->fIomStats = true;
+                break;
             case 'L':
                 pCfg->pszIoLog = optarg;
                 break;
@@ -1189,6 +1325,22 @@ int PSPCfgParse(PPSPEMUCFG pCfg, int cArgs, const char * const *papszArgs)
                     return rc;
                 break;
             }
+            case 'k':
+            {
+                int rc = pspCfgParseSnapshotSave(pCfg, optarg);
+                if (STS_FAILURE(rc))
+                    return rc;
+                break;
+            }
+            case 'K':
+                pCfg->pszSnapshotRestore = optarg;
+                break;
+            case 'z':
+                pCfg->pszForkSrv = optarg;
+                break;
+            case '5':
+                pCfg->cMsForkSrvTimeout = strtoul(optarg, NULL, 10);
+                break;
             default:
                 fprintf(stderr, "Unrecognised option: -%c\n", optopt);
                 return -1;
@@ -25,14 +25,77 @@
 #include <common/cdefs.h>
 #include <common/status.h>
 
+
 #include <psp-core.h>
 #include <psp-disasm.h>
 #include <psp-trace.h>
 
 /** Page size used in the PSP firmware. */
 #define PSP_PAGE_SIZE         _4K
+#define PSP_PAGE_SHIFT        12
 #define PSP_PAGE_L1_IDX_SHIFT 20
 
+/** Shift to get at the first level index of the memory region lookup table. */
+#define PSP_CORE_MEM_LOOKUP_L1_SHIFT    22
+/** Number of entries in the first level of the memory region lookup table. */
+#define PSP_CORE_MEM_LOOKUP_L1_ENTRIES  1024
+/** Number of entries in a second level table of the memory region lookup table. */
+#define PSP_CORE_MEM_LOOKUP_L2_ENTRIES  1024
+
+/** @name Reasons for a hook stopping the emulation, recorded so PSPEmuCoreExecRun() doesn't have to guess.
+ * @{ */
+/** The MMU configuration changed and the mappings have to be set up again. */
+#define PSP_CORE_EXIT_F_MMU_CHANGED     BIT(0)
+/** An exception became pending (interrupt, SVC or SMC). */
+#define PSP_CORE_EXIT_F_EXCP_PENDING    BIT(1)
+/** The virtual clock deadline was reached. */
+#define PSP_CORE_EXIT_F_DEADLINE        BIT(2)
+/** The emulation was stopped through PSPEmuCoreExecStop(). */
+#define PSP_CORE_EXIT_F_STOP            BIT(3)
+/** The core was kicked through PSPEmuCoreKick(). */
+#define PSP_CORE_EXIT_F_KICK            BIT(4)
+/** @} */
+
+/** @name Trace point index kinds, each has its own set of unicorn hooks per core.
+ * @{ */
+/** Trace points triggering on instruction execution. */
+#define PSP_CORE_TP_IDX_EXEC            0
+/** Trace points triggering on basic block execution. */
+#define PSP_CORE_TP_IDX_EXEC_BB         1
+/** Trace points triggering on memory reads/writes. */
+#define PSP_CORE_TP_IDX_MEM             2
+/** Number of trace point index kinds. */
+#define PSP_CORE_TP_IDX_COUNT           3
+/** @} */
+
+/** Number of buckets in the exact address hash of a trace point index, must be a power of two. */
+#define PSP_CORE_TP_HASH_ENTRIES        256
+/** Maximum number of trace points collected at once for a single dispatch. */
+#define PSP_CORE_TP_DISPATCH_MAX        32
+
+/** Number of entries in the direct mapped software TLB used by the host side virtual memory accessors, must be a power of two. */
+#define PSP_CORE_TLB_ENTRIES            256
+
+/** Number of L1 descriptors (and the L2 tables they reference) tracked for changes, only these translations get cached. */
+#define PSP_CORE_MMU_PGTBL_TRACK_L1_ENTRIES 32
+
+/** Number of L1 descriptors considered when looking up virtual addresses for a physical address (the first 32MB). */
+#define PSP_CORE_REVMAP_L1_ENTRIES      32
+/** Number of virtual pages covered by the reverse map. */
+#define PSP_CORE_REVMAP_VPAGES          (PSP_CORE_REVMAP_L1_ENTRIES * (_1M / _4K))
+/** Number of buckets in the physical page hash of the reverse map, must be a power of two. */
+#define PSP_CORE_REVMAP_HASH_ENTRIES    1024
+/** Marker for the end of a reverse map hash chain and an unmapped virtual page. */
+#define PSP_CORE_REVMAP_NIL             UINT32_MAX
+
+/** Maximum number of instructions per iteration for a sequence of MMIO reads to be considered a polling loop. */
+#define PSP_CORE_POLL_LOOP_INSNS_MAX    256
+/** Number of identical iterations before a polling loop is fast forwarded. */
+#define PSP_CORE_POLL_LOOP_ITERS_MIN    32
+
+/** Maximum number of registers transferred with a single batch by pspEmuCoreRegsXfer(). */
+#define PSP_CORE_REGS_XFER_MAX          64
+
 /**
  * A datum read/written.
  */
@@ -94,8 +157,10 @@ typedef struct PSPCORETPINT
     PFNPSPCORETRACE         pfnTrace;
     /** Opaque user data to pass to the callback. */
     void                    *pvUser;
-    /** The unicorn hook handle. */
-    uc_hook                 hUcHook;
+    /** The PSPEMU_CORE_TRACE_F_XXX flags given during registration. */
+    uint32_t                fFlags;
+    /** Next trace point in the same exact address hash bucket (only for trace points covering a single address). */
+    struct PSPCORETPINT     *pHashNext;
 } PSPCORETPINT;
 /** Pointer to a trace hook. */
 typedef PSPCORETPINT *PPSPCORETPINT;
@@ -103,6 +168,72 @@ typedef PSPCORETPINT *PPSPCORETPINT;
 typedef const PSPCORETPINT *PCPSPCORETPINT;
 
 
+/**
+ * Address range covered by a unicorn hook of a trace point index.
+ */
+typedef struct PSPCORETPHOOKRANGE
+{
+    /** Start address. */
+    PSPADDR                 PspAddrStart;
+    /** End address (inclusive). */
+    PSPADDR                 PspAddrEnd;
+} PSPCORETPHOOKRANGE;
+/** Pointer to a hook range. */
+typedef PSPCORETPHOOKRANGE *PPSPCORETPHOOKRANGE;
+/** Pointer to a const hook range. */
+typedef const PSPCORETPHOOKRANGE *PCPSPCORETPHOOKRANGE;
+
+
+/**
+ * Trace point index for one kind of trace point, dispatching from one unicorn hook per disjoint address range.
+ */
+typedef struct PSPCORETPIDX
+{
+    /** The unicorn hooks currently registered. */
+    uc_hook                 *pahUcHooks;
+    /** Number of unicorn hooks registered. */
+    uint32_t                cUcHooks;
+    /** Number of trace points in this index. */
+    uint32_t                cTps;
+    /** Trace points covering a single address, hashed by address. */
+    PPSPCORETPINT           apTpHash[PSP_CORE_TP_HASH_ENTRIES];
+    /** Trace points covering an address range, sorted by start address. */
+    PPSPCORETPINT           *papTpRanges;
+    /** Maximum end address of all ranges up to and including the same index in papTpRanges. */
+    PSPADDR                 *paPspAddrEndMax;
+    /** Number of entries in the range array. */
+    uint32_t                cTpRanges;
+    /** Maximum number of entries the range array can hold. */
+    uint32_t                cTpRangesMax;
+} PSPCORETPIDX;
+/** Pointer to a trace point index. */
+typedef PSPCORETPIDX *PPSPCORETPIDX;
+
+
+/**
+ * Software TLB entry caching a virtual to physical translation for the host side accessors.
+ */
+typedef struct PSPCORETLBENTRY
+{
+    /** Flag whether the entry is valid. */
+    bool                    fValid;
+    /** Flag whether the translation was done for the secure world. */
+    bool                    fSecure;
+    /** The ASID (context ID) the translation was done for. */
+    ARMASID                 idAsid;
+    /** The page aligned virtual address. */
+    PSPVADDR                PspVAddrPg;
+    /** The page aligned physical address. */
+    PSPPADDR                PspPAddrPg;
+    /** Size of the physically contiguous region starting at the page. */
+    size_t                  cbRegion;
+    /** The page table walk status of the translation. */
+    PSPCOREPGTBLWALKSTS     enmPgTblWalk;
+} PSPCORETLBENTRY;
+/** Pointer to a software TLB entry. */
+typedef PSPCORETLBENTRY *PPSPCORETLBENTRY;
+
+
 /**
  * A single memory (RAM/MMIO) region registration.
  */
@@ -140,6 +271,8 @@ typedef struct PSPCOREMEMREGION
             void                     *pvBacking;
             /** Protection flags assigned to this region. */
             uint32_t                 fProt;
+            /** Unicorn protection granted per page while page accesses are tracked without the MMU, NULL if not allocated. */
+            uint8_t                  *pbPgUcProt;
         } Ram;
     } u;
 } PSPCOREMEMREGION;
@@ -149,6 +282,18 @@ typedef PSPCOREMEMREGION *PPSPCOREMEMREGION;
 typedef const PSPCOREMEMREGION *PCPSPCOREMEMREGION;
 
 
+/**
+ * Second level of the memory region lookup table, covering 4MiB of the PSP address space.
+ */
+typedef struct PSPCOREMEMLOOKUPL2
+{
+    /** Region with the lowest start address overlapping the page, indexed by page number. */
+    PPSPCOREMEMREGION        apRegions[PSP_CORE_MEM_LOOKUP_L2_ENTRIES];
+} PSPCOREMEMLOOKUPL2;
+/** Pointer to a second level memory region lookup table. */
+typedef PSPCOREMEMLOOKUPL2 *PPSPCOREMEMLOOKUPL2;
+
+
 /**
  * A MMU mapping.
  */
@@ -168,6 +313,8 @@ typedef struct PSPCOREMMUMAP
     PSPPADDR                        offPhysMap;
     /** The physical memory region this mapping maps to. */
     PCPSPCOREMEMREGION              pMemRegion;
+    /** Unicorn protection granted for the mapping, page table write protection is applied on top. */
+    int32_t                         fUcProt;
 } PSPCOREMMUMAP;
 /** Pointer to a MMU mapping structure. */
 typedef PSPCOREMMUMAP *PPSPCOREMMUMAP;
@@ -234,7 +381,9 @@ typedef struct PSPCOREPGTBLTRACK
     PPSPCOREINT                 pThis;
     /** Flag whether this tracks an L1 or L2 table. */
     bool                        fL2PgTbl;
-    /** Unicorn hook handle to monitor writes. */
+    /** For L2 tables the index of the L1 descriptor referencing the table. */
+    uint32_t                    idxL1;
+    /** Unicorn hook handle to monitor writes, unused if the page table is tracked by write protecting it. */
     uc_hook                     hUcHookWrites;
     /** The physical page table start address we are tracking. */
     PSPPADDR                    PhysAddrPgTblStart;
@@ -249,6 +398,24 @@ typedef PSPCOREPGTBLTRACK *PPSPCOREPGTBLTRACK;
 typedef const PSPCOREPGTBLTRACK *PCPSPCOREPGTBLTRACK;
 
 
+/**
+ * Reverse map entry for a single virtual page, chained into the hash of the physical page it maps.
+ */
+typedef struct PSPCOREREVMAPENTRY
+{
+    /** The physical page the virtual page maps, PSP_CORE_REVMAP_NIL if not mapped. */
+    PSPPADDR                    PspPAddrPg;
+    /** Index of the next virtual page mapping a physical page with the same hash, PSP_CORE_REVMAP_NIL if last. */
+    uint32_t                    idxNext;
+    /** Flag whether the virtual page is mapped through a section. */
+    bool                        fSection;
+} PSPCOREREVMAPENTRY;
+/** Pointer to a reverse map entry. */
+typedef PSPCOREREVMAPENTRY *PPSPCOREREVMAPENTRY;
+/** Pointer to a const reverse map entry. */
+typedef const PSPCOREREVMAPENTRY *PCPSPCOREREVMAPENTRY;
+
+
 /**
  * A single PSP core executing.
  */
@@ -264,23 +431,121 @@ typedef struct PSPCOREINT
     PSPADDR                 PspAddrExecNext;
     /** Flag whether the exeuction should stop. */
     bool                    fExecStop;
+    /** Flag whether PSPEmuCoreExecRun() is currently active. */
+    bool                    fExecRunning;
     /** The current CPU mode. */
     PSPCOREMODE             enmCoreMode;
     /** Currently pending exception. */
     PSPCOREEXCP             enmExcpPending;
     /** The CPSR change hook. */
     uc_hook                 hUcHookCpsrChange;
+    /** The basic block hook counting retired instructions for the virtual clock. */
+    uc_hook                 hUcHookInsnCount;
+    /** Number of instructions retired so far. */
+    uint64_t                cInsnsRetired;
+    /** Instructions per second the virtual clock runs at. */
+    uint64_t                cVirtClockIps;
+    /** Number of retired instructions when the virtual clock was last rebased. */
+    uint64_t                cVirtClockInsnsBase;
+    /** Virtual time in nanoseconds when the virtual clock was last rebased (includes any fast forwarding). */
+    uint64_t                tsVirtClockBaseNs;
+    /** The next virtual clock deadline in nanoseconds, UINT64_MAX if none is set. */
+    uint64_t                tsDeadlineNs;
+    /** The retired instruction count at which the deadline is reached, UINT64_MAX if none is set. */
+    uint64_t                cInsnsDeadline;
+    /** The deadline reached callback if set. */
+    PFNPSPCOREDEADLINE      pfnDeadline;
+    /** Opaque user data to pass to the deadline reached callback. */
+    void                    *pvDeadlineUser;
+    /** Number of times the virtual clock was fast forwarded while idling in WFI. */
+    uint64_t                cWfiFastForwards;
+    /** Number of nanoseconds skipped while idling in WFI. */
+    uint64_t                cNsWfiFastForwarded;
+    /** Start address of the last basic block executed. */
+    PSPADDR                 PspAddrBbLast;
+    /** The polling loop deadline query callback, polling loop detection is disabled if NULL. */
+    PFNPSPCOREPOLLDEADLINE  pfnPollDeadline;
+    /** Opaque user data to pass to the polling loop deadline query callback. */
+    void                    *pvPollDeadlineUser;
+    /** Start of the basic block which issued the last MMIO read. */
+    PSPADDR                 PspAddrPollBb;
+    /** Physical address of the last MMIO read. */
+    PSPADDR                 PspAddrPollMmio;
+    /** Size of the last MMIO read. */
+    size_t                  cbPoll;
+    /** Value returned by the last MMIO read. */
+    uint64_t                uPollVal;
+    /** Retired instruction count at the last MMIO read. */
+    uint64_t                cPollInsnsLast;
+    /** Number of instructions retired between the last two MMIO reads. */
+    uint64_t                cPollInsnsIter;
+    /** Number of identical polling loop iterations seen so far. */
+    uint32_t                cPollIters;
+    /** Number of times the virtual clock was fast forwarded in a polling loop. */
+    uint64_t                cPollFastForwards;
+    /** Number of nanoseconds skipped in polling loops. */
+    uint64_t                cNsPollFastForwarded;
+    /** The page access notification callback, MMU mappings are created with page granularity when set. */
+    PFNPSPCOREMEMACCESS     pfnMemAccess;
+    /** Opaque user data to pass to the page access notification callback. */
+    void                    *pvMemAccessUser;
+    /** The interrupt line record callback, NULL if not recording. */
+    PFNPSPCOREIRQRECORD     pfnIrqRecord;
+    /** Opaque user data to pass to the interrupt line record callback. */
+    void                    *pvIrqRecordUser;
+    /** The interrupt line replay callback, interrupt line changes from the outside are ignored while set. */
+    PFNPSPCOREIRQREPLAY     pfnIrqReplay;
+    /** Opaque user data to pass to the interrupt line replay callback. */
+    void                    *pvIrqReplayUser;
+    /** Retired instruction count at which the next replayed interrupt line change is due. */
+    uint64_t                cInsnsIrqReplayNext;
+    /** The kick callback. */
+    PFNPSPCOREKICK          pfnKick;
+    /** Opaque user data for the kick callback. */
+    void                    *pvKickUser;
+    /** Flag whether a kick is pending, set from any thread. */
+    bool                    fKickPending;
+    /** Disassembler used for the state dumps, created on first use. */
+    PSPDISASM               hDisasm;
+    /** Number of uc_emu_start() round trips. */
+    uint64_t                cEmuStarts;
+    /** Number of MMU translation faults (accesses to not yet mapped virtual addresses). */
+    uint64_t                cMmuFaults;
+    /** Number of MMU mappings created. */
+    uint64_t                cMmuMappingsCreated;
+    /** Number of exceptions injected. */
+    uint64_t                cExcpsInjected;
+    /** Number of SVC instructions executed. */
+    uint64_t                cSvcs;
+    /** Number of SMC instructions executed. */
+    uint64_t                cSmcs;
+    /** Number of MMIO reads. */
+    uint64_t                cMmioReads;
+    /** Number of MMIO writes. */
+    uint64_t                cMmioWrites;
     /** The current CPSR value. */
     uint32_t                u32RegCpsr;
+    /** The PSP_CORE_EXIT_F_XXX reasons recorded by hooks since the last uc_emu_start(). */
+    uint32_t                fExitReasons;
+    /** Flag whether uc_emu_start() is currently active, the register cache is bypassed then. */
+    bool                    fUcEmuActive;
+    /** Flag whether the register cache is valid. */
+    bool                    fRegCacheValid;
+    /** Bitmap of registers (indexed by PSPCOREREG) modified in the cache and not yet written back. */
+    uint32_t                bmRegCacheDirty;
+    /** The register cache, indexed by PSPCOREREG. */
+    uint32_t                au32RegCache[PSPCOREREG_LAST + 1];
 
     /** Head of registered trace points. */
     PPSPCORETPINT           pTpHead;
+    /** The trace point indices, see PSP_CORE_TP_IDX_XXX. */
+    PSPCORETPIDX            aTpIdx[PSP_CORE_TP_IDX_COUNT];
+    /** Generation counter incremented on every trace point (de)registration. */
+    uint32_t                uTpGen;
     /** Head of memory regions. */
     PPSPCOREMEMREGION       pMemRegionsHead;
-    /** Lowest memory address assigned to a region (for faster lookup). */
-    PSPADDR                 PspAddrMemLowest;
-    /** Highest memory address assigned to a region (inclusive). */
-    PSPADDR                 PspAddrMemHighest;
+    /** Page granular memory region lookup table, second level tables are allocated on demand. */
+    PPSPCOREMEMLOOKUPL2     apMemLookupL2[PSP_CORE_MEM_LOOKUP_L1_ENTRIES];
 
     /** The WFI reached callback if set. */
     PFNPSPCOREWFI           pfnWfiReached;
@@ -323,6 +588,38 @@ typedef struct PSPCOREINT
     PPSPCOREMMUMAP          pMmuMappingsHead;
     /** Head of page trable tracking structures to monitor writes to L1 and L2. */
     PPSPCOREPGTBLTRACK      pMmuPgTblTrackingHead;
+    /** Flag whether page tables are tracked by write protecting their pages instead of unicorn write hooks. */
+    bool                    fMmuPgTblWrProt;
+    /** Flag whether the page table tracking doesn't match the L1 table anymore and has to be set up again. */
+    bool                    fMmuPgTblTrackingStale;
+    /** Flag whether the page table tracking is being set up, the page tables can't change meanwhile. */
+    bool                    fMmuPgTblTrackingSetup;
+    /** Number of write protection faults taken on pages containing tracked page tables. */
+    uint64_t                cMmuPgTblWrProtFaults;
+    /** Reverse (physical to virtual) map indexed by virtual page, allocated on first use. */
+    PPSPCOREREVMAPENTRY     paRevMap;
+    /** Hash of physical pages to the first virtual page mapping it in paRevMap. */
+    uint32_t                aidxRevMapHash[PSP_CORE_REVMAP_HASH_ENTRIES];
+    /** Flag whether the reverse map reflects the current page tables, it gets rebuilt on the next lookup if not. */
+    bool                    fRevMapValid;
+    /** The software TLB for the host side virtual memory accessors. */
+    PSPCORETLBENTRY         aTlb[PSP_CORE_TLB_ENTRIES];
+    /** Number of software TLB hits. */
+    uint64_t                cTlbHits;
+    /** Number of software TLB misses. */
+    uint64_t                cTlbMisses;
+    /** Number of writes to tracked page tables. */
+    uint64_t                cMmuPgTblWrites;
+    /** Number of page table writes which didn't change any descriptor. */
+    uint64_t                cMmuPgTblWritesUnchanged;
+    /** Number of times all MMU mappings were flushed. */
+    uint64_t                cMmuFlushes;
+    /** Number of full flushes avoided by invalidating only the affected range on a page table write. */
+    uint64_t                cMmuFlushesAvoided;
+    /** Number of MMU mappings invalidated due to page table writes. */
+    uint64_t                cMmuMappingsInvalidated;
+    /** Number of MMU mappings merged with an adjacent one. */
+    uint64_t                cMmuMappingsMerged;
 
     /** @name Co-Processor 15 related registers.
      * @{ */
@@ -421,9 +718,107 @@ static const PSPCOREREG g_aenmRegQueryBatch[] =
 };
 
 
+/**
+ * The architectural registers of the current mode saved in a snapshot, the CPSR must come after the PC
+ * because writing the PC changes the Thumb state.
+ */
+static const int g_aUcRegsState[] =
+{
+    UC_ARM_REG_R0,
+    UC_ARM_REG_R1,
+    UC_ARM_REG_R2,
+    UC_ARM_REG_R3,
+    UC_ARM_REG_R4,
+    UC_ARM_REG_R5,
+    UC_ARM_REG_R6,
+    UC_ARM_REG_R7,
+    UC_ARM_REG_R8,
+    UC_ARM_REG_R9,
+    UC_ARM_REG_R10,
+    UC_ARM_REG_R11,
+    UC_ARM_REG_R12,
+    UC_ARM_REG_SP,
+    UC_ARM_REG_LR,
+    UC_ARM_REG_PC,
+    UC_ARM_REG_CPSR,
+    UC_ARM_REG_D0,
+    UC_ARM_REG_D1,
+    UC_ARM_REG_D2,
+    UC_ARM_REG_D3,
+    UC_ARM_REG_D4,
+    UC_ARM_REG_D5,
+    UC_ARM_REG_D6,
+    UC_ARM_REG_D7,
+    UC_ARM_REG_D8,
+    UC_ARM_REG_D9,
+    UC_ARM_REG_D10,
+    UC_ARM_REG_D11,
+    UC_ARM_REG_D12,
+    UC_ARM_REG_D13,
+    UC_ARM_REG_D14,
+    UC_ARM_REG_D15,
+    UC_ARM_REG_D16,
+    UC_ARM_REG_D17,
+    UC_ARM_REG_D18,
+    UC_ARM_REG_D19,
+    UC_ARM_REG_D20,
+    UC_ARM_REG_D21,
+    UC_ARM_REG_D22,
+    UC_ARM_REG_D23,
+    UC_ARM_REG_D24,
+    UC_ARM_REG_D25,
+    UC_ARM_REG_D26,
+    UC_ARM_REG_D27,
+    UC_ARM_REG_D28,
+    UC_ARM_REG_D29,
+    UC_ARM_REG_D30,
+    UC_ARM_REG_D31,
+    UC_ARM_REG_FPEXC,
+    UC_ARM_REG_FPSCR
+};
+
+/** Index of the CPSR in g_aUcRegsState. */
+#define PSP_CORE_STATE_REG_IDX_CPSR     16
+
+
+/**
+ * The registers banked per mode saved in a snapshot, R8 to R12 are only banked for FIQ but saved
+ * for every mode to keep things simple.
+ */
+static const int g_aUcRegsBanked[] =
+{
+    UC_ARM_REG_R8,
+    UC_ARM_REG_R9,
+    UC_ARM_REG_R10,
+    UC_ARM_REG_R11,
+    UC_ARM_REG_R12,
+    UC_ARM_REG_SP,
+    UC_ARM_REG_LR,
+    UC_ARM_REG_SPSR
+};
+
+
+/**
+ * The modes having their own register bank, SYS shares the bank with USR.
+ */
+static const PSPCOREMODE g_aenmModesBanked[] =
+{
+    PSPCOREMODE_USR,
+    PSPCOREMODE_FIQ,
+    PSPCOREMODE_IRQ,
+    PSPCOREMODE_SVC,
+    PSPCOREMODE_MON,
+    PSPCOREMODE_ABRT,
+    PSPCOREMODE_UNDEF
+};
+
+
 static int pspEmuCoreMmuPAddrQueryFromVAddr(PPSPCOREINT pThis, PSPVADDR PspVAddr, PSPPADDR *pPspPAddr, size_t *pcbRegion,
                                             PPSPCOREPGTBLWALKSTS penmPgTblWalk);
 static int pspEmuCoreMmuMappingsClear(PPSPCOREINT pThis);
+static void pspEmuCoreMmuTlbFlush(PPSPCOREINT pThis);
+static void pspEmuCoreDeadlineInsnsRecalc(PPSPCOREINT pThis);
+static void pspEmuCoreDeadlineProcess(PPSPCOREINT pThis);
 
 
 /**
@@ -454,6 +849,105 @@ static int pspEmuCoreErrConvertFromUcErr(uc_err rcUc)
 }
 
 
+/**
+ * Fills the register cache with a single batched read if it isn't valid already.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ */
+static int pspEmuCoreRegCacheFill(PPSPCOREINT pThis)
+{
+    if (pThis->fRegCacheValid)
+        return STS_INF_SUCCESS;
+
+    int aUcRegs[ELEMENTS(g_aenmRegQueryBatch)];
+    uint64_t au64Vals[ELEMENTS(g_aenmRegQueryBatch)];
+    void *apvVals[ELEMENTS(g_aenmRegQueryBatch)];
+
+    for (uint32_t i = 0; i < ELEMENTS(g_aenmRegQueryBatch); i++)
+    {
+        au64Vals[i] = 0;
+        aUcRegs[i]  = pspEmuCoreReg2Uc(g_aenmRegQueryBatch[i]);
+        apvVals[i]  = &au64Vals[i];
+    }
+
+    uc_err rcUc = uc_reg_read_batch(pThis->pUcEngine, &aUcRegs[0], &apvVals[0], ELEMENTS(g_aenmRegQueryBatch));
+    if (rcUc == UC_ERR_OK)
+    {
+        for (uint32_t i = 0; i < ELEMENTS(g_aenmRegQueryBatch); i++)
+            pThis->au32RegCache[g_aenmRegQueryBatch[i]] = (uint32_t)au64Vals[i];
+        pThis->fRegCacheValid  = true;
+        pThis->bmRegCacheDirty = 0;
+    }
+
+    return pspEmuCoreErrConvertFromUcErr(rcUc);
+}
+
+
+/**
+ * Writes all dirty registers in the cache back with a single batched write.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ */
+static int pspEmuCoreRegCacheFlush(PPSPCOREINT pThis)
+{
+    if (!pThis->bmRegCacheDirty)
+        return STS_INF_SUCCESS;
+
+    int aUcRegs[PSPCOREREG_LAST + 1];
+    uint64_t au64Vals[PSPCOREREG_LAST + 1];
+    void *apvVals[PSPCOREREG_LAST + 1];
+    uint32_t cRegs = 0;
+
+    for (uint32_t i = PSPCOREREG_R0; i <= PSPCOREREG_LAST; i++)
+    {
+        if (pThis->bmRegCacheDirty & BIT(i))
+        {
+            au64Vals[cRegs] = pThis->au32RegCache[i];
+            aUcRegs[cRegs]  = pspEmuCoreReg2Uc((PSPCOREREG)i);
+            apvVals[cRegs]  = &au64Vals[cRegs];
+            cRegs++;
+        }
+    }
+
+    uc_err rcUc = uc_reg_write_batch(pThis->pUcEngine, &aUcRegs[0], &apvVals[0], cRegs);
+    if (rcUc == UC_ERR_OK)
+        pThis->bmRegCacheDirty = 0;
+
+    return pspEmuCoreErrConvertFromUcErr(rcUc);
+}
+
+
+/**
+ * Writes back any dirty registers and invalidates the register cache, required before
+ * unicorn modifies the register state.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ */
+static int pspEmuCoreRegCacheInvalidate(PPSPCOREINT pThis)
+{
+    int rc = pspEmuCoreRegCacheFlush(pThis);
+    pThis->fRegCacheValid = false;
+    return rc;
+}
+
+
+/**
+ * Drops the register cache content including any dirty registers, used when the whole
+ * register state gets replaced.
+ *
+ * @returns nothing.
+ * @param   pThis                   The PSP core instance.
+ */
+static void pspEmuCoreRegCacheDiscard(PPSPCOREINT pThis)
+{
+    pThis->fRegCacheValid  = false;
+    pThis->bmRegCacheDirty = 0;
+}
+
+
 /**
  * Returns the name of the given core mode.
  *
@@ -576,6 +1070,68 @@ static inline uint32_t pspEmuCoreModeToCpsr(PSPCOREMODE enmCoreMode)
 }
 
 
+/**
+ * Reads or writes the given registers of the current mode with a single batch.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ * @param   paUcRegs                The unicorn registers to transfer.
+ * @param   pau64Vals               The register values, 32-bit registers occupy the low half.
+ * @param   cRegs                   Number of registers to transfer.
+ * @param   fWrite                  Flag whether to write the registers instead of reading them.
+ */
+static int pspEmuCoreRegsXfer(PPSPCOREINT pThis, const int *paUcRegs, uint64_t *pau64Vals, uint32_t cRegs, bool fWrite)
+{
+    void *apvVals[PSP_CORE_REGS_XFER_MAX];
+
+    if (cRegs > ELEMENTS(apvVals))
+        return STS_ERR_BUFFER_OVERFLOW;
+
+    for (uint32_t i = 0; i < cRegs; i++)
+        apvVals[i] = &pau64Vals[i];
+
+    uc_err rcUc =   fWrite
+                  ? uc_reg_write_batch(pThis->pUcEngine, (int *)paUcRegs, &apvVals[0], cRegs)
+                  : uc_reg_read_batch(pThis->pUcEngine, (int *)paUcRegs, &apvVals[0], cRegs);
+    return pspEmuCoreErrConvertFromUcErr(rcUc);
+}
+
+
+/**
+ * Reads or writes the banked registers of all modes, unicorn only exposes the registers of the current mode
+ * so the core gets switched through all modes and back to the given CPSR afterwards.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ * @param   uCpsr                   The CPSR to switch to when done.
+ * @param   paau64Vals              The register values, indexed by g_aenmModesBanked and g_aUcRegsBanked.
+ * @param   fWrite                  Flag whether to write the registers instead of reading them.
+ */
+static int pspEmuCoreRegsBankedXfer(PPSPCOREINT pThis, uint32_t uCpsr,
+                                    uint64_t paau64Vals[][ELEMENTS(g_aUcRegsBanked)], bool fWrite)
+{
+    int rc = STS_INF_SUCCESS;
+
+    for (uint32_t i = 0; i < ELEMENTS(g_aenmModesBanked) && STS_SUCCESS(rc); i++)
+    {
+        /* Interrupts are masked while switching, nothing gets executed in between anyway. */
+        uint32_t uCpsrMode = (uCpsr & ~0x1f) | pspEmuCoreModeToCpsr(g_aenmModesBanked[i]) | BIT(7) | BIT(6);
+        uc_err rcUc = uc_reg_write(pThis->pUcEngine, UC_ARM_REG_CPSR, &uCpsrMode);
+        rc = pspEmuCoreErrConvertFromUcErr(rcUc);
+        if (STS_SUCCESS(rc))
+            rc = pspEmuCoreRegsXfer(pThis, &g_aUcRegsBanked[0], &paau64Vals[i][0], ELEMENTS(g_aUcRegsBanked), fWrite);
+    }
+
+    if (STS_SUCCESS(rc))
+    {
+        uc_err rcUc = uc_reg_write(pThis->pUcEngine, UC_ARM_REG_CPSR, &uCpsr);
+        rc = pspEmuCoreErrConvertFromUcErr(rcUc);
+    }
+
+    return rc;
+}
+
+
 /**
  * Returns flag whether the core is currently operating in the secure world.
  *
@@ -624,525 +1180,1264 @@ static inline bool pspEmuCoreCpIsSctrlMmuEnabled(PPSPCOREINT pThis)
 }
 
 
+
 /**
- * Checks whether an interrupt is pending and injects it.
+ * Stops the emulation from within a hook, recording the reason for PSPEmuCoreExecRun().
  *
  * @returns nothing.
  * @param   pThis               The PSP emulation core instance.
- * @param   PspAddrPc           The PC causing the check.
- * @param   fWait               Flag whether to wait for an interrupt (for wfi).
+ * @param   fReason             The PSP_CORE_EXIT_F_XXX reason for stopping.
  */
-static void pspEmuCoreIrqCheckAndInject(PPSPCOREINT pThis, PSPVADDR PspAddrPc, bool fWait)
+static inline void pspEmuCoreExecExit(PPSPCOREINT pThis, uint32_t fReason)
 {
-    bool fIrq = pThis->fIrq;
-    bool fFirq = pThis->fFiq;
-
-    if (pThis->pfnWfiReached)
-        pThis->pfnWfiReached(pThis, PspAddrPc, fWait ? 0 : PSPEMU_CORE_WFI_CHECK, &fIrq, &fFirq, pThis->pvWfiUser);
+    /* PSPEmuCoreExecStop() might record a reason from another thread at the same time. */
+    __atomic_fetch_or(&pThis->fExitReasons, fReason, __ATOMIC_SEQ_CST);
+    uc_emu_stop(pThis->pUcEngine);
+}
 
-    if (pThis->fIrq || pThis->fFiq)
-    {
-        if (pThis->enmExcpPending != PSPCOREEXCP_NONE)
-            printf("OVERWRITING another exception which should not happen!\n");
-        if (fFirq && !(pThis->u32RegCpsr & BIT(6)))
-            pThis->enmExcpPending = PSPCOREEXCP_FIQ;
-        else if (fIrq && !(pThis->u32RegCpsr & BIT(7)))
-            pThis->enmExcpPending = PSPCOREEXCP_IRQ;
+/**
+ * Checks whether an asserted interrupt line can be delivered and marks the exception as pending.
+ *
+ * @returns nothing.
+ * @param   pThis               The PSP emulation core instance.
+ * @param   fStop               Flag whether to stop the emulation to deliver the interrupt,
+ *                              false if the emulation isn't running anyway.
+ *
+ * @note This is only called when the state of an interrupt line or the interrupt mask bits in CPSR change
+ *       and not on every MMIO access.
+ */
+static void pspEmuCoreIrqCheckAndInject(PPSPCOREINT pThis, bool fStop)
+{
+    /* Already pending exceptions get handled first, the interrupt lines are re-evaluated when CPSR changes afterwards. */
+    if (pThis->enmExcpPending != PSPCOREEXCP_NONE)
+        return;
+
+    if (pThis->fFiq && !(pThis->u32RegCpsr & BIT(6)))
+        pThis->enmExcpPending = PSPCOREEXCP_FIQ;
+    else if (pThis->fIrq && !(pThis->u32RegCpsr & BIT(7)))
+        pThis->enmExcpPending = PSPCOREEXCP_IRQ;
+    else
+        return;
 
-        if (pThis->enmExcpPending == PSPCOREEXCP_FIQ || pThis->enmExcpPending == PSPCOREEXCP_IRQ)
-        {
-            PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_INFO, PSPTRACEEVTORIGIN_CORE, "Injecting IRQ!\n");
-            if (!fWait)
-                uc_emu_stop(pThis->pUcEngine);
-        }
-    }
+    PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_INFO, PSPTRACEEVTORIGIN_CORE, "Injecting IRQ!\n");
+    if (fStop)
+        pspEmuCoreExecExit(pThis, PSP_CORE_EXIT_F_EXCP_PENDING);
 }
 
 
 /**
- * The trace hook wrapper called by unicorn.
+ * Changes the state of the interrupt lines, recording the change if enabled.
  *
  * @returns nothing.
- * @param   pUcEngine               The unicorn engine pointer.
- * @param   uAddr                   The address of the instruction triggering the hook.
- * @param   cbInsn                  Size of the instruction.
- * @param   pvUser                  Opaque user data.
+ * @param   pThis               The PSP emulation core instance.
+ * @param   fIrq                The new IRQ line state.
+ * @param   fFiq                The new FIQ line state.
  */
-static void pspEmuCoreUcHookWrapper(uc_engine *pUcEngine, uint64_t uAddr, uint32_t cbInsn, void *pvUser)
+static void pspEmuCoreIrqLinesSet(PPSPCOREINT pThis, bool fIrq, bool fFiq)
 {
-    PPSPCORETPINT pTp = (PPSPCORETPINT)pvUser;
-    PPSPCOREINT pThis = pTp->pPspCore;
-    PPSPCORECPBANK pCpBank = pspEmuCoreCpGetBank(pThis);
-
-    if (   pTp->idAsid == ARMASID_ANY
-        || pTp->idAsid == pCpBank->u32RegContextId)
-        pTp->pfnTrace(pThis, pTp, PSPEMU_CORE_TRACE_F_EXEC, (PSPADDR)uAddr, cbInsn, NULL /*pvVal*/, pTp->pvUser);
+    if (   pThis->fIrq == fIrq
+        && pThis->fFiq == fFiq)
+        return;
+
+    bool fAsserted = (fIrq && !pThis->fIrq) || (fFiq && !pThis->fFiq);
+
+    pThis->fIrq = fIrq;
+    pThis->fFiq = fFiq;
+    if (pThis->pfnIrqRecord)
+        pThis->pfnIrqRecord(pThis, pThis->cInsnsRetired, PSPEmuCoreQueryVirtTimeNs(pThis), pThis->PspAddrBbLast,
+                            fIrq, fFiq, pThis->pvIrqRecordUser);
+    if (fAsserted)
+        pspEmuCoreIrqCheckAndInject(pThis, pThis->fExecRunning /*fStop*/);
 }
 
 
 /**
- * The memory trace hook wrapper called by unicorn.
+ * Calls the kick callback if the core was kicked since the last time.
  *
  * @returns nothing.
- * @param   pUcEngine               The unicorn engine pointer.
- * @param   uMemType                Memory type.
- * @param   uAddr                   The address of the instruction triggering the hook.
- * @param   cb                      Size of the memory access.
- * @param   i64Val                  Value written during a write, ignored for a read.
- * @param   pvUser                  Opaque user data.
+ * @param   pThis               The PSP emulation core instance.
  */
-static void pspEmuCoreUcHookMemWrapper(uc_engine *pUcEngine, uc_mem_type uMemType, uint64_t uAddr, int32_t cb, int64_t i64Val, void *pvUser)
+static inline void pspEmuCoreKickProcess(PPSPCOREINT pThis)
 {
-    PPSPCORETPINT pTp = (PPSPCORETPINT)pvUser;
-    PPSPCOREINT pThis = pTp->pPspCore;
-    PPSPCORECPBANK pCpBank = pspEmuCoreCpGetBank(pThis);
-    uint32_t fTpFlags = 0;
+    if (   __atomic_exchange_n(&pThis->fKickPending, false, __ATOMIC_SEQ_CST)
+        && pThis->pfnKick)
+        pThis->pfnKick(pThis, pThis->pvKickUser);
+}
 
-    switch (uMemType)
+
+/**
+ * Fast forwards the virtual clock to the given time without executing instructions, expiring
+ * all deadlines on the way in order.
+ *
+ * @returns nothing.
+ * @param   pThis               The PSP emulation core instance.
+ * @param   tsTargetNs          The virtual time in nanoseconds to fast forward to.
+ */
+static void pspEmuCoreVirtClockFastForward(PPSPCOREINT pThis, uint64_t tsTargetNs)
+{
+    for (;;)
     {
-        case UC_MEM_READ:
-        case UC_MEM_READ_PROT:
-            fTpFlags |= PSPEMU_CORE_TRACE_F_READ;
-            break;
-        case UC_MEM_WRITE:
-        case UC_MEM_WRITE_PROT:
-            fTpFlags |= PSPEMU_CORE_TRACE_F_WRITE;
-            break;
-        default:
-            /** @todo Assert */
+        uint64_t tsNowNs = PSPEmuCoreQueryVirtTimeNs(pThis);
+        if (tsNowNs >= tsTargetNs)
             break;
-    }
 
-    if (   pTp->idAsid == ARMASID_ANY
-        || pTp->idAsid == pCpBank->u32RegContextId)
-    {
-        PSPDATUM Datum;
+        bool fDeadline =    pThis->pfnDeadline
+                         && pThis->tsDeadlineNs <= tsTargetNs;
+        uint64_t tsSkipToNs = tsTargetNs;
+        if (fDeadline)
+            tsSkipToNs = pThis->tsDeadlineNs > tsNowNs ? pThis->tsDeadlineNs : tsNowNs;
 
-        switch (cb)
+        if (tsSkipToNs > tsNowNs)
         {
-            case 1:
-                Datum.u8 = (uint8_t)i64Val;
-                break;
-            case 2:
-                Datum.u16 = (uint16_t)i64Val;
-                break;
-            case 4:
-                Datum.u32 = (uint32_t)i64Val;
-                break;
-            case 8:
-                Datum.u64 = (uint64_t)i64Val;
-                break;
-            default:
-                /** @todo Assert */
-                break;
+            /* This replays an idle period in WFI, so account for it the same way. */
+            uint64_t cNsSkip = tsSkipToNs - tsNowNs;
+
+            pThis->tsVirtClockBaseNs += cNsSkip;
+            pspEmuCoreDeadlineInsnsRecalc(pThis);
+            pThis->cWfiFastForwards++;
+            pThis->cNsWfiFastForwarded += cNsSkip;
         }
 
-        pTp->pfnTrace(pThis, pTp, fTpFlags, (PSPADDR)uAddr, cb, &Datum.ab[0], pTp->pvUser);
+        if (!fDeadline)
+            break;
+
+        pspEmuCoreDeadlineProcess(pThis);
     }
 }
 
 
 /**
- * Unicorn MMIO read wrapper.
+ * Applies all replayed interrupt line changes which are due.
  *
- * @returns Data read.
- * @param   pUcEngine               The unicorn engine pointer.
- * @param   pvUser                  Opaque user data.
- * @param   uAddr                   MMIO address read.
- * @param   cbInsn                  Size of the read (1, 2, 4 or 8 bytes).
+ * @returns nothing.
+ * @param   pThis               The PSP emulation core instance.
  */
-static uint64_t pspEmuCoreMmioRead(struct uc_struct* pUcEngine, void *pvUser, uint64_t uAddr, unsigned cb)
+static void pspEmuCoreIrqReplayProcess(PPSPCOREINT pThis)
 {
-    PCPSPCOREMEMREGION pRegion = (PCPSPCOREMEMREGION)pvUser;
-    PSPDATUM ValRead;
-    uint64_t uValRet = 0;
+    if (   !pThis->pfnIrqReplay
+        || pThis->cInsnsRetired < pThis->cInsnsIrqReplayNext)
+        return;
 
-    pRegion->u.Mmio.pfnRead(pRegion->pPspCore, (PSPADDR)uAddr, cb, &ValRead, pRegion->u.Mmio.pvUser);
-    switch (cb)
+    do
     {
-        case 1:
-            uValRet = ValRead.u8;
-            break;
-        case 2:
-            uValRet = ValRead.u16;
-            break;
-        case 4:
-            uValRet = ValRead.u32;
-            break;
-        case 8:
-            uValRet = ValRead.u64;
-            break;
-        default:
-            /** @todo assert() */
-            uc_emu_stop(pUcEngine);
+        bool fIrq = pThis->fIrq;
+        bool fFiq = pThis->fFiq;
+        uint64_t tsVirtNs = PSPEmuCoreQueryVirtTimeNs(pThis);
+
+        pThis->cInsnsIrqReplayNext = pThis->pfnIrqReplay(pThis, pThis->cInsnsRetired, pThis->PspAddrBbLast,
+                                                         &tsVirtNs, &fIrq, &fFiq, pThis->pvIrqReplayUser);
+
+        /* Changes recorded while idling in WFI happened after the clock got fast forwarded. */
+        pspEmuCoreVirtClockFastForward(pThis, tsVirtNs);
+        pspEmuCoreIrqLinesSet(pThis, fIrq, fFiq);
+    } while (pThis->cInsnsRetired >= pThis->cInsnsIrqReplayNext);
+
+    pspEmuCoreDeadlineInsnsRecalc(pThis);
+}
+
+
+/**
+ * Returns the exact address hash bucket index for the given address.
+ *
+ * @returns Bucket index.
+ * @param   PspAddr                 The address to hash.
+ */
+static inline uint32_t pspEmuCoreTpHashIdx(PSPADDR PspAddr)
+{
+    /* Instructions are at least halfword aligned. */
+    return (PspAddr >> 1) & (PSP_CORE_TP_HASH_ENTRIES - 1);
+}
+
+
+/**
+ * Returns whether the given trace point triggers on the given address and access.
+ *
+ * @returns Flag whether the trace point matches.
+ * @param   pTp                     The trace point to check.
+ * @param   fTpFlags                The PSPEMU_CORE_TRACE_F_XXX access flags.
+ * @param   PspAddr                 The address accessed.
+ * @param   idAsid                  The current ASID.
+ */
+static inline bool pspEmuCoreTpMatches(PCPSPCORETPINT pTp, uint32_t fTpFlags, PSPADDR PspAddr, ARMASID idAsid)
+{
+    return    pTp->PspAddrStart <= PspAddr
+           && pTp->PspAddrEnd >= PspAddr
+           && (pTp->fFlags & fTpFlags)
+           && (   pTp->idAsid == ARMASID_ANY
+               || pTp->idAsid == idAsid);
+}
+
+
+/**
+ * Collects the trace points in the given index matching the given address and access.
+ *
+ * @returns Number of matching trace points, can be bigger than the number of entries stored.
+ * @param   pIdx                    The trace point index to search.
+ * @param   fTpFlags                The PSPEMU_CORE_TRACE_F_XXX access flags.
+ * @param   PspAddr                 The address accessed.
+ * @param   idAsid                  The current ASID.
+ * @param   cSkip                   Number of matching trace points to skip.
+ * @param   papTps                  Where to store the matching trace points.
+ * @param   cTpsMax                 Maximum number of trace points to store.
+ */
+static uint32_t pspEmuCoreTpIdxCollect(PPSPCORETPIDX pIdx, uint32_t fTpFlags, PSPADDR PspAddr, ARMASID idAsid,
+                                       uint32_t cSkip, PPSPCORETPINT *papTps, uint32_t cTpsMax)
+{
+    uint32_t cMatches = 0;
+
+    PPSPCORETPINT pTp = pIdx->apTpHash[pspEmuCoreTpHashIdx(PspAddr)];
+    while (pTp)
+    {
+        if (pspEmuCoreTpMatches(pTp, fTpFlags, PspAddr, idAsid))
+        {
+            if (cMatches >= cSkip && cMatches - cSkip < cTpsMax)
+                papTps[cMatches - cSkip] = pTp;
+            cMatches++;
+        }
+
+        pTp = pTp->pHashNext;
     }
 
-    pspEmuCoreIrqCheckAndInject(pRegion->pPspCore, (PSPVADDR)uAddr, false /*fWait*/);
-    return uValRet;
+    if (!pIdx->cTpRanges)
+        return cMatches;
+
+    /* Find the last range starting at or below the address and walk down while ranges can still cover it. */
+    uint32_t idxLow = 0;
+    uint32_t idxHigh = pIdx->cTpRanges;
+    while (idxLow < idxHigh)
+    {
+        uint32_t idxMid = idxLow + (idxHigh - idxLow) / 2;
+        if (pIdx->papTpRanges[idxMid]->PspAddrStart <= PspAddr)
+            idxLow = idxMid + 1;
+        else
+            idxHigh = idxMid;
+    }
+
+    for (uint32_t i = idxLow; i > 0 && pIdx->paPspAddrEndMax[i - 1] >= PspAddr; i--)
+    {
+        pTp = pIdx->papTpRanges[i - 1];
+        if (pspEmuCoreTpMatches(pTp, fTpFlags, PspAddr, idAsid))
+        {
+            if (cMatches >= cSkip && cMatches - cSkip < cTpsMax)
+                papTps[cMatches - cSkip] = pTp;
+            cMatches++;
+        }
+    }
+
+    return cMatches;
 }
 
 
 /**
- * Unicorn MMIO write wrapper.
+ * Returns whether the given trace point is still registered with the given core.
+ *
+ * @returns Flag whether the trace point is registered.
+ * @param   pThis                   The PSP core instance.
+ * @param   pTp                     The trace point to look for.
+ */
+static bool pspEmuCoreTpIsRegistered(PPSPCOREINT pThis, PCPSPCORETPINT pTp)
+{
+    PCPSPCORETPINT pCur = pThis->pTpHead;
+    while (   pCur
+           && pCur != pTp)
+        pCur = pCur->pNext;
+
+    return pCur != NULL;
+}
+
+
+/**
+ * Calls all trace points in the given index matching the given address and access.
+ *
+ * @returns nothing.
+ * @param   pThis                   The PSP core instance.
+ * @param   pIdx                    The trace point index to dispatch from.
+ * @param   fTpFlags                The PSPEMU_CORE_TRACE_F_XXX access flags.
+ * @param   PspAddr                 The address triggering the hook.
+ * @param   cb                      Size of the instruction or memory access.
+ * @param   pvVal                   The value for memory accesses, NULL for execution.
+ */
+static void pspEmuCoreTpDispatch(PPSPCOREINT pThis, PPSPCORETPIDX pIdx, uint32_t fTpFlags, PSPADDR PspAddr,
+                                 uint32_t cb, const void *pvVal)
+{
+    PPSPCORETPINT apTps[PSP_CORE_TP_DISPATCH_MAX];
+    ARMASID idAsid = pspEmuCoreCpGetBank(pThis)->u32RegContextId;
+    uint32_t cSkip = 0;
+    uint32_t cMatches = 0;
+    uint32_t cTps = 0;
+
+    /*
+     * The matching trace points are collected before calling any of them because callbacks may register
+     * or deregister trace points (the debugger does). Once that happened the remaining collected trace
+     * points are checked for still being registered before they get called.
+     */
+    do
+    {
+        uint32_t uTpGen = pThis->uTpGen;
+
+        cMatches = pspEmuCoreTpIdxCollect(pIdx, fTpFlags, PspAddr, idAsid, cSkip, &apTps[0], ELEMENTS(apTps));
+        cTps = cMatches > cSkip ? cMatches - cSkip : 0;
+        if (cTps > ELEMENTS(apTps))
+            cTps = ELEMENTS(apTps);
+        for (uint32_t i = 0; i < cTps; i++)
+        {
+            PPSPCORETPINT pTp = apTps[i];
+
+            if (   pThis->uTpGen != uTpGen
+                && (   !pspEmuCoreTpIsRegistered(pThis, pTp)
+                    || !pspEmuCoreTpMatches(pTp, fTpFlags, PspAddr, idAsid)))
+                continue;
+
+            pTp->pfnTrace(pThis, pTp, fTpFlags, PspAddr, cb, pvVal, pTp->pvUser);
+        }
+
+        cSkip += cTps;
+    } while (   cTps
+             && cSkip < cMatches);
+}
+
+
+/**
+ * The instruction trace hook called by unicorn, dispatching to all matching trace points.
  *
  * @returns nothing.
  * @param   pUcEngine               The unicorn engine pointer.
+ * @param   uAddr                   The address of the instruction triggering the hook.
+ * @param   cbInsn                  Size of the instruction.
  * @param   pvUser                  Opaque user data.
- * @param   uAddr                   MMIO address written.
- * @param   uVal                    Value written.
- * @param   cbInsn                  Size of the write (1, 2, 4 or 8 bytes).
  */
-static void pspEmuCoreMmioWrite(struct uc_struct* pUcEngine, void *pvUser, uint64_t uAddr, uint64_t uVal, unsigned cb)
+static void pspEmuCoreUcHookWrapper(uc_engine *pUcEngine, uint64_t uAddr, uint32_t cbInsn, void *pvUser)
 {
-    PCPSPCOREMEMREGION pRegion = (PCPSPCOREMEMREGION)pvUser;
-    PSPDATUM ValWrite;
+    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
+
+    pspEmuCoreTpDispatch(pThis, &pThis->aTpIdx[PSP_CORE_TP_IDX_EXEC], PSPEMU_CORE_TRACE_F_EXEC,
+                         (PSPADDR)uAddr, cbInsn, NULL /*pvVal*/);
+}
+
+
+/**
+ * The basic block trace hook called by unicorn, dispatching to all matching trace points.
+ *
+ * @returns nothing.
+ * @param   pUcEngine               The unicorn engine pointer.
+ * @param   uAddr                   The start address of the basic block.
+ * @param   cbBlock                 Size of the basic block.
+ * @param   pvUser                  Opaque user data.
+ */
+static void pspEmuCoreUcHookBbWrapper(uc_engine *pUcEngine, uint64_t uAddr, uint32_t cbBlock, void *pvUser)
+{
+    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
+
+    pspEmuCoreTpDispatch(pThis, &pThis->aTpIdx[PSP_CORE_TP_IDX_EXEC_BB], PSPEMU_CORE_TRACE_F_EXEC,
+                         (PSPADDR)uAddr, cbBlock, NULL /*pvVal*/);
+}
+
+
+/**
+ * The basic block hook counting the retired instructions for the virtual clock.
+ *
+ * @returns nothing.
+ * @param   pUcEngine               The unicorn engine pointer.
+ * @param   uAddr                   The start address of the basic block.
+ * @param   cbBlock                 Size of the basic block in bytes.
+ * @param   pvUser                  Opaque user data.
+ *
+ * @note The instruction count is derived from the block size and the execution mode, so 32bit Thumb-2
+ *       instructions count twice. This is good enough for a deterministic clock.
+ * @note The execution mode is queried for every block, interworking branches switch it without going through
+ *       the CPSR hook and the count must not depend on where the uc_emu_start() round trips fall.
+ */
+static void pspEmuCoreInsnCountHook(uc_engine *pUcEngine, uint64_t uAddr, uint32_t cbBlock, void *pvUser)
+{
+    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
+    size_t ucCpuMode = 0;
+
+    uc_query(pUcEngine, UC_QUERY_MODE, &ucCpuMode);
+    uint32_t cInsns = cbBlock / ((ucCpuMode & UC_MODE_THUMB) ? sizeof(uint16_t) : sizeof(uint32_t));
+    pThis->cInsnsRetired += cInsns ? cInsns : 1;
+    pThis->PspAddrBbLast  = (PSPADDR)uAddr;
+
+    /* Return to PSPEmuCoreExecRun() to process the deadline. */
+    if (pThis->cInsnsRetired >= pThis->cInsnsDeadline)
+        pspEmuCoreExecExit(pThis, PSP_CORE_EXIT_F_DEADLINE);
+}
+
+
+/**
+ * The memory trace hook wrapper called by unicorn.
+ *
+ * @returns nothing.
+ * @param   pUcEngine               The unicorn engine pointer.
+ * @param   uMemType                Memory type.
+ * @param   uAddr                   The address of the instruction triggering the hook.
+ * @param   cb                      Size of the memory access.
+ * @param   i64Val                  Value written during a write, ignored for a read.
+ * @param   pvUser                  Opaque user data.
+ */
+static void pspEmuCoreUcHookMemWrapper(uc_engine *pUcEngine, uc_mem_type uMemType, uint64_t uAddr, int32_t cb, int64_t i64Val, void *pvUser)
+{
+    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
+    uint32_t fTpFlags = 0;
+    PSPDATUM Datum;
+
+    switch (uMemType)
+    {
+        case UC_MEM_READ:
+        case UC_MEM_READ_PROT:
+            fTpFlags |= PSPEMU_CORE_TRACE_F_READ;
+            break;
+        case UC_MEM_WRITE:
+        case UC_MEM_WRITE_PROT:
+            fTpFlags |= PSPEMU_CORE_TRACE_F_WRITE;
+            break;
+        default:
+            /** @todo Assert */
+            break;
+    }
 
     switch (cb)
     {
         case 1:
-            ValWrite.u8 = (uint8_t)uVal;
+            Datum.u8 = (uint8_t)i64Val;
             break;
         case 2:
-            ValWrite.u16 = (uint16_t)uVal;
+            Datum.u16 = (uint16_t)i64Val;
             break;
         case 4:
-            ValWrite.u32 = (uint32_t)uVal;
+            Datum.u32 = (uint32_t)i64Val;
             break;
         case 8:
-            ValWrite.u64 = uVal;
+            Datum.u64 = (uint64_t)i64Val;
             break;
         default:
-            /** @todo assert() */
-            uc_emu_stop(pUcEngine);
+            /** @todo Assert */
+            break;
     }
 
-    pRegion->u.Mmio.pfnWrite(pRegion->pPspCore, (PSPADDR)uAddr, cb, &ValWrite, pRegion->u.Mmio.pvUser);
-    pspEmuCoreIrqCheckAndInject(pRegion->pPspCore, (PSPVADDR)uAddr, false /*fWait*/);
+    pspEmuCoreTpDispatch(pThis, &pThis->aTpIdx[PSP_CORE_TP_IDX_MEM], fTpFlags, (PSPADDR)uAddr, cb, &Datum.ab[0]);
 }
 
 
 /**
- * The exception wrapper to transition between CPU modes.
+ * Returns the trace point index kind for the given trace point flags.
+ *
+ * @returns Index kind, see PSP_CORE_TP_IDX_XXX.
+ * @param   fFlags                  The PSPEMU_CORE_TRACE_F_XXX flags.
+ */
+static uint32_t pspEmuCoreTpIdxKindGet(uint32_t fFlags)
+{
+    if (fFlags & PSPEMU_CORE_TRACE_F_EXEC)
+        return (fFlags & PSPEMU_CORE_TRACE_F_EXEC_BASIC_BLOCK) ? PSP_CORE_TP_IDX_EXEC_BB : PSP_CORE_TP_IDX_EXEC;
+
+    return PSP_CORE_TP_IDX_MEM;
+}
+
+
+/**
+ * Recalculates the maximum end address prefix array of the range trace points starting at the given index.
  *
  * @returns nothing.
- * @param   pUcEngine           Pointer to the unicorn engine instance.
- * @param   uIntNo              Interrupt/Exception number.
- * @param   pvUser              Opaque user data passed when adding the hook.
+ * @param   pIdx                    The trace point index.
+ * @param   idxStart                The first entry to recalculate.
  */
-static void pspEmuCoreExcpWrapper(uc_engine *pUcEngine, uint32_t uIntNo, void *pvUser)
+static void pspEmuCoreTpIdxEndMaxRecalc(PPSPCORETPIDX pIdx, uint32_t idxStart)
 {
-    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
+    for (uint32_t i = idxStart; i < pIdx->cTpRanges; i++)
+    {
+        PSPADDR PspAddrEnd = pIdx->papTpRanges[i]->PspAddrEnd;
+        if (i > 0 && pIdx->paPspAddrEndMax[i - 1] > PspAddrEnd)
+            PspAddrEnd = pIdx->paPspAddrEndMax[i - 1];
+        pIdx->paPspAddrEndMax[i] = PspAddrEnd;
+    }
+}
 
-    /*
-     * Set appropriate exception and stop emulation, we don't alter the vital CPU state
-     * (PC, CPSR, etc.) here as unicorn seems to be rather fragile in this regard
-     * when done from any hook callback.
-     */
-    if (uIntNo == 2)
-        pThis->enmExcpPending = PSPCOREEXCP_SWI;
-    else if (uIntNo == 13)
-        pThis->enmExcpPending = PSPCOREEXCP_SMC;
 
-    uc_emu_stop(pUcEngine);
+/**
+ * Compares two hook ranges by their start address, qsort() callback.
+ *
+ * @returns Negative value if the first range starts below the second one, 0 if equal, positive value otherwise.
+ * @param   pv1                     The first range.
+ * @param   pv2                     The second range.
+ */
+static int pspEmuCoreTpHookRangeCmp(const void *pv1, const void *pv2)
+{
+    PCPSPCORETPHOOKRANGE pRange1 = (PCPSPCORETPHOOKRANGE)pv1;
+    PCPSPCORETPHOOKRANGE pRange2 = (PCPSPCORETPHOOKRANGE)pv2;
+
+    if (pRange1->PspAddrStart < pRange2->PspAddrStart)
+        return -1;
+    if (pRange1->PspAddrStart > pRange2->PspAddrStart)
+        return 1;
+    return 0;
 }
 
 
 /**
- * The CP write wrapper to keep track of the MMU status.
+ * Collects the address ranges of all trace points in the given index having any of the given flags
+ * and merges them into sorted disjoint ranges.
  *
- * @returns nothing.
- * @param   pUcEngine           Pointer to the unicorn engine instance.
- * @param   uAddrPc             The PC causing the write.
- * @param   uCp                 Co-Processor being accessed.
- * @param   uCrn                cr<n> value.
- * @param   uCrm                cr<m> value.
- * @param   uOpc0               Opcode 0.
- * @param   uOpc1               Opcode 1.
- * @param   uOpc2               Opcode 2.
- * @param   u64Val              The value being written.
- * @param   pvUser              Opaque user data passed when adding the hook.
+ * @returns Number of disjoint ranges.
+ * @param   pIdx                    The trace point index.
+ * @param   fTpFlags                The PSPEMU_CORE_TRACE_F_XXX flags to filter for.
+ * @param   paRanges                Where to store the ranges, must hold at least one entry per trace point.
  */
-static bool pspEmuCoreCpWriteWrapper(struct uc_struct *pUcEngine, uint64_t uAddrPc, uint32_t uCp, uint32_t uCrn, uint32_t uCrm,
-                                     uint32_t uOpc0, uint32_t uOpc1, uint32_t uOpc2, uint64_t u64Val, void *pvUser)
+static uint32_t pspEmuCoreTpIdxRangesMerge(PPSPCORETPIDX pIdx, uint32_t fTpFlags, PPSPCORETPHOOKRANGE paRanges)
 {
-    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
-    PPSPCORECPBANK pCpBank = pspEmuCoreCpGetBank(pThis);
+    uint32_t cRanges = 0;
 
-    /*
-     * Check whether the MMU status changed and cause the emulation to stop so we
-     * can adjust the memory layout.
-     */
-    bool fHandled = true;
-    if (   uCp == 15
-        && uCrn == 1
-        && uCrm == 0
-        && uOpc1 == 0
-        && uOpc2 == 0)
+    for (uint32_t i = 0; i < ELEMENTS(pIdx->apTpHash); i++)
     {
-        if ((pCpBank->u32RegSctrl & BIT(0)) != (u64Val & BIT(0)))
+        for (PCPSPCORETPINT pTp = pIdx->apTpHash[i]; pTp; pTp = pTp->pHashNext)
         {
-            pThis->fMmuChanged = true;
-            uc_emu_stop(pUcEngine);
+            if (pTp->fFlags & fTpFlags)
+            {
+                paRanges[cRanges].PspAddrStart = pTp->PspAddrStart;
+                paRanges[cRanges].PspAddrEnd   = pTp->PspAddrEnd;
+                cRanges++;
+            }
         }
+    }
 
-        /* Store a copy of the SCTRL register. */
-        pCpBank->u32RegSctrl = (uint32_t)u64Val;
-        fHandled = false; /* To sync unicorns own copy. */
+    for (uint32_t i = 0; i < pIdx->cTpRanges; i++)
+    {
+        PCPSPCORETPINT pTp = pIdx->papTpRanges[i];
+        if (pTp->fFlags & fTpFlags)
+        {
+            paRanges[cRanges].PspAddrStart = pTp->PspAddrStart;
+            paRanges[cRanges].PspAddrEnd   = pTp->PspAddrEnd;
+            cRanges++;
+        }
     }
-    else if (   uCp == 15
-             && uCrn == 2
-             && uCrm == 0
-             && uOpc1 == 0
-             && uOpc2 == 0)
-        pCpBank->u32RegTtbr0 = (uint32_t)u64Val;
-    else if (   uCp == 15
-             && uCrn == 2
-             && uCrm == 0
-             && uOpc1 == 0
-             && uOpc2 == 2)
-        pCpBank->u32RegTtbcr = (uint32_t)u64Val;
-    else if (   uCp == 15
-             && uCrn == 12
-             && uCrm == 0
-             && uOpc1 == 0
-             && uOpc2 == 0)
-        pCpBank->u32RegVBar = (uint32_t)u64Val;
-    else if (   uCp == 15
-             && uCrn == 12
-             && uCrm == 0
-             && uOpc1 == 0
-             && uOpc2 == 1)
-        pCpBank->u32RegMVBar = (uint32_t)u64Val;
-    else if (   uCp == 15
-             && uCrn == 7
-             && uCrm == 4
-             && uOpc1 == 0
-             && uOpc2 == 0)
-        pCpBank->u32RegPa = (uint32_t)u64Val;
-    else if (   uCp == 15
-             && uCrn == 7
-             && uCrm == 8
-             && uOpc1 == 0
-             && uOpc2 == 0)
+
+    if (!cRanges)
+        return 0;
+
+    qsort(paRanges, cRanges, sizeof(*paRanges), pspEmuCoreTpHookRangeCmp);
+
+    /* Overlapping ranges must be merged, otherwise the dispatcher gets called more than once for an access. */
+    uint32_t idxLast = 0;
+    for (uint32_t i = 1; i < cRanges; i++)
     {
-        /* V2PCWPR, Privileged Read VA to PA translation */
-        PSPPADDR PspPAddrPg = 0;
-        size_t cbRegion = 0;
-        int rc = pspEmuCoreMmuPAddrQueryFromVAddr(pThis, (PSPVADDR)u64Val, &PspPAddrPg, &cbRegion, NULL /*penmPgTblWalk*/);
-        PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE,
-                                "pspEmuCoreMmuPAddrQueryFromVAddr(): VAddr=%#lx rc=%d PAddr=%#lx\n",
-                                (PSPVADDR)u64Val, rc, PspPAddrPg);
-        if (!rc)
-            pCpBank->u32RegPa = PspPAddrPg;
+        if (paRanges[i].PspAddrStart <= paRanges[idxLast].PspAddrEnd)
+        {
+            if (paRanges[i].PspAddrEnd > paRanges[idxLast].PspAddrEnd)
+                paRanges[idxLast].PspAddrEnd = paRanges[i].PspAddrEnd;
+        }
         else
-            pCpBank->u32RegPa = 0x1;
+            paRanges[++idxLast] = paRanges[i];
     }
-    else if (   uCp == 15
-             && uCrn == 7
-             && uCrm == 8
-             && uOpc1 == 0
-             && uOpc2 == 2)
+
+    return idxLast + 1;
+}
+
+
+/**
+ * Registers one unicorn hook per disjoint address range covered by the trace points of the given index,
+ * replacing the previously registered hooks, so sparse trace points don't hook everything in between.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ * @param   idxKind                 The index kind, see PSP_CORE_TP_IDX_XXX.
+ *
+ * @note The old hooks are kept if registering the new ones fails.
+ */
+static int pspEmuCoreTpIdxHooksRebuild(PPSPCOREINT pThis, uint32_t idxKind)
+{
+    PPSPCORETPIDX pIdx = &pThis->aTpIdx[idxKind];
+    uc_hook_type afUcHookTypes[2];
+    uint32_t afTpFlags[2];
+    uint32_t cHookTypes = 0;
+    void *pfnHook = NULL;
+    int rc = STS_INF_SUCCESS;
+
+    switch (idxKind)
     {
-        /* V2PCWUR, User Read VA to PA translation */
-        PSPPADDR PspPAddrPg = 0;
-        size_t cbRegion = 0;
-        int rc = pspEmuCoreMmuPAddrQueryFromVAddr(pThis, (PSPVADDR)u64Val, &PspPAddrPg, &cbRegion, NULL /*penmPgTblWalk*/);
-        PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE,
-                                "pspEmuCoreMmuPAddrQueryFromVAddr(): VAddr=%#lx rc=%d PAddr=%#lx\n",
-                                (PSPVADDR)u64Val, rc, PspPAddrPg);
-        if (!rc)
-            pCpBank->u32RegPa = PspPAddrPg;
+        case PSP_CORE_TP_IDX_EXEC:
+            afUcHookTypes[cHookTypes] = UC_HOOK_CODE;
+            afTpFlags[cHookTypes++]   = PSPEMU_CORE_TRACE_F_EXEC;
+            pfnHook = (void *)(uintptr_t)pspEmuCoreUcHookWrapper;
+            break;
+        case PSP_CORE_TP_IDX_EXEC_BB:
+            afUcHookTypes[cHookTypes] = UC_HOOK_BLOCK;
+            afTpFlags[cHookTypes++]   = PSPEMU_CORE_TRACE_F_EXEC;
+            pfnHook = (void *)(uintptr_t)pspEmuCoreUcHookBbWrapper;
+            break;
+        case PSP_CORE_TP_IDX_MEM:
+        default:
+            afUcHookTypes[cHookTypes] = UC_HOOK_MEM_READ;
+            afTpFlags[cHookTypes++]   = PSPEMU_CORE_TRACE_F_READ;
+            afUcHookTypes[cHookTypes] = UC_HOOK_MEM_WRITE;
+            afTpFlags[cHookTypes++]   = PSPEMU_CORE_TRACE_F_WRITE;
+            pfnHook = (void *)(uintptr_t)pspEmuCoreUcHookMemWrapper;
+            break;
+    }
+
+    uc_hook *pahUcHooksNew = NULL;
+    uint32_t cUcHooksNew = 0;
+    if (pIdx->cTps)
+    {
+        PPSPCORETPHOOKRANGE paRanges = (PPSPCORETPHOOKRANGE)calloc(pIdx->cTps, sizeof(*paRanges));
+        pahUcHooksNew = (uc_hook *)calloc(pIdx->cTps * cHookTypes, sizeof(*pahUcHooksNew));
+        if (   paRanges
+            && pahUcHooksNew)
+        {
+            for (uint32_t iType = 0; iType < cHookTypes && STS_SUCCESS(rc); iType++)
+            {
+                uint32_t cRanges = pspEmuCoreTpIdxRangesMerge(pIdx, afTpFlags[iType], paRanges);
+                for (uint32_t i = 0; i < cRanges && STS_SUCCESS(rc); i++)
+                {
+                    uc_err rcUc = uc_hook_add(pThis->pUcEngine, &pahUcHooksNew[cUcHooksNew], afUcHookTypes[iType],
+                                              pfnHook, pThis, paRanges[i].PspAddrStart, paRanges[i].PspAddrEnd);
+                    if (rcUc == UC_ERR_OK)
+                        cUcHooksNew++;
+                    else
+                        rc = pspEmuCoreErrConvertFromUcErr(rcUc);
+                }
+            }
+        }
         else
-            pCpBank->u32RegPa = 0x1;
+            rc = STS_ERR_NO_MEMORY;
+
+        if (paRanges)
+            free(paRanges);
     }
-    else if (   uCp == 15
-             && uCrn == 1
-             && uCrm == 1
-             && uOpc1 == 0
-             && uOpc2 == 0)
+
+    /* Get rid of the hooks not in use anymore, either the old ones or the partially registered new ones. */
+    uc_hook *pahUcHooksFree = STS_SUCCESS(rc) ? pIdx->pahUcHooks : pahUcHooksNew;
+    uint32_t cUcHooksFree   = STS_SUCCESS(rc) ? pIdx->cUcHooks : cUcHooksNew;
+    for (uint32_t i = 0; i < cUcHooksFree; i++)
     {
-        /* Check for a world switch and reset the MMU. */
-        if (   (pThis->Cp15.u32RegScr & BIT(0)) != (u64Val & BIT(0))
-            && pThis->enmCoreMode != PSPCOREMODE_MON)
+        uc_err rcUc = uc_hook_del(pThis->pUcEngine, pahUcHooksFree[i]);
+        /** @todo assert(rcUc == UC_ERR_OK) */
+    }
+    if (pahUcHooksFree)
+        free(pahUcHooksFree);
+
+    if (STS_SUCCESS(rc))
+    {
+        pIdx->pahUcHooks = pahUcHooksNew;
+        pIdx->cUcHooks   = cUcHooksNew;
+    }
+
+    return rc;
+}
+
+
+/**
+ * Links the given trace point into the data structures of the given index.
+ *
+ * @returns nothing.
+ * @param   pIdx                    The trace point index.
+ * @param   pTp                     The trace point to link, range trace points require a free slot in the range array.
+ */
+static void pspEmuCoreTpIdxLink(PPSPCORETPIDX pIdx, PPSPCORETPINT pTp)
+{
+    if (pTp->PspAddrStart == pTp->PspAddrEnd)
+    {
+        uint32_t idxHash = pspEmuCoreTpHashIdx(pTp->PspAddrStart);
+
+        pTp->pHashNext = pIdx->apTpHash[idxHash];
+        pIdx->apTpHash[idxHash] = pTp;
+    }
+    else
+    {
+        uint32_t idxIns = pIdx->cTpRanges;
+        while (   idxIns > 0
+               && pIdx->papTpRanges[idxIns - 1]->PspAddrStart > pTp->PspAddrStart)
         {
-            pThis->fMmuChanged = true;
-            uc_emu_stop(pUcEngine);
+            pIdx->papTpRanges[idxIns] = pIdx->papTpRanges[idxIns - 1];
+            idxIns--;
         }
 
-        pThis->Cp15.u32RegScr = (uint32_t)u64Val;
+        pIdx->papTpRanges[idxIns] = pTp;
+        pIdx->cTpRanges++;
+        pspEmuCoreTpIdxEndMaxRecalc(pIdx, idxIns);
     }
-    else if (   uCp == 15
-             && uCrn == 5
-             && uCrm == 0
-             && uOpc1 == 0
-             && uOpc2 == 0)
-        pCpBank->u32RegDfsr = (uint32_t)u64Val;
-    else if (   uCp == 15
-             && uCrn == 5
-             && uCrm == 0
-             && uOpc1 == 0
-             && uOpc2 == 1)
-        pCpBank->u32RegIfsr = (uint32_t)u64Val;
-    else if (   uCp == 15
-             && uCrn == 6
-             && uCrm == 0
-             && uOpc1 == 0
-             && uOpc2 == 0)
-        pCpBank->u32RegDfar = (uint32_t)u64Val;
-    else if (   uCp == 15
-             && uCrn == 6
-             && uCrm == 0
-             && uOpc1 == 0
-             && uOpc2 == 0)
-        pCpBank->u32RegIfar = (uint32_t)u64Val;
-    else if (   uCp == 15
-             && uCrn == 13
-             && uCrm == 0
-             && uOpc1 == 0)
+
+    pIdx->cTps++;
+}
+
+
+/**
+ * Unlinks the given trace point from the data structures of the given index.
+ *
+ * @returns nothing.
+ * @param   pIdx                    The trace point index.
+ * @param   pTp                     The trace point to unlink.
+ */
+static void pspEmuCoreTpIdxUnlink(PPSPCORETPIDX pIdx, PPSPCORETPINT pTp)
+{
+    if (pTp->PspAddrStart == pTp->PspAddrEnd)
     {
-        switch (uOpc2)
+        PPSPCORETPINT *ppTpCur = &pIdx->apTpHash[pspEmuCoreTpHashIdx(pTp->PspAddrStart)];
+        while (   *ppTpCur
+               && *ppTpCur != pTp)
+            ppTpCur = &(*ppTpCur)->pHashNext;
+        if (*ppTpCur)
+            *ppTpCur = pTp->pHashNext;
+    }
+    else
+    {
+        for (uint32_t i = 0; i < pIdx->cTpRanges; i++)
         {
-            case 1:
-                if (pCpBank->u32RegContextId != (uint32_t)u64Val)
-                {
-                    PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE,
-                                            "CO-PROC WRITE: ASID changed to %#lx\n", u64Val);
-                    pspEmuCoreMmuMappingsClear(pThis);
-                    fHandled = false; /* Let qemu update its internal states as well. */
-                }
-                pCpBank->u32RegContextId = (uint32_t)u64Val;
-                break;
-            case 2:
-                pCpBank->u32RegTpIdURw = (uint32_t)u64Val;
-                break;
-            case 3:
-                pCpBank->u32RegTpIdURo = (uint32_t)u64Val;
-                break;
-            case 4:
-                pCpBank->u32RegTpIdPRw = (uint32_t)u64Val;
-                break;
-            default:
-                fHandled = false;
+            if (pIdx->papTpRanges[i] == pTp)
+            {
+                for (uint32_t j = i + 1; j < pIdx->cTpRanges; j++)
+                    pIdx->papTpRanges[j - 1] = pIdx->papTpRanges[j];
+                pIdx->cTpRanges--;
+                pspEmuCoreTpIdxEndMaxRecalc(pIdx, i);
                 break;
+            }
         }
     }
-    else
-        fHandled = false;
-    /** @todo TTBR0, TTBR1 and TTBCR writes should cause a stop as well. */
 
-    PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE,
-                            "CO-PROC WRITE: uCp=%u uCrn=%u uCrm=%u uOpc1=%u uOpc2=%u u64Val=%#llx fHandled=%u\n",
-                            uCp, uCrn, uCrm, uOpc1, uOpc2, u64Val, fHandled);
-    return fHandled;
+    pIdx->cTps--;
 }
 
 
 /**
- * The CP read wrapper to keep track of the MMU status.
+ * Inserts the given trace point into the matching index, updating the unicorn hooks.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ * @param   pTp                     The trace point to insert.
+ */
+static int pspEmuCoreTpIdxInsert(PPSPCOREINT pThis, PPSPCORETPINT pTp)
+{
+    uint32_t idxKind = pspEmuCoreTpIdxKindGet(pTp->fFlags);
+    PPSPCORETPIDX pIdx = &pThis->aTpIdx[idxKind];
+
+    if (   pTp->PspAddrStart != pTp->PspAddrEnd
+        && pIdx->cTpRanges == pIdx->cTpRangesMax)
+    {
+        uint32_t cTpRangesMaxNew = pIdx->cTpRangesMax + 16;
+        PPSPCORETPINT *papTpRangesNew = (PPSPCORETPINT *)realloc(pIdx->papTpRanges, cTpRangesMaxNew * sizeof(*papTpRangesNew));
+        if (!papTpRangesNew)
+            return STS_ERR_NO_MEMORY;
+        pIdx->papTpRanges = papTpRangesNew;
+
+        PSPADDR *paPspAddrEndMaxNew = (PSPADDR *)realloc(pIdx->paPspAddrEndMax, cTpRangesMaxNew * sizeof(*paPspAddrEndMaxNew));
+        if (!paPspAddrEndMaxNew)
+            return STS_ERR_NO_MEMORY;
+        pIdx->paPspAddrEndMax = paPspAddrEndMaxNew;
+        pIdx->cTpRangesMax    = cTpRangesMaxNew;
+    }
+
+    pspEmuCoreTpIdxLink(pIdx, pTp);
+    int rc = pspEmuCoreTpIdxHooksRebuild(pThis, idxKind);
+    if (STS_FAILURE(rc))
+    {
+        pspEmuCoreTpIdxUnlink(pIdx, pTp);
+        return rc;
+    }
+
+    pThis->uTpGen++;
+    return STS_INF_SUCCESS;
+}
+
+
+/**
+ * Removes the given trace point from its index, updating the unicorn hooks.
  *
  * @returns nothing.
- * @param   pUcEngine           Pointer to the unicorn engine instance.
- * @param   uAddrPc             The PC causing the write.
- * @param   uCp                 Co-Processor being accessed.
- * @param   uCrn                cr<n> value.
- * @param   uCrm                cr<m> value.
- * @param   uOpc0               Opcode 0.
- * @param   uOpc1               Opcode 1.
- * @param   uOpc2               Opcode 2.
- * @param   pu64Val             Where to store the read value on success.
- * @param   pvUser              Opaque user data passed when adding the hook.
+ * @param   pThis                   The PSP core instance.
+ * @param   pTp                     The trace point to remove.
+ *
+ * @note If the hooks can't be rebuilt the old ones stay registered, they cover a superset of the remaining
+ *       trace points and the dispatcher filters out the rest.
  */
-static bool pspEmuCoreCpReadWrapper(struct uc_struct *pUcEngine, uint64_t uAddrPc, uint32_t uCp, uint32_t uCrn, uint32_t uCrm,
-                                    uint32_t uOpc0, uint32_t uOpc1, uint32_t uOpc2, uint64_t *pu64Val, void *pvUser)
+static void pspEmuCoreTpIdxRemove(PPSPCOREINT pThis, PPSPCORETPINT pTp)
 {
-    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
-    PPSPCORECPBANK pCpBank = pspEmuCoreCpGetBank(pThis);
+    uint32_t idxKind = pspEmuCoreTpIdxKindGet(pTp->fFlags);
 
-    *pu64Val = 0;
-    bool fHandled = true;
-    if (   uCp == 15
-        && uCrn == 1
-        && uCrm == 0
-        && uOpc1 == 0
-        && uOpc2 == 0)
-        *pu64Val = pCpBank->u32RegSctrl;
-    else if (   uCp == 15
-        && uCrn == 7
-        && uCrm == 4
-        && uOpc1 == 0
-        && uOpc2 == 0)
-        *pu64Val = pCpBank->u32RegPa;
-    else if (   uCp == 15
-             && uCrn == 2
-             && uCrm == 0
-             && uOpc1 == 0
-             && uOpc2 == 0)
-        *pu64Val = pCpBank->u32RegTtbr0;
-    else if (   uCp == 15
-             && uCrn == 2
-             && uCrm == 0
-             && uOpc1 == 0
-             && uOpc2 == 2)
-        *pu64Val = pCpBank->u32RegTtbcr;
-    else if (   uCp == 15
-             && uCrn == 12
-             && uCrm == 0
-             && uOpc1 == 0
-             && uOpc2 == 0)
-        *pu64Val = pCpBank->u32RegVBar;
-    else if (   uCp == 15
-             && uCrn == 12
-             && uCrm == 0
-             && uOpc1 == 0
-             && uOpc2 == 1)
-        *pu64Val = pCpBank->u32RegVBar;
-    else if (   uCp == 15
-             && uCrn == 1
-             && uCrm == 1
+    pspEmuCoreTpIdxUnlink(&pThis->aTpIdx[idxKind], pTp);
+    pspEmuCoreTpIdxHooksRebuild(pThis, idxKind);
+    pThis->uTpGen++;
+}
+
+
+/**
+ * Checks whether the given MMIO read is part of a polling loop and fast forwards the virtual clock
+ * to the point where the polled value might change if so.
+ *
+ * @returns nothing.
+ * @param   pThis                   The PSP core instance.
+ * @param   PspAddrMmio             Physical address of the MMIO read.
+ * @param   cb                      Size of the read.
+ * @param   uVal                    The value read.
+ *
+ * @note A polling loop is the same basic block reading the same value from the same address with
+ *       a constant number of instructions in between and no MMIO writes, this isn't perfect as
+ *       RAM writes go unnoticed but the loop keeps running, only the virtual clock jumps ahead.
+ */
+static void pspEmuCorePollLoopCheck(PPSPCOREINT pThis, PSPADDR PspAddrMmio, size_t cb, uint64_t uVal)
+{
+    uint64_t cInsnsIter = pThis->cInsnsRetired - pThis->cPollInsnsLast;
+
+    if (   PspAddrMmio == pThis->PspAddrPollMmio
+        && cb == pThis->cbPoll
+        && uVal == pThis->uPollVal
+        && pThis->PspAddrBbLast == pThis->PspAddrPollBb
+        && cInsnsIter == pThis->cPollInsnsIter
+        && cInsnsIter <= PSP_CORE_POLL_LOOP_INSNS_MAX)
+        pThis->cPollIters++;
+    else
+    {
+        pThis->PspAddrPollMmio = PspAddrMmio;
+        pThis->cbPoll          = cb;
+        pThis->uPollVal        = uVal;
+        pThis->PspAddrPollBb   = pThis->PspAddrBbLast;
+        pThis->cPollIters      = 0;
+    }
+
+    pThis->cPollInsnsIter = cInsnsIter;
+    pThis->cPollInsnsLast = pThis->cInsnsRetired;
+
+    if (pThis->cPollIters < PSP_CORE_POLL_LOOP_ITERS_MIN)
+        return;
+
+    /*
+     * Ask the owner when the value might change, never skip past the next virtual clock deadline
+     * as timers firing might change it as well. Start counting again afterwards so a loop
+     * which doesn't get anything skipped isn't queried on every iteration.
+     */
+    pThis->cPollIters = 0;
+
+    uint64_t tsNowNs    = PSPEmuCoreQueryVirtTimeNs(pThis);
+    uint64_t tsChangeNs = pThis->pfnPollDeadline(pThis, PspAddrMmio, cb, pThis->pvPollDeadlineUser);
+    if (   pThis->pfnDeadline
+        && pThis->tsDeadlineNs < tsChangeNs)
+        tsChangeNs = pThis->tsDeadlineNs;
+
+    if (   tsChangeNs != UINT64_MAX
+        && tsChangeNs > tsNowNs)
+    {
+        uint64_t cNsSkip = tsChangeNs - tsNowNs;
+
+        /* Any deadline reached gets processed as soon as the current basic block finished. */
+        pThis->tsVirtClockBaseNs += cNsSkip;
+        pspEmuCoreDeadlineInsnsRecalc(pThis);
+        pThis->cPollFastForwards++;
+        pThis->cNsPollFastForwarded += cNsSkip;
+    }
+}
+
+
+/**
+ * Unicorn MMIO read wrapper.
+ *
+ * @returns Data read.
+ * @param   pUcEngine               The unicorn engine pointer.
+ * @param   pvUser                  Opaque user data.
+ * @param   uAddr                   MMIO address read.
+ * @param   cbInsn                  Size of the read (1, 2, 4 or 8 bytes).
+ */
+static uint64_t pspEmuCoreMmioRead(struct uc_struct* pUcEngine, void *pvUser, uint64_t uAddr, unsigned cb)
+{
+    PPSPCOREMEMREGION pRegion = (PPSPCOREMEMREGION)pvUser;
+    PSPDATUM ValRead;
+    uint64_t uValRet = 0;
+
+    pRegion->pPspCore->cMmioReads++;
+    pRegion->u.Mmio.pfnRead(pRegion->pPspCore, (PSPADDR)uAddr, cb, &ValRead, pRegion->u.Mmio.pvUser);
+    switch (cb)
+    {
+        case 1:
+            uValRet = ValRead.u8;
+            break;
+        case 2:
+            uValRet = ValRead.u16;
+            break;
+        case 4:
+            uValRet = ValRead.u32;
+            break;
+        case 8:
+            uValRet = ValRead.u64;
+            break;
+        default:
+            /** @todo assert() */
+            uc_emu_stop(pUcEngine);
+    }
+
+    PPSPCOREINT pThis = pRegion->pPspCore;
+    if (pThis->pfnPollDeadline)
+        pspEmuCorePollLoopCheck(pThis, pRegion->PspAddrStart + (PSPADDR)uAddr, cb, uValRet);
+
+    return uValRet;
+}
+
+
+/**
+ * Unicorn MMIO write wrapper.
+ *
+ * @returns nothing.
+ * @param   pUcEngine               The unicorn engine pointer.
+ * @param   pvUser                  Opaque user data.
+ * @param   uAddr                   MMIO address written.
+ * @param   uVal                    Value written.
+ * @param   cbInsn                  Size of the write (1, 2, 4 or 8 bytes).
+ */
+static void pspEmuCoreMmioWrite(struct uc_struct* pUcEngine, void *pvUser, uint64_t uAddr, uint64_t uVal, unsigned cb)
+{
+    PPSPCOREMEMREGION pRegion = (PPSPCOREMEMREGION)pvUser;
+    PSPDATUM ValWrite;
+
+    switch (cb)
+    {
+        case 1:
+            ValWrite.u8 = (uint8_t)uVal;
+            break;
+        case 2:
+            ValWrite.u16 = (uint16_t)uVal;
+            break;
+        case 4:
+            ValWrite.u32 = (uint32_t)uVal;
+            break;
+        case 8:
+            ValWrite.u64 = uVal;
+            break;
+        default:
+            /** @todo assert() */
+            uc_emu_stop(pUcEngine);
+    }
+
+    pRegion->pPspCore->cMmioWrites++;
+    pRegion->u.Mmio.pfnWrite(pRegion->pPspCore, (PSPADDR)uAddr, cb, &ValWrite, pRegion->u.Mmio.pvUser);
+
+    /* Writing to a device is a side effect, so this can't be a pure polling loop. */
+    pRegion->pPspCore->cPollIters = 0;
+}
+
+
+/**
+ * The exception wrapper to transition between CPU modes.
+ *
+ * @returns nothing.
+ * @param   pUcEngine           Pointer to the unicorn engine instance.
+ * @param   uIntNo              Interrupt/Exception number.
+ * @param   pvUser              Opaque user data passed when adding the hook.
+ */
+static void pspEmuCoreExcpWrapper(uc_engine *pUcEngine, uint32_t uIntNo, void *pvUser)
+{
+    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
+
+    /*
+     * Set appropriate exception and stop emulation, we don't alter the vital CPU state
+     * (PC, CPSR, etc.) here as unicorn seems to be rather fragile in this regard
+     * when done from any hook callback.
+     */
+    if (uIntNo == 2)
+        pThis->enmExcpPending = PSPCOREEXCP_SWI;
+    else if (uIntNo == 13)
+        pThis->enmExcpPending = PSPCOREEXCP_SMC;
+
+    pspEmuCoreExecExit(pThis, PSP_CORE_EXIT_F_EXCP_PENDING);
+}
+
+
+/**
+ * The CP write wrapper to keep track of the MMU status.
+ *
+ * @returns nothing.
+ * @param   pUcEngine           Pointer to the unicorn engine instance.
+ * @param   uAddrPc             The PC causing the write.
+ * @param   uCp                 Co-Processor being accessed.
+ * @param   uCrn                cr<n> value.
+ * @param   uCrm                cr<m> value.
+ * @param   uOpc0               Opcode 0.
+ * @param   uOpc1               Opcode 1.
+ * @param   uOpc2               Opcode 2.
+ * @param   u64Val              The value being written.
+ * @param   pvUser              Opaque user data passed when adding the hook.
+ */
+static bool pspEmuCoreCpWriteWrapper(struct uc_struct *pUcEngine, uint64_t uAddrPc, uint32_t uCp, uint32_t uCrn, uint32_t uCrm,
+                                     uint32_t uOpc0, uint32_t uOpc1, uint32_t uOpc2, uint64_t u64Val, void *pvUser)
+{
+    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
+    PPSPCORECPBANK pCpBank = pspEmuCoreCpGetBank(pThis);
+
+    /*
+     * Check whether the MMU status changed and cause the emulation to stop so we
+     * can adjust the memory layout.
+     */
+    bool fHandled = true;
+    if (   uCp == 15
+        && uCrn == 1
+        && uCrm == 0
+        && uOpc1 == 0
+        && uOpc2 == 0)
+    {
+        if ((pCpBank->u32RegSctrl & BIT(0)) != (u64Val & BIT(0)))
+        {
+            pThis->fMmuChanged = true;
+            pspEmuCoreExecExit(pThis, PSP_CORE_EXIT_F_MMU_CHANGED);
+        }
+
+        /* Store a copy of the SCTRL register. */
+        pCpBank->u32RegSctrl = (uint32_t)u64Val;
+        pspEmuCoreMmuTlbFlush(pThis);
+        fHandled = false; /* To sync unicorns own copy. */
+    }
+    else if (   uCp == 15
+             && uCrn == 2
+             && uCrm == 0
              && uOpc1 == 0
              && uOpc2 == 0)
-        *pu64Val = pThis->Cp15.u32RegScr;
+    {
+        pCpBank->u32RegTtbr0 = (uint32_t)u64Val;
+        pspEmuCoreMmuTlbFlush(pThis);
+    }
     else if (   uCp == 15
-             && uCrn == 5
+             && uCrn == 2
+             && uCrm == 0
+             && uOpc1 == 0
+             && uOpc2 == 2)
+    {
+        pCpBank->u32RegTtbcr = (uint32_t)u64Val;
+        pspEmuCoreMmuTlbFlush(pThis);
+    }
+    else if (   uCp == 15
+             && uCrn == 12
              && uCrm == 0
              && uOpc1 == 0
              && uOpc2 == 0)
-        *pu64Val = pCpBank->u32RegDfsr;
+        pCpBank->u32RegVBar = (uint32_t)u64Val;
     else if (   uCp == 15
-             && uCrn == 5
+             && uCrn == 12
              && uCrm == 0
              && uOpc1 == 0
              && uOpc2 == 1)
-        *pu64Val = pCpBank->u32RegIfsr;
+        pCpBank->u32RegMVBar = (uint32_t)u64Val;
     else if (   uCp == 15
-             && uCrn == 6
-             && uCrm == 0
+             && uCrn == 7
+             && uCrm == 4
              && uOpc1 == 0
              && uOpc2 == 0)
-        *pu64Val = pCpBank->u32RegDfar;
+        pCpBank->u32RegPa = (uint32_t)u64Val;
     else if (   uCp == 15
-             && uCrn == 6
-             && uCrm == 0
+             && uCrn == 7
+             && uCrm == 8
              && uOpc1 == 0
              && uOpc2 == 0)
-        *pu64Val = pCpBank->u32RegIfar;
+    {
+        /* V2PCWPR, Privileged Read VA to PA translation */
+        PSPPADDR PspPAddrPg = 0;
+        size_t cbRegion = 0;
+        int rc = pspEmuCoreMmuPAddrQueryFromVAddr(pThis, (PSPVADDR)u64Val, &PspPAddrPg, &cbRegion, NULL /*penmPgTblWalk*/);
+        PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE,
+                                "pspEmuCoreMmuPAddrQueryFromVAddr(): VAddr=%#lx rc=%d PAddr=%#lx\n",
+                                (PSPVADDR)u64Val, rc, PspPAddrPg);
+        if (!rc)
+            pCpBank->u32RegPa = PspPAddrPg;
+        else
+            pCpBank->u32RegPa = 0x1;
+    }
     else if (   uCp == 15
-             && uCrn == 13
-             && uCrm == 0
-             && uOpc1 == 0)
+             && uCrn == 7
+             && uCrm == 8
+             && uOpc1 == 0
+             && uOpc2 == 2)
     {
-        switch (uOpc2)
+        /* V2PCWUR, User Read VA to PA translation */
+        PSPPADDR PspPAddrPg = 0;
+        size_t cbRegion = 0;
+        int rc = pspEmuCoreMmuPAddrQueryFromVAddr(pThis, (PSPVADDR)u64Val, &PspPAddrPg, &cbRegion, NULL /*penmPgTblWalk*/);
+        PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE,
+                                "pspEmuCoreMmuPAddrQueryFromVAddr(): VAddr=%#lx rc=%d PAddr=%#lx\n",
+                                (PSPVADDR)u64Val, rc, PspPAddrPg);
+        if (!rc)
+            pCpBank->u32RegPa = PspPAddrPg;
+        else
+            pCpBank->u32RegPa = 0x1;
+    }
+    else if (   uCp == 15
+             && uCrn == 1
+             && uCrm == 1
+             && uOpc1 == 0
+             && uOpc2 == 0)
+    {
+        /* Check for a world switch and reset the MMU. */
+        if (   (pThis->Cp15.u32RegScr & BIT(0)) != (u64Val & BIT(0))
+            && pThis->enmCoreMode != PSPCOREMODE_MON)
         {
-            case 1:
-                *pu64Val = pCpBank->u32RegContextId;
-                break;
-            case 2:
-                *pu64Val = pCpBank->u32RegTpIdURw;
-                break;
-            case 3:
-                *pu64Val = pCpBank->u32RegTpIdURo;
-                break;
-            case 4:
+            pThis->fMmuChanged = true;
+            pspEmuCoreExecExit(pThis, PSP_CORE_EXIT_F_MMU_CHANGED);
+        }
+
+        pThis->Cp15.u32RegScr = (uint32_t)u64Val;
+    }
+    else if (   uCp == 15
+             && uCrn == 5
+             && uCrm == 0
+             && uOpc1 == 0
+             && uOpc2 == 0)
+        pCpBank->u32RegDfsr = (uint32_t)u64Val;
+    else if (   uCp == 15
+             && uCrn == 5
+             && uCrm == 0
+             && uOpc1 == 0
+             && uOpc2 == 1)
+        pCpBank->u32RegIfsr = (uint32_t)u64Val;
+    else if (   uCp == 15
+             && uCrn == 6
+             && uCrm == 0
+             && uOpc1 == 0
+             && uOpc2 == 0)
+        pCpBank->u32RegDfar = (uint32_t)u64Val;
+    else if (   uCp == 15
+             && uCrn == 6
+             && uCrm == 0
+             && uOpc1 == 0
+             && uOpc2 == 0)
+        pCpBank->u32RegIfar = (uint32_t)u64Val;
+    else if (   uCp == 15
+             && uCrn == 13
+             && uCrm == 0
+             && uOpc1 == 0)
+    {
+        switch (uOpc2)
+        {
+            case 1:
+                if (pCpBank->u32RegContextId != (uint32_t)u64Val)
+                {
+                    PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE,
+                                            "CO-PROC WRITE: ASID changed to %#lx\n", u64Val);
+                    pspEmuCoreMmuMappingsClear(pThis);
+                    fHandled = false; /* Let qemu update its internal states as well. */
+                }
+                pCpBank->u32RegContextId = (uint32_t)u64Val;
+                break;
+            case 2:
+                pCpBank->u32RegTpIdURw = (uint32_t)u64Val;
+                break;
+            case 3:
+                pCpBank->u32RegTpIdURo = (uint32_t)u64Val;
+                break;
+            case 4:
+                pCpBank->u32RegTpIdPRw = (uint32_t)u64Val;
+                break;
+            default:
+                fHandled = false;
+                break;
+        }
+    }
+    else
+        fHandled = false;
+    /** @todo TTBR0, TTBR1 and TTBCR writes should cause a stop as well. */
+
+    PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE,
+                            "CO-PROC WRITE: uCp=%u uCrn=%u uCrm=%u uOpc1=%u uOpc2=%u u64Val=%#llx fHandled=%u\n",
+                            uCp, uCrn, uCrm, uOpc1, uOpc2, u64Val, fHandled);
+    return fHandled;
+}
+
+
+/**
+ * The CP read wrapper to keep track of the MMU status.
+ *
+ * @returns nothing.
+ * @param   pUcEngine           Pointer to the unicorn engine instance.
+ * @param   uAddrPc             The PC causing the write.
+ * @param   uCp                 Co-Processor being accessed.
+ * @param   uCrn                cr<n> value.
+ * @param   uCrm                cr<m> value.
+ * @param   uOpc0               Opcode 0.
+ * @param   uOpc1               Opcode 1.
+ * @param   uOpc2               Opcode 2.
+ * @param   pu64Val             Where to store the read value on success.
+ * @param   pvUser              Opaque user data passed when adding the hook.
+ */
+static bool pspEmuCoreCpReadWrapper(struct uc_struct *pUcEngine, uint64_t uAddrPc, uint32_t uCp, uint32_t uCrn, uint32_t uCrm,
+                                    uint32_t uOpc0, uint32_t uOpc1, uint32_t uOpc2, uint64_t *pu64Val, void *pvUser)
+{
+    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
+    PPSPCORECPBANK pCpBank = pspEmuCoreCpGetBank(pThis);
+
+    *pu64Val = 0;
+    bool fHandled = true;
+    if (   uCp == 15
+        && uCrn == 1
+        && uCrm == 0
+        && uOpc1 == 0
+        && uOpc2 == 0)
+        *pu64Val = pCpBank->u32RegSctrl;
+    else if (   uCp == 15
+        && uCrn == 7
+        && uCrm == 4
+        && uOpc1 == 0
+        && uOpc2 == 0)
+        *pu64Val = pCpBank->u32RegPa;
+    else if (   uCp == 15
+             && uCrn == 2
+             && uCrm == 0
+             && uOpc1 == 0
+             && uOpc2 == 0)
+        *pu64Val = pCpBank->u32RegTtbr0;
+    else if (   uCp == 15
+             && uCrn == 2
+             && uCrm == 0
+             && uOpc1 == 0
+             && uOpc2 == 2)
+        *pu64Val = pCpBank->u32RegTtbcr;
+    else if (   uCp == 15
+             && uCrn == 12
+             && uCrm == 0
+             && uOpc1 == 0
+             && uOpc2 == 0)
+        *pu64Val = pCpBank->u32RegVBar;
+    else if (   uCp == 15
+             && uCrn == 12
+             && uCrm == 0
+             && uOpc1 == 0
+             && uOpc2 == 1)
+        *pu64Val = pCpBank->u32RegVBar;
+    else if (   uCp == 15
+             && uCrn == 1
+             && uCrm == 1
+             && uOpc1 == 0
+             && uOpc2 == 0)
+        *pu64Val = pThis->Cp15.u32RegScr;
+    else if (   uCp == 15
+             && uCrn == 5
+             && uCrm == 0
+             && uOpc1 == 0
+             && uOpc2 == 0)
+        *pu64Val = pCpBank->u32RegDfsr;
+    else if (   uCp == 15
+             && uCrn == 5
+             && uCrm == 0
+             && uOpc1 == 0
+             && uOpc2 == 1)
+        *pu64Val = pCpBank->u32RegIfsr;
+    else if (   uCp == 15
+             && uCrn == 6
+             && uCrm == 0
+             && uOpc1 == 0
+             && uOpc2 == 0)
+        *pu64Val = pCpBank->u32RegDfar;
+    else if (   uCp == 15
+             && uCrn == 6
+             && uCrm == 0
+             && uOpc1 == 0
+             && uOpc2 == 0)
+        *pu64Val = pCpBank->u32RegIfar;
+    else if (   uCp == 15
+             && uCrn == 13
+             && uCrm == 0
+             && uOpc1 == 0)
+    {
+        switch (uOpc2)
+        {
+            case 1:
+                *pu64Val = pCpBank->u32RegContextId;
+                break;
+            case 2:
+                *pu64Val = pCpBank->u32RegTpIdURw;
+                break;
+            case 3:
+                *pu64Val = pCpBank->u32RegTpIdURo;
+                break;
+            case 4:
                 *pu64Val = pCpBank->u32RegTpIdPRw;
                 break;
             default:
@@ -1150,153 +2445,960 @@ static bool pspEmuCoreCpReadWrapper(struct uc_struct *pUcEngine, uint64_t uAddrP
                 break;
         }
     }
-    else
-        fHandled = false;
+    else
+        fHandled = false;
+
+    PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE,
+                            "CO-PROC READ: uCp=%u uCrn=%u uCrm=%u uOpc1=%u uOpc2=%u u64Val=%#llx fHandled=%u\n",
+                            uCp, uCrn, uCrm, uOpc1, uOpc2, *pu64Val, fHandled);
+    return fHandled;
+}
+
+
+/**
+ * The CPSR write callback.
+ *
+ * @returns nothing.
+ * @param   pUcEngine           Pointer to the unicorn engine instance.
+ * @param   uAddrPc             The PC causing the write.
+ * @param   u32Val              The new CPSR value.
+ * @param   pvUser              Opaque user data passed when adding the hook.
+ */
+static void pspEmuCoreCpsrChangeWrapper(struct uc_struct *pUcEngine, uint64_t uAddrPc, uint32_t u32Val, void *pvUser)
+{
+    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
+
+    PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE, "pspEmuCoreCpsrChangeWrapper: u32Val=%#x\n", u32Val);
+
+    PSPCOREMODE enmCoreMode = pspEmuCoreModeFromCpsr(u32Val);
+    if (pThis->enmCoreMode != enmCoreMode)
+    {
+        /* We need to stop emulation and rearrange the MMU when we switch in and out of monitor mode. */
+        //printf("%#llx Switching from mode %s to %s\n", uAddrPc, pspEmuCoreModeToStr(pThis->enmCoreMode),
+        //       pspEmuCoreModeToStr(enmCoreMode));
+        if (   (   pThis->enmCoreMode == PSPCOREMODE_MON
+                || enmCoreMode == PSPCOREMODE_MON)
+            && (pThis->Cp15.u32RegScr & BIT(0)))
+        {
+            pThis->fMmuChanged = true;
+            pspEmuCoreExecExit(pThis, PSP_CORE_EXIT_F_MMU_CHANGED);
+        }
+        pThis->enmCoreMode = enmCoreMode;
+    }
+
+    /* Only re-evaluate the interrupt lines if any of the mask bits got cleared. */
+    uint32_t fUnmasked = (pThis->u32RegCpsr & ~u32Val) & (BIT(7) | BIT(6));
+    pThis->u32RegCpsr = u32Val;
+    if (   fUnmasked
+        && (pThis->fIrq || pThis->fFiq))
+        pspEmuCoreIrqCheckAndInject(pThis, true /*fStop*/);
+}
+
+
+/**
+ * Execute any injected SVC handlers before possibly passing control to the supervisor code.
+ *
+ * @returns Status code.
+ * @param   pThis               The PSP emulation code instance.
+ * @param   PspAddrSvc          Address of the instruction coming after the SVC instruction.
+ * @param   fThumb              Flag whether the core is currently executing in thumb mode.
+ * @param   pfSwitchToSvc       Where to store the flag whether to switch to supervisor mode after all
+ *                              handlers where executed.
+ */
+static int pspEmuCoreSvcBefore(PPSPCOREINT pThis, PSPADDR PspAddrPc, bool fThumb, bool *pfSwitchToSvc)
+{
+    int rc = 0;
+    bool fHandled = false; /* Default is to switch to supervisor mode in case there is nothing injected. */
+
+    if (pThis->pSvcReg)
+    {
+        uint32_t idxSyscall = 0;
+
+        if (fThumb)
+        {
+            uint16_t uInsnSvc;
+            uc_err rcUc = uc_mem_read(pThis->pUcEngine, PspAddrPc - 2, &uInsnSvc, sizeof(uInsnSvc));
+            if (rcUc == UC_ERR_OK)
+            {
+                if (((uInsnSvc >> 8) & 0xff) == 0xdf)
+                    idxSyscall = uInsnSvc & 0xff;
+                else
+                    rc = -1; /* Should never happen. */
+            }
+            else
+                rc = pspEmuCoreErrConvertFromUcErr(rcUc);
+        }
+        else
+        {
+            uint32_t uInsnSvc;
+            uc_err rcUc = uc_mem_read(pThis->pUcEngine, PspAddrPc - 4, &uInsnSvc, sizeof(uInsnSvc));
+            if (rcUc == UC_ERR_OK)
+            {
+                if (((uInsnSvc >> 24) & 0x0f) == 0xf)
+                    idxSyscall = uInsnSvc & 0xffffff;
+                else
+                    rc = -1; /* Should never happen. */
+            }
+            else
+                rc = pspEmuCoreErrConvertFromUcErr(rcUc);
+        }
+
+        if (!rc)
+        {
+            pThis->idxSvc = idxSyscall;
+
+            /* Any global handlers?. */
+            if (   pThis->pSvcReg->GlobalSvmc.pfnSvmcHnd
+                && pThis->pSvcReg->GlobalSvmc.fFlags & PSPEMU_CORE_SVMC_F_BEFORE)
+                fHandled = pThis->pSvcReg->GlobalSvmc.pfnSvmcHnd(pThis, idxSyscall, PSPEMU_CORE_SVMC_F_BEFORE, pThis->pvSvcUser);
+
+            /* Any per SVC handler set?. */
+            if (idxSyscall < pThis->pSvcReg->cSvmcDescs)
+            {
+                PCPSPCORESVMCDESC pSvcDesc = &pThis->pSvcReg->paSvmcDescs[idxSyscall];
+                if (   pSvcDesc->pfnSvmcHnd
+                    && pSvcDesc->fFlags & PSPEMU_CORE_SVMC_F_BEFORE)
+                    fHandled = pSvcDesc->pfnSvmcHnd(pThis, idxSyscall, PSPEMU_CORE_SVMC_F_BEFORE, pThis->pvSvcUser);
+            }
+        }
+    }
+
+    *pfSwitchToSvc = fHandled ? false : true;
+
+    return rc;
+}
+
+
+/**
+ * Execute any injected SVC handlers after control was passed to the supervisor code and control is about to
+ * return to the code invoking the SVC.
+ *
+ * @returns Status code.
+ * @param   pThis               The PSP emulation code instance.
+ */
+static int pspEmuCoreSvcAfter(PPSPCOREINT pThis)
+{
+    int rc = 0;
+
+    if (pThis->pSvcReg)
+    {
+        /* Any global handlers?. */
+        if (   pThis->pSvcReg->GlobalSvmc.pfnSvmcHnd
+            && pThis->pSvcReg->GlobalSvmc.fFlags & PSPEMU_CORE_SVMC_F_AFTER)
+            pThis->pSvcReg->GlobalSvmc.pfnSvmcHnd(pThis, pThis->idxSvc, PSPEMU_CORE_SVMC_F_AFTER, pThis->pvSvcUser);
+
+        /* Any per SVC handler set?. */
+        if (pThis->idxSvc < pThis->pSvcReg->cSvmcDescs)
+        {
+            PCPSPCORESVMCDESC pSvcDesc = &pThis->pSvcReg->paSvmcDescs[pThis->idxSvc];
+            if (   pSvcDesc->pfnSvmcHnd
+                && pSvcDesc->fFlags & PSPEMU_CORE_SVMC_F_AFTER)
+                pSvcDesc->pfnSvmcHnd(pThis, pThis->idxSvc, PSPEMU_CORE_SVMC_F_AFTER, pThis->pvSvcUser);
+        }
+    }
+
+    return rc;
+}
+
+
+/**
+ * Execute any injected SMC handlers before possibly passing control to the monitor code.
+ *
+ * @returns Status code.
+ * @param   pThis               The PSP emulation code instance.
+ * @param   PspAddrPc           Address of the instruction coming after the SMC instruction.
+ * @param   fThumb              Flag whether the core is currently executing in thumb mode.
+ * @param   pfSwitchToMon       Where to store the flag whether to switch to monitor mode after all
+ *                              handlers where executed.
+ */
+static int pspEmuCoreSmcBefore(PPSPCOREINT pThis, PSPADDR PspAddrPc, bool fThumb, bool *pfSwitchToMon)
+{
+    int rc = 0;
+    bool fHandled = false; /* Default is to switch to supervisor mode in case there is nothing injected. */
+
+    if (pThis->pSmcReg)
+    {
+        uint32_t idxCall = 0;
+
+        if (fThumb)
+        {
+            uint32_t uInsnSmc;
+            uc_err rcUc = uc_mem_read(pThis->pUcEngine, PspAddrPc - 4, &uInsnSmc, sizeof(uInsnSmc));
+            if (rcUc == UC_ERR_OK)
+            {
+                if ((uInsnSmc & 0xfff0ffff) == 0x8000f7f0)
+                    idxCall = (uInsnSmc >> 16) & 0xf;
+                else
+                    rc = -1; /* Should never happen. */
+            }
+            else
+                rc = pspEmuCoreErrConvertFromUcErr(rcUc);
+        }
+        else
+        {
+            uint32_t uInsnSmc;
+            uc_err rcUc = uc_mem_read(pThis->pUcEngine, PspAddrPc - 4, &uInsnSmc, sizeof(uInsnSmc));
+            if (rcUc == UC_ERR_OK)
+            {
+                if ((uInsnSmc & 0x0ffffff0) == 0x01600070)
+                    idxCall = uInsnSmc & 0xf;
+                else
+                    rc = -1; /* Should never happen. */
+            }
+            else
+                rc = pspEmuCoreErrConvertFromUcErr(rcUc);
+        }
+
+        if (!rc)
+        {
+            pThis->idxSmc = idxCall;
+
+            /* Any global handlers?. */
+            if (   pThis->pSmcReg->GlobalSvmc.pfnSvmcHnd
+                && pThis->pSmcReg->GlobalSvmc.fFlags & PSPEMU_CORE_SVMC_F_BEFORE)
+                fHandled = pThis->pSmcReg->GlobalSvmc.pfnSvmcHnd(pThis, idxCall, PSPEMU_CORE_SVMC_F_BEFORE, pThis->pvSmcUser);
+
+            /* Any per SVC handler set?. */
+            if (idxCall < pThis->pSmcReg->cSvmcDescs)
+            {
+                PCPSPCORESVMCDESC pSmcDesc = &pThis->pSmcReg->paSvmcDescs[idxCall];
+                if (   pSmcDesc->pfnSvmcHnd
+                    && pSmcDesc->fFlags & PSPEMU_CORE_SVMC_F_BEFORE)
+                    fHandled = pSmcDesc->pfnSvmcHnd(pThis, idxCall, PSPEMU_CORE_SVMC_F_BEFORE, pThis->pvSmcUser);
+            }
+        }
+    }
+
+    *pfSwitchToMon = fHandled ? false : true;
+
+    return rc;
+}
+
+
+/**
+ * Execute any injected SMC handlers after control was passed to the supervisor code and control is about to
+ * return to the code invoking the SVC.
+ *
+ * @returns Status code.
+ * @param   pThis               The PSP emulation code instance.
+ */
+static int pspEmuCoreSmcAfter(PPSPCOREINT pThis)
+{
+    int rc = 0;
+
+    if (pThis->pSmcReg)
+    {
+        /* Any global handlers?. */
+        if (   pThis->pSmcReg->GlobalSvmc.pfnSvmcHnd
+            && pThis->pSmcReg->GlobalSvmc.fFlags & PSPEMU_CORE_SVMC_F_AFTER)
+            pThis->pSmcReg->GlobalSvmc.pfnSvmcHnd(pThis, pThis->idxSmc, PSPEMU_CORE_SVMC_F_AFTER, pThis->pvSmcUser);
+
+        /* Any per SMC handler set?. */
+        if (pThis->idxSmc < pThis->pSmcReg->cSvmcDescs)
+        {
+            PCPSPCORESVMCDESC pSmcDesc = &pThis->pSvcReg->paSvmcDescs[pThis->idxSvc];
+            if (   pSmcDesc->pfnSvmcHnd
+                && pSmcDesc->fFlags & PSPEMU_CORE_SVMC_F_AFTER)
+                pSmcDesc->pfnSvmcHnd(pThis, pThis->idxSmc, PSPEMU_CORE_SVMC_F_AFTER, pThis->pvSmcUser);
+        }
+    }
+
+    return rc;
+}
+
+
+/**
+ * The after SVC trace hook called by unicorn.
+ *
+ * @returns nothing.
+ * @param   pUcEngine               The unicorn engine pointer.
+ * @param   uAddr                   The address of the instruction triggering the hook.
+ * @param   cbInsn                  Size of the instruction.
+ * @param   pvUser                  Opaque user data.
+ */
+static void pspEmuCoreSvcAfterHook(uc_engine *pUcEngine, uint64_t uAddr, uint32_t cbInsn, void *pvUser)
+{
+    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
+
+    pspEmuCoreSvcAfter(pThis); /* Handle all after hooks. */
+
+    /* Delete the temporary unicorn hook. */
+    uc_err rcUc = uc_hook_del(pThis->pUcEngine, pThis->hUcHookSvcAfter);
+    /** @todo assert(rcUc == UC_ERR_OK) */
+    pThis->hUcHookSvcAfter = 0;
+}
+
+
+/**
+ * Recalculates the retired instruction count at which the current deadline is reached,
+ * needs to be called whenever the deadline or the virtual clock base changes.
+ *
+ * @returns nothing.
+ * @param   pThis                   The PSP core instance.
+ */
+static void pspEmuCoreDeadlineInsnsRecalc(PPSPCOREINT pThis)
+{
+    if (   pThis->tsDeadlineNs == UINT64_MAX
+        || !pThis->pfnDeadline)
+        pThis->cInsnsDeadline = UINT64_MAX;
+    else if (pThis->tsDeadlineNs <= pThis->tsVirtClockBaseNs)
+        pThis->cInsnsDeadline = pThis->cVirtClockInsnsBase;
+    else
+    {
+        uint64_t cNs   = pThis->tsDeadlineNs - pThis->tsVirtClockBaseNs;
+        uint64_t cSecs = cNs / UINT64_C(1000000000);
+
+        if (cSecs >= (UINT64_MAX - pThis->cVirtClockInsnsBase) / pThis->cVirtClockIps)
+            pThis->cInsnsDeadline = UINT64_MAX;
+        else
+        {
+            /* Round up so the virtual time is at or past the deadline once the instruction count is reached. */
+            uint64_t cNsRem = cNs % UINT64_C(1000000000);
+            pThis->cInsnsDeadline =   pThis->cVirtClockInsnsBase
+                                    + cSecs * pThis->cVirtClockIps
+                                    + (cNsRem * pThis->cVirtClockIps + UINT64_C(999999999)) / UINT64_C(1000000000);
+        }
+    }
+
+    /* Stop in time for the next replayed interrupt line change. */
+    if (pThis->cInsnsIrqReplayNext < pThis->cInsnsDeadline)
+        pThis->cInsnsDeadline = pThis->cInsnsIrqReplayNext;
+}
+
+
+/**
+ * Calls the deadline callback if the virtual clock reached the current deadline.
+ *
+ * @returns nothing.
+ * @param   pThis                   The PSP core instance.
+ */
+static void pspEmuCoreDeadlineProcess(PPSPCOREINT pThis)
+{
+    if (   !pThis->pfnDeadline
+        || pThis->tsDeadlineNs == UINT64_MAX)
+        return;
+
+    uint64_t tsNowNs = PSPEmuCoreQueryVirtTimeNs(pThis);
+    if (tsNowNs >= pThis->tsDeadlineNs)
+    {
+        /* The callback sets the next deadline. */
+        pThis->tsDeadlineNs   = UINT64_MAX;
+        pspEmuCoreDeadlineInsnsRecalc(pThis);
+        pThis->pfnDeadline(pThis, tsNowNs, pThis->pvDeadlineUser);
+    }
+}
+
+
+/**
+ * Idles in a WFI instruction without a WFI callback, fast forwarding the virtual clock from
+ * deadline to deadline until an interrupt line gets asserted.
+ *
+ * @returns Status code.
+ * @retval  STS_INF_PSP_EMU_CORE_INSN_WFI_REACHED if there is no deadline left which could wake up the core.
+ * @param   pThis                   The PSP core instance.
+ */
+static int pspEmuCoreWfiFastForward(PPSPCOREINT pThis)
+{
+    while (   !pThis->fIrq
+           && !pThis->fFiq)
+    {
+        /* Requests from other threads might assert an interrupt line. */
+        pspEmuCoreKickProcess(pThis);
+
+        /* A replayed interrupt recorded while idling happens at the current instruction count. */
+        pspEmuCoreIrqReplayProcess(pThis);
+        if (pThis->fIrq || pThis->fFiq)
+            break;
+
+        if (   !pThis->pfnDeadline
+            || pThis->tsDeadlineNs == UINT64_MAX)
+            return STS_INF_PSP_EMU_CORE_INSN_WFI_REACHED;
+
+        uint64_t tsNowNs = PSPEmuCoreQueryVirtTimeNs(pThis);
+        if (pThis->tsDeadlineNs > tsNowNs)
+        {
+            uint64_t cNsSkip = pThis->tsDeadlineNs - tsNowNs;
+
+            pThis->tsVirtClockBaseNs += cNsSkip;
+            pspEmuCoreDeadlineInsnsRecalc(pThis);
+            pThis->cWfiFastForwards++;
+            pThis->cNsWfiFastForwarded += cNsSkip;
+        }
+
+        pspEmuCoreDeadlineProcess(pThis);
+    }
+
+    return STS_INF_SUCCESS;
+}
+
+
+/**
+ * Checks whether the instruction before the given address is a WFI instruction.
+ *
+ * @returns Flag whether a WFI instruction was detected.
+ * @param   pThis               The PSP emulation core instance.
+ * @param   PspAddrPc           The PC following the potential WFI instruction.
+ * @param   fThumb              Flag whether we are in thumb state.
+ */
+static bool pspEmuCoreInsnIsWfi(PPSPCOREINT pThis, PSPVADDR PspAddrPc, bool fThumb)
+{
+    if (fThumb)
+    {
+        uint16_t u16Insn = 0;
+        int rc = PSPEmuCoreMemReadVirt(pThis, PspAddrPc - 2, &u16Insn, sizeof(u16Insn));
+        if (   STS_SUCCESS(rc)
+            && u16Insn == 0xbf30)
+            return true;
+    }
+    else
+    {
+        uint32_t u32Insn = 0;
+        int rc = PSPEmuCoreMemReadVirt(pThis, PspAddrPc - 4, &u32Insn, sizeof(u32Insn));
+        if (   STS_SUCCESS(rc)
+            && (   (u32Insn & 0x0fffffff) == 0x0320f003)
+                || (u32Insn & 0x0fffffff) == 0x0320f002) /* WFE, treated the same here for now */
+            return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * Returns the pointer to the lookup table entry for the given page.
+ *
+ * @returns Pointer to the lookup table entry or NULL if the second level table doesn't exist
+ *          and fAlloc is false or allocating it failed.
+ * @param   pThis                   The PSP core instance.
+ * @param   idxPage                 The page index to look for.
+ * @param   fAlloc                  Flag whether to allocate the second level table if it doesn't exist.
+ */
+static PPSPCOREMEMREGION *pspEmuCoreMemLookupEntryGet(PPSPCOREINT pThis, uint32_t idxPage, bool fAlloc)
+{
+    uint32_t idxL1 = idxPage >> (PSP_CORE_MEM_LOOKUP_L1_SHIFT - PSP_PAGE_SHIFT);
+    PPSPCOREMEMLOOKUPL2 pL2 = pThis->apMemLookupL2[idxL1];
+    if (!pL2)
+    {
+        if (!fAlloc)
+            return NULL;
+
+        pL2 = (PPSPCOREMEMLOOKUPL2)calloc(1, sizeof(*pL2));
+        if (!pL2)
+            return NULL;
+        pThis->apMemLookupL2[idxL1] = pL2;
+    }
+
+    return &pL2->apRegions[idxPage & (PSP_CORE_MEM_LOOKUP_L2_ENTRIES - 1)];
+}
+
+
+/**
+ * Finds the region assigned to the given address or NULL if there is nothing assigned.
+ *
+ * @returns Pointer to the region or NULL if not found.
+ * @param   pThis                   The PSP core instance.
+ * @param   PspAddr                 The physical PSP address to look for.
+ */
+static PPSPCOREMEMREGION pspEmuCoreMemRegionFindByAddr(PPSPCOREINT pThis, PSPADDR PspAddr)
+{
+    PPSPCOREMEMLOOKUPL2 pL2 = pThis->apMemLookupL2[PspAddr >> PSP_CORE_MEM_LOOKUP_L1_SHIFT];
+    if (!pL2)
+        return NULL;
+
+    /*
+     * The entry points to the lowest region overlapping the page, for page aligned regions
+     * this is the region we are looking for. Multiple regions can only share a page
+     * if they are smaller than a page, walk the sorted list in that case.
+     */
+    PPSPCOREMEMREGION pCur = pL2->apRegions[(PspAddr >> PSP_PAGE_SHIFT) & (PSP_CORE_MEM_LOOKUP_L2_ENTRIES - 1)];
+    while (   pCur
+           && pCur->PspAddrStart <= PspAddr)
+    {
+        if (PspAddr - pCur->PspAddrStart < pCur->cbRegion)
+            return pCur;
+
+        pCur = pCur->pNext;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Inserts the given memory region at the appropriate palce in the linked list
+ * and updates the lookup table.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ * @param   pMemRegion              The memory region to add.
+ */
+static int pspEmuCoreMemRegionInsert(PPSPCOREINT pThis, PPSPCOREMEMREGION pMemRegion)
+{
+    int rc = 0;
+    PPSPCOREMEMREGION pPrev = NULL;
+    PPSPCOREMEMREGION pCur = pThis->pMemRegionsHead;
+
+    /* Search where to insert the new device, sorted by starting MMIO address. */
+    while (pCur)
+    {
+        if (pCur->PspAddrStart > pMemRegion->PspAddrStart)
+            break;
+        pPrev = pCur;
+        pCur = pCur->pNext;
+    }
+
+    /* Do some sanity checks, the new range must not overlap with the previous and current range. */
+    if (   pMemRegion->cbRegion
+        && (uint64_t)pMemRegion->PspAddrStart + pMemRegion->cbRegion <= (uint64_t)UINT32_MAX + 1
+        && (   !pPrev
+            || pPrev->PspAddrStart + pPrev->cbRegion <= pMemRegion->PspAddrStart)
+        && (   !pCur
+            || pMemRegion->PspAddrStart + pMemRegion->cbRegion <= pCur->PspAddrStart))
+    {
+        uint32_t idxPageFirst = pMemRegion->PspAddrStart >> PSP_PAGE_SHIFT;
+        uint32_t idxPageLast  = (uint32_t)(((uint64_t)pMemRegion->PspAddrStart + pMemRegion->cbRegion - 1) >> PSP_PAGE_SHIFT);
+
+        /* Make sure all second level tables exist before changing anything. */
+        for (uint32_t idxPage = idxPageFirst;
+             idxPage <= idxPageLast && !rc;
+             idxPage += PSP_CORE_MEM_LOOKUP_L2_ENTRIES - (idxPage & (PSP_CORE_MEM_LOOKUP_L2_ENTRIES - 1)))
+        {
+            if (!pspEmuCoreMemLookupEntryGet(pThis, idxPage, true /*fAlloc*/))
+                rc = STS_ERR_NO_MEMORY;
+        }
+
+        if (!rc)
+        {
+            pMemRegion->pNext = pCur;
+            if (pPrev)
+                pPrev->pNext = pMemRegion;
+            else
+                pThis->pMemRegionsHead = pMemRegion;
+
+            /* Only the lowest region sharing a page is recorded in the lookup table. */
+            for (uint32_t idxPage = idxPageFirst; idxPage <= idxPageLast; idxPage++)
+            {
+                PPSPCOREMEMREGION *ppEntry = pspEmuCoreMemLookupEntryGet(pThis, idxPage, false /*fAlloc*/);
+                if (   !*ppEntry
+                    || (*ppEntry)->PspAddrStart > pMemRegion->PspAddrStart)
+                    *ppEntry = pMemRegion;
+            }
+        }
+    }
+    else
+        rc = -1;
+
+    return rc;
+}
+
+
+/**
+ * Finds the region assigned to the given region bounadries, unlinks and returns or returns
+ * NULL if there is nothing assigned.
+ *
+ * @returns Pointer to the unlinked region or NULL if not found.
+ * @param   pThis                   The PSP core instance.
+ * @param   PspAddr                 The physical PSP address to look for.
+ * @param   cbRegion                Size of the region.
+ */
+static PPSPCOREMEMREGION pspEmuCoreMemRegionFindAndUnlinkByAddr(PPSPCOREINT pThis, PSPADDR PspAddr, size_t cbRegion)
+{
+    PPSPCOREMEMREGION pPrev = NULL;
+    PPSPCOREMEMREGION pRegion = pThis->pMemRegionsHead;
+    while (   pRegion
+           && pRegion->PspAddrStart < PspAddr)
+    {
+        pPrev = pRegion;
+        pRegion = pRegion->pNext;
+    }
+
+    if (   pRegion
+        && pRegion->PspAddrStart == PspAddr
+        && pRegion->cbRegion == cbRegion)
+    {
+        /*
+         * Hand over the pages to the next region if it shares the page,
+         * this works because the list is sorted and regions don't overlap.
+         */
+        uint32_t idxPageFirst = pRegion->PspAddrStart >> PSP_PAGE_SHIFT;
+        uint32_t idxPageLast  = (uint32_t)(((uint64_t)pRegion->PspAddrStart + pRegion->cbRegion - 1) >> PSP_PAGE_SHIFT);
+        PPSPCOREMEMREGION pNext = pRegion->pNext;
+        for (uint32_t idxPage = idxPageFirst; idxPage <= idxPageLast; idxPage++)
+        {
+            PPSPCOREMEMREGION *ppEntry = pspEmuCoreMemLookupEntryGet(pThis, idxPage, false /*fAlloc*/);
+            if (*ppEntry == pRegion)
+                *ppEntry =    pNext
+                           && pNext->PspAddrStart >> PSP_PAGE_SHIFT == idxPage
+                         ? pNext
+                         : NULL;
+        }
+
+        if (pPrev)
+            pPrev->pNext = pNext;
+        else
+            pThis->pMemRegionsHead = pNext;
+        return pRegion;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Unregisters all memory regions from unicorn.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ */
+static int pspEmuCoreMemRegionsUnregisterAll(PPSPCOREINT pThis)
+{
+    PPSPCOREMEMREGION pMemCur = pThis->pMemRegionsHead;
+    while (pMemCur)
+    {
+        if (pMemCur->fMapped)
+        {
+            uc_err rcUc = uc_mem_unmap(pThis->pUcEngine, pMemCur->PspAddrStart, pMemCur->cbRegion);
+            /** @todo assert(rcUrc == UC_ERR_OK) */
+            pMemCur->fMapped = false;
+        }
+        pMemCur = pMemCur->pNext;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Converts our own protection flags to unicorn flags.
+ *
+ * @returns Unicorn protection flag mask.
+ * @param   fProt                   The protection flags to convert.
+ */
+static int32_t pspEmuCoreMemRegionProt2UcProt(uint32_t fProt)
+{
+    int32_t fUcProt = 0;
+
+    if (fProt & PSPEMU_CORE_MEM_REGION_PROT_F_EXEC)
+        fUcProt |= UC_PROT_EXEC;
+    if (fProt & PSPEMU_CORE_MEM_REGION_PROT_F_READ)
+        fUcProt |= UC_PROT_READ;
+    if (fProt & PSPEMU_CORE_MEM_REGION_PROT_F_WRITE)
+        fUcProt |= UC_PROT_WRITE;
+
+    return fUcProt;
+}
+
+
+/**
+ * Maps a given memory region directly into unicorn.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ * @param   pMemRegion              The memory region to map.
+ */
+static int pspEmuCoreMemRegionMap(PPSPCOREINT pThis, PPSPCOREMEMREGION pMemRegion)
+{
+    int rc = 0;
+    uc_err rcUc;
+
+    if (pMemRegion->fMmio)
+        rcUc = uc_mmio_map(pThis->pUcEngine, pMemRegion->PspAddrStart, pMemRegion->cbRegion,
+                           pspEmuCoreMmioRead, pspEmuCoreMmioWrite, pMemRegion);
+    else
+    {
+        /* While page accesses are tracked every access type is granted per page on the first protection fault. */
+        int32_t fUcProt = UC_PROT_NONE;
+        if (!pThis->pfnMemAccess)
+            fUcProt = pspEmuCoreMemRegionProt2UcProt(pMemRegion->u.Ram.fProt);
+        else if (pMemRegion->u.Ram.pbPgUcProt)
+            memset(pMemRegion->u.Ram.pbPgUcProt, 0, pMemRegion->cbRegion / PSP_PAGE_SIZE);
+        rcUc = uc_mem_map_ptr(pThis->pUcEngine, pMemRegion->PspAddrStart, pMemRegion->cbRegion,
+                              fUcProt, pMemRegion->u.Ram.pvBacking);
+    }
+
+    if (rcUc == UC_ERR_OK)
+        pMemRegion->fMapped = true;
+    else
+        rc = pspEmuCoreErrConvertFromUcErr(rcUc);
+
+    return rc;
+}
+
+
+/**
+ * Unregisters all physical memory regions with unicorn.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ */
+static int pspEmuCoreMemRegionsRegisterAll(PPSPCOREINT pThis)
+{
+    int rc = 0;
+    PPSPCOREMEMREGION pMemCur = pThis->pMemRegionsHead;
+    while (   pMemCur
+           && !rc)
+    {
+        rc = pspEmuCoreMemRegionMap(pThis, pMemCur);
+        pMemCur = pMemCur->pNext;
+    }
+
+    return rc;
+}
+
+
+/**
+ * Inserts the given MMU mapping at the appropriate place in the linked list.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ * @param   pMmuMap                 The MMU mapping to add.
+ */
+static int pspEmuCoreMmuMappingInsert(PPSPCOREINT pThis, PPSPCOREMMUMAP pMmuMap)
+{
+    int rc = 0;
+    PPSPCOREMMUMAP pPrev = NULL;
+    PPSPCOREMMUMAP pCur  = pThis->pMmuMappingsHead;
+
+    /* Search where to insert the new device, sorted by starting MMIO address. */
+    while (pCur)
+    {
+        if (pCur->PspAddrVStart > pMmuMap->PspAddrVStart)
+            break;
+        pPrev = pCur;
+        pCur = pCur->pNext;
+    }
+
+    /* Do some sanity checks, the new range must not overlap with the previous and current range. */
+    if (   (   !pPrev
+            || pPrev->PspAddrVStart + pPrev->cbRegion <= pMmuMap->PspAddrVStart)
+        && (   !pCur
+            || pMmuMap->PspAddrVStart + pMmuMap->cbRegion <= pCur->PspAddrVStart))
+    {
+        pMmuMap->pNext = pCur;
+        if (pPrev)
+            pPrev->pNext = pMmuMap;
+        else
+            pThis->pMmuMappingsHead = pMmuMap;
+    }
+    else
+        rc = -1;
+
+    return rc;
+}
+
+
+/**
+ * Queries the root of the page tables, i.e. the physical address where the L1 table is located.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ * @param   pPspAddrPbTblL1         WHere to store the physical address of the L1 page table start on success.
+ */
+static int pspEmuCoreMmuPgTblQueryRoot(PPSPCOREINT pThis, PSPPADDR *pPspPAddrPgTblL1)
+{
+    int rc = STS_INF_SUCCESS;
+
+    /* Get TTBR0 . */
+    PPSPCORECPBANK pCpBank = pspEmuCoreCpGetBank(pThis);
+    uint32_t uN = pCpBank->u32RegTtbcr & 0x7;
+    PSPPADDR PhysAddrPgTbl = pCpBank->u32RegTtbr0;
+
+    /* Extract the physical L1 address using the read boundary size. */
+    *pPspPAddrPgTblL1 = PhysAddrPgTbl & ~(uint32_t)(0x3fff >> uN);
+
+    return rc;
+}
+
+
+/**
+ * Returns the memory range where page tables are located (this can also cover memory which
+ * doesn't contain page tables).
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ * @param   pPspPAddrPgTblStart     Where to store the physical address of the start of the page tables on success.
+ * @param   pcbPgTbl                Size of the memory region containing the page tables on success.
+ */
+static int pspEmuCoreMmuPgTblQueryRange(PPSPCOREINT pThis, PSPPADDR *pPspPAddrPgTblStart, size_t *pcbPgTbl)
+{
+    PSPPADDR PhysAddrPgTbl = 0;
+    int rc = pspEmuCoreMmuPgTblQueryRoot(pThis, &PhysAddrPgTbl);
+    if (!rc)
+    {
+        uint32_t au32Tbl[32/*4096*/];
+
+        rc = PSPEmuCoreMemRead(pThis, PhysAddrPgTbl, &au32Tbl[0], sizeof(au32Tbl));
+        if (!rc)
+        {
+            PSPPADDR PhysAddrStart = PhysAddrPgTbl;
+            PSPPADDR PhysAddrEnd   = PhysAddrStart + sizeof(au32Tbl);
+
+            for (uint32_t i = 0; i < ELEMENTS(au32Tbl) && !rc; i++)
+            {
+                if ((au32Tbl[i] & 0x3) == 0x1) /* Only page table entries contain a L2 table. */
+                {
+                    PSPPADDR PhysAddrL2 = au32Tbl[i] & 0xfffffc00;
+
+                    if (PhysAddrL2 < PhysAddrStart)
+                        PhysAddrStart = PhysAddrL2;
+                    else if (PhysAddrL2 > PhysAddrEnd)
+                        PhysAddrEnd = PhysAddrL2 + _1K;
+                }
+            }
+
+            *pPspPAddrPgTblStart = PhysAddrStart;
+            *pcbPgTbl = PhysAddrEnd - PhysAddrStart;
+        }
+    }
 
-    PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE,
-                            "CO-PROC READ: uCp=%u uCrn=%u uCrm=%u uOpc1=%u uOpc2=%u u64Val=%#llx fHandled=%u\n",
-                            uCp, uCrn, uCrm, uOpc1, uOpc2, *pu64Val, fHandled);
-    return fHandled;
+    return rc;
 }
 
 
 /**
- * The CPSR write callback.
+ * Returns the physical address the given L2 descriptor points to.
  *
- * @returns nothing.
- * @param   pUcEngine           Pointer to the unicorn engine instance.
- * @param   uAddrPc             The PC causing the write.
- * @param   u32Val              The new CPSR value.
- * @param   pvUser              Opaque user data passed when adding the hook.
+ * @returns Page aligned physical address.
+ * @param   u32L2Desc               The L2 descriptor.
+ * @param   idxL2                   Index in the L2 table where the descriptor is stored.
  */
-static void pspEmuCoreCpsrChangeWrapper(struct uc_struct *pUcEngine, uint64_t uAddrPc, uint32_t u32Val, void *pvUser)
+static inline PSPPADDR pspEmuCoreMmuPgTblL2GetPhysAddrFromDesc(uint32_t u32L2Desc, uint32_t idxL2)
 {
-    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
+    if ((u32L2Desc & 0x2) == 0x2)
+        return u32L2Desc & 0xfffff000;
+    else if ((u32L2Desc & 0x3) == 0x1)
+        return (u32L2Desc & 0xffff0000) + (idxL2 % 16) * _4K;
 
-    PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE, "pspEmuCoreCpsrChangeWrapper: u32Val=%#x\n", u32Val);
+    /* Not present entry. */
+    return 0xffffffff;
+}
 
-    PSPCOREMODE enmCoreMode = pspEmuCoreModeFromCpsr(u32Val);
-    if (pThis->enmCoreMode != enmCoreMode)
-    {
-        /* We need to stop emulation and rearrange the MMU when we switch in and out of monitor mode. */
-        //printf("%#llx Switching from mode %s to %s\n", uAddrPc, pspEmuCoreModeToStr(pThis->enmCoreMode),
-        //       pspEmuCoreModeToStr(enmCoreMode));
-        if (   (   pThis->enmCoreMode == PSPCOREMODE_MON
-                || enmCoreMode == PSPCOREMODE_MON)
-            && (pThis->Cp15.u32RegScr & BIT(0)))
-        {
-            pThis->fMmuChanged = true;
-            uc_emu_stop(pUcEngine);
-        }
-        pThis->enmCoreMode = enmCoreMode;
-    }
 
-    pThis->u32RegCpsr = u32Val;
-    if ((u32Val & (BIT(7) | BIT(6))) != 0xc0)
-        pspEmuCoreIrqCheckAndInject(pThis, (PSPVADDR)uAddrPc, false /*fWait*/);
+/**
+ * Returns the attributes of the given L2 descriptor, used to check whether adjacent entries can be
+ * mapped in one go.
+ *
+ * @returns Attribute bits including the descriptor type.
+ * @param   u32L2Desc               The L2 descriptor.
+ */
+static inline uint32_t pspEmuCoreMmuPgTblL2GetAttrFromDesc(uint32_t u32L2Desc)
+{
+    if ((u32L2Desc & 0x2) == 0x2)
+        return u32L2Desc & 0xfff;
+
+    /* Large page or not present entry. */
+    return u32L2Desc & 0xffff;
 }
 
 
 /**
- * Execute any injected SVC handlers before possibly passing control to the supervisor code.
+ * Tries to resolve a given virtual PSP address to a physical one - page aligned version.
  *
  * @returns Status code.
- * @param   pThis               The PSP emulation code instance.
- * @param   PspAddrSvc          Address of the instruction coming after the SVC instruction.
- * @param   fThumb              Flag whether the core is currently executing in thumb mode.
- * @param   pfSwitchToSvc       Where to store the flag whether to switch to supervisor mode after all
- *                              handlers where executed.
+ * @param   pThis                   The PSP core instance.
+ * @param   PspVAddrPg              Page aligned virtual PSP address.
+ * @param   pPspPAddrPg             Where to store the physical address on success.
+ * @param   pcbRegion               Where to store the size of the resolved physical memory region on success.
+ * @param   penmPgTblWalk           Where to store information on the page table walk, optional.
+ *
+ * @todo Extract access permissions.
  */
-static int pspEmuCoreSvcBefore(PPSPCOREINT pThis, PSPADDR PspAddrPc, bool fThumb, bool *pfSwitchToSvc)
+static int pspEmuCoreMmuPAddrQueryFromVAddrPageAligned(PPSPCOREINT pThis, PSPVADDR PspVAddrPg, PSPPADDR *pPspPAddrPg, size_t *pcbRegion,
+                                                       PPSPCOREPGTBLWALKSTS penmPgTblWalk)
 {
-    int rc = 0;
-    bool fHandled = false; /* Default is to switch to supervisor mode in case there is nothing injected. */
-
-    if (pThis->pSvcReg)
+    PSPPADDR PhysAddrPgTbl = 0;
+    int rc = pspEmuCoreMmuPgTblQueryRoot(pThis, &PhysAddrPgTbl);
+    if (!rc)
     {
-        uint32_t idxSyscall = 0;
-
-        if (fThumb)
-        {
-            uint16_t uInsnSvc;
-            uc_err rcUc = uc_mem_read(pThis->pUcEngine, PspAddrPc - 2, &uInsnSvc, sizeof(uInsnSvc));
-            if (rcUc == UC_ERR_OK)
-            {
-                if (((uInsnSvc >> 8) & 0xff) == 0xdf)
-                    idxSyscall = uInsnSvc & 0xff;
-                else
-                    rc = -1; /* Should never happen. */
-            }
-            else
-                rc = pspEmuCoreErrConvertFromUcErr(rcUc);
-        }
-        else
-        {
-            uint32_t uInsnSvc;
-            uc_err rcUc = uc_mem_read(pThis->pUcEngine, PspAddrPc - 4, &uInsnSvc, sizeof(uInsnSvc));
-            if (rcUc == UC_ERR_OK)
-            {
-                if (((uInsnSvc >> 24) & 0x0f) == 0xf)
-                    idxSyscall = uInsnSvc & 0xffffff;
-                else
-                    rc = -1; /* Should never happen. */
-            }
-            else
-                rc = pspEmuCoreErrConvertFromUcErr(rcUc);
-        }
+        uint32_t au32Tbl[4096];
 
+        rc = PSPEmuCoreMemRead(pThis, PhysAddrPgTbl, &au32Tbl[0], sizeof(au32Tbl));
         if (!rc)
         {
-            pThis->idxSvc = idxSyscall;
+            uint32_t idxL1 = PspVAddrPg >> PSP_PAGE_L1_IDX_SHIFT;
+            uint32_t idxL2 = (PspVAddrPg >> 12) & 0xff;
+            uint32_t u32L1Desc = au32Tbl[idxL1];
 
-            /* Any global handlers?. */
-            if (   pThis->pSvcReg->GlobalSvmc.pfnSvmcHnd
-                && pThis->pSvcReg->GlobalSvmc.fFlags & PSPEMU_CORE_SVMC_F_BEFORE)
-                fHandled = pThis->pSvcReg->GlobalSvmc.pfnSvmcHnd(pThis, idxSyscall, PSPEMU_CORE_SVMC_F_BEFORE, pThis->pvSvcUser);
+            if (penmPgTblWalk)
+                *penmPgTblWalk = PSPCOREPGTBLWALKSTS_L1;
 
-            /* Any per SVC handler set?. */
-            if (idxSyscall < pThis->pSvcReg->cSvmcDescs)
+            /* Coarse page table.*/
+            if ((u32L1Desc & 0x3) == 0x1)
             {
-                PCPSPCORESVMCDESC pSvcDesc = &pThis->pSvcReg->paSvmcDescs[idxSyscall];
-                if (   pSvcDesc->pfnSvmcHnd
-                    && pSvcDesc->fFlags & PSPEMU_CORE_SVMC_F_BEFORE)
-                    fHandled = pSvcDesc->pfnSvmcHnd(pThis, idxSyscall, PSPEMU_CORE_SVMC_F_BEFORE, pThis->pvSvcUser);
+                PSPPADDR PhysAddrL2 = u32L1Desc & 0xfffffc00;
+                rc = PSPEmuCoreMemRead(pThis, PhysAddrL2, &au32Tbl[0], _1K);
+                if (!rc)
+                {
+                    uint32_t u32L2Desc = au32Tbl[idxL2];
+                    PSPPADDR PhysAddrPg = pspEmuCoreMmuPgTblL2GetPhysAddrFromDesc(u32L2Desc, idxL2);
+                    if (PhysAddrPg != 0xffffffff)
+                    {
+                        /*
+                         * Include all following entries in the same table which are physically contiguous
+                         * and have the same attributes so the whole run can be mapped at once.
+                         */
+                        uint32_t fAttr = pspEmuCoreMmuPgTblL2GetAttrFromDesc(u32L2Desc);
+                        uint32_t idxL2Next = idxL2 + 1;
+                        PSPPADDR PhysAddrNext = PhysAddrPg + _4K;
+
+                        while (   idxL2Next < _1K / sizeof(uint32_t)
+                               && pspEmuCoreMmuPgTblL2GetPhysAddrFromDesc(au32Tbl[idxL2Next], idxL2Next) == PhysAddrNext
+                               && pspEmuCoreMmuPgTblL2GetAttrFromDesc(au32Tbl[idxL2Next]) == fAttr)
+                        {
+                            idxL2Next++;
+                            PhysAddrNext += _4K;
+                        }
+
+                        *pPspPAddrPg = PhysAddrPg;
+                        *pcbRegion   = (idxL2Next - idxL2) * _4K;
+                    }
+                    else
+                        rc = -1;
+                }
+
+                if (penmPgTblWalk)
+                    *penmPgTblWalk = PSPCOREPGTBLWALKSTS_L2;
+            }
+            else if (   (u32L1Desc & 0x2) == 0x2
+                     && (u32L1Desc & BIT(18)) == 0x0)
+            {
+                /* Section, the remainder of the section is contiguous. */
+                PSPPADDR PhysAddrSection = u32L1Desc & 0xfff00000;
+                *pPspPAddrPg = PhysAddrSection + idxL2 * _4K;
+                *pcbRegion   = _1M - idxL2 * _4K;
             }
+            else
+                rc = -1; /** @todo Support supersections. */
         }
     }
 
-    *pfSwitchToSvc = fHandled ? false : true;
-
     return rc;
 }
 
 
 /**
- * Execute any injected SVC handlers after control was passed to the supervisor code and control is about to
- * return to the code invoking the SVC.
+ * Tries to resolve a given virtual PSP address to a physical one.
  *
  * @returns Status code.
- * @param   pThis               The PSP emulation code instance.
+ * @param   pThis                   The PSP core instance.
+ * @param   PspVAddr                Virtual PSP address to resolve.
+ * @param   pPspPAddr               Where to store the physical address on success.
+ * @param   pcbRegion               Where to store the size of the resolved contiguous physical memory region on success.
+ * @param   penmPgTblWak            Where to store the information about the page table walk, optional.
+ *
+ * @todo Extract access permissions.
  */
-static int pspEmuCoreSvcAfter(PPSPCOREINT pThis)
+static int pspEmuCoreMmuPAddrQueryFromVAddr(PPSPCOREINT pThis, PSPVADDR PspVAddr, PSPPADDR *pPspPAddr, size_t *pcbRegion,
+                                            PPSPCOREPGTBLWALKSTS penmPgTblWalk)
 {
-    int rc = 0;
+    PSPVADDR PspVAddrPg = PspVAddr & ~(PSP_PAGE_SIZE - 1);
+    uint32_t offPg = PspVAddr & (PSP_PAGE_SIZE - 1);
 
-    if (pThis->pSvcReg)
+    int rc = pspEmuCoreMmuPAddrQueryFromVAddrPageAligned(pThis, PspVAddrPg, pPspPAddr, pcbRegion, penmPgTblWalk);
+    if (STS_SUCCESS(rc))
     {
-        /* Any global handlers?. */
-        if (   pThis->pSvcReg->GlobalSvmc.pfnSvmcHnd
-            && pThis->pSvcReg->GlobalSvmc.fFlags & PSPEMU_CORE_SVMC_F_AFTER)
-            pThis->pSvcReg->GlobalSvmc.pfnSvmcHnd(pThis, pThis->idxSvc, PSPEMU_CORE_SVMC_F_AFTER, pThis->pvSvcUser);
-
-        /* Any per SVC handler set?. */
-        if (pThis->idxSvc < pThis->pSvcReg->cSvmcDescs)
-        {
-            PCPSPCORESVMCDESC pSvcDesc = &pThis->pSvcReg->paSvmcDescs[pThis->idxSvc];
-            if (   pSvcDesc->pfnSvmcHnd
-                && pSvcDesc->fFlags & PSPEMU_CORE_SVMC_F_AFTER)
-                pSvcDesc->pfnSvmcHnd(pThis, pThis->idxSvc, PSPEMU_CORE_SVMC_F_AFTER, pThis->pvSvcUser);
-        }
+        *pPspPAddr |= offPg;
+        *pcbRegion -= offPg;
     }
 
     return rc;
@@ -1304,787 +3406,844 @@ static int pspEmuCoreSvcAfter(PPSPCOREINT pThis)
 
 
 /**
- * Execute any injected SMC handlers before possibly passing control to the monitor code.
+ * Returns whether a translation can be cached in the software TLB, which is only the case when all
+ * descriptors involved are in tracked page tables so any change to them invalidates the entry.
  *
- * @returns Status code.
- * @param   pThis               The PSP emulation code instance.
- * @param   PspAddrPc           Address of the instruction coming after the SMC instruction.
- * @param   fThumb              Flag whether the core is currently executing in thumb mode.
- * @param   pfSwitchToMon       Where to store the flag whether to switch to monitor mode after all
- *                              handlers where executed.
+ * @returns Flag whether the translation can be cached.
+ * @param   pThis                   The PSP core instance.
+ * @param   PspVAddrPg              The page aligned virtual address translated.
+ * @param   enmPgTblWalk            The page table walk status of the translation.
  */
-static int pspEmuCoreSmcBefore(PPSPCOREINT pThis, PSPADDR PspAddrPc, bool fThumb, bool *pfSwitchToMon)
+static bool pspEmuCoreMmuTlbIsCacheable(PPSPCOREINT pThis, PSPVADDR PspVAddrPg, PSPCOREPGTBLWALKSTS enmPgTblWalk)
 {
-    int rc = 0;
-    bool fHandled = false; /* Default is to switch to supervisor mode in case there is nothing injected. */
-
-    if (pThis->pSmcReg)
-    {
-        uint32_t idxCall = 0;
+    uint32_t idxL1 = PspVAddrPg >> PSP_PAGE_L1_IDX_SHIFT;
 
-        if (fThumb)
-        {
-            uint32_t uInsnSmc;
-            uc_err rcUc = uc_mem_read(pThis->pUcEngine, PspAddrPc - 4, &uInsnSmc, sizeof(uInsnSmc));
-            if (rcUc == UC_ERR_OK)
-            {
-                if ((uInsnSmc & 0xfff0ffff) == 0x8000f7f0)
-                    idxCall = (uInsnSmc >> 16) & 0xf;
-                else
-                    rc = -1; /* Should never happen. */
-            }
-            else
-                rc = pspEmuCoreErrConvertFromUcErr(rcUc);
-        }
-        else
-        {
-            uint32_t uInsnSmc;
-            uc_err rcUc = uc_mem_read(pThis->pUcEngine, PspAddrPc - 4, &uInsnSmc, sizeof(uInsnSmc));
-            if (rcUc == UC_ERR_OK)
-            {
-                if ((uInsnSmc & 0x0ffffff0) == 0x01600070)
-                    idxCall = uInsnSmc & 0xf;
-                else
-                    rc = -1; /* Should never happen. */
-            }
-            else
-                rc = pspEmuCoreErrConvertFromUcErr(rcUc);
-        }
-
-        if (!rc)
-        {
-            pThis->idxSmc = idxCall;
+    if (   pThis->fMmuPgTblTrackingStale
+        || idxL1 >= PSP_CORE_MMU_PGTBL_TRACK_L1_ENTRIES)
+        return false;
 
-            /* Any global handlers?. */
-            if (   pThis->pSmcReg->GlobalSvmc.pfnSvmcHnd
-                && pThis->pSmcReg->GlobalSvmc.fFlags & PSPEMU_CORE_SVMC_F_BEFORE)
-                fHandled = pThis->pSmcReg->GlobalSvmc.pfnSvmcHnd(pThis, idxCall, PSPEMU_CORE_SVMC_F_BEFORE, pThis->pvSmcUser);
+    bool fL1Tracked = false;
+    bool fL2Tracked = false;
+    PCPSPCOREPGTBLTRACK pCur = pThis->pMmuPgTblTrackingHead;
+    while (pCur)
+    {
+        if (!pCur->fL2PgTbl)
+            fL1Tracked = true;
+        else if (pCur->idxL1 == idxL1)
+            fL2Tracked = true;
 
-            /* Any per SVC handler set?. */
-            if (idxCall < pThis->pSmcReg->cSvmcDescs)
-            {
-                PCPSPCORESVMCDESC pSmcDesc = &pThis->pSmcReg->paSvmcDescs[idxCall];
-                if (   pSmcDesc->pfnSvmcHnd
-                    && pSmcDesc->fFlags & PSPEMU_CORE_SVMC_F_BEFORE)
-                    fHandled = pSmcDesc->pfnSvmcHnd(pThis, idxCall, PSPEMU_CORE_SVMC_F_BEFORE, pThis->pvSmcUser);
-            }
-        }
+        pCur = pCur->pNext;
     }
 
-    *pfSwitchToMon = fHandled ? false : true;
-
-    return rc;
+    return    fL1Tracked
+           && (   enmPgTblWalk != PSPCOREPGTBLWALKSTS_L2
+               || fL2Tracked);
 }
 
 
 /**
- * Execute any injected SMC handlers after control was passed to the supervisor code and control is about to
- * return to the code invoking the SVC.
+ * Tries to resolve a given virtual PSP address to a physical one going through the software TLB first.
  *
  * @returns Status code.
- * @param   pThis               The PSP emulation code instance.
+ * @param   pThis                   The PSP core instance.
+ * @param   PspVAddr                Virtual PSP address to resolve.
+ * @param   pPspPAddr               Where to store the physical address on success.
+ * @param   pcbRegion               Where to store the size of the resolved contiguous physical memory region on success.
+ * @param   penmPgTblWalk           Where to store the information about the page table walk, optional.
+ *
+ * @note Only meant for the host side accessors, the TLB has the same coherency as the unicorn MMU mappings
+ *       (page table tracking, host writes to tracked tables, TTBR/TTBCR/SCTLR writes, ASID changes and world
+ *       switches), see pspEmuCoreMmuTlbIsCacheable() for which translations get cached.
  */
-static int pspEmuCoreSmcAfter(PPSPCOREINT pThis)
+static int pspEmuCoreMmuPAddrQueryFromVAddrCached(PPSPCOREINT pThis, PSPVADDR PspVAddr, PSPPADDR *pPspPAddr, size_t *pcbRegion,
+                                                  PPSPCOREPGTBLWALKSTS penmPgTblWalk)
 {
-    int rc = 0;
-
-    if (pThis->pSmcReg)
+    PSPVADDR PspVAddrPg = PspVAddr & ~(PSP_PAGE_SIZE - 1);
+    uint32_t offPg = PspVAddr & (PSP_PAGE_SIZE - 1);
+    bool fSecure = pspEmuCoreIsSecure(pThis);
+    ARMASID idAsid = pspEmuCoreCpGetBank(pThis)->u32RegContextId;
+    PPSPCORETLBENTRY pTlbEntry = &pThis->aTlb[(PspVAddrPg >> PSP_PAGE_SHIFT) & (PSP_CORE_TLB_ENTRIES - 1)];
+
+    if (   pTlbEntry->fValid
+        && pTlbEntry->PspVAddrPg == PspVAddrPg
+        && pTlbEntry->idAsid == idAsid
+        && pTlbEntry->fSecure == fSecure)
     {
-        /* Any global handlers?. */
-        if (   pThis->pSmcReg->GlobalSvmc.pfnSvmcHnd
-            && pThis->pSmcReg->GlobalSvmc.fFlags & PSPEMU_CORE_SVMC_F_AFTER)
-            pThis->pSmcReg->GlobalSvmc.pfnSvmcHnd(pThis, pThis->idxSmc, PSPEMU_CORE_SVMC_F_AFTER, pThis->pvSmcUser);
+        pThis->cTlbHits++;
+        *pPspPAddr = pTlbEntry->PspPAddrPg | offPg;
+        *pcbRegion = pTlbEntry->cbRegion - offPg;
+        if (penmPgTblWalk)
+            *penmPgTblWalk = pTlbEntry->enmPgTblWalk;
+        return STS_INF_SUCCESS;
+    }
 
-        /* Any per SMC handler set?. */
-        if (pThis->idxSmc < pThis->pSmcReg->cSvmcDescs)
+    PSPPADDR PspPAddrPg = 0;
+    size_t cbRegion = 0;
+    PSPCOREPGTBLWALKSTS enmPgTblWalk = PSPCOREPGTBLWALKSTS_INVALID;
+
+    pThis->cTlbMisses++;
+    int rc = pspEmuCoreMmuPAddrQueryFromVAddrPageAligned(pThis, PspVAddrPg, &PspPAddrPg, &cbRegion, &enmPgTblWalk);
+    if (STS_SUCCESS(rc))
+    {
+        if (pspEmuCoreMmuTlbIsCacheable(pThis, PspVAddrPg, enmPgTblWalk))
         {
-            PCPSPCORESVMCDESC pSmcDesc = &pThis->pSvcReg->paSvmcDescs[pThis->idxSvc];
-            if (   pSmcDesc->pfnSvmcHnd
-                && pSmcDesc->fFlags & PSPEMU_CORE_SVMC_F_AFTER)
-                pSmcDesc->pfnSvmcHnd(pThis, pThis->idxSmc, PSPEMU_CORE_SVMC_F_AFTER, pThis->pvSmcUser);
+            pTlbEntry->fValid       = true;
+            pTlbEntry->fSecure      = fSecure;
+            pTlbEntry->idAsid       = idAsid;
+            pTlbEntry->PspVAddrPg   = PspVAddrPg;
+            pTlbEntry->PspPAddrPg   = PspPAddrPg;
+            pTlbEntry->cbRegion     = cbRegion;
+            pTlbEntry->enmPgTblWalk = enmPgTblWalk;
         }
+
+        *pPspPAddr = PspPAddrPg | offPg;
+        *pcbRegion = cbRegion - offPg;
     }
 
+    if (penmPgTblWalk)
+        *penmPgTblWalk = enmPgTblWalk;
+
     return rc;
 }
 
 
 /**
- * The after SVC trace hook called by unicorn.
+ * Returns the reverse map hash bucket index for the given physical page.
  *
- * @returns nothing.
- * @param   pUcEngine               The unicorn engine pointer.
- * @param   uAddr                   The address of the instruction triggering the hook.
- * @param   cbInsn                  Size of the instruction.
- * @param   pvUser                  Opaque user data.
+ * @returns Bucket index.
+ * @param   PspPAddrPg              The page aligned physical address.
  */
-static void pspEmuCoreSvcAfterHook(uc_engine *pUcEngine, uint64_t uAddr, uint32_t cbInsn, void *pvUser)
+static inline uint32_t pspEmuCoreMmuRevMapHashIdx(PSPPADDR PspPAddrPg)
 {
-    PPSPCOREINT pThis = (PPSPCOREINT)pvUser;
-
-    pspEmuCoreSvcAfter(pThis); /* Handle all after hooks. */
-
-    /* Delete the temporary unicorn hook. */
-    uc_err rcUc = uc_hook_del(pThis->pUcEngine, pThis->hUcHookSvcAfter);
-    /** @todo assert(rcUc == UC_ERR_OK) */
-    pThis->hUcHookSvcAfter = 0;
+    return (PspPAddrPg >> PSP_PAGE_SHIFT) & (PSP_CORE_REVMAP_HASH_ENTRIES - 1);
 }
 
 
 /**
- * Checks whether the instruction before the given address is a WFI instruction.
+ * Removes the given virtual page from the reverse map.
  *
- * @returns Flag whether a WFI instruction was detected.
- * @param   pThis               The PSP emulation core instance.
- * @param   PspAddrPc           The PC following the potential WFI instruction.
- * @param   fThumb              Flag whether we are in thumb state.
+ * @returns nothing.
+ * @param   pThis                   The PSP core instance.
+ * @param   idxVPg                  The virtual page index.
  */
-static bool pspEmuCoreInsnIsWfi(PPSPCOREINT pThis, PSPVADDR PspAddrPc, bool fThumb)
+static void pspEmuCoreMmuRevMapRemove(PPSPCOREINT pThis, uint32_t idxVPg)
 {
-    if (fThumb)
-    {
-        uint16_t u16Insn = 0;
-        int rc = PSPEmuCoreMemReadVirt(pThis, PspAddrPc - 2, &u16Insn, sizeof(u16Insn));
-        if (   STS_SUCCESS(rc)
-            && u16Insn == 0xbf30)
-            return true;
-    }
-    else
-    {
-        uint32_t u32Insn = 0;
-        int rc = PSPEmuCoreMemReadVirt(pThis, PspAddrPc - 4, &u32Insn, sizeof(u32Insn));
-        if (   STS_SUCCESS(rc)
-            && (   (u32Insn & 0x0fffffff) == 0x0320f003)
-                || (u32Insn & 0x0fffffff) == 0x0320f002) /* WFE, treated the same here for now */
-            return true;
-    }
+    PPSPCOREREVMAPENTRY pEntry = &pThis->paRevMap[idxVPg];
 
-    return false;
+    if (pEntry->PspPAddrPg == PSP_CORE_REVMAP_NIL)
+        return;
+
+    uint32_t *pidxCur = &pThis->aidxRevMapHash[pspEmuCoreMmuRevMapHashIdx(pEntry->PspPAddrPg)];
+    while (   *pidxCur != PSP_CORE_REVMAP_NIL
+           && *pidxCur != idxVPg)
+        pidxCur = &pThis->paRevMap[*pidxCur].idxNext;
+    if (*pidxCur == idxVPg)
+        *pidxCur = pEntry->idxNext;
+
+    pEntry->PspPAddrPg = PSP_CORE_REVMAP_NIL;
+    pEntry->idxNext    = PSP_CORE_REVMAP_NIL;
 }
 
 
 /**
- * Finds the region assigned to the given address or NULL if there is nothing assigned.
+ * Adds the given virtual page mapping to the reverse map, the page must not be mapped already.
  *
- * @returns Pointer to the region or NULL if not found.
+ * @returns nothing.
  * @param   pThis                   The PSP core instance.
- * @param   PspAddr                 The physical PSP address to look for.
- * @param   ppPrevRegion            Where to store the pointer to the previous region, optional.
+ * @param   idxVPg                  The virtual page index.
+ * @param   PspPAddrPg              The page aligned physical address mapped.
+ * @param   fSection                Flag whether the mapping is done through a section.
  */
-static PPSPCOREMEMREGION pspEmuCoreMemRegionFindByAddr(PPSPCOREINT pThis, PSPADDR PspAddr,
-                                                       PPSPCOREMEMREGION *ppPrevRegion)
+static void pspEmuCoreMmuRevMapAdd(PPSPCOREINT pThis, uint32_t idxVPg, PSPPADDR PspPAddrPg, bool fSection)
 {
-    if (   PspAddr < pThis->PspAddrMemLowest
-        || PspAddr > pThis->PspAddrMemHighest)
-        return NULL;
-
-    /* Slow path. */
-    PPSPCOREMEMREGION pPrev = NULL;
-    PPSPCOREMEMREGION pCur = pThis->pMemRegionsHead;
-    while (pCur)
-    {
-        if (   PspAddr >= pCur->PspAddrStart
-            && PspAddr < pCur->PspAddrStart + pCur->cbRegion)
-        {
-            if (ppPrevRegion)
-                *ppPrevRegion = pPrev;
-            return pCur;
-        }
-
-        pPrev = pCur;
-        pCur = pCur->pNext;
-    }
+    PPSPCOREREVMAPENTRY pEntry = &pThis->paRevMap[idxVPg];
+    uint32_t idxHash = pspEmuCoreMmuRevMapHashIdx(PspPAddrPg);
 
-    return NULL;
+    pEntry->PspPAddrPg = PspPAddrPg;
+    pEntry->fSection   = fSection;
+    pEntry->idxNext    = pThis->aidxRevMapHash[idxHash];
+    pThis->aidxRevMapHash[idxHash] = idxVPg;
 }
 
 
 /**
- * Inserts the given memory region at the appropriate palce in the linked list.
+ * Returns whether all page tables the reverse map is built from are tracked, so writes to them keep it up to date.
  *
- * @returns Status code.
+ * @returns Flag whether the reverse map can be kept up to date.
  * @param   pThis                   The PSP core instance.
- * @param   pMemRegion              The memory region to add.
  */
-static int pspEmuCoreMemRegionInsert(PPSPCOREINT pThis, PPSPCOREMEMREGION pMemRegion)
+static bool pspEmuCoreMmuRevMapIsTracked(PPSPCOREINT pThis)
 {
-    int rc = 0;
-    PPSPCOREMEMREGION pPrev = NULL;
-    PPSPCOREMEMREGION pCur = pThis->pMemRegionsHead;
+    if (pThis->fMmuPgTblTrackingStale)
+        return false;
 
-    /* Search where to insert the new device, sorted by starting MMIO address. */
+    PSPPADDR PhysAddrPgTbl = 0;
+    int rc = pspEmuCoreMmuPgTblQueryRoot(pThis, &PhysAddrPgTbl);
+    if (STS_FAILURE(rc))
+        return false;
+
+    uint32_t au32Tbl[PSP_CORE_REVMAP_L1_ENTRIES];
+    rc = PSPEmuCoreMemRead(pThis, PhysAddrPgTbl, &au32Tbl[0], sizeof(au32Tbl));
+    if (STS_FAILURE(rc))
+        return false;
+
+    bool fL1Tracked = false;
+    PCPSPCOREPGTBLTRACK pCur = pThis->pMmuPgTblTrackingHead;
     while (pCur)
     {
-        if (pCur->PspAddrStart > pMemRegion->PspAddrStart)
-            break;
-        pPrev = pCur;
+        if (!pCur->fL2PgTbl)
+            fL1Tracked = true;
         pCur = pCur->pNext;
     }
 
-    /* Do some sanity checks, the new range must not overlap with the previous and current range. */
-    if (   (   !pPrev
-            || pPrev->PspAddrStart + pPrev->cbRegion <= pMemRegion->PspAddrStart)
-        && (   !pCur
-            || pMemRegion->PspAddrStart + pMemRegion->cbRegion <= pCur->PspAddrStart))
+    if (   !fL1Tracked
+        || ELEMENTS(au32Tbl) > PSP_CORE_MMU_PGTBL_TRACK_L1_ENTRIES)
+        return false;
+
+    for (uint32_t i = 0; i < ELEMENTS(au32Tbl); i++)
     {
-        pMemRegion->pNext = pCur;
-        if (pPrev)
-            pPrev->pNext = pMemRegion;
-        else
-            pThis->pMemRegionsHead = pMemRegion;
+        if ((au32Tbl[i] & 0x3) == 0x1)
+        {
+            PSPPADDR PhysAddrL2 = au32Tbl[i] & 0xfffffc00;
 
-        /* Adjust the lowest and highest device range. */
-        if (pMemRegion->PspAddrStart < pThis->PspAddrMemLowest)
-            pThis->PspAddrMemLowest = pMemRegion->PspAddrStart;
-        if (pMemRegion->PspAddrStart + pMemRegion->cbRegion - 1 > pThis->PspAddrMemHighest)
-            pThis->PspAddrMemHighest = pMemRegion->PspAddrStart + pMemRegion->cbRegion - 1;
+            pCur = pThis->pMmuPgTblTrackingHead;
+            while (   pCur
+                   && (   !pCur->fL2PgTbl
+                       || pCur->idxL1 != i
+                       || pCur->PhysAddrPgTblStart != PhysAddrL2))
+                pCur = pCur->pNext;
+
+            if (!pCur)
+                return false;
+        }
     }
-    else
-        rc = -1;
 
-    return rc;
+    return true;
 }
 
 
 /**
- * Finds the region assigned to the given region bounadries, unlinks and returns or returns
- * NULL if there is nothing assigned.
+ * Rebuilds the reverse map from the current page tables.
  *
- * @returns Pointer to the unlinked region or NULL if not found.
+ * @returns Status code.
  * @param   pThis                   The PSP core instance.
- * @param   PspAddr                 The physical PSP address to look for.
- * @param   cbRegion                Size of the region.
  */
-static PPSPCOREMEMREGION pspEmuCoreMemRegionFindAndUnlinkByAddr(PPSPCOREINT pThis, PSPADDR PspAddr, size_t cbRegion)
+static int pspEmuCoreMmuRevMapBuild(PPSPCOREINT pThis)
 {
-    PPSPCOREMEMREGION pPrev = NULL;
-    PPSPCOREMEMREGION pRegion = pspEmuCoreMemRegionFindByAddr(pThis, PspAddr, &pPrev);
-    if (   pRegion
-        && pRegion->PspAddrStart == PspAddr
-        && pRegion->cbRegion == cbRegion)
+    if (!pThis->paRevMap)
     {
-        if (pPrev)
-            pPrev->pNext = pRegion->pNext;
-        else
-            pThis->pMemRegionsHead = pRegion->pNext;
-        return pRegion;
+        pThis->paRevMap = (PPSPCOREREVMAPENTRY)calloc(PSP_CORE_REVMAP_VPAGES, sizeof(*pThis->paRevMap));
+        if (!pThis->paRevMap)
+            return STS_ERR_NO_MEMORY;
     }
 
-    return NULL;
-}
-
+    for (uint32_t i = 0; i < PSP_CORE_REVMAP_VPAGES; i++)
+    {
+        pThis->paRevMap[i].PspPAddrPg = PSP_CORE_REVMAP_NIL;
+        pThis->paRevMap[i].idxNext    = PSP_CORE_REVMAP_NIL;
+    }
+    for (uint32_t i = 0; i < ELEMENTS(pThis->aidxRevMapHash); i++)
+        pThis->aidxRevMapHash[i] = PSP_CORE_REVMAP_NIL;
 
-/**
- * Unregisters all memory regions from unicorn.
- *
- * @returns Status code.
- * @param   pThis                   The PSP core instance.
- */
-static int pspEmuCoreMemRegionsUnregisterAll(PPSPCOREINT pThis)
-{
-    PPSPCOREMEMREGION pMemCur = pThis->pMemRegionsHead;
-    while (pMemCur)
+    PSPPADDR PhysAddrPgTbl = 0;
+    int rc = pspEmuCoreMmuPgTblQueryRoot(pThis, &PhysAddrPgTbl);
+    if (!rc)
     {
-        if (pMemCur->fMapped)
+        uint32_t au32Tbl[PSP_CORE_REVMAP_L1_ENTRIES];
+
+        rc = PSPEmuCoreMemRead(pThis, PhysAddrPgTbl, &au32Tbl[0], sizeof(au32Tbl));
+        for (uint32_t i = 0; i < ELEMENTS(au32Tbl) && !rc; i++)
         {
-            uc_err rcUc = uc_mem_unmap(pThis->pUcEngine, pMemCur->PspAddrStart, pMemCur->cbRegion);
-            /** @todo assert(rcUrc == UC_ERR_OK) */
-            pMemCur->fMapped = false;
+            if ((au32Tbl[i] & 0x3) == 0x1)
+            {
+                PSPPADDR PhysAddrL2 = au32Tbl[i] & 0xfffffc00;
+                uint32_t au32TblL2[1024 / sizeof(uint32_t)];
+
+                rc = PSPEmuCoreMemRead(pThis, PhysAddrL2, &au32TblL2[0], sizeof(au32TblL2));
+                for (uint32_t idxL2 = 0; idxL2 < ELEMENTS(au32TblL2) && !rc; idxL2++)
+                {
+                    PSPPADDR PhysStart = pspEmuCoreMmuPgTblL2GetPhysAddrFromDesc(au32TblL2[idxL2], idxL2);
+                    if (PhysStart != 0xffffffff)
+                        pspEmuCoreMmuRevMapAdd(pThis, i * ELEMENTS(au32TblL2) + idxL2, PhysStart, false /*fSection*/);
+                }
+            }
+            else if (   (au32Tbl[i] & 0x2) == 0x2
+                     && (au32Tbl[i] & BIT(18)) == 0x0)
+            {
+                PSPPADDR PhysStartSection = au32Tbl[i] & 0xfff00000;
+
+                for (uint32_t idxPg = 0; idxPg < _1M / _4K; idxPg++)
+                    pspEmuCoreMmuRevMapAdd(pThis, i * (_1M / _4K) + idxPg, PhysStartSection + idxPg * _4K, true /*fSection*/);
+            }
+            else if ((au32Tbl[i] & 0x3) != 0x0)
+                printf("No support for super sections right now %#x!\n", au32Tbl[i]);
         }
-        pMemCur = pMemCur->pNext;
     }
 
-    return 0;
+    /*
+     * Keep the map around only if writes to all tables are seen, otherwise it is rebuilt on the next lookup.
+     * While the tracking gets set up nothing can change the page tables.
+     */
+    if (!rc)
+        pThis->fRevMapValid =    pThis->fMmuPgTblTrackingSetup
+                              || pspEmuCoreMmuRevMapIsTracked(pThis);
+
+    return rc;
 }
 
 
 /**
- * Converts our own protection flags to unicorn flags.
+ * Updates the reverse map after a L2 descriptor changed.
  *
- * @returns Unicorn protection flag mask.
- * @param   fProt                   The protection flags to convert.
+ * @returns nothing.
+ * @param   pThis                   The PSP core instance.
+ * @param   idxL1                   Index of the L1 descriptor referencing the L2 table.
+ * @param   idxL2                   Index of the changed descriptor in the L2 table.
+ * @param   u32L2DescNew            The new descriptor value.
  */
-static int32_t pspEmuCoreMemRegionProt2UcProt(uint32_t fProt)
+static void pspEmuCoreMmuRevMapL2DescUpdate(PPSPCOREINT pThis, uint32_t idxL1, uint32_t idxL2, uint32_t u32L2DescNew)
 {
-    int32_t fUcProt = 0;
+    if (   !pThis->fRevMapValid
+        || idxL1 >= PSP_CORE_REVMAP_L1_ENTRIES)
+        return;
 
-    if (fProt & PSPEMU_CORE_MEM_REGION_PROT_F_EXEC)
-        fUcProt |= UC_PROT_EXEC;
-    if (fProt & PSPEMU_CORE_MEM_REGION_PROT_F_READ)
-        fUcProt |= UC_PROT_READ;
-    if (fProt & PSPEMU_CORE_MEM_REGION_PROT_F_WRITE)
-        fUcProt |= UC_PROT_WRITE;
+    uint32_t idxVPg = idxL1 * (_1M / _4K) + idxL2;
+    pspEmuCoreMmuRevMapRemove(pThis, idxVPg);
 
-    return fUcProt;
+    PSPPADDR PhysStart = pspEmuCoreMmuPgTblL2GetPhysAddrFromDesc(u32L2DescNew, idxL2);
+    if (PhysStart != 0xffffffff)
+        pspEmuCoreMmuRevMapAdd(pThis, idxVPg, PhysStart, false /*fSection*/);
 }
 
 
 /**
- * Maps a given memory region directly into unicorn.
+ * Tries to resolve a given physical PSP address to a virtual one.
  *
  * @returns Status code.
  * @param   pThis                   The PSP core instance.
- * @param   pMemRegion              The memory region to map.
+ * @param   PspPAddr                Physical PSP address.
+ * @param   cbPhysRegion            The physical region size.
+ * @param   pPspVAddr               Where to store the virtual address on success.
+ * @param   pcbRegion               Where to store the size of the resolved contiguous virtual memory region on success.
+ * @param   pidxL1                  The L1 index to continue the search from, updated on success.
+ * @param   pidxL2                  The L2 index to continue the search from, updated on success.
+ *
+ * @note Mappings are returned in page table order, the lookup goes through the reverse map which is
+ *       rebuilt lazily and kept up to date by the page table write tracking.
  */
-static int pspEmuCoreMemRegionMap(PPSPCOREINT pThis, PPSPCOREMEMREGION pMemRegion)
+static int pspEmuCoreMmuVAddrQueryFromPAddr(PPSPCOREINT pThis, PSPPADDR PspPAddr, size_t cbPhysRegion,
+                                            PSPVADDR *pPspVAddr, size_t *pcbRegion,
+                                            uint32_t *pidxL1, uint32_t *pidxL2)
 {
-    int rc = 0;
-    uc_err rcUc;
+    PSPPADDR PspPAddrPg = PspPAddr & ~(PSP_PAGE_SIZE - 1);
+    PSPPADDR offPg = PspPAddr - PspPAddrPg;
+    const uint32_t cL2Entries = _1M / _4K;
 
-    if (pMemRegion->fMmio)
-        rcUc = uc_mmio_map(pThis->pUcEngine, pMemRegion->PspAddrStart, pMemRegion->cbRegion,
-                           pspEmuCoreMmioRead, pspEmuCoreMmioWrite, pMemRegion);
-    else
+    if (!pThis->fRevMapValid)
     {
-        int32_t fUcProt = pspEmuCoreMemRegionProt2UcProt(pMemRegion->u.Ram.fProt);
-        rcUc = uc_mem_map_ptr(pThis->pUcEngine, pMemRegion->PspAddrStart, pMemRegion->cbRegion,
-                              fUcProt, pMemRegion->u.Ram.pvBacking);
+        int rc = pspEmuCoreMmuRevMapBuild(pThis);
+        if (STS_FAILURE(rc))
+            return rc;
     }
 
-    if (rcUc == UC_ERR_OK)
-        pMemRegion->fMapped = true;
+    /* Find the first mapping at or after the given position, sections are ordered by their L1 index only. */
+    uint32_t idxKeyStart = *pidxL1 * cL2Entries + *pidxL2;
+    uint32_t idxKeyBest  = PSP_CORE_REVMAP_NIL;
+    uint32_t idxVPgBest  = PSP_CORE_REVMAP_NIL;
+    uint32_t idxVPg      = pThis->aidxRevMapHash[pspEmuCoreMmuRevMapHashIdx(PspPAddrPg)];
+    while (idxVPg != PSP_CORE_REVMAP_NIL)
+    {
+        PCPSPCOREREVMAPENTRY pEntry = &pThis->paRevMap[idxVPg];
+        if (pEntry->PspPAddrPg == PspPAddrPg)
+        {
+            uint32_t idxKey = pEntry->fSection ? idxVPg - (idxVPg % cL2Entries) : idxVPg;
+            if (   idxKey >= idxKeyStart
+                && (   idxKeyBest == PSP_CORE_REVMAP_NIL
+                    || idxKey < idxKeyBest))
+            {
+                idxKeyBest = idxKey;
+                idxVPgBest = idxVPg;
+            }
+        }
+
+        idxVPg = pEntry->idxNext;
+    }
+
+    if (idxVPgBest == PSP_CORE_REVMAP_NIL)
+        return -1;
+
+    uint32_t idxL1 = idxVPgBest / cL2Entries;
+    uint32_t idxL2 = idxVPgBest % cL2Entries;
+    if (pThis->paRevMap[idxVPgBest].fSection)
+    {
+        *pPspVAddr = (idxL1 * _1M + idxL2 * _4K) | offPg;
+        *pcbRegion = MIN(cbPhysRegion, _1M);
+        *pidxL1 = idxL1 + 1;
+        *pidxL2 = 0;
+    }
     else
-        rc = pspEmuCoreErrConvertFromUcErr(rcUc);
+    {
+        /* Check for adjacent regions. */
+        PSPVADDR PspVAddrStart = idxL1 * _1M + idxL2 * _4K;
+        size_t cbVRegion = _4K;
+
+        idxL2++;
+        PspPAddrPg += _4K;
+        while (   idxL2 < cL2Entries
+               && cbVRegion < cbPhysRegion)
+        {
+            PCPSPCOREREVMAPENTRY pEntry = &pThis->paRevMap[idxL1 * cL2Entries + idxL2];
+            if (   pEntry->fSection
+                || pEntry->PspPAddrPg != PspPAddrPg)
+                break;
+            cbVRegion  += _4K;
+            PspPAddrPg += _4K;
+            idxL2++;
+        }
+
+        *pPspVAddr = PspVAddrStart | offPg;
+        *pcbRegion = MIN(cbPhysRegion, cbVRegion);
+        *pidxL1 = idxL1;
+        *pidxL2 = idxL2;
+    }
 
-    return rc;
+    return 0;
 }
 
 
 /**
- * Unregisters all physical memory regions with unicorn.
+ * Unicorn MMIO read wrapper for the MMU enabled case.
  *
- * @returns Status code.
- * @param   pThis                   The PSP core instance.
+ * @returns Data read.
+ * @param   pUcEngine               The unicorn engine pointer.
+ * @param   pvUser                  Opaque user data.
+ * @param   uAddr                   MMIO address read.
+ * @param   cbInsn                  Size of the read (1, 2, 4 or 8 bytes).
  */
-static int pspEmuCoreMemRegionsRegisterAll(PPSPCOREINT pThis)
+static uint64_t pspEmuCoreMmuMapMmioRead(struct uc_struct* pUcEngine, void *pvUser, uint64_t uAddr, unsigned cb)
 {
-    int rc = 0;
-    PPSPCOREMEMREGION pMemCur = pThis->pMemRegionsHead;
-    while (   pMemCur
-           && !rc)
-    {
-        rc = pspEmuCoreMemRegionMap(pThis, pMemCur);
-        pMemCur = pMemCur->pNext;
-    }
+    PCPSPCOREMMUMAP pMmuMap = (PCPSPCOREMMUMAP)pvUser;
 
-    return rc;
+    /* The address is from the start of our MMU mapping. */
+    PSPADDR offPhys = pMmuMap->offPhysMap + (uint32_t)uAddr;
+    return pspEmuCoreMmioRead(pUcEngine, (void *)pMmuMap->pMemRegion, offPhys, cb);
 }
 
 
 /**
- * Inserts the given MMU mapping at the appropriate place in the linked list.
+ * Unicorn MMIO write wrapper for the MMU enabled case.
  *
- * @returns Status code.
- * @param   pThis                   The PSP core instance.
- * @param   pMmuMap                 The MMU mapping to add.
+ * @returns nothing.
+ * @param   pUcEngine               The unicorn engine pointer.
+ * @param   pvUser                  Opaque user data.
+ * @param   uAddr                   MMIO address written.
+ * @param   uVal                    Value written.
+ * @param   cbInsn                  Size of the write (1, 2, 4 or 8 bytes).
  */
-static int pspEmuCoreMmuMappingInsert(PPSPCOREINT pThis, PPSPCOREMMUMAP pMmuMap)
+static void pspEmuCoreMmuMapMmioWrite(struct uc_struct* pUcEngine, void *pvUser, uint64_t uAddr, uint64_t uVal, unsigned cb)
 {
-    int rc = 0;
-    PPSPCOREMMUMAP pPrev = NULL;
-    PPSPCOREMMUMAP pCur  = pThis->pMmuMappingsHead;
-
-    /* Search where to insert the new device, sorted by starting MMIO address. */
-    while (pCur)
-    {
-        if (pCur->PspAddrVStart > pMmuMap->PspAddrVStart)
-            break;
-        pPrev = pCur;
-        pCur = pCur->pNext;
-    }
-
-    /* Do some sanity checks, the new range must not overlap with the previous and current range. */
-    if (   (   !pPrev
-            || pPrev->PspAddrVStart + pPrev->cbRegion <= pMmuMap->PspAddrVStart)
-        && (   !pCur
-            || pMmuMap->PspAddrVStart + pMmuMap->cbRegion <= pCur->PspAddrVStart))
-    {
-        pMmuMap->pNext = pCur;
-        if (pPrev)
-            pPrev->pNext = pMmuMap;
-        else
-            pThis->pMmuMappingsHead = pMmuMap;
-    }
-    else
-        rc = -1;
+    PCPSPCOREMMUMAP pMmuMap = (PCPSPCOREMMUMAP)pvUser;
 
-    return rc;
+    /* The address is from the start of our MMU mapping. */
+    PSPADDR offPhys = pMmuMap->offPhysMap + (uint32_t)uAddr;
+    pspEmuCoreMmioWrite(pUcEngine, (void *)pMmuMap->pMemRegion, offPhys, uVal, cb);
 }
 
 
 /**
- * Queries the root of the page tables, i.e. the physical address where the L1 table is located.
+ * Flushes the whole software TLB.
  *
- * @returns Status code.
+ * @returns nothing.
  * @param   pThis                   The PSP core instance.
- * @param   pPspAddrPbTblL1         WHere to store the physical address of the L1 page table start on success.
  */
-static int pspEmuCoreMmuPgTblQueryRoot(PPSPCOREINT pThis, PSPPADDR *pPspPAddrPgTblL1)
+static void pspEmuCoreMmuTlbFlush(PPSPCOREINT pThis)
 {
-    int rc = STS_INF_SUCCESS;
-
-    /* Get TTBR0 . */
-    PPSPCORECPBANK pCpBank = pspEmuCoreCpGetBank(pThis);
-    uint32_t uN = pCpBank->u32RegTtbcr & 0x7;
-    PSPPADDR PhysAddrPgTbl = pCpBank->u32RegTtbr0;
-
-    /* Extract the physical L1 address using the read boundary size. */
-    *pPspPAddrPgTblL1 = PhysAddrPgTbl & ~(uint32_t)(0x3fff >> uN);
+    for (uint32_t i = 0; i < ELEMENTS(pThis->aTlb); i++)
+        pThis->aTlb[i].fValid = false;
 
-    return rc;
+    /* Anything invalidating the whole TLB changes the reverse mappings as well. */
+    pThis->fRevMapValid = false;
 }
 
 
 /**
- * Returns the memory range where page tables are located (this can also cover memory which
- * doesn't contain page tables).
+ * Invalidates all software TLB entries whose translated region overlaps the given virtual range.
  *
- * @returns Status code.
+ * @returns nothing.
  * @param   pThis                   The PSP core instance.
- * @param   pPspPAddrPgTblStart     Where to store the physical address of the start of the page tables on success.
- * @param   pcbPgTbl                Size of the memory region containing the page tables on success.
+ * @param   PspVAddrStart           Start of the virtual address range to invalidate.
+ * @param   cbRange                 Size of the range in bytes.
  */
-static int pspEmuCoreMmuPgTblQueryRange(PPSPCOREINT pThis, PSPPADDR *pPspPAddrPgTblStart, size_t *pcbPgTbl)
+static void pspEmuCoreMmuTlbInvalidateRange(PPSPCOREINT pThis, PSPVADDR PspVAddrStart, size_t cbRange)
 {
-    PSPPADDR PhysAddrPgTbl = 0;
-    int rc = pspEmuCoreMmuPgTblQueryRoot(pThis, &PhysAddrPgTbl);
-    if (!rc)
-    {
-        uint32_t au32Tbl[32/*4096*/];
-
-        rc = PSPEmuCoreMemRead(pThis, PhysAddrPgTbl, &au32Tbl[0], sizeof(au32Tbl));
-        if (!rc)
-        {
-            PSPPADDR PhysAddrStart = PhysAddrPgTbl;
-            PSPPADDR PhysAddrEnd   = PhysAddrStart + sizeof(au32Tbl);
-
-            for (uint32_t i = 0; i < ELEMENTS(au32Tbl) && !rc; i++)
-            {
-                if ((au32Tbl[i] & 0x3) == 0x1) /* Only page table entries contain a L2 table. */
-                {
-                    PSPPADDR PhysAddrL2 = au32Tbl[i] & 0xfffffc00;
+    PSPVADDR PspVAddrLast = PspVAddrStart + (cbRange - 1);
 
-                    if (PhysAddrL2 < PhysAddrStart)
-                        PhysAddrStart = PhysAddrL2;
-                    else if (PhysAddrL2 > PhysAddrEnd)
-                        PhysAddrEnd = PhysAddrL2 + _1K;
-                }
-            }
+    for (uint32_t i = 0; i < ELEMENTS(pThis->aTlb); i++)
+    {
+        PPSPCORETLBENTRY pTlbEntry = &pThis->aTlb[i];
 
-            *pPspPAddrPgTblStart = PhysAddrStart;
-            *pcbPgTbl = PhysAddrEnd - PhysAddrStart;
-        }
+        /* The cached region size covers following descriptors as well, so check the whole region. */
+        if (   pTlbEntry->fValid
+            && pTlbEntry->PspVAddrPg <= PspVAddrLast
+            && pTlbEntry->PspVAddrPg + (pTlbEntry->cbRegion - 1) >= PspVAddrStart)
+            pTlbEntry->fValid = false;
     }
-
-    return rc;
 }
 
 
 /**
- * Returns the physical address the given L2 descriptor points to.
+ * Marks the page table tracking as stale after the L1 table changed in a way the tracked L2 tables
+ * don't reflect anymore, it gets set up again before the emulation continues.
  *
- * @returns Page aligned physical address.
- * @param   u32L2Desc               The L2 descriptor.
- * @param   idxL2                   Index in the L2 table where the descriptor is stored.
+ * @returns nothing.
+ * @param   pThis                   The PSP core instance.
  */
-static inline PSPPADDR pspEmuCoreMmuPgTblL2GetPhysAddrFromDesc(uint32_t u32L2Desc, uint32_t idxL2)
+static void pspEmuCoreMmuPgTblTrackingInvalidate(PPSPCOREINT pThis)
 {
-    if ((u32L2Desc & 0x2) == 0x2)
-        return u32L2Desc & 0xfffff000;
-    else if ((u32L2Desc & 0x3) == 0x1)
-        return (u32L2Desc & 0xffff0000) + (idxL2 % 16) * _4K;
-
-    /* Not present entry. */
-    return 0xffffffff;
+    pThis->fMmuPgTblTrackingStale = true;
+    if (pThis->fUcEmuActive)
+        pspEmuCoreExecExit(pThis, PSP_CORE_EXIT_F_MMU_CHANGED);
 }
 
 
 /**
- * Tries to resolve a given virtual PSP address to a physical one - page aligned version.
+ * Clears all virtual memory mappings registered with unicorn by the MMU.
  *
  * @returns Status code.
  * @param   pThis                   The PSP core instance.
- * @param   PspVAddrPg              Page aligned virtual PSP address.
- * @param   pPspPAddrPg             Where to store the physical address on success.
- * @param   pcbRegion               Where to store the size of the resolved physical memory region on success.
- * @param   penmPgTblWalk           Where to store information on the page table walk, optional.
- *
- * @todo Extract access permissions.
  */
-static int pspEmuCoreMmuPAddrQueryFromVAddrPageAligned(PPSPCOREINT pThis, PSPVADDR PspVAddrPg, PSPPADDR *pPspPAddrPg, size_t *pcbRegion,
-                                                       PPSPCOREPGTBLWALKSTS penmPgTblWalk)
+static int pspEmuCoreMmuMappingsClear(PPSPCOREINT pThis)
 {
-    PSPPADDR PhysAddrPgTbl = 0;
-    int rc = pspEmuCoreMmuPgTblQueryRoot(pThis, &PhysAddrPgTbl);
-    if (!rc)
+    PPSPCOREMMUMAP pMmuMap = pThis->pMmuMappingsHead;
+    while (pMmuMap)
     {
-        uint32_t au32Tbl[4096];
-
-        rc = PSPEmuCoreMemRead(pThis, PhysAddrPgTbl, &au32Tbl[0], sizeof(au32Tbl));
-        if (!rc)
-        {
-            uint32_t idxL1 = PspVAddrPg >> PSP_PAGE_L1_IDX_SHIFT;
-            uint32_t idxL2 = (PspVAddrPg >> 12) & 0xff;
-            uint32_t u32L1Desc = au32Tbl[idxL1];
-
-            if (penmPgTblWalk)
-                *penmPgTblWalk = PSPCOREPGTBLWALKSTS_L1;
-
-            /* Coarse page table.*/
-            if ((u32L1Desc & 0x3) == 0x1)
-            {
-                PSPPADDR PhysAddrL2 = u32L1Desc & 0xfffffc00;
-                rc = PSPEmuCoreMemRead(pThis, PhysAddrL2, &au32Tbl[0], _1K);
-                if (!rc)
-                {
-                    uint32_t u32L2Desc = au32Tbl[idxL2];
-                    if ((u32L2Desc & 0x2) == 0x2)
-                    {
-                        *pPspPAddrPg = u32L2Desc & 0xfffff000;
-                        *pcbRegion   = _4K;
-                    }
-                    else if ((u32L2Desc & 0x3) == 0x1)
-                    {
-                        *pPspPAddrPg = u32L2Desc & 0xffff0000;
-                        *pcbRegion   = 64 * _1K;
-                    }
-                    else
-                        rc = -1;
-                }
-
-                if (penmPgTblWalk)
-                    *penmPgTblWalk = PSPCOREPGTBLWALKSTS_L2;
-            }
-            else if (   (u32L1Desc & 0x2) == 0x2
-                     && (u32L1Desc & BIT(18)) == 0x0)
-            {
-                /* Section. */
-                PSPPADDR PhysAddrSection = u32L1Desc & 0xfff00000;
-                *pPspPAddrPg = PhysAddrSection + idxL2 * _4K;
-                *pcbRegion   = _4K;
-            }
-            else
-                rc = -1; /** @todo Support supersections. */
-        }
+        PPSPCOREMMUMAP pFree = pMmuMap;
+        pMmuMap = pMmuMap->pNext;
+        uc_err rcUc = uc_mem_unmap(pThis->pUcEngine, pFree->PspAddrVStart, pFree->cbRegion);
+        /** @todo assert(rcUrc == UC_ERR_OK) */
+        free(pFree);
     }
 
-    return rc;
+    pThis->pMmuMappingsHead = NULL;
+    pThis->cMmuFlushes++;
+    pspEmuCoreMmuTlbFlush(pThis);
+    return 0;
 }
 
 
 /**
- * Tries to resolve a given virtual PSP address to a physical one.
+ * Invalidates all virtual memory mappings overlapping the given range.
  *
- * @returns Status code.
+ * @returns Number of mappings invalidated.
  * @param   pThis                   The PSP core instance.
- * @param   PspVAddr                Virtual PSP address to resolve.
- * @param   pPspPAddr               Where to store the physical address on success.
- * @param   pcbRegion               Where to store the size of the resolved contiguous physical memory region on success.
- * @param   penmPgTblWak            Where to store the information about the page table walk, optional.
- *
- * @todo Extract access permissions.
+ * @param   PspVAddrStart           Start of the virtual address range to invalidate.
+ * @param   cbRange                 Size of the range in bytes.
  */
-static int pspEmuCoreMmuPAddrQueryFromVAddr(PPSPCOREINT pThis, PSPVADDR PspVAddr, PSPPADDR *pPspPAddr, size_t *pcbRegion,
-                                            PPSPCOREPGTBLWALKSTS penmPgTblWalk)
+static uint32_t pspEmuCoreMmuMappingsInvalidateRange(PPSPCOREINT pThis, PSPVADDR PspVAddrStart, size_t cbRange)
 {
-    PSPVADDR PspVAddrPg = PspVAddr & ~(PSP_PAGE_SIZE - 1);
-    uint32_t offPg = PspVAddr & (PSP_PAGE_SIZE - 1);
+    uint32_t cInvalidated = 0;
+    PSPVADDR PspVAddrLast = PspVAddrStart + (cbRange - 1);
+    PPSPCOREMMUMAP pPrev = NULL;
+    PPSPCOREMMUMAP pCur  = pThis->pMmuMappingsHead;
 
-    int rc = pspEmuCoreMmuPAddrQueryFromVAddrPageAligned(pThis, PspVAddrPg, pPspPAddr, pcbRegion, penmPgTblWalk);
-    if (STS_SUCCESS(rc))
+    /* The list is sorted by virtual start address and mappings don't overlap. */
+    while (   pCur
+           && pCur->PspAddrVStart <= PspVAddrLast)
     {
-        *pPspPAddr |= offPg;
-        *pcbRegion -= offPg;
+        PPSPCOREMMUMAP pNext = pCur->pNext;
+
+        if (pCur->PspAddrVStart + (pCur->cbRegion - 1) >= PspVAddrStart)
+        {
+            if (pPrev)
+                pPrev->pNext = pNext;
+            else
+                pThis->pMmuMappingsHead = pNext;
+
+            uc_err rcUc = uc_mem_unmap(pThis->pUcEngine, pCur->PspAddrVStart, pCur->cbRegion);
+            /** @todo assert(rcUrc == UC_ERR_OK) */
+            free(pCur);
+            cInvalidated++;
+        }
+        else
+            pPrev = pCur;
+
+        pCur = pNext;
     }
 
-    return rc;
+    return cInvalidated;
 }
 
 
 /**
- * Tries to resolve a given physical PSP address to a virtual one.
+ * Processes a write to a tracked page table before it is carried out.
  *
- * @returns Status code.
- * @param   pThis                   The PSP core instance.
- * @param   PspPAddr                Physical PSP address.
- * @param   cbPhysRegion            The physical region size.
- * @param   pPspVAddr               Where to store the virtual address on success.
- * @param   pcbRegion               Where to store the size of the resolved contiguous virtual memory region on success.
+ * @returns nothing.
+ * @param   pPgTblTrack             The page table tracking structure covering the written address.
+ * @param   uAddr                   Virtual address being written.
+ * @param   cb                      Size of the write (1, 2, 4 or 8 bytes).
+ * @param   iVal                    Value written.
  */
-static int pspEmuCoreMmuVAddrQueryFromPAddr(PPSPCOREINT pThis, PSPPADDR PspPAddr, size_t cbPhysRegion,
-                                            PSPVADDR *pPspVAddr, size_t *pcbRegion,
-                                            uint32_t *pidxL1, uint32_t *pidxL2)
+static void pspEmuCoreMmuPgTblWriteProcess(PCPSPCOREPGTBLTRACK pPgTblTrack, uint64_t uAddr, int cb, int64_t iVal)
 {
-    PSPPADDR PspPAddrPg = PspPAddr & ~(PSP_PAGE_SIZE - 1);
-    PSPPADDR offPg = PspPAddr - PspPAddrPg;
+    PPSPCOREINT pThis = pPgTblTrack->pThis;
 
-    PSPPADDR PhysAddrPgTbl = 0;
-    int rc = pspEmuCoreMmuPgTblQueryRoot(pThis, &PhysAddrPgTbl);
-    if (!rc)
+    PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE, "Page table write at address %#llx with value %#llx (cb=%u)\n", uAddr, iVal, cb);
+
+    /*
+     * The hook gets called before the write is carried out, so the old descriptors can be read from memory.
+     * Decode every descriptor touched by the write and only invalidate the virtual range it covers if
+     * it actually changes.
+     */
+    PSPPADDR PhysAddrWrite = pPgTblTrack->PhysAddrPgTblStart + (PSPPADDR)((PSPVADDR)uAddr - pPgTblTrack->PspAddrVPgTbl);
+    PSPPADDR PhysAddrDesc  = PhysAddrWrite & ~(PSPPADDR)(sizeof(uint32_t) - 1);
+    bool fChanged = false;
+
+    pThis->cMmuPgTblWrites++;
+    while (PhysAddrDesc < PhysAddrWrite + cb)
     {
-        uint32_t au32Tbl[32];
+        uint32_t u32DescOld = 0;
+        int rc = PSPEmuCoreMemRead(pThis, PhysAddrDesc, &u32DescOld, sizeof(u32DescOld));
+        if (STS_FAILURE(rc))
+        {
+            /* Can't decode the change, play safe and clear everything. */
+            pspEmuCoreMmuMappingsClear(pThis);
+            return;
+        }
 
-        rc = PSPEmuCoreMemRead(pThis, PhysAddrPgTbl, &au32Tbl[0], sizeof(au32Tbl));
-        if (!rc)
+        uint32_t u32DescNew = u32DescOld;
+        for (uint32_t i = 0; i < sizeof(uint32_t); i++)
         {
-            /* Scan the page tables for the physical address. */
-            for (uint32_t i = *pidxL1; i < ELEMENTS(au32Tbl) && !rc; i++)
+            PSPPADDR PhysAddrByte = PhysAddrDesc + i;
+            if (   PhysAddrByte >= PhysAddrWrite
+                && PhysAddrByte < PhysAddrWrite + cb)
             {
-                if ((au32Tbl[i] & 0x3) == 0x1)
-                {
-                    PSPPADDR PhysAddrL2 = au32Tbl[i] & 0xfffffc00;
-                    uint32_t au32TblL2[1024 / sizeof(uint32_t)];
-
-                    rc = PSPEmuCoreMemRead(pThis, PhysAddrL2, &au32TblL2[0], sizeof(au32TblL2));
-                    if (!rc)
-                    {
-                        for (uint32_t idxL2 = *pidxL2; idxL2 < ELEMENTS(au32TblL2) && !rc; idxL2++)
-                        {
-                            PSPPADDR PhysStart = pspEmuCoreMmuPgTblL2GetPhysAddrFromDesc(au32TblL2[idxL2], idxL2);
-                            if (PhysStart == 0xffffffff)
-                                continue;
-
-                            if (PspPAddrPg == PhysStart)
-                            {
-                                /* Check for adjacent regions. */
-                                PSPVADDR PspVAddrStart = i * _1M + idxL2 * _4K;
-                                size_t cbVRegion = _4K;
-
-                                idxL2++;
-                                PspPAddrPg += _4K;
-                                while (   idxL2 < ELEMENTS(au32TblL2)
-                                       && cbVRegion < cbPhysRegion)
-                                {
-                                    PhysStart = pspEmuCoreMmuPgTblL2GetPhysAddrFromDesc(au32TblL2[idxL2], idxL2);
-                                    if (PhysStart != PspPAddrPg)
-                                        break;
-                                    cbVRegion  += _4K;
-                                    PspPAddrPg += _4K;
-                                    idxL2++;
-                                }
-
-                                *pPspVAddr = PspVAddrStart | offPg;
-                                *pcbRegion = MIN(cbPhysRegion, cbVRegion);
-                                *pidxL1 = i;
-                                *pidxL2 = idxL2;
-                                return 0;
-                            }
-                        }
+                uint32_t u32Byte = (uint32_t)(((uint64_t)iVal >> ((PhysAddrByte - PhysAddrWrite) * 8)) & 0xff);
+                u32DescNew = (u32DescNew & ~(0xffU << (i * 8))) | (u32Byte << (i * 8));
+            }
+        }
 
-                        *pidxL2 = 0;
-                    }
-                }
-                else if (   (au32Tbl[i] & 0x2) == 0x2
-                         && (au32Tbl[i] & BIT(18)) == 0x0)
-                {
-                    /* Section. */
-                    PSPPADDR PhysStartSection = au32Tbl[i] & 0xfff00000;
-                    size_t cbSection = _1M;
+        if (u32DescNew != u32DescOld)
+        {
+            uint32_t idxDesc = (PhysAddrDesc - pPgTblTrack->PhysAddrPgTblStart) / sizeof(uint32_t);
+            PSPVADDR PspVAddrInv;
+            size_t cbInv;
 
-                    if (   PspPAddrPg >= PhysStartSection
-                        && PspPAddrPg < PhysStartSection + cbSection)
-                    {
-                        *pPspVAddr = (i * _1M + (PspPAddrPg - PhysStartSection)) | offPg;
-                        *pcbRegion = MIN(cbPhysRegion, cbSection);
-                        *pidxL1 = i + 1;
-                        *pidxL2 = 0;
-                        return 0;
-                    }
-                }
-                else if ((au32Tbl[i] & 0x3) != 0x0)
-                    printf("No support for super sections right now %#x!\n", au32Tbl[i]);
+            if (pPgTblTrack->fL2PgTbl)
+            {
+                PspVAddrInv = pPgTblTrack->idxL1 * _1M + idxDesc * _4K;
+                cbInv       = _4K;
+                pspEmuCoreMmuRevMapL2DescUpdate(pThis, pPgTblTrack->idxL1, idxDesc, u32DescNew);
+            }
+            else
+            {
+                PspVAddrInv = idxDesc * _1M;
+                cbInv       = _1M;
+                pThis->fRevMapValid = false; /* L1 changes are rare, just rebuild on the next lookup. */
+
+                /* The L2 table referenced by the descriptor changed, the new one isn't tracked yet. */
+                if (   (u32DescOld & 0x3) == 0x1
+                    || (u32DescNew & 0x3) == 0x1)
+                    pspEmuCoreMmuPgTblTrackingInvalidate(pThis);
             }
 
-            if (!rc)
-                rc = -1; /* If we got here we found nothing :(. */
+            pThis->cMmuMappingsInvalidated += pspEmuCoreMmuMappingsInvalidateRange(pThis, PspVAddrInv, cbInv);
+            pspEmuCoreMmuTlbInvalidateRange(pThis, PspVAddrInv, cbInv);
+            fChanged = true;
         }
+
+        PhysAddrDesc += sizeof(uint32_t);
     }
 
-    return rc;
+    if (fChanged)
+        pThis->cMmuFlushesAvoided++;
+    else
+        pThis->cMmuPgTblWritesUnchanged++;
+
+    PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE,
+                            "MMU: %llu page table writes (%llu unchanged), %llu full flushes avoided, %llu full flushes, %llu mappings invalidated, %llu mappings merged\n",
+                            pThis->cMmuPgTblWrites, pThis->cMmuPgTblWritesUnchanged, pThis->cMmuFlushesAvoided,
+                            pThis->cMmuFlushes, pThis->cMmuMappingsInvalidated, pThis->cMmuMappingsMerged);
 }
 
 
 /**
- * Unicorn MMIO read wrapper for the MMU enabled case.
+ * Unicorn write hook wrapper for the page table region.
  *
- * @returns Data read.
+ * @returns nothing.
  * @param   pUcEngine               The unicorn engine pointer.
+ * @param   uAddr                   Address being written.
+ * @param   cb                      Size of the write (1, 2, 4 or 8 bytes).
+ * @param   iVal                    Value written.
  * @param   pvUser                  Opaque user data.
- * @param   uAddr                   MMIO address read.
- * @param   cbInsn                  Size of the read (1, 2, 4 or 8 bytes).
  */
-static uint64_t pspEmuCoreMmuMapMmioRead(struct uc_struct* pUcEngine, void *pvUser, uint64_t uAddr, unsigned cb)
+static void pspEmuCoreMmuPgTblWrite(struct uc_struct* pUcEngine, uc_mem_type enmMemType, uint64_t uAddr, int cb, int64_t iVal, void *pvUser)
 {
-    PCPSPCOREMMUMAP pMmuMap = (PCPSPCOREMMUMAP)pvUser;
+    pspEmuCoreMmuPgTblWriteProcess((PCPSPCOREPGTBLTRACK)pvUser, uAddr, cb, iVal);
+}
 
-    /* The address is from the start of our MMU mapping. */
-    PSPADDR offPhys = pMmuMap->offPhysMap + (uint32_t)uAddr;
-    return pspEmuCoreMmioRead(pUcEngine, (void *)pMmuMap->pMemRegion, offPhys, cb);
+
+/**
+ * Changes the unicorn protection of the given virtual page containing a tracked page table.
+ *
+ * @returns nothing.
+ * @param   pThis                   The PSP core instance.
+ * @param   PspVAddrPg              The page aligned virtual address of the page.
+ * @param   fWrProt                 Flag whether to write protect the page or restore the protection of the memory backing.
+ */
+static void pspEmuCoreMmuPgTblPageProtect(PPSPCOREINT pThis, PSPVADDR PspVAddrPg, bool fWrProt)
+{
+    PCPSPCOREMMUMAP pCur = pThis->pMmuMappingsHead;
+
+    /* Nothing to do if the page isn't mapped yet, the protection gets applied when the mapping is created. */
+    while (   pCur
+           && pCur->PspAddrVStart + (pCur->cbRegion - 1) < PspVAddrPg)
+        pCur = pCur->pNext;
+
+    if (   pCur
+        && pCur->PspAddrVStart <= PspVAddrPg
+        && !pCur->pMemRegion->fMmio)
+    {
+        int32_t fUcProt = pCur->fUcProt;
+        if (fWrProt)
+            fUcProt &= ~UC_PROT_WRITE;
+
+        uc_err rcUc = uc_mem_protect(pThis->pUcEngine, PspVAddrPg, PSP_PAGE_SIZE, fUcProt);
+        /** @todo assert(rcUc == UC_ERR_OK) */
+    }
 }
 
 
 /**
- * Unicorn MMIO write wrapper for the MMU enabled case.
+ * Write protects all pages containing tracked page tables in the given freshly mapped virtual range.
  *
  * @returns nothing.
- * @param   pUcEngine               The unicorn engine pointer.
- * @param   pvUser                  Opaque user data.
- * @param   uAddr                   MMIO address written.
- * @param   uVal                    Value written.
- * @param   cbInsn                  Size of the write (1, 2, 4 or 8 bytes).
+ * @param   pThis                   The PSP core instance.
+ * @param   PspVAddrStart           Start of the virtual range which got mapped.
+ * @param   cbRange                 Size of the range in bytes.
  */
-static void pspEmuCoreMmuMapMmioWrite(struct uc_struct* pUcEngine, void *pvUser, uint64_t uAddr, uint64_t uVal, unsigned cb)
+static void pspEmuCoreMmuPgTblWrProtApply(PPSPCOREINT pThis, PSPVADDR PspVAddrStart, size_t cbRange)
 {
-    PCPSPCOREMMUMAP pMmuMap = (PCPSPCOREMMUMAP)pvUser;
+    PCPSPCOREPGTBLTRACK pCur = pThis->pMmuPgTblTrackingHead;
 
-    /* The address is from the start of our MMU mapping. */
-    PSPADDR offPhys = pMmuMap->offPhysMap + (uint32_t)uAddr;
-    pspEmuCoreMmioWrite(pUcEngine, (void *)pMmuMap->pMemRegion, offPhys, uVal, cb);
+    while (pCur)
+    {
+        PSPVADDR PspVAddrPg = pCur->PspAddrVPgTbl & ~(PSP_PAGE_SIZE - 1);
+        if (   PspVAddrPg >= PspVAddrStart
+            && PspVAddrPg - PspVAddrStart < cbRange)
+            pspEmuCoreMmuPgTblPageProtect(pThis, PspVAddrPg, true /*fWrProt*/);
+
+        pCur = pCur->pNext;
+    }
 }
 
 
 /**
- * Clears all virtual memory mappings registered with unicorn by the MMU.
+ * Handles a write protection fault on a page containing tracked page tables.
  *
- * @returns Status code.
+ * @returns Flag whether the fault was caused by page table write protection and got handled.
  * @param   pThis                   The PSP core instance.
+ * @param   uAddr                   The virtual address being written.
+ * @param   cb                      Size of the write (1, 2, 4 or 8 bytes).
+ * @param   iVal                    Value written.
  */
-static int pspEmuCoreMmuMappingsClear(PPSPCOREINT pThis)
+static bool pspEmuCoreMmuPgTblWrProtFault(PPSPCOREINT pThis, uint64_t uAddr, int cb, int64_t iVal)
 {
-    PPSPCOREMMUMAP pMmuMap = pThis->pMmuMappingsHead;
-    while (pMmuMap)
+    PSPVADDR PspVAddrPg = (PSPVADDR)uAddr & ~(PSP_PAGE_SIZE - 1);
+    PCPSPCOREPGTBLTRACK pPgTblTrackPg = NULL;
+    PCPSPCOREPGTBLTRACK pCur = pThis->pMmuPgTblTrackingHead;
+
+    /* Several tables can live in the same page, process every one the write touches. */
+    while (pCur)
     {
-        PPSPCOREMMUMAP pFree = pMmuMap;
-        pMmuMap = pMmuMap->pNext;
-        uc_err rcUc = uc_mem_unmap(pThis->pUcEngine, pFree->PspAddrVStart, pFree->cbRegion);
-        /** @todo assert(rcUrc == UC_ERR_OK) */
-        free(pFree);
+        if ((pCur->PspAddrVPgTbl & ~(PSP_PAGE_SIZE - 1)) == PspVAddrPg)
+        {
+            pPgTblTrackPg = pCur;
+            if (   uAddr + cb > pCur->PspAddrVPgTbl
+                && uAddr < pCur->PspAddrVPgTbl + pCur->cbPgTbl)
+                pspEmuCoreMmuPgTblWriteProcess(pCur, uAddr, cb, iVal);
+        }
+
+        pCur = pCur->pNext;
     }
 
-    pThis->pMmuMappingsHead = NULL;
-    return 0;
+    if (!pPgTblTrackPg)
+        return false;
+
+    /*
+     * Unicorn carries out the store itself once the hook reports the fault as handled, so the write
+     * must not be done here as well. The page stays write protected so the next write to it faults again,
+     * writes to the rest of the page just go through that way.
+     */
+    pThis->cMmuPgTblWrProtFaults++;
+    return true;
 }
 
 
 /**
- * Unicorn write hook wrapper for the page table region.
+ * Merges the given mapping range with adjacent MMU mappings which map the same RAM region contiguously,
+ * the merged mappings get removed from unicorn and freed.
  *
  * @returns nothing.
- * @param   pUcEngine               The unicorn engine pointer.
- * @param   uAddr                   Address being written.
- * @param   cb                      Size of the write (1, 2, 4 or 8 bytes).
- * @param   iVal                    Value written.
- * @param   pvUser                  Opaque user data.
+ * @param   pThis                   The PSP core instance.
+ * @param   pMemRegion              The physical memory region the new mapping maps to.
+ * @param   pPspVAddrPg             The virtual start address of the new mapping, updated on return.
+ * @param   pPspPAddrPg             The physical start address of the new mapping, updated on return.
+ * @param   poffMap                 The offset of the new mapping into the physical region, updated on return.
+ * @param   pcbMap                  The size of the new mapping, updated on return.
  */
-static void pspEmuCoreMmuPgTblWrite(struct uc_struct* pUcEngine, uc_mem_type enmMemType, uint64_t uAddr, int cb, int64_t iVal, void *pvUser)
+static void pspEmuCoreMmuMappingMergeAdjacent(PPSPCOREINT pThis, PCPSPCOREMEMREGION pMemRegion,
+                                              PSPVADDR *pPspVAddrPg, PSPPADDR *pPspPAddrPg,
+                                              uint32_t *poffMap, size_t *pcbMap)
 {
-    PCPSPCOREPGTBLTRACK pPgTblTrack = (PCPSPCOREPGTBLTRACK)pvUser;
-    PPSPCOREINT pThis = pPgTblTrack->pThis;
+    PPSPCOREMMUMAP pPrev = NULL;
+    PPSPCOREMMUMAP pCur  = pThis->pMmuMappingsHead;
 
-    PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_DEBUG, PSPTRACEEVTORIGIN_CORE, "Page table write at address %#llx with value %#llx (cb=%u)\n", uAddr, iVal, cb);
+    while (pCur)
+    {
+        PPSPCOREMMUMAP pNext = pCur->pNext;
+
+        if (pCur->PspAddrVStart > *pPspVAddrPg + *pcbMap)
+            break;
+
+        bool fMerge = false;
+        if (pCur->pMemRegion == pMemRegion)
+        {
+            if (   pCur->PspAddrVStart + pCur->cbRegion == *pPspVAddrPg
+                && pCur->offPhysMap + pCur->cbRegion == *poffMap)
+            {
+                /* Mapping directly in front of the new one. */
+                *pPspVAddrPg  = pCur->PspAddrVStart;
+                *pPspPAddrPg  = pCur->PspAddrPStart;
+                *poffMap      = pCur->offPhysMap;
+                *pcbMap      += pCur->cbRegion;
+                fMerge = true;
+            }
+            else if (   pCur->PspAddrVStart == *pPspVAddrPg + *pcbMap
+                     && pCur->offPhysMap == *poffMap + *pcbMap)
+            {
+                /* Mapping directly following the new one. */
+                *pcbMap += pCur->cbRegion;
+                fMerge = true;
+            }
+        }
+
+        if (fMerge)
+        {
+            if (pPrev)
+                pPrev->pNext = pNext;
+            else
+                pThis->pMmuMappingsHead = pNext;
+
+            uc_err rcUc = uc_mem_unmap(pThis->pUcEngine, pCur->PspAddrVStart, pCur->cbRegion);
+            /** @todo assert(rcUrc == UC_ERR_OK) */
+            free(pCur);
+            pThis->cMmuMappingsMerged++;
+        }
+        else
+            pPrev = pCur;
 
-    /* As the page tables have changed we have to clear all mappings and start all over. */
-    pspEmuCoreMmuMappingsClear(pThis);
+        pCur = pNext;
+    }
 }
 
 
@@ -2103,11 +4262,20 @@ static int pspEmuCoreMmuMappingCreate(PPSPCOREINT pThis, PCPSPCOREMEMREGION pMem
                                       PSPVADDR PspVAddrPg, PSPPADDR PspPAddrPg,
                                       uint32_t offMap, size_t cbMap)
 {
+    /*
+     * Keep the number of unicorn regions low by merging with contiguous RAM mappings, except when
+     * page accesses are tracked as the protection is granted page by page then.
+     */
+    if (   !pMemRegion->fMmio
+        && !pThis->pfnMemAccess)
+        pspEmuCoreMmuMappingMergeAdjacent(pThis, pMemRegion, &PspVAddrPg, &PspPAddrPg, &offMap, &cbMap);
+
     /* Create a new MMU mapping and register with unicorn. */
     int rc = 0;
     PPSPCOREMMUMAP pMmuMap = (PPSPCOREMMUMAP)calloc(1, sizeof(*pMmuMap));
     if (pMmuMap)
     {
+        pThis->cMmuMappingsCreated++;
         pMmuMap->pNext         = NULL;
         pMmuMap->pPspCore      = pThis;
         pMmuMap->pMemRegion    = pMemRegion;
@@ -2115,6 +4283,7 @@ static int pspEmuCoreMmuMappingCreate(PPSPCOREINT pThis, PCPSPCOREMEMREGION pMem
         pMmuMap->PspAddrPStart = PspPAddrPg;
         pMmuMap->cbRegion      = cbMap;
         pMmuMap->offPhysMap    = offMap;
+        pMmuMap->fUcProt       = UC_PROT_NONE;
 
         rc = pspEmuCoreMmuMappingInsert(pThis, pMmuMap);
         if (!rc)
@@ -2124,10 +4293,17 @@ static int pspEmuCoreMmuMappingCreate(PPSPCOREINT pThis, PCPSPCOREMEMREGION pMem
 
             if (!pMemRegion->fMmio)
             {
-                /* We use the assigned protection of the memory backing instead of what the page tables say. */
-                int32_t fUcProt = pspEmuCoreMemRegionProt2UcProt(pMemRegion->u.Ram.fProt);
+                /*
+                 * We use the assigned protection of the memory backing instead of what the page tables say,
+                 * while page accesses are tracked nothing is granted until the first protection fault.
+                 */
+                if (!pThis->pfnMemAccess)
+                    pMmuMap->fUcProt = pspEmuCoreMemRegionProt2UcProt(pMemRegion->u.Ram.fProt);
                 uint8_t *pbBacking = (uint8_t *)pMemRegion->u.Ram.pvBacking + offMap;
-                rcUc = uc_mem_map_ptr(pThis->pUcEngine, PspVAddrPg, cbMap, fUcProt, pbBacking);
+                rcUc = uc_mem_map_ptr(pThis->pUcEngine, PspVAddrPg, cbMap, pMmuMap->fUcProt, pbBacking);
+                if (   rcUc == UC_ERR_OK
+                    && pThis->fMmuPgTblWrProt)
+                    pspEmuCoreMmuPgTblWrProtApply(pThis, PspVAddrPg, cbMap);
             }
             else
             {
@@ -2167,8 +4343,21 @@ static int pspEmuCoreMmuMap(PPSPCOREINT pThis, PSPVADDR PspVAddr, bool *pfHandle
     {
         //printf("pspEmuCoreMmuMap: PspVAddr=%#lx PspPAddr=%#lx\n", PspVAddr, PspPAddrPg);
 
+        /* The resolved run might cover pages which are mapped already, stop right before the next mapping. */
+        PCPSPCOREMMUMAP pMmuMapNext = pThis->pMmuMappingsHead;
+        while (   pMmuMapNext
+               && pMmuMapNext->PspAddrVStart <= PspVAddrPg)
+            pMmuMapNext = pMmuMapNext->pNext;
+        if (   pMmuMapNext
+            && cbRegion > pMmuMapNext->PspAddrVStart - PspVAddrPg)
+            cbRegion = pMmuMapNext->PspAddrVStart - PspVAddrPg;
+
+        /* Map single pages only when accesses are tracked so every page touched faults once. */
+        if (pThis->pfnMemAccess)
+            cbRegion = MIN(cbRegion, PSP_PAGE_SIZE);
+
         /* Walk the physical memory regions registered and create appropriate mappings. */
-        PCPSPCOREMEMREGION pMemRegion = pspEmuCoreMemRegionFindByAddr(pThis, PspPAddrPg, NULL /*ppPrevRegion*/);
+        PCPSPCOREMEMREGION pMemRegion = pspEmuCoreMemRegionFindByAddr(pThis, PspPAddrPg);
         while (   cbRegion
                && pMemRegion
                && !rc)
@@ -2209,8 +4398,10 @@ static int pspEmuCoreMmuMap(PPSPCOREINT pThis, PSPVADDR PspVAddr, bool *pfHandle
  * @param   PspPAddrPgTbl           The physical address of the page table region to track.
  * @param   cbPgTbl                 Size of the region in bytes.
  * @param   fL2PgTbl                Flag whether this tracks a L1 or L2 page table.
+ * @param   idxL1Ref                Index of the L1 descriptor referencing the L2 table, ignored for L1 tables.
  */
-static int pspEmuCoreMmuPgTblTrackingCreate(PPSPCOREINT pThis, PSPPADDR PspPAddrPgTbl, size_t cbPgTbl, bool fL2PgTbl)
+static int pspEmuCoreMmuPgTblTrackingCreate(PPSPCOREINT pThis, PSPPADDR PspPAddrPgTbl, size_t cbPgTbl, bool fL2PgTbl,
+                                            uint32_t idxL1Ref)
 {
     PSPVADDR PspVAddrPgTbl = 0;
     size_t cbVPgTbl = 0;
@@ -2236,16 +4427,21 @@ static int pspEmuCoreMmuPgTblTrackingCreate(PPSPCOREINT pThis, PSPPADDR PspPAddr
                     pPgTblTrack->pNext    = NULL;
                     pPgTblTrack->pThis    = pThis;
                     pPgTblTrack->fL2PgTbl = fL2PgTbl;
+                    pPgTblTrack->idxL1    = idxL1Ref;
                     pPgTblTrack->PhysAddrPgTblStart = PspPAddrPgTbl;
                     pPgTblTrack->PspAddrVPgTbl      = PspVAddrPgTbl;
                     pPgTblTrack->cbPgTbl            = cbPgTbl;
 
-                    uc_err rcUc = uc_hook_add(pThis->pUcEngine, &pPgTblTrack->hUcHookWrites, UC_HOOK_MEM_WRITE, (void *)(uintptr_t)pspEmuCoreMmuPgTblWrite,
-                                              pPgTblTrack, pPgTblTrack->PspAddrVPgTbl, pPgTblTrack->PspAddrVPgTbl + cbPgTbl - 1);
+                    uc_err rcUc = UC_ERR_OK;
+                    if (!pThis->fMmuPgTblWrProt)
+                        rcUc = uc_hook_add(pThis->pUcEngine, &pPgTblTrack->hUcHookWrites, UC_HOOK_MEM_WRITE, (void *)(uintptr_t)pspEmuCoreMmuPgTblWrite,
+                                           pPgTblTrack, pPgTblTrack->PspAddrVPgTbl, pPgTblTrack->PspAddrVPgTbl + cbPgTbl - 1);
                     if (rcUc == UC_ERR_OK)
                     {
                         pPgTblTrack->pNext = pThis->pMmuPgTblTrackingHead;
                         pThis->pMmuPgTblTrackingHead = pPgTblTrack;
+                        if (pThis->fMmuPgTblWrProt)
+                            pspEmuCoreMmuPgTblPageProtect(pThis, PspVAddrPgTbl & ~(PSP_PAGE_SIZE - 1), true /*fWrProt*/);
                     }
                     else
                         rc = pspEmuCoreErrConvertFromUcErr(rcUc);
@@ -2280,9 +4476,12 @@ static int pspEmuCoreMmuSetupPgTblTracking(PPSPCOREINT pThis)
     int rc = pspEmuCoreMmuPgTblQueryRoot(pThis, &PhysAddrPgTbl);
     if (STS_SUCCESS(rc))
     {
-        uint32_t au32Tbl[32/*4096*/];
+        uint32_t au32Tbl[PSP_CORE_MMU_PGTBL_TRACK_L1_ENTRIES];
+
+        pThis->fMmuPgTblTrackingStale = false;
+        pThis->fMmuPgTblTrackingSetup = true;
 
-        rc = pspEmuCoreMmuPgTblTrackingCreate(pThis, PhysAddrPgTbl, sizeof(au32Tbl), false /*fL1PgTBl*/);
+        rc = pspEmuCoreMmuPgTblTrackingCreate(pThis, PhysAddrPgTbl, sizeof(au32Tbl), false /*fL1PgTBl*/, 0 /*idxL1*/);
         if (STS_SUCCESS(rc))
         {
             rc = PSPEmuCoreMemRead(pThis, PhysAddrPgTbl, &au32Tbl[0], sizeof(au32Tbl));
@@ -2294,11 +4493,17 @@ static int pspEmuCoreMmuSetupPgTblTracking(PPSPCOREINT pThis)
                     {
                         PSPPADDR PhysAddrL2 = au32Tbl[i] & 0xfffffc00;
 
-                        rc = pspEmuCoreMmuPgTblTrackingCreate(pThis, PhysAddrL2, _1K, true /*fL2PgTbl*/);
+                        rc = pspEmuCoreMmuPgTblTrackingCreate(pThis, PhysAddrL2, _1K, true /*fL2PgTbl*/, i /*idxL1*/);
                     }
                 }
             }
         }
+
+        /* Tables which couldn't be tracked (not mapped for instance) leave the reverse map without updates. */
+        pThis->fMmuPgTblTrackingSetup = false;
+        if (   pThis->fRevMapValid
+            && !pspEmuCoreMmuRevMapIsTracked(pThis))
+            pThis->fRevMapValid = false;
     }
 
     return rc;
@@ -2321,16 +4526,75 @@ static int pspEmuCoreMmuPgTblTrackingRemove(PPSPCOREINT pThis)
         PPSPCOREPGTBLTRACK pFree = pCur;
         pCur = pCur->pNext;
 
-        uc_err rcUc = uc_hook_del(pThis->pUcEngine, pFree->hUcHookWrites);
-        /** @todo assert(rcUc == UC_ERR_OK) */
+        if (pThis->fMmuPgTblWrProt)
+            pspEmuCoreMmuPgTblPageProtect(pThis, pFree->PspAddrVPgTbl & ~(PSP_PAGE_SIZE - 1), false /*fWrProt*/);
+        else
+        {
+            uc_err rcUc = uc_hook_del(pThis->pUcEngine, pFree->hUcHookWrites);
+            /** @todo assert(rcUc == UC_ERR_OK) */
+        }
         free(pFree);
     }
 
     pThis->pMmuPgTblTrackingHead = NULL;
+    pThis->fRevMapValid = false; /* Can't be kept up to date without the tracking. */
     return rc;
 }
 
 
+/**
+ * Sets up the page table tracking again if it became stale.
+ *
+ * @returns Status code.
+ * @param   pThis                   The PSP core instance.
+ */
+static int pspEmuCoreMmuPgTblTrackingResync(PPSPCOREINT pThis)
+{
+    if (   !pThis->fMmuPgTblTrackingStale
+        || !pThis->fMmuEnabled)
+        return STS_INF_SUCCESS;
+
+    /* Mappings might have been created from the new tables while writes to them were not tracked. */
+    int rc = pspEmuCoreMmuMappingsClear(pThis);
+    if (STS_SUCCESS(rc))
+        rc = pspEmuCoreMmuPgTblTrackingRemove(pThis);
+    if (STS_SUCCESS(rc))
+        rc = pspEmuCoreMmuSetupPgTblTracking(pThis);
+
+    return rc;
+}
+
+
+/**
+ * Handles a write by the host into physical memory which might contain tracked page tables.
+ *
+ * @returns nothing.
+ * @param   pThis                   The PSP core instance.
+ * @param   PspPAddrWrite           The physical start address of the write.
+ * @param   cbWrite                 Size of the write in bytes.
+ *
+ * @note Unlike writes by the emulated code these aren't seen by the page table tracking, and they
+ *       are rare enough to not bother decoding the individual descriptors.
+ */
+static void pspEmuCoreMmuPgTblHostWrite(PPSPCOREINT pThis, PSPPADDR PspPAddrWrite, size_t cbWrite)
+{
+    PCPSPCOREPGTBLTRACK pCur = pThis->pMmuPgTblTrackingHead;
+
+    while (pCur)
+    {
+        if (   (uint64_t)PspPAddrWrite + cbWrite > pCur->PhysAddrPgTblStart
+            && PspPAddrWrite < (uint64_t)pCur->PhysAddrPgTblStart + pCur->cbPgTbl)
+        {
+            pspEmuCoreMmuMappingsClear(pThis);
+            pspEmuCoreMmuPgTblTrackingInvalidate(pThis);
+            return;
+        }
+
+        pCur = pCur->pNext;
+    }
+}
+
+
 /**
  * Sets up or tears down the MMU state based on the current MMU setting.
  *
@@ -2383,6 +4647,123 @@ static int pspEmuCoreMmuSetupTeardown(PPSPCOREINT pThis)
 }
 
 
+/**
+ * Converts the given unicorn memory access type to the matching PSPEMU_CORE_TRACE_F_XXX flag.
+ *
+ * @returns PSPEMU_CORE_TRACE_F_XXX flag.
+ * @param   enmMemType              Memory access type.
+ */
+static inline uint32_t pspEmuCoreMemTypeToTraceFlags(uc_mem_type enmMemType)
+{
+    switch (enmMemType)
+    {
+        case UC_MEM_FETCH:
+        case UC_MEM_FETCH_UNMAPPED:
+        case UC_MEM_FETCH_PROT:
+            return PSPEMU_CORE_TRACE_F_EXEC;
+        case UC_MEM_WRITE:
+        case UC_MEM_WRITE_UNMAPPED:
+        case UC_MEM_WRITE_PROT:
+            return PSPEMU_CORE_TRACE_F_WRITE;
+        default:
+            break;
+    }
+
+    return PSPEMU_CORE_TRACE_F_READ;
+}
+
+
+/**
+ * Handles a protection fault on a page while page accesses are tracked, granting the faulting
+ * access type for the page and reporting it.
+ *
+ * @returns Flag whether the fault was caused by page access tracking and got handled.
+ * @param   pThis                   The PSP core instance.
+ * @param   enmMemType              Memory access type.
+ * @param   uAddr                   The address causing the protection fault.
+ *
+ * @note Unicorn carries out the access once the hook reports the fault as handled.
+ */
+static bool pspEmuCoreMemAccessProtFault(PPSPCOREINT pThis, uc_mem_type enmMemType, uint64_t uAddr)
+{
+    PSPADDR PspAddrPg = (PSPADDR)uAddr & ~(PSP_PAGE_SIZE - 1);
+    PSPPADDR PspPAddrPg = 0;
+    int32_t fUcAccess = 0;
+    int32_t fUcProt = 0;
+
+    switch (enmMemType)
+    {
+        case UC_MEM_READ_PROT:
+            fUcAccess = UC_PROT_READ;
+            break;
+        case UC_MEM_WRITE_PROT:
+            fUcAccess = UC_PROT_WRITE;
+            break;
+        case UC_MEM_FETCH_PROT:
+            fUcAccess = UC_PROT_EXEC;
+            break;
+        default:
+            return false;
+    }
+
+    if (pspEmuCoreCpIsSctrlMmuEnabled(pThis))
+    {
+        PPSPCOREMMUMAP pCur = pThis->pMmuMappingsHead;
+        while (   pCur
+               && pCur->PspAddrVStart + (pCur->cbRegion - 1) < PspAddrPg)
+            pCur = pCur->pNext;
+
+        /* Faults for access types granted already or not allowed by the memory backing are real ones. */
+        if (   !pCur
+            || pCur->PspAddrVStart > PspAddrPg
+            || pCur->pMemRegion->fMmio
+            || (pCur->fUcProt & fUcAccess)
+            || !(pspEmuCoreMemRegionProt2UcProt(pCur->pMemRegion->u.Ram.fProt) & fUcAccess))
+            return false;
+
+        pCur->fUcProt |= fUcAccess;
+        fUcProt    = pCur->fUcProt;
+        PspPAddrPg = pCur->PspAddrPStart + (PspAddrPg - pCur->PspAddrVStart);
+    }
+    else
+    {
+        PPSPCOREMEMREGION pMemRegion = pspEmuCoreMemRegionFindByAddr(pThis, PspAddrPg);
+        if (   !pMemRegion
+            || pMemRegion->fMmio
+            || !pMemRegion->fMapped
+            || !(pspEmuCoreMemRegionProt2UcProt(pMemRegion->u.Ram.fProt) & fUcAccess))
+            return false;
+
+        if (!pMemRegion->u.Ram.pbPgUcProt)
+        {
+            pMemRegion->u.Ram.pbPgUcProt = (uint8_t *)calloc(pMemRegion->cbRegion / PSP_PAGE_SIZE, sizeof(uint8_t));
+            if (!pMemRegion->u.Ram.pbPgUcProt)
+                return false;
+        }
+
+        uint8_t *pfPgUcProt = &pMemRegion->u.Ram.pbPgUcProt[(PspAddrPg - pMemRegion->PspAddrStart) / PSP_PAGE_SIZE];
+        if (*pfPgUcProt & fUcAccess)
+            return false;
+
+        *pfPgUcProt |= (uint8_t)fUcAccess;
+        fUcProt    = *pfPgUcProt;
+        PspPAddrPg = PspAddrPg;
+    }
+
+    uc_err rcUc = uc_mem_protect(pThis->pUcEngine, PspAddrPg, PSP_PAGE_SIZE, fUcProt);
+    if (rcUc != UC_ERR_OK)
+        return false;
+
+    /* Keep pages holding tracked page tables write protected so later writes fault again. */
+    if (   pThis->fMmuPgTblWrProt
+        && pspEmuCoreCpIsSctrlMmuEnabled(pThis))
+        pspEmuCoreMmuPgTblWrProtApply(pThis, PspAddrPg, PSP_PAGE_SIZE);
+
+    pThis->pfnMemAccess(pThis, PspPAddrPg, pspEmuCoreMemTypeToTraceFlags(enmMemType), pThis->pvMemAccessUser);
+    return true;
+}
+
+
 /**
  * Callback for invalid memory accesses so the MMU can map in regions lazily.
  *
@@ -2404,9 +4785,25 @@ static bool pspEmuCoreMemMemInvAccess(uc_engine *pUcEngine, uc_mem_type enmMemTy
     printf("pspEmuCoreMemMemInvAccess: enmMemType=%#x uAddr=%#llx cbAcc=%u i64Val=%#llx\n",
            enmMemType, uAddr, cbAcc, i64Val);
 #endif
+    /*
+     * Granting the access for page access tracking lets the write go through, so a write to a page
+     * holding tracked page tables must be processed in the same go.
+     */
+    bool fProtHandled =    pThis->pfnMemAccess
+                        && pspEmuCoreMemAccessProtFault(pThis, enmMemType, uAddr);
+    if (   enmMemType == UC_MEM_WRITE_PROT
+        && pThis->fMmuPgTblWrProt
+        && pspEmuCoreCpIsSctrlMmuEnabled(pThis)
+        && pspEmuCoreMmuPgTblWrProtFault(pThis, uAddr, cbAcc, i64Val))
+        fProtHandled = true;
+    if (fProtHandled)
+        return true;
+
     if (pspEmuCoreCpIsSctrlMmuEnabled(pThis))
     {
         bool fHandled;
+
+        pThis->cMmuFaults++;
         int rc = pspEmuCoreMmuMap(pThis, uAddr, &fHandled);
         if (   !rc
             && fHandled)
@@ -2424,7 +4821,7 @@ static bool pspEmuCoreMemMemInvAccess(uc_engine *pUcEngine, uc_mem_type enmMemTy
     else
     {
         /* Map in a region lazily. */
-        PPSPCOREMEMREGION pMemRegion = pspEmuCoreMemRegionFindByAddr(pThis, uAddr, NULL /*ppPrevRegion*/);
+        PPSPCOREMEMREGION pMemRegion = pspEmuCoreMemRegionFindByAddr(pThis, uAddr);
         if (   pMemRegion
             && !pMemRegion->fMapped)
         {
@@ -2453,18 +4850,26 @@ static int pspEmuCoreExcpInject(PPSPCOREINT pThis, PSPCOREMODE enmCoreMode, uint
 {
     uint32_t uCpsrOld = 0;
 
+    /* The mode switch changes the banked registers, so the cache can't be kept. */
+    int rc = pspEmuCoreRegCacheInvalidate(pThis);
+    if (STS_FAILURE(rc))
+        return rc;
+
     uc_err rcUc = uc_reg_read(pThis->pUcEngine, UC_ARM_REG_CPSR, &uCpsrOld);
 
     /* Set new mode. */
     //printf("pspEmuCoreExcpInject: Switching from mode %s to %s\n", pspEmuCoreModeToStr(pThis->enmCoreMode),
     //       pspEmuCoreModeToStr(enmCoreMode));
+    pThis->cExcpsInjected++;
     pThis->enmCoreMode = enmCoreMode;
     uint32_t uMode = pspEmuCoreModeToCpsr(enmCoreMode);
     uint32_t uCpsr = (uCpsrOld & ~0x1f) | uMode | BIT(7); /* IRQs are always disabled. */
+    if (enmCoreMode == PSPCOREMODE_FIQ)
+        uCpsr |= BIT(6);
     pThis->u32RegCpsr = uCpsr;
     if (enmCoreMode == PSPCOREMODE_MON)
     {
-        int rc = pspEmuCoreMmuSetupTeardown(pThis);
+        rc = pspEmuCoreMmuSetupTeardown(pThis);
         if (STS_FAILURE(rc))
             printf("MMU failed during world switch %d\n", rc);
     }
@@ -2502,6 +4907,8 @@ static int pspEmuCoreExcpHandle(PPSPCOREINT pThis, PSPADDR PspAddrPc, bool fThum
 
     if (pThis->enmExcpPending == PSPCOREEXCP_SWI)
     {
+        pThis->cSvcs++;
+
         /* Handle any SVC injections before passing control to any supervisor code. */
         bool fSwitchToSvc = true;
         rc = pspEmuCoreSvcBefore(pThis, PspAddrPc, fThumb, &fSwitchToSvc);
@@ -2521,6 +4928,8 @@ static int pspEmuCoreExcpHandle(PPSPCOREINT pThis, PSPADDR PspAddrPc, bool fThum
     }
     else if (pThis->enmExcpPending == PSPCOREEXCP_SMC)
     {
+        pThis->cSmcs++;
+
         /* Handle any SMC injections before passing control to any monitor code. */
         bool fSwitchToSmc = true;
         rc = pspEmuCoreSmcBefore(pThis, PspAddrPc, fThumb, &fSwitchToSmc);
@@ -2543,6 +4952,11 @@ static int pspEmuCoreExcpHandle(PPSPCOREINT pThis, PSPADDR PspAddrPc, bool fThum
         PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_INFO, PSPTRACEEVTORIGIN_CORE, "IRQ exception");
         rc = pspEmuCoreExcpInject(pThis, PSPCOREMODE_IRQ, 0x6, PspAddrPc + 4, false /*fUseMVBar*/);
     }
+    else if (pThis->enmExcpPending == PSPCOREEXCP_FIQ)
+    {
+        PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_INFO, PSPTRACEEVTORIGIN_CORE, "FIQ exception");
+        rc = pspEmuCoreExcpInject(pThis, PSPCOREMODE_FIQ, 0x7, PspAddrPc + 4, false /*fUseMVBar*/);
+    }
 
     pThis->enmExcpPending = PSPCOREEXCP_NONE;
     return rc;
@@ -2581,6 +4995,39 @@ int PSPEmuCoreCreate(PPSPCORE phCore)
         pThis->pMmuPgTblTrackingHead = NULL;
         pThis->u32RegCpsr            = 0;
         pThis->Cp15.u32RegScr        = 0;
+        pThis->cInsnsRetired         = 0;
+        pThis->cVirtClockIps         = PSPEMU_CORE_VIRT_CLOCK_IPS_DEFAULT;
+        pThis->cVirtClockInsnsBase   = 0;
+        pThis->tsVirtClockBaseNs     = 0;
+        pThis->tsDeadlineNs          = UINT64_MAX;
+        pThis->cInsnsDeadline        = UINT64_MAX;
+        pThis->pfnDeadline           = NULL;
+        pThis->pvDeadlineUser        = NULL;
+        pThis->cWfiFastForwards      = 0;
+        pThis->cNsWfiFastForwarded   = 0;
+        pThis->PspAddrBbLast         = 0;
+        pThis->pfnPollDeadline       = NULL;
+        pThis->pvPollDeadlineUser    = NULL;
+        pThis->pfnMemAccess          = NULL;
+        pThis->pvMemAccessUser       = NULL;
+        pThis->pfnIrqRecord          = NULL;
+        pThis->pvIrqRecordUser       = NULL;
+        pThis->pfnIrqReplay          = NULL;
+        pThis->pvIrqReplayUser       = NULL;
+        pThis->cInsnsIrqReplayNext   = UINT64_MAX;
+        pThis->cPollIters            = 0;
+        pThis->cPollFastForwards     = 0;
+        pThis->cNsPollFastForwarded  = 0;
+        pThis->cEmuStarts            = 0;
+        pThis->cMmuFaults            = 0;
+        pThis->cMmuMappingsCreated   = 0;
+        pThis->fMmuPgTblWrProt       = false;
+        pThis->cMmuPgTblWrProtFaults = 0;
+        pThis->cExcpsInjected        = 0;
+        pThis->cSvcs                 = 0;
+        pThis->cSmcs                 = 0;
+        pThis->cMmioReads            = 0;
+        pThis->cMmioWrites           = 0;
         memset(&pThis->Cp15.aBankedRegs[0], 0, sizeof(pThis->Cp15.aBankedRegs));
 
         /* Initialize unicorn engine in ARM mode. */
@@ -2598,6 +5045,8 @@ int PSPEmuCoreCreate(PPSPCORE phCore)
                     err = uc_hook_add(pThis->pUcEngine, &pThis->hUcHookCpsrChange, UC_HOOK_ARM_CPSR_WRITE, (void *)(uintptr_t)pspEmuCoreCpsrChangeWrapper, pThis, 1, 0);
                 if (!err)
                     err = uc_hook_add(pThis->pUcEngine, &pThis->hUcInvMemAcc, UC_HOOK_MEM_INVALID, (void *)(uintptr_t)pspEmuCoreMemMemInvAccess, pThis, 1, 0);
+                if (!err)
+                    err = uc_hook_add(pThis->pUcEngine, &pThis->hUcHookInsnCount, UC_HOOK_BLOCK, (void *)(uintptr_t)pspEmuCoreInsnCountHook, pThis, 1, 0);
                 if (!err)
                 {
                     /* Create the initial CPU context used for resetting later on. */
@@ -2646,22 +5095,47 @@ void PSPEmuCoreDestroy(PSPCORE hCore)
         pMemCur = pMemCur->pNext;
         uc_err rcUc = uc_mem_unmap(pThis->pUcEngine, pFree->PspAddrStart, pFree->cbRegion);
         /** @todo assert(rcUrc == UC_ERR_OK) */
+        if (   !pFree->fMmio
+            && pFree->u.Ram.pbPgUcProt)
+            free(pFree->u.Ram.pbPgUcProt);
         free(pFree);
     }
 
-    /* Deregister all hooks. */
+    /* Deregister all trace points. */
     PPSPCORETPINT pTraceCur = pThis->pTpHead;
     while (pTraceCur)
     {
         PPSPCORETPINT pFree = pTraceCur;
 
         pTraceCur = pTraceCur->pNext;
-        uc_err rcUc = uc_hook_del(pThis->pUcEngine, pFree->hUcHook);
-        /** @todo assert(rcUc == UC_ERR_OK) */
+        pspEmuCoreTpIdxRemove(pThis, pFree);
         free(pFree);
     }
 
+    for (uint32_t i = 0; i < ELEMENTS(pThis->aTpIdx); i++)
+    {
+        if (pThis->aTpIdx[i].pahUcHooks)
+            free(pThis->aTpIdx[i].pahUcHooks);
+        if (pThis->aTpIdx[i].papTpRanges)
+            free(pThis->aTpIdx[i].papTpRanges);
+        if (pThis->aTpIdx[i].paPspAddrEndMax)
+            free(pThis->aTpIdx[i].paPspAddrEndMax);
+    }
+
+    if (pThis->paRevMap)
+        free(pThis->paRevMap);
+
+    if (pThis->hDisasm)
+        PSPEmuDisasmDestroy(pThis->hDisasm);
+
     pThis->pMemRegionsHead = NULL;
+    for (uint32_t i = 0; i < ELEMENTS(pThis->apMemLookupL2); i++)
+    {
+        if (pThis->apMemLookupL2[i])
+            free(pThis->apMemLookupL2[i]);
+        pThis->apMemLookupL2[i] = NULL;
+    }
+
     uc_free(pThis->pUcCtxReset);
     uc_close(pThis->pUcEngine);
     free(pThis);
@@ -2671,16 +5145,24 @@ int PSPEmuCoreMemWrite(PSPCORE hCore, PSPADDR AddrPspWrite, const void *pvData,
 {
     PPSPCOREINT pThis = hCore;
 
+    if (pThis->fMmuEnabled)
+        pspEmuCoreMmuPgTblHostWrite(pThis, AddrPspWrite, cbData);
+
     /*
      * Walk each region and act upon the type there, as soon as an unmapped address is encountered
      * we stop with an error.
      */
     int rc = 0;
     const uint8_t *pbData = (const uint8_t *)pvData;
+
+    /* The written range might contain code which was disassembled already. */
+    if (pThis->hDisasm)
+        PSPEmuDisasmCacheInvalidate(pThis->hDisasm, AddrPspWrite, cbData);
+
     while (   cbData
            && !rc)
     {
-        PPSPCOREMEMREGION pRegion = pspEmuCoreMemRegionFindByAddr(pThis, AddrPspWrite, NULL /*ppPrev*/);
+        PPSPCOREMEMREGION pRegion = pspEmuCoreMemRegionFindByAddr(pThis, AddrPspWrite);
         if (pRegion)
         {
             PSPADDR offStart = AddrPspWrite - pRegion->PspAddrStart;
@@ -2723,7 +5205,7 @@ int PSPEmuCoreMemRead(PSPCORE hCore, PSPADDR AddrPspRead, void *pvDst, size_t cb
     while (   cbDst
            && !rc)
     {
-        PPSPCOREMEMREGION pRegion = pspEmuCoreMemRegionFindByAddr(pThis, AddrPspRead, NULL /*ppPrev*/);
+        PPSPCOREMEMREGION pRegion = pspEmuCoreMemRegionFindByAddr(pThis, AddrPspRead);
         if (pRegion)
         {
             PSPADDR offStart = AddrPspRead - pRegion->PspAddrStart;
@@ -2768,7 +5250,7 @@ int PSPEmuCoreMemWriteVirt(PSPCORE hCore, PSPVADDR AddrPspVWrite, const void *pv
         {
             PSPPADDR PspPAddr;
             size_t cbThisWrite;
-            rc = pspEmuCoreMmuPAddrQueryFromVAddr(pThis, AddrPspVWrite, &PspPAddr, &cbThisWrite, NULL /*penmPgTblWalk*/);
+            rc = pspEmuCoreMmuPAddrQueryFromVAddrCached(pThis, AddrPspVWrite, &PspPAddr, &cbThisWrite, NULL /*penmPgTblWalk*/);
             if (STS_SUCCESS(rc))
             {
                 cbThisWrite = MIN(cbThisWrite, cbData);
@@ -2799,7 +5281,7 @@ int PSPEmuCoreMemReadVirt(PSPCORE hCore, PSPVADDR AddrPspVRead, void *pvDst, siz
         {
             PSPPADDR PspPAddr;
             size_t cbThisRead;
-            rc = pspEmuCoreMmuPAddrQueryFromVAddr(pThis, AddrPspVRead, &PspPAddr, &cbThisRead, NULL /*penmPgTblWalk*/);
+            rc = pspEmuCoreMmuPAddrQueryFromVAddrCached(pThis, AddrPspVRead, &PspPAddr, &cbThisRead, NULL /*penmPgTblWalk*/);
             if (STS_SUCCESS(rc))
             {
                 cbThisRead = MIN(cbThisRead, cbDst);
@@ -2868,6 +5350,8 @@ int PSPEmuCoreMemRegionRemove(PSPCORE hCore, PSPADDR AddrStart, size_t cbRegion)
                 uc_err rcUc = uc_mem_unmap(pThis->pUcEngine, AddrStart, cbRegion);
                 /** @todo assert(rcUc == UC_ERR_OK) */
             }
+            if (pRegion->u.Ram.pbPgUcProt)
+                free(pRegion->u.Ram.pbPgUcProt);
             free(pRegion);
         }
         else
@@ -2899,25 +5383,48 @@ int PSPEmuCoreSetReg(PSPCORE hCore, PSPCOREREG enmReg, uint32_t uVal)
 {
     PPSPCOREINT pThis = hCore;
 
-    uint64_t uTmp = uVal;
-    uc_err rcUc = uc_reg_write(pThis->pUcEngine, pspEmuCoreReg2Uc(enmReg), &uTmp);
-    if (   rcUc == UC_ERR_OK
+    if (enmReg < PSPCOREREG_R0 || enmReg > PSPCOREREG_LAST)
+        return STS_ERR_INVALID_PARAMETER;
+
+    int rc = STS_INF_SUCCESS;
+    if (   pThis->fUcEmuActive
+        || enmReg == PSPCOREREG_CPSR
+        || enmReg == PSPCOREREG_SPSR)
+    {
+        /*
+         * Write through while unicorn is running (hooks) and for CPSR/SPSR as a mode switch
+         * changes the banked registers and must not get reordered with other dirty registers.
+         */
+        rc = pspEmuCoreRegCacheInvalidate(pThis);
+        if (STS_SUCCESS(rc))
+        {
+            uint64_t uTmp = uVal;
+            uc_err rcUc = uc_reg_write(pThis->pUcEngine, pspEmuCoreReg2Uc(enmReg), &uTmp);
+            rc = pspEmuCoreErrConvertFromUcErr(rcUc);
+        }
+    }
+    else
+    {
+        rc = pspEmuCoreRegCacheFill(pThis);
+        if (STS_SUCCESS(rc))
+        {
+            pThis->au32RegCache[enmReg] = uVal;
+            pThis->bmRegCacheDirty |= BIT(enmReg);
+        }
+    }
+
+    if (   STS_SUCCESS(rc)
         && enmReg == PSPCOREREG_PC)
     {
         /* Set the next address to execute to the written value. */
         pThis->PspAddrExecNext = (PSPADDR)uVal;
     }
-    return pspEmuCoreErrConvertFromUcErr(rcUc);
+    return rc;
 }
 
 int PSPEmuCoreQueryReg(PSPCORE hCore, PSPCOREREG enmReg, uint32_t *puVal)
 {
-    PPSPCOREINT pThis = hCore;
-
-    uint64_t uTmp;
-    uc_err rcUc = uc_reg_read(pThis->pUcEngine, pspEmuCoreReg2Uc(enmReg), &uTmp);
-    *puVal = (uint32_t)uTmp;
-    return pspEmuCoreErrConvertFromUcErr(rcUc);
+    return PSPEmuCoreQueryRegBatch(hCore, &enmReg, 1, puVal);
 }
 
 int PSPEmuCoreQueryRegBatch(PSPCORE hCore, const PSPCOREREG *paenmReg, uint32_t cRegs, uint32_t *pauVal)
@@ -2931,6 +5438,25 @@ int PSPEmuCoreQueryRegBatch(PSPCORE hCore, const PSPCOREREG *paenmReg, uint32_t
     if (cRegs > ELEMENTS(aUcRegs))
         return -1;
 
+    for (uint32_t i = 0; i < cRegs; i++)
+    {
+        if (paenmReg[i] < PSPCOREREG_R0 || paenmReg[i] > PSPCOREREG_LAST)
+            return STS_ERR_INVALID_PARAMETER;
+    }
+
+    if (!pThis->fUcEmuActive)
+    {
+        int rc = pspEmuCoreRegCacheFill(pThis);
+        if (STS_SUCCESS(rc))
+        {
+            for (uint32_t i = 0; i < cRegs; i++)
+                pauVal[i] = pThis->au32RegCache[paenmReg[i]];
+        }
+
+        return rc;
+    }
+
+    /* The register state changes behind our back while unicorn is running, so always read from unicorn. */
     for (uint32_t i = 0; i < cRegs; i++)
     {
         au64Vals[i] = 0;
@@ -2955,6 +5481,11 @@ int PSPEmuCoreExecSetStartAddr(PSPCORE hCore, PSPADDR AddrExecStart)
     pThis->PspAddrExecNext = AddrExecStart;
     uint64_t uTmp = AddrExecStart;
     uc_err rcUc = uc_reg_write(pThis->pUcEngine, UC_ARM_REG_PC, &uTmp);
+    if (rcUc == UC_ERR_OK)
+    {
+        pThis->au32RegCache[PSPCOREREG_PC] = AddrExecStart;
+        pThis->bmRegCacheDirty &= ~BIT(PSPCOREREG_PC);
+    }
     return pspEmuCoreErrConvertFromUcErr(rcUc);
 }
 
@@ -2970,26 +5501,63 @@ int PSPEmuCoreExecRun(PSPCORE hCore, uint32_t fFlags, uint32_t cInsnExec, uint32
         msExec = 1;
 
     pThis->fExecStop = false;
+    pThis->fExecRunning = true;
 
     bool fSingleStep = fFlags & PSPEMU_CORE_EXEC_F_DUMP_CORE_STATE ? true : false;
-    while (!rc && cInsnExec && msExec && !pThis->fExecStop)
+    while (!rc && cInsnExec && msExec && !__atomic_load_n(&pThis->fExecStop, __ATOMIC_SEQ_CST))
     {
+        pspEmuCoreKickProcess(pThis);
+        pspEmuCoreIrqReplayProcess(pThis);
+        pspEmuCoreDeadlineProcess(pThis);
+
+        rc = pspEmuCoreMmuPgTblTrackingResync(pThis);
+        if (STS_FAILURE(rc))
+            break;
+
+        /* Deliver any interrupt which became pending while the emulation was not running. */
+        if (   pThis->enmExcpPending == PSPCOREEXCP_IRQ
+            || pThis->enmExcpPending == PSPCOREEXCP_FIQ)
+        {
+            rc = pspEmuCoreExcpHandle(pThis, pThis->PspAddrExecNext & ~(PSPADDR)1,
+                                      (pThis->PspAddrExecNext & 1) ? true : false);
+            if (STS_FAILURE(rc))
+                break;
+        }
+
         uint64_t usUcExec = msExec == PSPEMU_CORE_EXEC_INDEFINITE ? 0 : (uint64_t)msExec * 1000;
+        /* Write back anything modified while stopped, unicorn owns the register state from now on. */
+        rc = pspEmuCoreRegCacheInvalidate(pThis);
+        if (STS_FAILURE(rc))
+            break;
+
+        pThis->cEmuStarts++;
+        __atomic_store_n(&pThis->fExitReasons, 0, __ATOMIC_SEQ_CST);
+        pThis->fUcEmuActive = true;
         uc_err rcUc = uc_emu_start(pThis->pUcEngine, pThis->PspAddrExecNext, 0xffffffff, usUcExec, fSingleStep ? 1 : cInsnExec);
+        pThis->fUcEmuActive = false;
         if (rcUc == UC_ERR_OK)
         {
             cInsnExec--; /* Executed at least one instruction. */
 
-            /* Query the PC and execution mode. */
-            uint32_t uPc = 0;
-            bool     fThumb = false;
+            /*
+             * Unicorn has no hook for WFI, so it can only be detected by decoding the instruction before the PC
+             * which requires a guest memory read. This is only done when no hook recorded a reason for stopping,
+             * because any recorded reason means the emulation didn't halt on its own. Skipping a WFI which happened
+             * to coincide with a deadline or stop request is fine as it is allowed to wake up spuriously.
+             */
+            uint32_t fExitReasons = __atomic_load_n(&pThis->fExitReasons, __ATOMIC_SEQ_CST);
+
+            /*
+             * The PC is required to resume in any case, so it is fetched along with the CPSR in a single batch
+             * and the execution mode is taken from the CPSR T bit instead of querying unicorn separately.
+             */
+            int      aUcRegs[2] = { UC_ARM_REG_PC, UC_ARM_REG_CPSR };
+            uint64_t au64Vals[2] = { 0, 0 };
+            void     *apvVals[2] = { &au64Vals[0], &au64Vals[1] };
             bool     fCont = true;
-            size_t   ucCpuMode = 0;
-            uc_err rcUc2 = uc_reg_read(pThis->pUcEngine, UC_ARM_REG_PC, &uPc);
-            if (rcUc2 == UC_ERR_OK)
-                rcUc2 = uc_query(pThis->pUcEngine, UC_QUERY_MODE, &ucCpuMode);
-
-            fThumb = (ucCpuMode & UC_MODE_THUMB) ? true : false;
+            uc_err rcUc2 = uc_reg_read_batch(pThis->pUcEngine, &aUcRegs[0], &apvVals[0], ELEMENTS(aUcRegs));
+            uint32_t uPc = (uint32_t)au64Vals[0];
+            bool fThumb = (au64Vals[1] & BIT(5)) ? true : false;
 
             if (rcUc2 == UC_ERR_OK)
             {
@@ -3009,26 +5577,39 @@ int PSPEmuCoreExecRun(PSPCORE hCore, uint32_t fFlags, uint32_t cInsnExec, uint32
                         pThis->fMmuChanged = false;
                     }
                 }
-                else if (pspEmuCoreInsnIsWfi(pThis, uPc, fThumb))
+                else if (   !fExitReasons
+                         && pspEmuCoreInsnIsWfi(pThis, uPc, fThumb))
                 {
                     if (pThis->pfnWfiReached)
                     {
-                        pspEmuCoreIrqCheckAndInject(pThis, uPc, true /*fWait*/);
-                        if (pThis->enmExcpPending != PSPCOREEXCP_NONE)
-                        {
-                            rc = pspEmuCoreExcpHandle(pThis, uPc, fThumb);
-                            fCont = false;
-                        }
-                        else
-                        {
-                            uPc |= fThumb ? 1 : 0;
-                            pThis->PspAddrExecNext = (PSPADDR)uPc;
-                        }
+                        /*
+                         * The callback waits for an interrupt, the pending exception gets set
+                         * through PSPEmuCoreIrqSet()/PSPEmuCoreFiqSet().
+                         */
+                        bool fIrq = pThis->fIrq;
+                        bool fFiq = pThis->fFiq;
+                        rc = pThis->pfnWfiReached(pThis, uPc, 0 /*fFlags*/, &fIrq, &fFiq, pThis->pvWfiUser);
+                        if (STS_FAILURE(rc))
+                            break;
                     }
                     else
                     {
-                        rc = STS_INF_PSP_EMU_CORE_INSN_WFI_REACHED;
-                        break;
+                        /* Nothing would ever wake us up if there is no deadline left. */
+                        rc = pspEmuCoreWfiFastForward(pThis);
+                        if (rc)
+                            break;
+                    }
+
+                    pspEmuCoreIrqCheckAndInject(pThis, false /*fStop*/);
+                    if (pThis->enmExcpPending != PSPCOREEXCP_NONE)
+                    {
+                        rc = pspEmuCoreExcpHandle(pThis, uPc, fThumb);
+                        fCont = false;
+                    }
+                    else
+                    {
+                        uPc |= fThumb ? 1 : 0;
+                        pThis->PspAddrExecNext = (PSPADDR)uPc;
                     }
                 }
                 else if (fCont)
@@ -3081,6 +5662,7 @@ int PSPEmuCoreExecRun(PSPCORE hCore, uint32_t fFlags, uint32_t cInsnExec, uint32
             PSPEmuCoreStateDump(pThis, PSPEMU_CORE_STATE_DUMP_F_NO_STACK, 1 /*cInsns*/);
     }
 
+    pThis->fExecRunning = false;
     return rc;
 }
 
@@ -3088,7 +5670,29 @@ int PSPEmuCoreExecStop(PSPCORE hCore)
 {
     PPSPCOREINT pThis = hCore;
 
-    pThis->fExecStop = true;
+    /* Might get called from other threads (debugger, proxy), the reasons are updated atomically. */
+    __atomic_store_n(&pThis->fExecStop, true, __ATOMIC_SEQ_CST);
+    __atomic_fetch_or(&pThis->fExitReasons, PSP_CORE_EXIT_F_STOP, __ATOMIC_SEQ_CST);
+    int rcUc = uc_emu_stop(pThis->pUcEngine);
+    return pspEmuCoreErrConvertFromUcErr(rcUc);
+}
+
+int PSPEmuCoreKickCallbackSet(PSPCORE hCore, PFNPSPCOREKICK pfnKick, void *pvUser)
+{
+    PPSPCOREINT pThis = hCore;
+
+    pThis->pfnKick    = pfnKick;
+    pThis->pvKickUser = pvUser;
+    return STS_INF_SUCCESS;
+}
+
+int PSPEmuCoreKick(PSPCORE hCore)
+{
+    PPSPCOREINT pThis = hCore;
+
+    /* The pending flag survives if the engine isn't running right now, the loop checks it before the next start. */
+    __atomic_store_n(&pThis->fKickPending, true, __ATOMIC_SEQ_CST);
+    __atomic_fetch_or(&pThis->fExitReasons, PSP_CORE_EXIT_F_KICK, __ATOMIC_SEQ_CST);
     int rcUc = uc_emu_stop(pThis->pUcEngine);
     return pspEmuCoreErrConvertFromUcErr(rcUc);
 }
@@ -3097,6 +5701,7 @@ int PSPEmuCoreExecReset(PSPCORE hCore)
 {
     PPSPCOREINT pThis = hCore;
 
+    pspEmuCoreRegCacheDiscard(pThis);
     int rcUc = uc_context_restore(pThis->pUcEngine, pThis->pUcCtxReset);
     return pspEmuCoreErrConvertFromUcErr(rcUc);
 }
@@ -3114,7 +5719,7 @@ int PSPEmuCoreTraceRegister(PSPCORE hCore, PSPADDR uPspAddrStart, PSPADDR uPspAd
             || (fFlags & PSPEMU_CORE_TRACE_F_WRITE)))
         return -1;
 
-    /* Try to register a new hook. */
+    /* Try to register a new trace point. */
     PPSPCORETPINT pTp = (PPSPCORETPINT)calloc(1, sizeof(*pTp));
     if (pTp)
     {
@@ -3124,31 +5729,10 @@ int PSPEmuCoreTraceRegister(PSPCORE hCore, PSPADDR uPspAddrStart, PSPADDR uPspAd
         pTp->pPspCore     = pThis;
         pTp->pfnTrace     = pfnTrace;
         pTp->pvUser       = pvUser;
+        pTp->fFlags       = fFlags;
+        pTp->pHashNext    = NULL;
 
-        uc_hook_type fHook = 0;
-        if (fFlags & PSPEMU_CORE_TRACE_F_EXEC)
-        {
-            if (fFlags & PSPEMU_CORE_TRACE_F_EXEC_BASIC_BLOCK)
-                fHook = UC_HOOK_BLOCK;
-            else
-                fHook = UC_HOOK_CODE;
-        }
-
-        void *pfnHook = (void *)(uintptr_t)pspEmuCoreUcHookWrapper;
-        if (fFlags & PSPEMU_CORE_TRACE_F_READ)
-        {
-            pfnHook = (void *)(uintptr_t)pspEmuCoreUcHookMemWrapper;
-            fHook |= UC_HOOK_MEM_READ;
-        }
-        if (fFlags & PSPEMU_CORE_TRACE_F_WRITE)
-        {
-            pfnHook = (void *)(uintptr_t)pspEmuCoreUcHookMemWrapper;
-            fHook |= UC_HOOK_MEM_WRITE;
-        }
-
-        uc_err rcUc = uc_hook_add(pThis->pUcEngine, &pTp->hUcHook, fHook,
-                                  pfnHook, pTp, uPspAddrStart, uPspAddrEnd);
-        rc = pspEmuCoreErrConvertFromUcErr(rcUc);
+        rc = pspEmuCoreTpIdxInsert(pThis, pTp);
         if (STS_SUCCESS(rc))
         {
             pTp->pNext = pThis->pTpHead;
@@ -3187,8 +5771,7 @@ int PSPEmuCoreTraceDeregister(PSPCORETP hTp)
         else
             pThis->pTpHead = pCur->pNext;
 
-        uc_err rcUc = uc_hook_del(pThis->pUcEngine, pCur->hUcHook);
-        /** @todo assert(rcUc == UC_ERR_OK) */
+        pspEmuCoreTpIdxRemove(pThis, pCur);
         free(pCur);
     }
     else
@@ -3276,7 +5859,9 @@ int PSPEmuCoreIrqSet(PSPCORE hCore, bool fAssert)
 {
     PPSPCOREINT pThis = hCore;
 
-    pThis->fIrq = fAssert;
+    /* The interrupt lines are driven by the replay only. */
+    if (!pThis->pfnIrqReplay)
+        pspEmuCoreIrqLinesSet(pThis, fAssert, pThis->fFiq);
     return STS_INF_SUCCESS;
 }
 
@@ -3284,10 +5869,233 @@ int PSPEmuCoreFiqSet(PSPCORE hCore, bool fAssert)
 {
     PPSPCOREINT pThis = hCore;
 
-    pThis->fFiq = fAssert;
+    if (!pThis->pfnIrqReplay)
+        pspEmuCoreIrqLinesSet(pThis, pThis->fIrq, fAssert);
+    return STS_INF_SUCCESS;
+}
+
+int PSPEmuCoreIrqRecordCallbackSet(PSPCORE hCore, PFNPSPCOREIRQRECORD pfnIrqRecord, void *pvUser)
+{
+    PPSPCOREINT pThis = hCore;
+
+    pThis->pfnIrqRecord    = pfnIrqRecord;
+    pThis->pvIrqRecordUser = pvUser;
+    return STS_INF_SUCCESS;
+}
+
+int PSPEmuCoreIrqReplayCallbackSet(PSPCORE hCore, PFNPSPCOREIRQREPLAY pfnIrqReplay, void *pvUser, uint64_t cInsnsFirst)
+{
+    PPSPCOREINT pThis = hCore;
+
+    pThis->pfnIrqReplay        = pfnIrqReplay;
+    pThis->pvIrqReplayUser     = pvUser;
+    pThis->cInsnsIrqReplayNext = pfnIrqReplay ? cInsnsFirst : UINT64_MAX;
+    pspEmuCoreDeadlineInsnsRecalc(pThis);
+    return STS_INF_SUCCESS;
+}
+
+int PSPEmuCoreVirtClockSetIps(PSPCORE hCore, uint64_t cIps)
+{
+    PPSPCOREINT pThis = hCore;
+
+    if (!cIps)
+        return STS_ERR_INVALID_PARAMETER;
+
+    /* Rebase the clock so the virtual time doesn't jump when the rate changes. */
+    pThis->tsVirtClockBaseNs   = PSPEmuCoreQueryVirtTimeNs(hCore);
+    pThis->cVirtClockInsnsBase = pThis->cInsnsRetired;
+    pThis->cVirtClockIps       = cIps;
+    pspEmuCoreDeadlineInsnsRecalc(pThis);
+    return STS_INF_SUCCESS;
+}
+
+int PSPEmuCoreMmuPgTblTrackingSetWrProt(PSPCORE hCore, bool fWrProt)
+{
+    PPSPCOREINT pThis = hCore;
+    int rc = STS_INF_SUCCESS;
+
+    if (pThis->fMmuPgTblWrProt == fWrProt)
+        return STS_INF_SUCCESS;
+
+    /* Re-create the tracking structures with the new method if the MMU is active. */
+    if (pThis->fMmuEnabled)
+        rc = pspEmuCoreMmuPgTblTrackingRemove(pThis);
+    if (STS_SUCCESS(rc))
+    {
+        pThis->fMmuPgTblWrProt = fWrProt;
+        if (pThis->fMmuEnabled)
+            rc = pspEmuCoreMmuSetupPgTblTracking(pThis);
+    }
+
+    return rc;
+}
+
+int PSPEmuCoreVirtClockAdvanceNs(PSPCORE hCore, uint64_t cNs)
+{
+    PPSPCOREINT pThis = hCore;
+
+    pThis->tsVirtClockBaseNs += cNs;
+    pspEmuCoreDeadlineInsnsRecalc(pThis);
+    return STS_INF_SUCCESS;
+}
+
+uint64_t PSPEmuCoreQueryVirtTimeNs(PSPCORE hCore)
+{
+    PPSPCOREINT pThis = hCore;
+    uint64_t cInsns = pThis->cInsnsRetired - pThis->cVirtClockInsnsBase;
+
+    /* Split the conversion up to avoid overflowing the intermediate result. */
+    return   pThis->tsVirtClockBaseNs
+           + (cInsns / pThis->cVirtClockIps) * UINT64_C(1000000000)
+           + ((cInsns % pThis->cVirtClockIps) * UINT64_C(1000000000)) / pThis->cVirtClockIps;
+}
+
+uint64_t PSPEmuCoreQueryInsnsRetired(PSPCORE hCore)
+{
+    PPSPCOREINT pThis = hCore;
+
+    return pThis->cInsnsRetired;
+}
+
+ARMASID PSPEmuCoreQueryAsid(PSPCORE hCore)
+{
+    PPSPCOREINT pThis = hCore;
+
+    return pspEmuCoreCpGetBank(pThis)->u32RegContextId;
+}
+
+int PSPEmuCorePollDeadlineCallbackSet(PSPCORE hCore, PFNPSPCOREPOLLDEADLINE pfnPollDeadline, void *pvUser)
+{
+    PPSPCOREINT pThis = hCore;
+
+    pThis->pfnPollDeadline    = pfnPollDeadline;
+    pThis->pvPollDeadlineUser = pvUser;
+    pThis->cPollIters         = 0;
+    return STS_INF_SUCCESS;
+}
+
+int PSPEmuCoreMemAccessCallbackSet(PSPCORE hCore, PFNPSPCOREMEMACCESS pfnMemAccess, void *pvUser)
+{
+    PPSPCOREINT pThis = hCore;
+
+    pThis->pfnMemAccess    = pfnMemAccess;
+    pThis->pvMemAccessUser = pvUser;
+
+    /* Existing mappings might span multiple pages and have access granted already, start over. */
+    return PSPEmuCoreMemAccessRearm(hCore);
+}
+
+int PSPEmuCoreMemAccessRearm(PSPCORE hCore)
+{
+    PPSPCOREINT pThis = hCore;
+
+    if (pThis->fMmuEnabled)
+        return pspEmuCoreMmuMappingsClear(pThis);
+
+    /* Without the MMU the regions stay mapped, revoke the access granted to every page instead. */
+    PPSPCOREMEMREGION pMemCur = pThis->pMemRegionsHead;
+    while (pMemCur)
+    {
+        if (   pMemCur->fMapped
+            && !pMemCur->fMmio)
+        {
+            int32_t fUcProt = UC_PROT_NONE;
+            if (!pThis->pfnMemAccess)
+                fUcProt = pspEmuCoreMemRegionProt2UcProt(pMemCur->u.Ram.fProt);
+            if (pMemCur->u.Ram.pbPgUcProt)
+                memset(pMemCur->u.Ram.pbPgUcProt, 0, pMemCur->cbRegion / PSP_PAGE_SIZE);
+
+            uc_err rcUc = uc_mem_protect(pThis->pUcEngine, pMemCur->PspAddrStart, pMemCur->cbRegion, fUcProt);
+            if (rcUc != UC_ERR_OK)
+                return pspEmuCoreErrConvertFromUcErr(rcUc);
+        }
+        pMemCur = pMemCur->pNext;
+    }
+
+    return STS_INF_SUCCESS;
+}
+
+int PSPEmuCoreDeadlineCallbackSet(PSPCORE hCore, PFNPSPCOREDEADLINE pfnDeadline, void *pvUser)
+{
+    PPSPCOREINT pThis = hCore;
+
+    pThis->pfnDeadline    = pfnDeadline;
+    pThis->pvDeadlineUser = pvUser;
+    pspEmuCoreDeadlineInsnsRecalc(pThis);
+    return STS_INF_SUCCESS;
+}
+
+int PSPEmuCoreDeadlineSet(PSPCORE hCore, uint64_t tsDeadlineNs)
+{
+    PPSPCOREINT pThis = hCore;
+
+    pThis->tsDeadlineNs = tsDeadlineNs;
+    pspEmuCoreDeadlineInsnsRecalc(pThis);
+    return STS_INF_SUCCESS;
+}
+
+int PSPEmuCoreQueryStats(PSPCORE hCore, PPSPCORESTATS pStats)
+{
+    PPSPCOREINT pThis = hCore;
+
+    memset(pStats, 0, sizeof(*pStats));
+
+    pStats->cInsnsRetired           = pThis->cInsnsRetired;
+    pStats->tsVirtNs                = PSPEmuCoreQueryVirtTimeNs(hCore);
+    pStats->cEmuStarts              = pThis->cEmuStarts;
+    pStats->cMmioReads              = pThis->cMmioReads;
+    pStats->cMmioWrites             = pThis->cMmioWrites;
+    pStats->cMmuFaults              = pThis->cMmuFaults;
+    pStats->cMmuMappingsCreated     = pThis->cMmuMappingsCreated;
+    pStats->cMmuMappingsMerged      = pThis->cMmuMappingsMerged;
+    pStats->cMmuMappingsInvalidated = pThis->cMmuMappingsInvalidated;
+    pStats->cMmuFlushes             = pThis->cMmuFlushes;
+    pStats->cMmuFlushesAvoided      = pThis->cMmuFlushesAvoided;
+    pStats->cMmuPgTblWrites         = pThis->cMmuPgTblWrites;
+    pStats->cMmuPgTblWrProtFaults   = pThis->cMmuPgTblWrProtFaults;
+    pStats->cTlbHits                = pThis->cTlbHits;
+    pStats->cTlbMisses              = pThis->cTlbMisses;
+    pStats->cExcpsInjected          = pThis->cExcpsInjected;
+    pStats->cSvcs                   = pThis->cSvcs;
+    pStats->cSmcs                   = pThis->cSmcs;
+    pStats->cWfiFastForwards        = pThis->cWfiFastForwards;
+    pStats->cNsWfiFastForwarded     = pThis->cNsWfiFastForwarded;
+    pStats->cPollFastForwards       = pThis->cPollFastForwards;
+    pStats->cNsPollFastForwarded    = pThis->cNsPollFastForwarded;
     return STS_INF_SUCCESS;
 }
 
+void PSPEmuCoreStatsDump(PSPCORE hCore)
+{
+    PSPCORESTATS Stats;
+
+    PSPEmuCoreQueryStats(hCore, &Stats);
+    printf("Execution statistics:\n"
+           "    Instructions retired:     %llu\n"
+           "    Virtual time:             %lluns\n"
+           "    uc_emu_start() calls:     %llu\n"
+           "    MMIO reads/writes:        %llu/%llu\n"
+           "    MMU faults:               %llu\n"
+           "    MMU mappings created:     %llu (%llu merged, %llu invalidated)\n"
+           "    MMU flushes:              %llu (%llu avoided, %llu page table writes)\n"
+           "    Page table WP faults:     %llu\n"
+           "    Software TLB hits/misses: %llu/%llu\n"
+           "    Exceptions injected:      %llu\n"
+           "    SVCs/SMCs:                %llu/%llu\n"
+           "    WFI fast forwards:        %llu (%lluns skipped)\n"
+           "    Polling loops skipped:    %llu (%lluns skipped)\n",
+           Stats.cInsnsRetired, Stats.tsVirtNs, Stats.cEmuStarts,
+           Stats.cMmioReads, Stats.cMmioWrites,
+           Stats.cMmuFaults,
+           Stats.cMmuMappingsCreated, Stats.cMmuMappingsMerged, Stats.cMmuMappingsInvalidated,
+           Stats.cMmuFlushes, Stats.cMmuFlushesAvoided, Stats.cMmuPgTblWrites,
+           Stats.cMmuPgTblWrProtFaults,
+           Stats.cTlbHits, Stats.cTlbMisses,
+           Stats.cExcpsInjected, Stats.cSvcs, Stats.cSmcs,
+           Stats.cWfiFastForwards, Stats.cNsWfiFastForwarded,
+           Stats.cPollFastForwards, Stats.cNsPollFastForwarded);
+}
+
 void PSPEmuCoreStateDump(PSPCORE hCore, uint32_t fFlags, uint32_t cInsns)
 {
     PPSPCOREINT pThis = hCore;
@@ -3303,10 +6111,29 @@ void PSPEmuCoreStateDump(PSPCORE hCore, uint32_t fFlags, uint32_t cInsns)
         if (!rc)
         {
             size_t ucCpuMode = 0;
+            PSPPADDR PspPAddrPc = au32Reg[PSPCOREREG_PC];
+            size_t cbRegion = 0;
+
+            if (!pThis->hDisasm)
+                PSPEmuDisasmCreate(&pThis->hDisasm);
+
+            /* The cache is keyed by the physical address, without it we just disassemble. */
+            if (   pThis->hDisasm
+                && pspEmuCoreCpIsSctrlMmuEnabled(pThis))
+                rc = pspEmuCoreMmuPAddrQueryFromVAddrCached(pThis, au32Reg[PSPCOREREG_PC], &PspPAddrPc, &cbRegion, NULL /*penmPgTblWalk*/);
 
             uc_err rcUc = uc_query(pThis->pUcEngine, UC_QUERY_MODE, &ucCpuMode);
             if (rcUc == UC_ERR_OK)
-                rc = PSPEmuDisasm(&achBuf[0], sizeof(achBuf), cInsns, &abInsn[0], sizeof(abInsn), au32Reg[PSPCOREREG_PC], (ucCpuMode & UC_MODE_THUMB) ? true : false);
+            {
+                bool fThumb = (ucCpuMode & UC_MODE_THUMB) ? true : false;
+
+                if (   pThis->hDisasm
+                    && STS_SUCCESS(rc))
+                    rc = PSPEmuDisasmCached(pThis->hDisasm, &achBuf[0], sizeof(achBuf), cInsns, &abInsn[0], sizeof(abInsn),
+                                            au32Reg[PSPCOREREG_PC], PspPAddrPc, fThumb);
+                else
+                    rc = PSPEmuDisasm(&achBuf[0], sizeof(achBuf), cInsns, &abInsn[0], sizeof(abInsn), au32Reg[PSPCOREREG_PC], fThumb);
+            }
             else
                 fprintf(stderr, "Querying CPU mode failed with %d\n", pspEmuCoreErrConvertFromUcErr(rcUc));
         }
@@ -3399,9 +6226,139 @@ int PSPEmuCoreQueryPAddrFromVAddr(PSPCORE hCore, PSPVADDR PspVAddr, PSPPADDR *pP
     else
     {
         size_t cbRegion = 0;
-        rc = pspEmuCoreMmuPAddrQueryFromVAddr(pThis, PspVAddr, pPspPAddr, &cbRegion, penmPgTblWalk);
+        rc = pspEmuCoreMmuPAddrQueryFromVAddrCached(pThis, PspVAddr, pPspPAddr, &cbRegion, penmPgTblWalk);
+    }
+
+    return rc;
+}
+
+
+int PSPEmuCoreStateSave(PSPCORE hCore, PSPSNAPSHOT hSnap)
+{
+    PPSPCOREINT pThis = hCore;
+    uint64_t au64Regs[ELEMENTS(g_aUcRegsState)];
+    uint64_t aau64RegsBanked[ELEMENTS(g_aenmModesBanked)][ELEMENTS(g_aUcRegsBanked)];
+
+    memset(&au64Regs[0], 0, sizeof(au64Regs));
+    memset(&aau64RegsBanked[0][0], 0, sizeof(aau64RegsBanked));
+
+    /*
+     * The architectural registers are saved explicitly instead of the opaque unicorn context
+     * so the snapshot doesn't depend on the emulator build. The cache gets invalidated because
+     * walking the modes to get at the banked registers changes what unicorn presents.
+     */
+    int rc = pspEmuCoreRegCacheInvalidate(pThis);
+    if (STS_SUCCESS(rc))
+        rc = pspEmuCoreRegsXfer(pThis, &g_aUcRegsState[0], &au64Regs[0], ELEMENTS(g_aUcRegsState), false /*fWrite*/);
+    if (STS_SUCCESS(rc))
+        rc = pspEmuCoreRegsBankedXfer(pThis, (uint32_t)au64Regs[PSP_CORE_STATE_REG_IDX_CPSR], aau64RegsBanked,
+                                      false /*fWrite*/);
+
+    for (uint32_t i = 0; i < ELEMENTS(au64Regs) && STS_SUCCESS(rc); i++)
+        rc = PSPEmuSnapshotPutU64(hSnap, au64Regs[i]);
+    for (uint32_t i = 0; i < ELEMENTS(g_aenmModesBanked) && STS_SUCCESS(rc); i++)
+    {
+        for (uint32_t iReg = 0; iReg < ELEMENTS(g_aUcRegsBanked) && STS_SUCCESS(rc); iReg++)
+            rc = PSPEmuSnapshotPutU64(hSnap, aau64RegsBanked[i][iReg]);
     }
 
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutData(hSnap, &pThis->Cp15, sizeof(pThis->Cp15));
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutU32(hSnap, pThis->u32RegCpsr);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutU32(hSnap, (uint32_t)pThis->enmCoreMode);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutU32(hSnap, pThis->PspAddrExecNext);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutBool(hSnap, pThis->fIrq);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutBool(hSnap, pThis->fFiq);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutU64(hSnap, pThis->cInsnsRetired);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutU64(hSnap, PSPEmuCoreQueryVirtTimeNs(hCore));
+
     return rc;
 }
 
+int PSPEmuCoreStateLoad(PSPCORE hCore, PSPSNAPSHOT hSnap)
+{
+    PPSPCOREINT pThis = hCore;
+    uint64_t au64Regs[ELEMENTS(g_aUcRegsState)];
+    uint64_t aau64RegsBanked[ELEMENTS(g_aenmModesBanked)][ELEMENTS(g_aUcRegsBanked)];
+    int rc = STS_INF_SUCCESS;
+
+    for (uint32_t i = 0; i < ELEMENTS(au64Regs) && STS_SUCCESS(rc); i++)
+        rc = PSPEmuSnapshotGetU64(hSnap, &au64Regs[i]);
+    for (uint32_t i = 0; i < ELEMENTS(g_aenmModesBanked) && STS_SUCCESS(rc); i++)
+    {
+        for (uint32_t iReg = 0; iReg < ELEMENTS(g_aUcRegsBanked) && STS_SUCCESS(rc); iReg++)
+            rc = PSPEmuSnapshotGetU64(hSnap, &aau64RegsBanked[i][iReg]);
+    }
+    if (STS_SUCCESS(rc))
+    {
+        /* Throw away the current mappings, they are re-established from the restored state below. */
+        if (pThis->fMmuEnabled)
+        {
+            rc = pspEmuCoreMmuMappingsClear(pThis);
+            if (STS_SUCCESS(rc))
+                rc = pspEmuCoreMmuPgTblTrackingRemove(pThis);
+        }
+        else
+            rc = pspEmuCoreMemRegionsUnregisterAll(pThis);
+    }
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetData(hSnap, &pThis->Cp15, sizeof(pThis->Cp15));
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetU32(hSnap, &pThis->u32RegCpsr);
+    if (STS_SUCCESS(rc))
+    {
+        uint32_t u32CoreMode = 0;
+        rc = PSPEmuSnapshotGetU32(hSnap, &u32CoreMode);
+        pThis->enmCoreMode = (PSPCOREMODE)u32CoreMode;
+    }
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetU32(hSnap, &pThis->PspAddrExecNext);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetBool(hSnap, &pThis->fIrq);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetBool(hSnap, &pThis->fFiq);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetU64(hSnap, &pThis->cInsnsRetired);
+    if (STS_SUCCESS(rc))
+    {
+        /* Continue the virtual clock where it stopped, using the currently configured rate. */
+        rc = PSPEmuSnapshotGetU64(hSnap, &pThis->tsVirtClockBaseNs);
+        pThis->cVirtClockInsnsBase = pThis->cInsnsRetired;
+        pspEmuCoreDeadlineInsnsRecalc(pThis);
+    }
+    if (STS_SUCCESS(rc))
+    {
+        /* The banked registers come first, they leave the core in the saved mode for the remaining registers. */
+        pspEmuCoreRegCacheDiscard(pThis);
+        rc = pspEmuCoreRegsBankedXfer(pThis, (uint32_t)au64Regs[PSP_CORE_STATE_REG_IDX_CPSR], aau64RegsBanked,
+                                      true /*fWrite*/);
+        if (STS_SUCCESS(rc))
+            rc = pspEmuCoreRegsXfer(pThis, &g_aUcRegsState[0], &au64Regs[0], ELEMENTS(g_aUcRegsState), true /*fWrite*/);
+    }
+    if (STS_SUCCESS(rc))
+    {
+        pThis->enmExcpPending = PSPCOREEXCP_NONE;
+        pThis->fMmuChanged    = false;
+        pThis->fMmuSecure     = pspEmuCoreIsSecure(pThis);
+        pThis->fMmuEnabled    = pspEmuCoreCpIsSctrlMmuEnabled(pThis);
+
+        /*
+         * The MMU mappings are derived from the page tables in the already restored memory,
+         * so only the page table tracking needs to be set up again and everything else gets
+         * mapped lazily on the first access.
+         */
+        if (pThis->fMmuEnabled)
+            rc = pspEmuCoreMmuSetupPgTblTracking(pThis);
+        else
+            rc = pspEmuCoreMemRegionsRegisterAll(pThis);
+    }
+
+    return rc;
+}
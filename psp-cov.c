@@ -320,6 +320,7 @@ void PSPEmuCovReset(PSPCOV hCov)
 
     pThis->pBbsHead = NULL;
     pThis->pBbsTail = NULL;
+    pThis->cBbs     = 0;
 
     /* Clear the bitmap. */
     for (size_t i = 0; i < pThis->cbBmHit; i++)
@@ -381,3 +382,19 @@ int PSPEmuCovDumpToFile(PSPCOV hCov, const char *pszFilename)
     return rc;
 }
 
+
+uint32_t PSPEmuCovQueryBbCount(PSPCOV hCov)
+{
+    PPSPCOVINT pThis = hCov;
+
+    return pThis->cBbs;
+}
+
+
+const uint8_t *PSPEmuCovQueryHitBitmap(PSPCOV hCov, size_t *pcbBm)
+{
+    PPSPCOVINT pThis = hCov;
+
+    *pcbBm = pThis->cbBmHit;
+    return pThis->pbmHit;
+}
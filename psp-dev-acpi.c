@@ -113,6 +113,12 @@ const PSPDEVREG g_DevRegAcpi =
     /** pfnDestruct */
     pspDevAcpiDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    NULL,
+    /** pfnLoad */
+    NULL,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
@@ -66,6 +66,9 @@ typedef uint64_t CCPADDR;
 /** Create a CCP address from the given low and high parts. */
 #define CCP_ADDR_CREATE_FROM_HI_LO(a_High, a_Low) (((CCPADDR)(a_High) << 32) | (a_Low))
 
+/** Virtual time in nanoseconds between finishing a queue run and raising the completion interrupt. */
+#define CCP_V5_IRQ_LATENCY_NS                     UINT64_C(1000)
+
 
 /**
  * A single CCP queue.
@@ -84,6 +87,8 @@ typedef struct CCPQUEUE
     uint32_t                        u32RegIen;
     /** Interrupt status register. */
     uint32_t                        u32RegIsts;
+    /** Interrupt status bits which become visible when the completion interrupt is raised. */
+    uint32_t                        u32RegIstsPending;
     /** Flag whether the queue was enabled by setting the run bit. */
     bool                            fEnabled;
 } CCPQUEUE;
@@ -144,6 +149,8 @@ typedef struct PSPDEVCCP
     z_stream                        Zlib;
     /** Size of the last transfer in bytes (written to local PSP memory). */
     size_t                          cbWrittenLast;
+    /** Timer raising the interrupt request after a queue run completed. */
+    PSPEVTQTIMER                    hTmrIrq;
 } PSPDEVCCP;
 /** Pointer to the device instance data. */
 typedef PSPDEVCCP *PPSPDEVCCP;
@@ -2034,12 +2041,12 @@ static void pspDevCcpQueueRunMaybe(PPSPDEVCCP pThis, PCCPQUEUE pQueue)
                 if (!rc)
                 {
                     pQueue->u32RegSts = CCP_V5_Q_REG_STATUS_SUCCESS;
-                    pQueue->u32RegIsts |= CCP_V5_Q_REG_ISTS_COMPLETION;
+                    pQueue->u32RegIstsPending |= CCP_V5_Q_REG_ISTS_COMPLETION;
                 }
                 else
                 {
                     pQueue->u32RegSts = CCP_V5_Q_REG_STATUS_ERROR;
-                    pQueue->u32RegIsts |= CCP_V5_Q_REG_ISTS_ERROR;
+                    pQueue->u32RegIstsPending |= CCP_V5_Q_REG_ISTS_ERROR;
                     break;
                 }
             }
@@ -2047,7 +2054,7 @@ static void pspDevCcpQueueRunMaybe(PPSPDEVCCP pThis, PCCPQUEUE pQueue)
             {
                 printf("CCP: Failed to read request from 0x%08x with rc=%d\n", u32ReqHead, rc);
                 pQueue->u32RegSts = CCP_V5_Q_REG_STATUS_ERROR; /* Signal error. */
-                pQueue->u32RegIsts |= CCP_V5_Q_REG_ISTS_ERROR;
+                pQueue->u32RegIstsPending |= CCP_V5_Q_REG_ISTS_ERROR;
                 break;
             }
 
@@ -2057,13 +2064,13 @@ static void pspDevCcpQueueRunMaybe(PPSPDEVCCP pThis, PCCPQUEUE pQueue)
         /* Set halt bit again. */
         pQueue->u32RegReqHead = u32ReqHead;
         pQueue->u32RegCtrl |= CCP_V5_Q_REG_CTRL_HALT;
-        pQueue->u32RegIsts |= CCP_V5_Q_REG_ISTS_Q_STOP;
+        pQueue->u32RegIstsPending |= CCP_V5_Q_REG_ISTS_Q_STOP;
         if (u32ReqTail == u32ReqHead)
-            pQueue->u32RegIsts |= CCP_V5_Q_REG_ISTS_Q_EMPTY;
+            pQueue->u32RegIstsPending |= CCP_V5_Q_REG_ISTS_Q_EMPTY;
 
-        /* Issue an interrupt request if there is something pending. */
-        if (pQueue->u32RegIen & pQueue->u32RegIsts)
-            pThis->pDev->pDevIf->pfnIrqSet(pThis->pDev->pDevIf, 0 /*idPrio*/, 0x15 /*idDev*/, true /*fAssert*/);
+        /* The interrupt status becomes visible together with the interrupt request. */
+        if (!PSPEmuEvtQTimerIsArmed(pThis->hTmrIrq))
+            PSPEmuEvtQTimerArmRelative(pThis->hTmrIrq, CCP_V5_IRQ_LATENCY_NS);
     }
 }
 
@@ -2179,7 +2186,10 @@ static void pspDevCcpMmioQueueRegWrite(PPSPDEVCCP pThis, PCCPQUEUE pQueue, uint3
             /* Set bits clear the corresponding interrupt. */
             pQueue->u32RegIsts &= ~u32Val;
 
-            /* Reset the interrupt line if there is nothing pending anymore. */
+            /*
+             * Reset the interrupt line if there is nothing pending anymore, the timer stays armed
+             * for status of queue runs which didn't become visible yet.
+             */
             if (!(pQueue->u32RegIen & pQueue->u32RegIsts))
                 pThis->pDev->pDevIf->pfnIrqSet(pThis->pDev->pDevIf, 0 /*idPrio*/, 0x15 /*idDev*/, false /*fAssert*/);
             break;
@@ -2279,6 +2289,33 @@ static void pspDevCcpMmioRead2(PSPADDR offMmio, size_t cbRead, void *pvDst, void
 }
 
 
+/**
+ * @copydoc{FNPSPEVTQTIMER, Raises the interrupt request for completed queue runs}
+ */
+static void pspDevCcpIrqTimerExpired(PSPEVTQTIMER hTimer, uint64_t tsNowNs, void *pvUser)
+{
+    PPSPDEVCCP pThis = (PPSPDEVCCP)pvUser;
+
+    (void)hTimer;
+    (void)tsNowNs;
+
+    for (unsigned i = 0; i < ELEMENTS(pThis->aQueues); i++)
+    {
+        pThis->aQueues[i].u32RegIsts        |= pThis->aQueues[i].u32RegIstsPending;
+        pThis->aQueues[i].u32RegIstsPending  = 0;
+    }
+
+    for (unsigned i = 0; i < ELEMENTS(pThis->aQueues); i++)
+    {
+        if (pThis->aQueues[i].u32RegIen & pThis->aQueues[i].u32RegIsts)
+        {
+            pThis->pDev->pDevIf->pfnIrqSet(pThis->pDev->pDevIf, 0 /*idPrio*/, 0x15 /*idDev*/, true /*fAssert*/);
+            break;
+        }
+    }
+}
+
+
 static int pspDevCcpInit(PPSPDEV pDev)
 {
     PPSPDEVCCP pThis = (PPSPDEVCCP)&pDev->abInstance[0];
@@ -2288,15 +2325,20 @@ static int pspDevCcpInit(PPSPDEV pDev)
 
     for (unsigned i = 0; i < ELEMENTS(pThis->aQueues); i++)
     {
-        pThis->aQueues[i].u32RegCtrl = CCP_V5_Q_REG_CTRL_HALT; /* Halt bit set. */
-        pThis->aQueues[i].u32RegSts  = CCP_V5_Q_REG_STATUS_SUCCESS;
-        pThis->aQueues[i].u32RegIen  = 0;
-        pThis->aQueues[i].u32RegIsts = 0;
-        pThis->aQueues[i].fEnabled   = false;
+        pThis->aQueues[i].u32RegCtrl        = CCP_V5_Q_REG_CTRL_HALT; /* Halt bit set. */
+        pThis->aQueues[i].u32RegSts         = CCP_V5_Q_REG_STATUS_SUCCESS;
+        pThis->aQueues[i].u32RegIen         = 0;
+        pThis->aQueues[i].u32RegIsts        = 0;
+        pThis->aQueues[i].u32RegIstsPending = 0;
+        pThis->aQueues[i].fEnabled          = false;
     }
 
+    int rc = PSPEmuEvtQTimerCreate(pDev->hEvtQ, pspDevCcpIrqTimerExpired, pThis, "CCPv5 IRQ", &pThis->hTmrIrq);
+    if (rc)
+        return rc;
+
     /* Register MMIO ranges. */
-    int rc = PSPEmuIoMgrMmioRegister(pDev->hIoMgr, CCP_V5_MMIO_ADDRESS, CCP_V5_Q_OFFSET + ELEMENTS(pThis->aQueues) * CCP_V5_Q_SIZE,
+    rc = PSPEmuIoMgrMmioRegister(pDev->hIoMgr, CCP_V5_MMIO_ADDRESS, CCP_V5_Q_OFFSET + ELEMENTS(pThis->aQueues) * CCP_V5_Q_SIZE,
                                      pspDevCcpMmioRead, pspDevCcpMmioWrite, pThis,
                                      "CCPv5 Global+Queue", &pThis->hMmio);
     /** @todo Not sure this really belongs to the CCP (could be some other hardware block) but
@@ -2312,7 +2354,109 @@ static int pspDevCcpInit(PPSPDEV pDev)
 
 static void pspDevCcpDestruct(PPSPDEV pDev)
 {
-    /* Nothing to do so far. */
+    PPSPDEVCCP pThis = (PPSPDEVCCP)&pDev->abInstance[0];
+
+    if (pThis->hTmrIrq)
+    {
+        PSPEmuEvtQTimerDestroy(pThis->hTmrIrq);
+        pThis->hTmrIrq = NULL;
+    }
+}
+
+
+static int pspDevCcpSave(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVCCP pThis = (PPSPDEVCCP)&pDev->abInstance[0];
+
+    /* The openssl and zlib contexts of a multi-part operation in flight can't be serialized. */
+    if (   pThis->pOsslShaCtx
+        || pThis->pOsslAesCtx
+        || pThis->Zlib.state)
+    {
+        printf("CCP: Can't save the state while a multi-part operation is in progress\n");
+        return STS_ERR_GENERAL_ERROR;
+    }
+
+    int rc = STS_INF_SUCCESS;
+    for (unsigned i = 0; i < ELEMENTS(pThis->aQueues) && STS_SUCCESS(rc); i++)
+    {
+        PCCCPQUEUE pQueue = &pThis->aQueues[i];
+
+        rc = PSPEmuSnapshotPutU32(hSnap, pQueue->u32RegCtrl);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU32(hSnap, pQueue->u32RegReqTail);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU32(hSnap, pQueue->u32RegReqHead);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU32(hSnap, pQueue->u32RegSts);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU32(hSnap, pQueue->u32RegIen);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU32(hSnap, pQueue->u32RegIsts);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU32(hSnap, pQueue->u32RegIstsPending);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutBool(hSnap, pQueue->fEnabled);
+    }
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutData(hSnap, &pThis->Lsb, sizeof(pThis->Lsb));
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutU64(hSnap, pThis->cbWrittenLast);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutU64(hSnap, PSPEmuEvtQTimerDeadlineGet(pThis->hTmrIrq));
+
+    return rc;
+}
+
+
+static int pspDevCcpLoad(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVCCP pThis = (PPSPDEVCCP)&pDev->abInstance[0];
+
+    int rc = STS_INF_SUCCESS;
+    for (unsigned i = 0; i < ELEMENTS(pThis->aQueues) && STS_SUCCESS(rc); i++)
+    {
+        PCCPQUEUE pQueue = &pThis->aQueues[i];
+
+        rc = PSPEmuSnapshotGetU32(hSnap, &pQueue->u32RegCtrl);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotGetU32(hSnap, &pQueue->u32RegReqTail);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotGetU32(hSnap, &pQueue->u32RegReqHead);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotGetU32(hSnap, &pQueue->u32RegSts);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotGetU32(hSnap, &pQueue->u32RegIen);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotGetU32(hSnap, &pQueue->u32RegIsts);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotGetU32(hSnap, &pQueue->u32RegIstsPending);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotGetBool(hSnap, &pQueue->fEnabled);
+    }
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetData(hSnap, &pThis->Lsb, sizeof(pThis->Lsb));
+    if (STS_SUCCESS(rc))
+    {
+        uint64_t cbWrittenLast = 0;
+        rc = PSPEmuSnapshotGetU64(hSnap, &cbWrittenLast);
+        pThis->cbWrittenLast = (size_t)cbWrittenLast;
+    }
+    if (STS_SUCCESS(rc))
+    {
+        /* The deadline is absolute, the virtual clock gets restored along with the core. */
+        uint64_t tsDeadlineNs = UINT64_MAX;
+        rc = PSPEmuSnapshotGetU64(hSnap, &tsDeadlineNs);
+        if (STS_SUCCESS(rc))
+        {
+            if (tsDeadlineNs != UINT64_MAX)
+                rc = PSPEmuEvtQTimerArm(pThis->hTmrIrq, tsDeadlineNs);
+            else
+                rc = PSPEmuEvtQTimerDisarm(pThis->hTmrIrq);
+        }
+    }
+
+    return rc;
 }
 
 
@@ -2332,6 +2476,12 @@ const PSPDEVREG g_DevRegCcpV5 =
     /** pfnDestruct */
     pspDevCcpDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    pspDevCcpSave,
+    /** pfnLoad */
+    pspDevCcpLoad,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
@@ -188,6 +188,12 @@ const PSPDEVREG g_DevRegFlash =
     /** pfnDestruct */
     pspDevFlashDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    NULL,
+    /** pfnLoad */
+    NULL,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
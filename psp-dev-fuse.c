@@ -131,6 +131,12 @@ const PSPDEVREG g_DevRegFuse =
     /** pfnDestruct */
     pspDevMmioFuseDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    NULL,
+    /** pfnLoad */
+    NULL,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
@@ -21,6 +21,7 @@
 #include <stdio.h>
 
 #include <common/cdefs.h>
+#include <common/status.h>
 
 #include <psp-devs.h>
 #include <psp-trace.h>
@@ -134,6 +135,30 @@ static void pspDevGpioDestruct(PPSPDEV pDev)
 }
 
 
+static int pspDevGpioSave(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVGPIO pThis = (PPSPDEVGPIO)&pDev->abInstance[0];
+
+    int rc = STS_INF_SUCCESS;
+    for (uint32_t i = 0; i < ELEMENTS(pThis->aBanks) && STS_SUCCESS(rc); i++)
+        rc = PSPEmuSnapshotPutData(hSnap, &pThis->aBanks[i].aGpioRegs[0], sizeof(pThis->aBanks[i].aGpioRegs));
+
+    return rc;
+}
+
+
+static int pspDevGpioLoad(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVGPIO pThis = (PPSPDEVGPIO)&pDev->abInstance[0];
+
+    int rc = STS_INF_SUCCESS;
+    for (uint32_t i = 0; i < ELEMENTS(pThis->aBanks) && STS_SUCCESS(rc); i++)
+        rc = PSPEmuSnapshotGetData(hSnap, &pThis->aBanks[i].aGpioRegs[0], sizeof(pThis->aBanks[i].aGpioRegs));
+
+    return rc;
+}
+
+
 /**
  * Device registration structure.
  */
@@ -150,6 +175,12 @@ const PSPDEVREG g_DevRegGpio =
     /** pfnDestruct */
     pspDevGpioDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    pspDevGpioSave,
+    /** pfnLoad */
+    pspDevGpioLoad,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
@@ -90,6 +90,22 @@ static void pspDevIoMuxDestruct(PPSPDEV pDev)
 }
 
 
+static int pspDevIoMuxSave(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVIOMUX pThis = (PPSPDEVIOMUX)&pDev->abInstance[0];
+
+    return PSPEmuSnapshotPutData(hSnap, &pThis->aIoMuxRegs[0], sizeof(pThis->aIoMuxRegs));
+}
+
+
+static int pspDevIoMuxLoad(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVIOMUX pThis = (PPSPDEVIOMUX)&pDev->abInstance[0];
+
+    return PSPEmuSnapshotGetData(hSnap, &pThis->aIoMuxRegs[0], sizeof(pThis->aIoMuxRegs));
+}
+
+
 /**
  * Device registration structure.
  */
@@ -106,6 +122,12 @@ const PSPDEVREG g_DevRegIoMux =
     /** pfnDestruct */
     pspDevIoMuxDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    pspDevIoMuxSave,
+    /** pfnLoad */
+    pspDevIoMuxLoad,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
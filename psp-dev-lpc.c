@@ -114,6 +114,12 @@ const PSPDEVREG g_DevRegLpc =
     /** pfnDestruct */
     pspDevLpcDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    NULL,
+    /** pfnLoad */
+    NULL,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
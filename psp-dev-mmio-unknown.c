@@ -154,6 +154,12 @@ const PSPDEVREG g_DevRegMmioUnk =
     /** pfnDestruct */
     pspDevMmioUnkDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    NULL,
+    /** pfnLoad */
+    NULL,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
@@ -22,6 +22,7 @@
 #include <string.h>
 
 #include <common/cdefs.h>
+#include <common/status.h>
 
 #include <psp-devs.h>
 
@@ -98,6 +99,30 @@ static void pspDevMp2Destruct(PPSPDEV pDev)
 }
 
 
+static int pspDevMp2Save(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVMP2 pThis = (PPSPDEVMP2)&pDev->abInstance[0];
+
+    int rc = PSPEmuSnapshotPutData(hSnap, &pThis->abFw[0], sizeof(pThis->abFw));
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutData(hSnap, &pThis->abSram1[0], sizeof(pThis->abSram1));
+
+    return rc;
+}
+
+
+static int pspDevMp2Load(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVMP2 pThis = (PPSPDEVMP2)&pDev->abInstance[0];
+
+    int rc = PSPEmuSnapshotGetData(hSnap, &pThis->abFw[0], sizeof(pThis->abFw));
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetData(hSnap, &pThis->abSram1[0], sizeof(pThis->abSram1));
+
+    return rc;
+}
+
+
 /**
  * Device registration structure.
  */
@@ -114,6 +139,12 @@ const PSPDEVREG g_DevRegMp2 =
     /** pfnDestruct */
     pspDevMp2Destruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    pspDevMp2Save,
+    /** pfnLoad */
+    pspDevMp2Load,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
@@ -19,8 +19,10 @@
  */
 
 #include <stdio.h>
+#include <time.h>
 
 #include <common/cdefs.h>
+#include <common/status.h>
 
 #include <psp-devs.h>
 #include <psp-trace.h>
@@ -29,6 +31,28 @@
 /** 128 bytes per CMOS bank. */
 #define PSPEMU_RTC_CMOS_BANK_SZ         128
 
+/** @name RTC registers in the first CMOS bank.
+ * @{ */
+#define PSPEMU_RTC_REG_SECONDS          0x00
+#define PSPEMU_RTC_REG_MINUTES          0x02
+#define PSPEMU_RTC_REG_HOURS            0x04
+#define PSPEMU_RTC_REG_WEEKDAY          0x06
+#define PSPEMU_RTC_REG_DAY_OF_MONTH     0x07
+#define PSPEMU_RTC_REG_MONTH            0x08
+#define PSPEMU_RTC_REG_YEAR             0x09
+#define PSPEMU_RTC_REG_B                0x0b
+#define PSPEMU_RTC_REG_D                0x0d
+#define PSPEMU_RTC_REG_CENTURY          0x32
+/** @} */
+
+/** Register B: Data mode is binary instead of BCD. */
+#define PSPEMU_RTC_REG_B_DM             BIT(2)
+/** Register B: 24 hour mode. */
+#define PSPEMU_RTC_REG_B_24H            BIT(1)
+
+/** The time the RTC starts at when the virtual clock is 0 (2020-01-01 00:00:00 UTC), fixed to keep runs reproducible. */
+#define PSPEMU_RTC_EPOCH_START          INT64_C(1577836800)
+
 /** Pointer to the device instance data. */
 typedef struct PSPDEVRTC *PPSPDEVRTC;
 
@@ -64,6 +88,8 @@ typedef struct PSPDEVRTC
     PPSPDEV                 pDev;
     /** The CMOS banks. */
     CMOSBANK                aBanks[2];
+    /** Offset in seconds applied to the RTC time by writes from the guest. */
+    int64_t                 iSecOff;
 } PSPDEVRTC;
 
 
@@ -74,6 +100,164 @@ static const char *s_apszCmosBankDesc[] =
 };
 
 
+/**
+ * Returns whether the given register of the first CMOS bank is an RTC time register.
+ *
+ * @returns Flag whether the register contains the time.
+ * @param   offReg                  The register offset.
+ */
+static inline bool pspDevRtcRegIsTime(uint8_t offReg)
+{
+    return    offReg <= PSPEMU_RTC_REG_YEAR
+           && offReg != 0x01 && offReg != 0x03 && offReg != 0x05; /* Alarm registers. */
+}
+
+
+/**
+ * Returns the current RTC time in seconds since the UNIX epoch derived from the virtual clock.
+ *
+ * @returns Seconds since the UNIX epoch.
+ * @param   pThis                   The RTC device instance.
+ */
+static time_t pspDevRtcTimeGet(PPSPDEVRTC pThis)
+{
+    PCPSPDEVIF pDevIf = pThis->pDev->pDevIf;
+    uint64_t tsVirtNs = pDevIf->pfnQueryVirtTimeNs(pDevIf);
+
+    return (time_t)(PSPEMU_RTC_EPOCH_START + pThis->iSecOff + (int64_t)(tsVirtNs / UINT64_C(1000000000)));
+}
+
+
+/**
+ * Converts the given binary value to the data mode configured in register B.
+ *
+ * @returns Converted value.
+ * @param   pBank                   The first CMOS bank.
+ * @param   uVal                    The value to convert.
+ */
+static uint8_t pspDevRtcToDataMode(PCCMOSBANK pBank, uint32_t uVal)
+{
+    if (pBank->abBank[PSPEMU_RTC_REG_B] & PSPEMU_RTC_REG_B_DM)
+        return (uint8_t)uVal;
+
+    return (uint8_t)(((uVal / 10) << 4) | (uVal % 10));
+}
+
+
+/**
+ * Converts the given value from the data mode configured in register B to binary.
+ *
+ * @returns Converted value.
+ * @param   pBank                   The first CMOS bank.
+ * @param   bVal                    The value to convert.
+ */
+static uint32_t pspDevRtcFromDataMode(PCCMOSBANK pBank, uint8_t bVal)
+{
+    if (pBank->abBank[PSPEMU_RTC_REG_B] & PSPEMU_RTC_REG_B_DM)
+        return bVal;
+
+    return (bVal >> 4) * 10 + (bVal & 0xf);
+}
+
+
+/**
+ * Reads the given RTC time register.
+ *
+ * @returns Register value.
+ * @param   pBank                   The first CMOS bank.
+ * @param   offReg                  The register to read.
+ */
+static uint8_t pspDevRtcTimeRegRead(PCCMOSBANK pBank, uint8_t offReg)
+{
+    time_t TimeNow = pspDevRtcTimeGet(pBank->pDev);
+    struct tm Tm;
+
+    gmtime_r(&TimeNow, &Tm);
+    switch (offReg)
+    {
+        case PSPEMU_RTC_REG_SECONDS:
+            return pspDevRtcToDataMode(pBank, Tm.tm_sec);
+        case PSPEMU_RTC_REG_MINUTES:
+            return pspDevRtcToDataMode(pBank, Tm.tm_min);
+        case PSPEMU_RTC_REG_HOURS:
+        {
+            if (pBank->abBank[PSPEMU_RTC_REG_B] & PSPEMU_RTC_REG_B_24H)
+                return pspDevRtcToDataMode(pBank, Tm.tm_hour);
+
+            /* 12 hour mode, bit 7 indicates PM. */
+            uint32_t uHour = Tm.tm_hour % 12;
+            return   pspDevRtcToDataMode(pBank, uHour ? uHour : 12)
+                   | (Tm.tm_hour >= 12 ? 0x80 : 0x00);
+        }
+        case PSPEMU_RTC_REG_WEEKDAY:
+            return pspDevRtcToDataMode(pBank, Tm.tm_wday + 1);
+        case PSPEMU_RTC_REG_DAY_OF_MONTH:
+            return pspDevRtcToDataMode(pBank, Tm.tm_mday);
+        case PSPEMU_RTC_REG_MONTH:
+            return pspDevRtcToDataMode(pBank, Tm.tm_mon + 1);
+        case PSPEMU_RTC_REG_YEAR:
+            return pspDevRtcToDataMode(pBank, Tm.tm_year % 100);
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Writes the given RTC time register, adjusting the time offset.
+ *
+ * @returns nothing.
+ * @param   pBank                   The first CMOS bank.
+ * @param   offReg                  The register to write.
+ * @param   bVal                    The value to write.
+ */
+static void pspDevRtcTimeRegWrite(PCMOSBANK pBank, uint8_t offReg, uint8_t bVal)
+{
+    PPSPDEVRTC pThis = pBank->pDev;
+    time_t TimeNow = pspDevRtcTimeGet(pThis);
+    struct tm Tm;
+
+    gmtime_r(&TimeNow, &Tm);
+    switch (offReg)
+    {
+        case PSPEMU_RTC_REG_SECONDS:
+            Tm.tm_sec = pspDevRtcFromDataMode(pBank, bVal);
+            break;
+        case PSPEMU_RTC_REG_MINUTES:
+            Tm.tm_min = pspDevRtcFromDataMode(pBank, bVal);
+            break;
+        case PSPEMU_RTC_REG_HOURS:
+        {
+            if (pBank->abBank[PSPEMU_RTC_REG_B] & PSPEMU_RTC_REG_B_24H)
+                Tm.tm_hour = pspDevRtcFromDataMode(pBank, bVal);
+            else
+                Tm.tm_hour =   pspDevRtcFromDataMode(pBank, bVal & 0x7f) % 12
+                             + ((bVal & 0x80) ? 12 : 0);
+            break;
+        }
+        case PSPEMU_RTC_REG_WEEKDAY:
+            return; /* Derived from the date. */
+        case PSPEMU_RTC_REG_DAY_OF_MONTH:
+            Tm.tm_mday = pspDevRtcFromDataMode(pBank, bVal);
+            break;
+        case PSPEMU_RTC_REG_MONTH:
+            Tm.tm_mon = pspDevRtcFromDataMode(pBank, bVal) - 1;
+            break;
+        case PSPEMU_RTC_REG_YEAR:
+            Tm.tm_year = (Tm.tm_year / 100) * 100 + pspDevRtcFromDataMode(pBank, bVal);
+            break;
+        default:
+            return;
+    }
+
+    time_t TimeNew = timegm(&Tm);
+    if (TimeNew != (time_t)-1)
+        pThis->iSecOff += (int64_t)(TimeNew - TimeNow);
+}
+
+
 static void pspDevRtcCmosBankRead(X86PADDR offMmio, size_t cbRead, void *pvVal, void *pvUser)
 {
     PCCMOSBANK pBank = (PCCMOSBANK)pvUser;
@@ -88,6 +272,9 @@ static void pspDevRtcCmosBankRead(X86PADDR offMmio, size_t cbRead, void *pvVal,
     uint8_t *pbVal = (uint8_t *)pvVal;
     if (offMmio == 0)
         *pbVal = 0xff; /* Address register is write-only. */
+    else if (   pBank->idBank == 0
+             && pspDevRtcRegIsTime(pBank->offBank))
+        *pbVal = pspDevRtcTimeRegRead(pBank, pBank->offBank);
     else
         *pbVal = pBank->abBank[pBank->offBank];
 }
@@ -107,6 +294,9 @@ static void pspDevRtcCmosBankWrite(X86PADDR offMmio, size_t cbWrite, const void
     uint8_t bVal = *(const uint8_t *)pvVal;
     if (offMmio == 0)
         pBank->offBank = bVal & 0x7f;
+    else if (   pBank->idBank == 0
+             && pspDevRtcRegIsTime(pBank->offBank))
+        pspDevRtcTimeRegWrite(pBank, pBank->offBank, bVal);
     else
         pBank->abBank[pBank->offBank] = bVal;
 }
@@ -117,7 +307,13 @@ static int pspDevRtcInit(PPSPDEV pDev)
     int rc = 0;
     PPSPDEVRTC pThis = (PPSPDEVRTC)&pDev->abInstance[0];
 
-    pThis->pDev = pDev;
+    pThis->pDev    = pDev;
+    pThis->iSecOff = 0;
+
+    /* 24 hour BCD mode with a valid RAM and time, the time registers are derived from the virtual clock. */
+    pThis->aBanks[0].abBank[PSPEMU_RTC_REG_B]       = PSPEMU_RTC_REG_B_24H;
+    pThis->aBanks[0].abBank[PSPEMU_RTC_REG_D]       = 0x80;
+    pThis->aBanks[0].abBank[PSPEMU_RTC_REG_CENTURY] = 0x20;
 
     for (uint32_t i = 0; i < ELEMENTS(pThis->aBanks) && !rc; i++)
     {
@@ -141,6 +337,74 @@ static void pspDevRtcDestruct(PPSPDEV pDev)
 }
 
 
+static int pspDevRtcSave(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVRTC pThis = (PPSPDEVRTC)&pDev->abInstance[0];
+
+    int rc = STS_INF_SUCCESS;
+    for (uint32_t i = 0; i < ELEMENTS(pThis->aBanks) && STS_SUCCESS(rc); i++)
+    {
+        rc = PSPEmuSnapshotPutData(hSnap, &pThis->aBanks[i].offBank, sizeof(pThis->aBanks[i].offBank));
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutData(hSnap, &pThis->aBanks[i].abBank[0], sizeof(pThis->aBanks[i].abBank));
+    }
+
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutU64(hSnap, (uint64_t)pThis->iSecOff);
+
+    return rc;
+}
+
+
+static int pspDevRtcLoad(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVRTC pThis = (PPSPDEVRTC)&pDev->abInstance[0];
+
+    int rc = STS_INF_SUCCESS;
+    for (uint32_t i = 0; i < ELEMENTS(pThis->aBanks) && STS_SUCCESS(rc); i++)
+    {
+        rc = PSPEmuSnapshotGetData(hSnap, &pThis->aBanks[i].offBank, sizeof(pThis->aBanks[i].offBank));
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotGetData(hSnap, &pThis->aBanks[i].abBank[0], sizeof(pThis->aBanks[i].abBank));
+    }
+
+    if (STS_SUCCESS(rc))
+    {
+        uint64_t u64SecOff = 0;
+        rc = PSPEmuSnapshotGetU64(hSnap, &u64SecOff);
+        pThis->iSecOff = (int64_t)u64SecOff;
+    }
+
+    return rc;
+}
+
+static int pspDevRtcPollDeadlineQuery(PPSPDEV pDev, PSPIOMREGIONHANDLE hRegion, uint64_t offRegion, size_t cbRead,
+                                      uint64_t *ptsChangeNs)
+{
+    PPSPDEVRTC pThis = (PPSPDEVRTC)&pDev->abInstance[0];
+
+    if (   hRegion != pThis->aBanks[0].hMmioX86
+        && hRegion != pThis->aBanks[1].hMmioX86)
+        return STS_ERR_NOT_FOUND;
+
+    /* The time registers tick on every full second of the virtual clock, everything else only changes on writes. */
+    PCCMOSBANK pBank = &pThis->aBanks[0];
+    if (   hRegion == pBank->hMmioX86
+        && offRegion == 1
+        && pspDevRtcRegIsTime(pBank->offBank))
+    {
+        PCPSPDEVIF pDevIf = pDev->pDevIf;
+        uint64_t tsVirtNs = pDevIf->pfnQueryVirtTimeNs(pDevIf);
+
+        *ptsChangeNs = (tsVirtNs / UINT64_C(1000000000) + 1) * UINT64_C(1000000000);
+    }
+    else
+        *ptsChangeNs = UINT64_MAX;
+
+    return STS_INF_SUCCESS;
+}
+
+
 /**
  * Device registration structure.
  */
@@ -157,6 +421,12 @@ const PSPDEVREG g_DevRegRtc =
     /** pfnDestruct */
     pspDevRtcDestruct,
     /** pfnReset */
-    NULL
+    NULL,
+    /** pfnSave */
+    pspDevRtcSave,
+    /** pfnLoad */
+    pspDevRtcLoad,
+    /** pfnPollDeadlineQuery */
+    pspDevRtcPollDeadlineQuery
 };
 
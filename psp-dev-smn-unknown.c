@@ -452,6 +452,12 @@ const PSPDEVREG g_DevRegSmnUnk =
     /** pfnDestruct */
     pspDevUnkDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    NULL,
+    /** pfnLoad */
+    NULL,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
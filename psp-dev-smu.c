@@ -22,6 +22,7 @@
 #include <string.h>
 
 #include <common/cdefs.h>
+#include <common/status.h>
 
 #include <psp-devs.h>
 
@@ -191,6 +192,38 @@ static void pspDevSmuDestruct(PPSPDEV pDev)
 }
 
 
+static int pspDevSmuSave(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVSMU pThis = (PPSPDEVSMU)&pDev->abInstance[0];
+
+    int rc = PSPEmuSnapshotPutU32(hSnap, pThis->u32RegMsgSts);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutU32(hSnap, pThis->u32RegMsgArgRet);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutU32(hSnap, pThis->u32RegMsgId);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutData(hSnap, &pThis->abFw[0], sizeof(pThis->abFw));
+
+    return rc;
+}
+
+
+static int pspDevSmuLoad(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVSMU pThis = (PPSPDEVSMU)&pDev->abInstance[0];
+
+    int rc = PSPEmuSnapshotGetU32(hSnap, &pThis->u32RegMsgSts);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetU32(hSnap, &pThis->u32RegMsgArgRet);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetU32(hSnap, &pThis->u32RegMsgId);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetData(hSnap, &pThis->abFw[0], sizeof(pThis->abFw));
+
+    return rc;
+}
+
+
 /**
  * Device registration structure.
  */
@@ -207,6 +240,12 @@ const PSPDEVREG g_DevRegSmu =
     /** pfnDestruct */
     pspDevSmuDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    pspDevSmuSave,
+    /** pfnLoad */
+    pspDevSmuLoad,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
@@ -21,6 +21,7 @@
 #include <stdio.h>
 
 #include <common/cdefs.h>
+#include <common/status.h>
 #include <psp-fw/err.h>
 
 #include <psp-devs.h>
@@ -197,6 +198,37 @@ static void pspDevStsDestruct(PPSPDEV pDev)
 }
 
 
+static int pspDevStsSave(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVSTS pThis = (PPSPDEVSTS)&pDev->abInstance[0];
+
+    int rc = PSPEmuSnapshotPutBool(hSnap, pThis->fPort80hLog);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutU32(hSnap, pThis->offWrite);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutData(hSnap, &pThis->achBuf[0], sizeof(pThis->achBuf));
+
+    return rc;
+}
+
+
+static int pspDevStsLoad(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVSTS pThis = (PPSPDEVSTS)&pDev->abInstance[0];
+
+    int rc = PSPEmuSnapshotGetBool(hSnap, &pThis->fPort80hLog);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetU32(hSnap, &pThis->offWrite);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetData(hSnap, &pThis->achBuf[0], sizeof(pThis->achBuf));
+    if (   STS_SUCCESS(rc)
+        && pThis->offWrite >= sizeof(pThis->achBuf))
+        rc = STS_ERR_INVALID_PARAMETER;
+
+    return rc;
+}
+
+
 /**
  * Device registration structure.
  */
@@ -213,6 +245,12 @@ const PSPDEVREG g_DevRegSts =
     /** pfnDestruct */
     pspDevStsDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    pspDevStsSave,
+    /** pfnLoad */
+    pspDevStsLoad,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
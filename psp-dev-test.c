@@ -184,6 +184,12 @@ const PSPDEVREG g_DevRegTest =
     /** pfnDestruct */
     pspDevTestDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    NULL,
+    /** pfnLoad */
+    NULL,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
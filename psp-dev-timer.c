@@ -21,6 +21,7 @@
 #include <stdio.h>
 
 #include <common/cdefs.h>
+#include <common/status.h>
 
 #include <os/time.h>
 
@@ -32,9 +33,11 @@
  */
 typedef struct PSPDEVTIMER
 {
+    /** Pointer to the owning device instance. */
+    PPSPDEV                         pDev;
     /** Flag whether to run in realtime. */
     bool                            fRealtime;
-    /** Last nanosecond timestamp. */
+    /** Last nanosecond timestamp (virtual time unless running in realtime). */
     uint64_t                        tsLast;
     /** The control register perhaps. */
     uint32_t                        regCtrl;
@@ -47,6 +50,37 @@ typedef struct PSPDEVTIMER
 typedef PSPDEVTIMER *PPSPDEVTIMER;
 
 
+/**
+ * Returns the current time in nanoseconds the timer is running on.
+ *
+ * @returns Timestamp in nanoseconds.
+ * @param   pThis                   The timer device instance.
+ */
+static uint64_t pspDevTimerGetNano(PPSPDEVTIMER pThis)
+{
+    if (pThis->fRealtime)
+        return OSTimeTsGetNano();
+
+    return pThis->pDev->pDevIf->pfnQueryVirtTimeNs(pThis->pDev->pDevIf);
+}
+
+
+/**
+ * Updates the 100MHz counter with the time elapsed since the last update.
+ *
+ * @returns nothing.
+ * @param   pThis                   The timer device instance.
+ */
+static void pspDevTimerCntUpdate(PPSPDEVTIMER pThis)
+{
+    uint64_t tsNow = pspDevTimerGetNano(pThis);
+    uint64_t tsElapsed = tsNow - pThis->tsLast;
+
+    pThis->regCnt100MHz += (uint32_t)(tsElapsed / 10); /* 10ns intervals. */
+    pThis->tsLast        = tsNow - tsElapsed % 10; /* Don't lose the remainder. */
+}
+
+
 static void pspDevTimerMmioRead(PSPADDR offMmio, size_t cbRead, void *pvVal, void *pvUser)
 {
     PPSPDEVTIMER pThis = (PPSPDEVTIMER)pvUser;
@@ -67,23 +101,9 @@ static void pspDevTimerMmioRead(PSPADDR offMmio, size_t cbRead, void *pvVal, voi
         }
         case 32: /* 100MHz counter. */
         {
-            if (!pThis->fRealtime)
-            {
-                *pu32Ret = pThis->regCnt100MHz;
-                if (pThis->regCtrl & 0x1)
-                    pThis->regCnt100MHz += 1000 * 1000 * 100; /* 1 second jump per read. */
-            }
-            else
-            {
-                if (pThis->regCtrl & 0x1)
-                {
-                    uint64_t tsNow = OSTimeTsGetNano();
-                    uint64_t tsElapsed = tsNow - pThis->tsLast;
-                    pThis->regCnt100MHz += (uint32_t)(tsElapsed / 10); /* 10ns intervals. */
-                    *pu32Ret = pThis->regCnt100MHz;
-                    pThis->tsLast = tsNow;
-                }
-            }
+            if (pThis->regCtrl & 0x1)
+                pspDevTimerCntUpdate(pThis);
+            *pu32Ret = pThis->regCnt100MHz;
             break;
         }
         default:
@@ -112,11 +132,13 @@ static void pspDevTimerMmioWrite(PSPADDR offMmio, size_t cbWrite, const void *pv
     {
         case 0: /* Control register */
         {
-            /* Read the time once if in realtime mode and the timer got enabled. */
-            if (   pThis->fRealtime
-                && (u32Val & 0x1)
+            /* Start counting from now when the timer gets enabled and catch up when it gets disabled. */
+            if (   (u32Val & 0x1)
                 && !(pThis->regCtrl & 0x1))
-                pThis->tsLast = OSTimeTsGetNano();
+                pThis->tsLast = pspDevTimerGetNano(pThis);
+            else if (   !(u32Val & 0x1)
+                     && (pThis->regCtrl & 0x1))
+                pspDevTimerCntUpdate(pThis);
             pThis->regCtrl = u32Val;
             break;
         }
@@ -128,6 +150,7 @@ static void pspDevTimerMmioWrite(PSPADDR offMmio, size_t cbWrite, const void *pv
         case 32: /* 100MHz counter. */
         {
             pThis->regCnt100MHz = u32Val;
+            pThis->tsLast       = pspDevTimerGetNano(pThis);
             break;
         }
         default:
@@ -141,8 +164,9 @@ static int pspDevTimerInit(PPSPDEV pDev)
 {
     PPSPDEVTIMER pThis = (PPSPDEVTIMER)&pDev->abInstance[0];
 
+    pThis->pDev         = pDev;
     pThis->fRealtime    = pDev->pCfg->fTimerRealtime;
-    pThis->tsLast       = OSTimeTsGetNano();
+    pThis->tsLast       = pspDevTimerGetNano(pThis);
     pThis->regCtrl      = 0;
     pThis->regCnt100MHz = 0;
 
@@ -162,6 +186,53 @@ static void pspDevTimerDestruct(PPSPDEV pDev)
     /* Nothing to do so far. */
 }
 
+static int pspDevTimerSave(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVTIMER pThis = (PPSPDEVTIMER)&pDev->abInstance[0];
+
+    int rc = PSPEmuSnapshotPutU32(hSnap, pThis->regCtrl);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutU32(hSnap, pThis->regCnt100MHz);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutU64(hSnap, pThis->tsLast);
+
+    return rc;
+}
+
+static int pspDevTimerLoad(PPSPDEV pDev, PSPSNAPSHOT hSnap)
+{
+    PPSPDEVTIMER pThis = (PPSPDEVTIMER)&pDev->abInstance[0];
+
+    int rc = PSPEmuSnapshotGetU32(hSnap, &pThis->regCtrl);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetU32(hSnap, &pThis->regCnt100MHz);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetU64(hSnap, &pThis->tsLast);
+
+    /* The host time stamp is meaningless across runs, continue counting from now. */
+    if (pThis->fRealtime)
+        pThis->tsLast = OSTimeTsGetNano();
+    return rc;
+}
+
+static int pspDevTimerPollDeadlineQuery(PPSPDEV pDev, PSPIOMREGIONHANDLE hRegion, uint64_t offRegion, size_t cbRead,
+                                        uint64_t *ptsChangeNs)
+{
+    PPSPDEVTIMER pThis = (PPSPDEVTIMER)&pDev->abInstance[0];
+
+    if (hRegion != pThis->hMmio)
+        return STS_ERR_NOT_FOUND;
+
+    /* A running counter changes every 10ns (and is never the same when polled), everything else only on writes. */
+    if (   offRegion == 32
+        && (pThis->regCtrl & 0x1))
+        *ptsChangeNs = 0;
+    else
+        *ptsChangeNs = UINT64_MAX;
+
+    return STS_INF_SUCCESS;
+}
+
 
 /**
  * Device registration structure.
@@ -179,7 +250,13 @@ const PSPDEVREG g_DevRegTimer1 =
     /** pfnDestruct */
     pspDevTimerDestruct,
     /** pfnReset */
-    NULL
+    NULL,
+    /** pfnSave */
+    pspDevTimerSave,
+    /** pfnLoad */
+    pspDevTimerLoad,
+    /** pfnPollDeadlineQuery */
+    pspDevTimerPollDeadlineQuery
 };
 
 
@@ -199,6 +276,12 @@ const PSPDEVREG g_DevRegTimer2 =
     /** pfnDestruct */
     pspDevTimerDestruct,
     /** pfnReset */
-    NULL
+    NULL,
+    /** pfnSave */
+    pspDevTimerSave,
+    /** pfnLoad */
+    pspDevTimerLoad,
+    /** pfnPollDeadlineQuery */
+    pspDevTimerPollDeadlineQuery
 };
 
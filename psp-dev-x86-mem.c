@@ -73,6 +73,12 @@ const PSPDEVREG g_DevRegX86Mem =
     /** pfnDestruct */
     pspDevX86MemDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    NULL,
+    /** pfnLoad */
+    NULL,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
@@ -354,6 +354,12 @@ const PSPDEVREG g_DevRegX86Uart =
     /** pfnDestruct */
     pspDevX86UartDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    NULL,
+    /** pfnLoad */
+    NULL,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
@@ -89,6 +89,12 @@ const PSPDEVREG g_DevRegX86Unk =
     /** pfnDestruct */
     pspDevX86UnkDestruct,
     /** pfnReset */
+    NULL,
+    /** pfnSave */
+    NULL,
+    /** pfnLoad */
+    NULL,
+    /** pfnPollDeadlineQuery */
     NULL
 };
 
@@ -25,7 +25,7 @@
 #include <psp-dev.h>
 
 
-int PSPEmuDevCreate(PSPIOM hIoMgr, PCPSPDEVREG pDevReg, PCPSPDEVIF pDevIf, PCPSPEMUCFG pCfg, PPSPDEV *ppDev)
+int PSPEmuDevCreate(PSPIOM hIoMgr, PSPEVTQ hEvtQ, PCPSPDEVREG pDevReg, PCPSPDEVIF pDevIf, PCPSPEMUCFG pCfg, PPSPDEV *ppDev)
 {
     int rc = 0;
     PPSPDEV pDev = (PPSPDEV)calloc(1, sizeof(*pDev) + pDevReg->cbInstance);
@@ -34,6 +34,7 @@ int PSPEmuDevCreate(PSPIOM hIoMgr, PCPSPDEVREG pDevReg, PCPSPDEVIF pDevIf, PCPSP
         pDev->pReg      = pDevReg;
         pDev->pDevIf    = pDevIf;
         pDev->hIoMgr    = hIoMgr;
+        pDev->hEvtQ     = hEvtQ;
         pDev->pCfg      = pCfg;
 
         /* Initialize the device instance and add to the list of known devices. */
@@ -18,23 +18,281 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <capstone/capstone.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <common/types.h>
 #include <common/cdefs.h>
+#include <common/status.h>
 
 #include <psp-disasm.h>
+#include <psp-itrace.h>
 
-int PSPEmuDisasm(char *pchDst, size_t cch, uint32_t cInsnsDisasm, uint8_t *pbCode, size_t cbCode, PSPADDR uAddrStart, bool fThumb)
+
+/** Number of entries in the decode cache (must be a power of two). */
+#define PSP_DISASM_CACHE_ENTRIES            256
+/** Maximum number of code bytes a decode cache entry can hold. */
+#define PSP_DISASM_CACHE_CODE_MAX           32
+
+/** Number of hash buckets for the code records of the instruction trace decoder (must be a power of two). */
+#define PSP_DISASM_ITRACE_CODE_BUCKETS      4096
+
+/**
+ * Decode cache entry.
+ */
+typedef struct PSPDISASMCACHEENTRY
+{
+    /** The formatted disassembly, NULL if the entry is free. */
+    char                            *pszDisasm;
+    /** Physical address of the first instruction. */
+    PSPPADDR                        PspPAddrStart;
+    /** Virtual address of the first instruction (part of the formatted output). */
+    PSPADDR                         uAddrStart;
+    /** Maximum number of instructions disassembled. */
+    uint32_t                        cInsnsDisasm;
+    /** Flag whether the code was disassembled in THUMB mode. */
+    bool                            fThumb;
+    /** Number of code bytes. */
+    size_t                          cbCode;
+    /** The code bytes the disassembly was created from. */
+    uint8_t                         abCode[PSP_DISASM_CACHE_CODE_MAX];
+} PSPDISASMCACHEENTRY;
+/** Pointer to a decode cache entry. */
+typedef PSPDISASMCACHEENTRY *PPSPDISASMCACHEENTRY;
+
+
+/**
+ * Disassembler instance data.
+ */
+typedef struct PSPDISASMINT
+{
+    /** Capstone handle for ARM mode. */
+    csh                             hCsArm;
+    /** Capstone handle for THUMB mode. */
+    csh                             hCsThumb;
+    /** The decode cache, direct mapped by physical address. */
+    PSPDISASMCACHEENTRY             aCache[PSP_DISASM_CACHE_ENTRIES];
+} PSPDISASMINT;
+/** Pointer to the disassembler instance data. */
+typedef PSPDISASMINT *PPSPDISASMINT;
+
+
+/**
+ * Code record read from an instruction trace.
+ */
+typedef struct PSPDISASMITRACECODE
+{
+    /** Next code record in the bucket. */
+    struct PSPDISASMITRACECODE      *pNext;
+    /** Start address of the code. */
+    PSPADDR                         PspAddr;
+    /** Number of code bytes. */
+    size_t                          cbCode;
+    /** The code bytes - variable in size. */
+    uint8_t                         abCode[1];
+} PSPDISASMITRACECODE;
+/** Pointer to a code record. */
+typedef PSPDISASMITRACECODE *PPSPDISASMITRACECODE;
+
+
+/**
+ * Instruction trace decoder state.
+ */
+typedef struct PSPDISASMITRACEDEC
+{
+    /** The trace file being read. */
+    FILE                            *pFile;
+    /** The output stream. */
+    FILE                            *pOut;
+    /** Capstone handle for ARM mode. */
+    csh                             hCsArm;
+    /** Capstone handle for THUMB mode. */
+    csh                             hCsThumb;
+    /** Current register values. */
+    uint32_t                        au32Regs[PSP_ITRACE_REGS];
+    /** Number of basic blocks decoded. */
+    uint64_t                        cBbs;
+    /** Number of instructions decoded. */
+    uint64_t                        cInsns;
+    /** Code record hash buckets. */
+    PPSPDISASMITRACECODE            apCode[PSP_DISASM_ITRACE_CODE_BUCKETS];
+} PSPDISASMITRACEDEC;
+/** Pointer to the instruction trace decoder state. */
+typedef PSPDISASMITRACEDEC *PPSPDISASMITRACEDEC;
+
+
+/**
+ * Register names in the order of the instruction trace register delta bitmap.
+ */
+static const char *g_apszITraceRegs[PSP_ITRACE_REGS] =
+{
+    "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+    "r8", "r9", "r10", "r11", "r12", "sp", "lr", "cpsr"
+};
+
+
+/**
+ * Returns the code record hash bucket for the given address.
+ *
+ * @returns Pointer to the bucket head.
+ * @param   pDec                    The instruction trace decoder state.
+ * @param   PspAddr                 The start address of the code.
+ */
+static inline PPSPDISASMITRACECODE *pspEmuDisasmITraceCodeBucket(PPSPDISASMITRACEDEC pDec, PSPADDR PspAddr)
+{
+    return &pDec->apCode[(PspAddr >> 1) & (PSP_DISASM_ITRACE_CODE_BUCKETS - 1)];
+}
+
+
+/**
+ * Looks up the code record for the given basic block.
+ *
+ * @returns Pointer to the code record or NULL if not found.
+ * @param   pDec                    The instruction trace decoder state.
+ * @param   PspAddr                 The start address of the basic block.
+ */
+static PPSPDISASMITRACECODE pspEmuDisasmITraceCodeGet(PPSPDISASMITRACEDEC pDec, PSPADDR PspAddr)
+{
+    PPSPDISASMITRACECODE pCode = *pspEmuDisasmITraceCodeBucket(pDec, PspAddr);
+    while (   pCode
+           && pCode->PspAddr != PspAddr)
+        pCode = pCode->pNext;
+
+    return pCode;
+}
+
+
+/**
+ * Reads the next code record from the trace, replacing any older record for the same address.
+ *
+ * @returns Status code.
+ * @param   pDec                    The instruction trace decoder state.
+ */
+static int pspEmuDisasmITraceCodeRead(PPSPDISASMITRACEDEC pDec)
+{
+    PSPITRACERECCODE Rec;
+
+    if (fread((uint8_t *)&Rec + 1, sizeof(Rec) - 1, 1, pDec->pFile) != 1)
+        return STS_ERR_BUFFER_OVERFLOW;
+
+    PPSPDISASMITRACECODE pCode = (PPSPDISASMITRACECODE)malloc(sizeof(*pCode) + Rec.cbCode);
+    if (!pCode)
+        return STS_ERR_NO_MEMORY;
+
+    pCode->PspAddr = Rec.PspAddr;
+    pCode->cbCode  = Rec.cbCode;
+    if (   Rec.cbCode
+        && fread(&pCode->abCode[0], Rec.cbCode, 1, pDec->pFile) != 1)
+    {
+        free(pCode);
+        return STS_ERR_BUFFER_OVERFLOW;
+    }
+
+    /* Unlink an older record for the same address. */
+    PPSPDISASMITRACECODE *ppCode = pspEmuDisasmITraceCodeBucket(pDec, Rec.PspAddr);
+    PPSPDISASMITRACECODE *ppPrev = ppCode;
+    while (   *ppPrev
+           && (*ppPrev)->PspAddr != Rec.PspAddr)
+        ppPrev = &(*ppPrev)->pNext;
+    if (*ppPrev)
+    {
+        PPSPDISASMITRACECODE pOld = *ppPrev;
+        *ppPrev = pOld->pNext;
+        free(pOld);
+    }
+
+    pCode->pNext = *ppCode;
+    *ppCode = pCode;
+    return STS_INF_SUCCESS;
+}
+
+
+/**
+ * Reads the next basic block record from the trace and writes it to the output.
+ *
+ * @returns Status code.
+ * @param   pDec                    The instruction trace decoder state.
+ */
+static int pspEmuDisasmITraceBbRead(PPSPDISASMITRACEDEC pDec)
+{
+    PSPITRACERECBB Rec;
+
+    if (fread((uint8_t *)&Rec + 1, sizeof(Rec) - 1, 1, pDec->pFile) != 1)
+        return STS_ERR_BUFFER_OVERFLOW;
+
+    for (uint32_t i = 0; i < PSP_ITRACE_REGS; i++)
+    {
+        if (   (Rec.bmRegsChanged & BIT(i))
+            && fread(&pDec->au32Regs[i], sizeof(uint32_t), 1, pDec->pFile) != 1)
+            return STS_ERR_BUFFER_OVERFLOW;
+    }
+
+    bool fThumb = (pDec->au32Regs[PSP_ITRACE_REG_IDX_CPSR] & BIT(5)) ? true : false;
+    fprintf(pDec->pOut, "BB %#010x cb=%u mode=%#04x %s\n", Rec.PspAddr, Rec.cbBb,
+            pDec->au32Regs[PSP_ITRACE_REG_IDX_CPSR] & 0x1f, fThumb ? "THUMB" : "ARM");
+
+    if (Rec.bmRegsChanged)
+    {
+        uint32_t cRegsPrinted = 0;
+
+        for (uint32_t i = 0; i < PSP_ITRACE_REGS; i++)
+        {
+            if (Rec.bmRegsChanged & BIT(i))
+            {
+                fprintf(pDec->pOut, "%s%s=%#010x", cRegsPrinted % 8 ? " " : "    ",
+                        g_apszITraceRegs[i], pDec->au32Regs[i]);
+                if (++cRegsPrinted % 8 == 0)
+                    fprintf(pDec->pOut, "\n");
+            }
+        }
+
+        if (cRegsPrinted % 8)
+            fprintf(pDec->pOut, "\n");
+    }
+
+    PPSPDISASMITRACECODE pCode = pspEmuDisasmITraceCodeGet(pDec, Rec.PspAddr);
+    if (pCode)
+    {
+        cs_insn *paInsn = NULL;
+        size_t cInsn = cs_disasm(fThumb ? pDec->hCsThumb : pDec->hCsArm, &pCode->abCode[0],
+                                 MIN(pCode->cbCode, Rec.cbBb), Rec.PspAddr, 0, &paInsn);
+        for (size_t i = 0; i < cInsn; i++)
+            fprintf(pDec->pOut, "    %#010llx:    %s\t\t%s\n", paInsn[i].address, paInsn[i].mnemonic,
+                    paInsn[i].op_str);
+
+        if (cInsn)
+            cs_free(paInsn, cInsn);
+        else
+            fprintf(pDec->pOut, "    <failed to disassemble>\n");
+
+        pDec->cInsns += cInsn;
+    }
+    else
+        fprintf(pDec->pOut, "    <code not recorded>\n");
+
+    pDec->cBbs++;
+    return STS_INF_SUCCESS;
+}
+
+/**
+ * Disassembles the given code with the given capstone handle and formats the result.
+ *
+ * @returns Status code.
+ * @param   hCapStone               The capstone handle to use.
+ * @param   pchDst                  Pointer to the character buffer holding the zero terminated string on success.
+ * @param   cch                     Size of the destination buffer.
+ * @param   cInsnsDisasm            Maximum number of instructions to disassemble, 0 for as much as possible.
+ * @param   pbCode                  The code to disassemble.
+ * @param   cbCode                  Number of code bytes.
+ * @param   uAddrStart              The address of the first instruction.
+ */
+static int pspEmuDisasmFmt(csh hCapStone, char *pchDst, size_t cch, uint32_t cInsnsDisasm, const uint8_t *pbCode, size_t cbCode,
+                           PSPADDR uAddrStart)
 {
     int rc = 0;
-    csh hCapStone;
     cs_insn *paInsn;
 
-    /** @todo Thumb */
-    if (cs_open(CS_ARCH_ARM, fThumb ? CS_MODE_THUMB : CS_MODE_ARM, &hCapStone) != CS_ERR_OK)
-        return -1;
-
     size_t cInsn = cs_disasm(hCapStone, pbCode, cbCode, uAddrStart, 0, &paInsn);
     if (cInsn)
     {
@@ -65,8 +323,200 @@ int PSPEmuDisasm(char *pchDst, size_t cch, uint32_t cInsnsDisasm, uint8_t *pbCod
     else
         rc = -1;
 
+    return rc;
+}
+
+
+int PSPEmuDisasm(char *pchDst, size_t cch, uint32_t cInsnsDisasm, uint8_t *pbCode, size_t cbCode, PSPADDR uAddrStart, bool fThumb)
+{
+    csh hCapStone;
+
+    if (cs_open(CS_ARCH_ARM, fThumb ? CS_MODE_THUMB : CS_MODE_ARM, &hCapStone) != CS_ERR_OK)
+        return -1;
+
+    int rc = pspEmuDisasmFmt(hCapStone, pchDst, cch, cInsnsDisasm, pbCode, cbCode, uAddrStart);
     cs_close(&hCapStone);
 
     return rc;
 }
 
+
+int PSPEmuDisasmCreate(PPSPDISASM phDisasm)
+{
+    PPSPDISASMINT pThis = (PPSPDISASMINT)calloc(1, sizeof(*pThis));
+
+    if (!pThis)
+        return STS_ERR_NO_MEMORY;
+
+    if (cs_open(CS_ARCH_ARM, CS_MODE_ARM, &pThis->hCsArm) == CS_ERR_OK)
+    {
+        if (cs_open(CS_ARCH_ARM, CS_MODE_THUMB, &pThis->hCsThumb) == CS_ERR_OK)
+        {
+            *phDisasm = pThis;
+            return STS_INF_SUCCESS;
+        }
+
+        cs_close(&pThis->hCsArm);
+    }
+
+    free(pThis);
+    return STS_ERR_GENERAL_ERROR;
+}
+
+
+void PSPEmuDisasmDestroy(PSPDISASM hDisasm)
+{
+    PPSPDISASMINT pThis = hDisasm;
+
+    for (uint32_t i = 0; i < ELEMENTS(pThis->aCache); i++)
+    {
+        if (pThis->aCache[i].pszDisasm)
+            free(pThis->aCache[i].pszDisasm);
+    }
+
+    cs_close(&pThis->hCsArm);
+    cs_close(&pThis->hCsThumb);
+    free(pThis);
+}
+
+
+int PSPEmuDisasmCached(PSPDISASM hDisasm, char *pchDst, size_t cch, uint32_t cInsnsDisasm, const uint8_t *pbCode, size_t cbCode,
+                       PSPADDR uAddrStart, PSPPADDR PspPAddrStart, bool fThumb)
+{
+    PPSPDISASMINT pThis = hDisasm;
+    csh hCapStone = fThumb ? pThis->hCsThumb : pThis->hCsArm;
+
+    /* Too much code to remember, just disassemble. */
+    if (cbCode > PSP_DISASM_CACHE_CODE_MAX)
+        return pspEmuDisasmFmt(hCapStone, pchDst, cch, cInsnsDisasm, pbCode, cbCode, uAddrStart);
+
+    PPSPDISASMCACHEENTRY pEntry = &pThis->aCache[(PspPAddrStart >> 1) & (PSP_DISASM_CACHE_ENTRIES - 1)];
+    if (   pEntry->pszDisasm
+        && pEntry->PspPAddrStart == PspPAddrStart
+        && pEntry->uAddrStart == uAddrStart
+        && pEntry->cInsnsDisasm == cInsnsDisasm
+        && pEntry->fThumb == fThumb
+        && pEntry->cbCode == cbCode
+        && !memcmp(&pEntry->abCode[0], pbCode, cbCode)
+        && strlen(pEntry->pszDisasm) < cch)
+    {
+        strcpy(pchDst, pEntry->pszDisasm);
+        return STS_INF_SUCCESS;
+    }
+
+    int rc = pspEmuDisasmFmt(hCapStone, pchDst, cch, cInsnsDisasm, pbCode, cbCode, uAddrStart);
+    if (!rc)
+    {
+        /* Replace the entry, failing to remember the result is not fatal. */
+        if (pEntry->pszDisasm)
+            free(pEntry->pszDisasm);
+
+        pEntry->pszDisasm = strdup(pchDst);
+        if (pEntry->pszDisasm)
+        {
+            pEntry->PspPAddrStart = PspPAddrStart;
+            pEntry->uAddrStart    = uAddrStart;
+            pEntry->cInsnsDisasm  = cInsnsDisasm;
+            pEntry->fThumb        = fThumb;
+            pEntry->cbCode        = cbCode;
+            memcpy(&pEntry->abCode[0], pbCode, cbCode);
+        }
+    }
+
+    return rc;
+}
+
+
+void PSPEmuDisasmCacheInvalidate(PSPDISASM hDisasm, PSPPADDR PspPAddrStart, size_t cb)
+{
+    PPSPDISASMINT pThis = hDisasm;
+
+    for (uint32_t i = 0; i < ELEMENTS(pThis->aCache); i++)
+    {
+        PPSPDISASMCACHEENTRY pEntry = &pThis->aCache[i];
+
+        if (   pEntry->pszDisasm
+            && pEntry->PspPAddrStart < PspPAddrStart + cb
+            && PspPAddrStart < pEntry->PspPAddrStart + pEntry->cbCode)
+        {
+            free(pEntry->pszDisasm);
+            pEntry->pszDisasm = NULL;
+        }
+    }
+}
+
+
+int PSPEmuDisasmITraceDecode(const char *pszFilename, FILE *pOut)
+{
+    int rc = STS_INF_SUCCESS;
+    PPSPDISASMITRACEDEC pDec = (PPSPDISASMITRACEDEC)calloc(1, sizeof(*pDec));
+    if (!pDec)
+        return STS_ERR_NO_MEMORY;
+
+    pDec->pOut  = pOut;
+    pDec->pFile = fopen(pszFilename, "rb");
+    if (pDec->pFile)
+    {
+        PSPITRACEHDR Hdr;
+
+        if (   fread(&Hdr, sizeof(Hdr), 1, pDec->pFile) == 1
+            && !memcmp(&Hdr.achMagic[0], PSP_ITRACE_HDR_MAGIC, sizeof(PSP_ITRACE_HDR_MAGIC))
+            && Hdr.u32Version == PSP_ITRACE_HDR_VERSION
+            && Hdr.cRegs == PSP_ITRACE_REGS)
+        {
+            /* Open the disassemblers once for the whole trace. */
+            if (cs_open(CS_ARCH_ARM, CS_MODE_ARM, &pDec->hCsArm) == CS_ERR_OK)
+            {
+                if (cs_open(CS_ARCH_ARM, CS_MODE_THUMB, &pDec->hCsThumb) == CS_ERR_OK)
+                {
+                    int chType;
+
+                    while (   STS_SUCCESS(rc)
+                           && (chType = fgetc(pDec->pFile)) != EOF)
+                    {
+                        switch (chType)
+                        {
+                            case PSP_ITRACE_REC_TYPE_CODE:
+                                rc = pspEmuDisasmITraceCodeRead(pDec);
+                                break;
+                            case PSP_ITRACE_REC_TYPE_BB:
+                                rc = pspEmuDisasmITraceBbRead(pDec);
+                                break;
+                            default:
+                                rc = STS_ERR_INVALID_PARAMETER;
+                        }
+                    }
+
+                    fprintf(pOut, "Decoded %llu basic blocks with %llu instructions\n", pDec->cBbs, pDec->cInsns);
+                    cs_close(&pDec->hCsThumb);
+                }
+                else
+                    rc = STS_ERR_GENERAL_ERROR;
+
+                cs_close(&pDec->hCsArm);
+            }
+            else
+                rc = STS_ERR_GENERAL_ERROR;
+        }
+        else
+            rc = STS_ERR_INVALID_PARAMETER;
+
+        fclose(pDec->pFile);
+    }
+    else
+        rc = STS_ERR_NOT_FOUND;
+
+    for (uint32_t i = 0; i < ELEMENTS(pDec->apCode); i++)
+    {
+        PPSPDISASMITRACECODE pCode = pDec->apCode[i];
+        while (pCode)
+        {
+            PPSPDISASMITRACECODE pFree = pCode;
+            pCode = pCode->pNext;
+            free(pFree);
+        }
+    }
+
+    free(pDec);
+    return rc;
+}
@@ -23,6 +23,12 @@
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 #include <libpspproxy.h>
 
@@ -30,47 +36,473 @@
 #include <common/status.h>
 #include <psp-fw/boot-rom-svc-page.h>
 
+#include <os/thread.h>
+#include <os/time.h>
+
 #include <psp-ccd.h>
 #include <psp-cfg.h>
+#include <psp-cov.h>
 #include <psp-dbg.h>
 #include <psp-proxy.h>
 #include <psp-iolog-replay.h>
 #include <psp-x86-ice.h>
 
 
+/** Magic value for fork server requests and responses ('PSPF'). */
+#define PSPEMU_FORK_SRV_MAGIC           UINT32_C(0x46505350)
+
+/** Fork server command: Fork a child executing from the fork point and report the result. */
+#define PSPEMU_FORK_SRV_CMD_RUN         1
+/** Fork server command: Shut down the fork server. */
+#define PSPEMU_FORK_SRV_CMD_QUIT        2
+
+
+/**
+ * Fork server request as sent by the client.
+ */
+typedef struct PSPEMUFORKSRVREQ
+{
+    /** Magic value, PSPEMU_FORK_SRV_MAGIC. */
+    uint32_t                    u32Magic;
+    /** The command, PSPEMU_FORK_SRV_CMD_XXX. */
+    uint32_t                    u32Cmd;
+} PSPEMUFORKSRVREQ;
+
+
+/**
+ * Fork server response for a run, followed by cbCovBm bytes of the coverage bitmap.
+ */
+typedef struct PSPEMUFORKSRVRSP
+{
+    /** Magic value, PSPEMU_FORK_SRV_MAGIC. */
+    uint32_t                    u32Magic;
+    /** Status code PSPEmuCcdRun() returned in the child, STS_ERR_GENERAL_ERROR if the child died before reporting. */
+    int32_t                     rcRun;
+    /** The wait status of the child as returned by waitpid(). */
+    int32_t                     iWaitStatus;
+    /** Flag whether the child was killed because the run exceeded the configured timeout. */
+    uint32_t                    fTimeout;
+    /** Number of distinct basic blocks covered in the run, 0 if coverage tracing is disabled. */
+    uint32_t                    cBbs;
+    /** Size of the coverage bitmap following the response in bytes. */
+    uint32_t                    cbCovBm;
+} PSPEMUFORKSRVRSP;
+
+
+/**
+ * Reads exactly the given amount of data from the given file descriptor.
+ *
+ * @returns Status code.
+ * @param   fd                      The file descriptor to read from.
+ * @param   pvBuf                   Where to store the data.
+ * @param   cbRead                  Number of bytes to read.
+ */
+static int pspEmuForkSrvReadAll(int fd, void *pvBuf, size_t cbRead)
+{
+    uint8_t *pbBuf = (uint8_t *)pvBuf;
+
+    while (cbRead)
+    {
+        ssize_t cbThisRead = read(fd, pbBuf, cbRead);
+        if (cbThisRead < 0 && errno == EINTR)
+            continue;
+        if (cbThisRead <= 0)
+            return STS_ERR_GENERAL_ERROR;
+
+        pbBuf  += cbThisRead;
+        cbRead -= cbThisRead;
+    }
+
+    return STS_INF_SUCCESS;
+}
+
+
+/**
+ * Writes exactly the given amount of data to the given file descriptor.
+ *
+ * @returns Status code.
+ * @param   fd                      The file descriptor to write to.
+ * @param   pvBuf                   The data to write.
+ * @param   cbWrite                 Number of bytes to write.
+ */
+static int pspEmuForkSrvWriteAll(int fd, const void *pvBuf, size_t cbWrite)
+{
+    const uint8_t *pbBuf = (const uint8_t *)pvBuf;
+
+    while (cbWrite)
+    {
+        ssize_t cbThisWrite = write(fd, pbBuf, cbWrite);
+        if (cbThisWrite < 0 && errno == EINTR)
+            continue;
+        if (cbThisWrite <= 0)
+            return STS_ERR_GENERAL_ERROR;
+
+        pbBuf   += cbThisWrite;
+        cbWrite -= cbThisWrite;
+    }
+
+    return STS_INF_SUCCESS;
+}
+
+
+/**
+ * Executes a single run in the forked child and reports the result to the parent, never returns.
+ *
+ * @returns nothing.
+ * @param   hCcd                    The CCD to run.
+ * @param   fdRsp                   The pipe to write the response to.
+ */
+static void pspEmuForkSrvChild(PSPCCD hCcd, int fdRsp)
+{
+    PSPCOV hCov = NULL;
+    int rc = PSPEmuCcdQueryCov(hCcd, &hCov);
+    if (STS_SUCCESS(rc))
+        PSPEmuCovReset(hCov); /* Only report what this run covered. */
+    else
+        hCov = NULL;
+
+    PSPEMUFORKSRVRSP Rsp;
+    const uint8_t *pbCovBm = NULL;
+    size_t cbCovBm = 0;
+
+    Rsp.u32Magic    = PSPEMU_FORK_SRV_MAGIC;
+    Rsp.rcRun       = PSPEmuCcdRun(hCcd);
+    Rsp.iWaitStatus = 0; /* Filled in by the parent. */
+    Rsp.fTimeout    = 0;
+    Rsp.cBbs        = 0;
+    Rsp.cbCovBm     = 0;
+    if (hCov)
+    {
+        pbCovBm     = PSPEmuCovQueryHitBitmap(hCov, &cbCovBm);
+        Rsp.cBbs    = PSPEmuCovQueryBbCount(hCov);
+        Rsp.cbCovBm = (uint32_t)cbCovBm;
+    }
+
+    rc = pspEmuForkSrvWriteAll(fdRsp, &Rsp, sizeof(Rsp));
+    if (   STS_SUCCESS(rc)
+        && cbCovBm)
+        rc = pspEmuForkSrvWriteAll(fdRsp, pbCovBm, cbCovBm);
+
+    /*
+     * Don't tear anything down, the parent owns the state and the copy on write pages just go away.
+     * Only write out what this run logged as _exit() discards anything still buffered.
+     */
+    PSPEmuCcdFlush(hCcd);
+    fflush(stdout);
+    _exit(STS_SUCCESS(Rsp.rcRun) ? 0 : 1);
+}
+
+
 /**
- * Executes the given CCD under debugger control.
+ * Waits for the child to start sending its response.
+ *
+ * @returns Flag whether the response is ready to be read, false if the timeout expired.
+ * @param   fdRsp                   The pipe the child writes the response to.
+ * @param   cMsTimeout              Maximum number of milliseconds to wait, 0 to wait indefinitely.
+ */
+static bool pspEmuForkSrvRspWait(int fdRsp, uint32_t cMsTimeout)
+{
+    if (!cMsTimeout)
+        return true; /* The read blocks until the child reports or dies. */
+
+    uint64_t tsDeadlineNs = OSTimeTsGetNano() + (uint64_t)cMsTimeout * 1000 * 1000;
+    for (;;)
+    {
+        uint64_t tsNowNs = OSTimeTsGetNano();
+        if (tsNowNs >= tsDeadlineNs)
+            return false;
+
+        struct pollfd PollFd;
+        PollFd.fd      = fdRsp;
+        PollFd.events  = POLLIN;
+        PollFd.revents = 0;
+
+        /* Round up so the child always gets the full time. */
+        int rcPoll = poll(&PollFd, 1, (int)((tsDeadlineNs - tsNowNs + 999999) / (1000 * 1000)));
+        if (rcPoll > 0)
+            return true; /* Data or hangup because the child died. */
+        if (   rcPoll < 0
+            && errno != EINTR)
+            return true; /* Let the read figure out what is wrong. */
+    }
+}
+
+
+/**
+ * Forks a child for a single run, waits for it to finish and sends the result to the client.
  *
  * @returns Status code.
- * @param   hCcd                    The CCD instance to run in a debugger.
+ * @param   hCcd                    The CCD to run.
+ * @param   fdSrv                   The listening socket (closed in the child).
+ * @param   fdClient                The client connection to send the response to.
+ * @param   cMsTimeout              Maximum number of milliseconds the run may take, 0 for no limit.
+ */
+static int pspEmuForkSrvRunOne(PSPCCD hCcd, int fdSrv, int fdClient, uint32_t cMsTimeout)
+{
+    int afdPipe[2];
+    if (pipe(afdPipe) < 0)
+        return STS_ERR_GENERAL_ERROR;
+
+    /* Everything buffered so far belongs to the parent, the child must not write it out again. */
+    PSPEmuCcdFlush(hCcd);
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pidChild = fork();
+    if (pidChild < 0)
+    {
+        close(afdPipe[0]);
+        close(afdPipe[1]);
+        return STS_ERR_GENERAL_ERROR;
+    }
+
+    if (!pidChild)
+    {
+        close(afdPipe[0]);
+        close(fdClient);
+        close(fdSrv);
+        pspEmuForkSrvChild(hCcd, afdPipe[1]);
+    }
+
+    /* Drain the response before waiting so the child never blocks on a full pipe. */
+    close(afdPipe[1]);
+
+    /* A killed child closes the pipe, so the read below fails and the run gets reported as failed. */
+    bool fTimeout = !pspEmuForkSrvRspWait(afdPipe[0], cMsTimeout);
+    if (fTimeout)
+        kill(pidChild, SIGKILL);
+
+    PSPEMUFORKSRVRSP Rsp;
+    uint8_t *pbCovBm = NULL;
+    int rc = pspEmuForkSrvReadAll(afdPipe[0], &Rsp, sizeof(Rsp));
+    if (   STS_SUCCESS(rc)
+        && Rsp.u32Magic == PSPEMU_FORK_SRV_MAGIC
+        && Rsp.cbCovBm)
+    {
+        pbCovBm = (uint8_t *)malloc(Rsp.cbCovBm);
+        if (pbCovBm)
+            rc = pspEmuForkSrvReadAll(afdPipe[0], pbCovBm, Rsp.cbCovBm);
+        else
+            rc = STS_ERR_NO_MEMORY;
+    }
+
+    if (   STS_FAILURE(rc)
+        || Rsp.u32Magic != PSPEMU_FORK_SRV_MAGIC)
+    {
+        /* The child died before it could report anything. */
+        Rsp.u32Magic = PSPEMU_FORK_SRV_MAGIC;
+        Rsp.rcRun    = STS_ERR_GENERAL_ERROR;
+        Rsp.cBbs     = 0;
+        Rsp.cbCovBm  = 0;
+    }
+    close(afdPipe[0]);
+
+    int iWaitStatus = 0;
+    while (   waitpid(pidChild, &iWaitStatus, 0) < 0
+           && errno == EINTR);
+    Rsp.iWaitStatus = iWaitStatus;
+    Rsp.fTimeout    = fTimeout ? 1 : 0;
+
+    rc = pspEmuForkSrvWriteAll(fdClient, &Rsp, sizeof(Rsp));
+    if (   STS_SUCCESS(rc)
+        && Rsp.cbCovBm)
+        rc = pspEmuForkSrvWriteAll(fdClient, pbCovBm, Rsp.cbCovBm);
+
+    if (pbCovBm)
+        free(pbCovBm);
+    return rc;
+}
+
+
+/**
+ * Runs the fork server, the given CCD is initialized and executed up to the fork point once
+ * and every run requested by a client is carried out in a copy on write child.
+ *
+ * @returns Status code.
+ * @param   hCcd                    The CCD to serve runs for.
  * @param   pCfg                    The configuration.
  */
-static int pspEmuDbgRun(PSPCCD hCcd, PCPSPEMUCFG pCfg)
+static int pspEmuForkSrvRun(PSPCCD hCcd, PCPSPEMUCFG pCfg)
 {
-    PSPCORE hPspCore = NULL;
+    int rc = STS_INF_SUCCESS;
 
-    int rc = PSPEmuCcdQueryCore(hCcd, &hPspCore);
-    if (!rc)
+    if (pCfg->PspAddrDbgRunUpTo != UINT32_MAX)
     {
-        /*
-         * Execute one instruction to initialize the CPU state properly
-         * so the debugger has valid values to work with.
-         */
-        int rc = PSPEmuCoreExecRun(hPspCore, PSPEMU_CORE_EXEC_F_DEFAULT, 1, PSPEMU_CORE_EXEC_INDEFINITE);
-        if (!rc)
+        rc = PSPEmuCcdRunUpTo(hCcd, pCfg->PspAddrDbgRunUpTo);
+        if (STS_FAILURE(rc))
+        {
+            fprintf(stderr, "Running up to the fork point %#x failed with %d\n", pCfg->PspAddrDbgRunUpTo, rc);
+            return rc;
+        }
+    }
+
+    struct sockaddr_un SockAddr;
+    if (strlen(pCfg->pszForkSrv) >= sizeof(SockAddr.sun_path))
+        return STS_ERR_BUFFER_OVERFLOW;
+
+    memset(&SockAddr, 0, sizeof(SockAddr));
+    SockAddr.sun_family = AF_UNIX;
+    strcpy(&SockAddr.sun_path[0], pCfg->pszForkSrv);
+
+    int fdSrv = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fdSrv < 0)
+        return STS_ERR_GENERAL_ERROR;
+
+    unlink(pCfg->pszForkSrv);
+    if (   bind(fdSrv, (struct sockaddr *)&SockAddr, sizeof(SockAddr)) < 0
+        || listen(fdSrv, 1) < 0)
+    {
+        fprintf(stderr, "Setting up the fork server socket %s failed with errno=%d\n", pCfg->pszForkSrv, errno);
+        close(fdSrv);
+        return STS_ERR_GENERAL_ERROR;
+    }
+
+    printf("Fork server is listening on %s...\n", pCfg->pszForkSrv);
+
+    bool fQuit = false;
+    while (!fQuit)
+    {
+        int fdClient = accept(fdSrv, NULL, NULL);
+        if (fdClient < 0)
         {
-            PSPDBG hDbg = NULL;
+            if (errno == EINTR)
+                continue;
+            rc = STS_ERR_GENERAL_ERROR;
+            break;
+        }
 
-            rc = PSPEmuDbgCreate(&hDbg, pCfg->uDbgPort, pCfg->cDbgInsnStep, pCfg->PspAddrDbgRunUpTo,
-                                 &hCcd, 1, pCfg->hDbgHlp);
-            if (!rc)
+        /* Serve requests until the client disconnects. */
+        PSPEMUFORKSRVREQ Req;
+        while (   !fQuit
+               && STS_SUCCESS(pspEmuForkSrvReadAll(fdClient, &Req, sizeof(Req))))
+        {
+            if (Req.u32Magic != PSPEMU_FORK_SRV_MAGIC)
+                break;
+
+            if (Req.u32Cmd == PSPEMU_FORK_SRV_CMD_RUN)
             {
-                printf("Debugger is listening on port %u...\n", pCfg->uDbgPort);
-                rc = PSPEmuDbgRunloop(hDbg);
+                if (STS_FAILURE(pspEmuForkSrvRunOne(hCcd, fdSrv, fdClient, pCfg->cMsForkSrvTimeout)))
+                    break;
             }
+            else if (Req.u32Cmd == PSPEMU_FORK_SRV_CMD_QUIT)
+                fQuit = true;
+            else
+                break;
+        }
+
+        close(fdClient);
+    }
+
+    close(fdSrv);
+    unlink(pCfg->pszForkSrv);
+    return rc;
+}
+
+
+/**
+ * Executes the given CCDs under debugger control.
+ *
+ * @returns Status code.
+ * @param   pahCcds                 The CCD instances to run in a debugger.
+ * @param   cCcds                   Number of CCD instances.
+ * @param   pCfg                    The configuration.
+ */
+static int pspEmuDbgRun(PSPCCD *pahCcds, uint32_t cCcds, PCPSPEMUCFG pCfg)
+{
+    int rc = 0;
+
+    for (uint32_t i = 0; i < cCcds && !rc; i++)
+    {
+        PSPCORE hPspCore = NULL;
+
+        rc = PSPEmuCcdQueryCore(pahCcds[i], &hPspCore);
+        if (!rc)
+        {
+            /*
+             * Execute one instruction to initialize the CPU state properly
+             * so the debugger has valid values to work with.
+             */
+            rc = PSPEmuCoreExecRun(hPspCore, PSPEMU_CORE_EXEC_F_DEFAULT, 1, PSPEMU_CORE_EXEC_INDEFINITE);
+        }
+    }
+
+    if (!rc)
+    {
+        PSPDBG hDbg = NULL;
+
+        rc = PSPEmuDbgCreate(&hDbg, pCfg->uDbgPort, pCfg->cDbgInsnStep, pCfg->PspAddrDbgRunUpTo,
+                             pahCcds, cCcds, pCfg->hDbgHlp);
+        if (!rc)
+        {
+            printf("Debugger is listening on port %u...\n", pCfg->uDbgPort);
+            rc = PSPEmuDbgRunloop(hDbg);
+        }
+    }
+
+    return rc;
+}
+
+
+/**
+ * @copydoc{FNOSTHREADMAIN, Runs a single CCD on its own thread}
+ */
+static int pspEmuCcdThreadMain(OSTHREAD hThread, void *pvUser)
+{
+    (void)hThread;
+    return PSPEmuCcdRun((PSPCCD)pvUser);
+}
+
+
+/**
+ * Runs all the given CCDs concurrently, each on its own thread.
+ *
+ * @returns Status code of the first CCD failing or the status code of the first CCD.
+ * @param   pahCcds                 The CCD instances to run.
+ * @param   cCcds                   Number of CCD instances.
+ */
+static int pspEmuCcdsRun(PSPCCD *pahCcds, uint32_t cCcds)
+{
+    /* Don't bother with threads if there is only one CCD. */
+    if (cCcds == 1)
+        return PSPEmuCcdRun(pahCcds[0]);
+
+    OSTHREAD *pahThreads = (OSTHREAD *)calloc(cCcds, sizeof(*pahThreads));
+    if (!pahThreads)
+        return STS_ERR_NO_MEMORY;
+
+    int rc = STS_INF_SUCCESS;
+    uint32_t cThreads = 0;
+    for (uint32_t i = 0; i < cCcds; i++)
+    {
+        rc = OSThreadCreate(&pahThreads[i], pspEmuCcdThreadMain, pahCcds[i]);
+        if (STS_FAILURE(rc))
+        {
+            fprintf(stderr, "Creating the thread for CCD %u failed with %d\n", i, rc);
+            break;
         }
+        cThreads++;
+    }
+
+    /* Stop the CCDs already running if not all of them could be started, they depend on each other. */
+    if (cThreads < cCcds)
+    {
+        for (uint32_t i = 0; i < cThreads; i++)
+            PSPEmuCcdStop(pahCcds[i]);
+    }
+
+    for (uint32_t i = 0; i < cThreads; i++)
+    {
+        int rcThread = STS_INF_SUCCESS;
+        int rc2 = OSThreadDestroy(pahThreads[i], &rcThread);
+        if (STS_SUCCESS(rc2))
+            rc2 = rcThread;
+        if (   STS_SUCCESS(rc)
+            && (   i == 0
+                || STS_FAILURE(rc2)))
+            rc = rc2;
     }
 
+    free(pahThreads);
     return rc;
 }
 
@@ -91,15 +523,77 @@ int main(int argc, char *argv[])
 
         if (STS_SUCCESS(rc))
         {
-            PSPCCD hCcd = NULL;
+            PSPCCD *pahCcds = NULL;
+            uint32_t cCcds = 0;
+
             if (   Cfg.idSocketSingle != UINT32_MAX
                 && Cfg.idCcdSingle != UINT32_MAX)
-                rc = PSPEmuCcdCreate(&hCcd, Cfg.idSocketSingle, Cfg.idCcdSingle, &Cfg);
+                cCcds = 1;
             else
-                rc = PSPEmuCcdCreate(&hCcd, 0, 0, &Cfg);
+                cCcds = Cfg.cSockets * Cfg.cCcdsPerSocket;
+
+            /* The following features work with a single CCD only right now. */
+            if (   cCcds > 1
+                && (   Cfg.pszPspProxyAddr
+                    || Cfg.pszIoLogReplay
+                    || Cfg.pszSnapshotRestore
+                    || Cfg.pszSnapshotSave
+                    || Cfg.pszForkSrv))
+            {
+                fprintf(stderr, "The proxy, I/O log replay, snapshots and the fork server are only supported when emulating a single CCD\n");
+                rc = STS_ERR_INVALID_PARAMETER;
+            }
+
+            /* Children can't share the connection to the real hardware or the debugger. */
+            if (   Cfg.pszForkSrv
+                && (   Cfg.pszPspProxyAddr
+                    || Cfg.uDbgPort))
+            {
+                fprintf(stderr, "The fork server can't be used together with the proxy or the debugger\n");
+                rc = STS_ERR_INVALID_PARAMETER;
+            }
+
+            if (!rc)
+            {
+                pahCcds = (PSPCCD *)calloc(cCcds, sizeof(*pahCcds));
+                if (!pahCcds)
+                    rc = STS_ERR_NO_MEMORY;
+            }
+
+            uint32_t cCcdsCreated = 0;
+            if (!rc)
+            {
+                if (cCcds == 1)
+                {
+                    if (   Cfg.idSocketSingle != UINT32_MAX
+                        && Cfg.idCcdSingle != UINT32_MAX)
+                        rc = PSPEmuCcdCreate(&pahCcds[0], Cfg.idSocketSingle, Cfg.idCcdSingle, &Cfg);
+                    else
+                        rc = PSPEmuCcdCreate(&pahCcds[0], 0, 0, &Cfg);
+                    if (!rc)
+                        cCcdsCreated++;
+                }
+                else
+                {
+                    for (uint32_t i = 0; i < cCcds && !rc; i++)
+                    {
+                        rc = PSPEmuCcdCreate(&pahCcds[i], i / Cfg.cCcdsPerSocket, i % Cfg.cCcdsPerSocket, &Cfg);
+                        if (!rc)
+                            cCcdsCreated++;
+                        else
+                            fprintf(stderr, "Creating CCD %u on socket %u failed with %d\n",
+                                    i % Cfg.cCcdsPerSocket, i / Cfg.cCcdsPerSocket, rc);
+                    }
+
+                    /* Make cross die SMN accesses work. */
+                    for (uint32_t i = 0; i < cCcds && !rc; i++)
+                        rc = PSPEmuCcdPeersSet(pahCcds[i], pahCcds, cCcds);
+                }
+            }
 
             if (!rc)
             {
+                PSPCCD hCcd = pahCcds[0];
                 PSPPROXY hProxy = NULL;
                 PSPX86ICE hX86Ice = NULL;
                 PSPIOLOGREPLAY hIoLogReplay = NULL;
@@ -129,12 +623,22 @@ int main(int argc, char *argv[])
                         rc = PSPIoLogReplayCcdRegister(hIoLogReplay, hCcd);
                 }
 
+                if (   !rc
+                    && Cfg.pszSnapshotRestore)
+                {
+                    rc = PSPEmuCcdSnapshotRestore(hCcd, Cfg.pszSnapshotRestore);
+                    if (rc)
+                        fprintf(stderr, "Restoring the snapshot from %s failed with %d\n", Cfg.pszSnapshotRestore, rc);
+                }
+
                 if (!rc)
                 {
                     if (Cfg.uDbgPort)
-                        rc = pspEmuDbgRun(hCcd, &Cfg);
+                        rc = pspEmuDbgRun(pahCcds, cCcds, &Cfg);
+                    else if (Cfg.pszForkSrv)
+                        rc = pspEmuForkSrvRun(hCcd, &Cfg);
                     else
-                        rc = PSPEmuCcdRun(hCcd);
+                        rc = pspEmuCcdsRun(pahCcds, cCcds);
                 }
 
                 if (hProxy)
@@ -148,9 +652,12 @@ int main(int argc, char *argv[])
                     PSPIoLogReplayCcdDeregister(hIoLogReplay, hCcd);
                     PSPIoLogReplayDestroy(hIoLogReplay);
                 }
-
-                PSPEmuCcdDestroy(hCcd);
             }
+
+            for (uint32_t i = 0; i < cCcdsCreated; i++)
+                PSPEmuCcdDestroy(pahCcds[i]);
+            if (pahCcds)
+                free(pahCcds);
         }
 
         PSPCfgFree(&Cfg);
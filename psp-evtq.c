@@ -0,0 +1,389 @@
+/** @file
+ * PSP Emulator - Virtual clock event queue.
+ */
+
+/*
+ * Copyright (C) 2020 Alexander Eichner <alexander.eichner@campus.tu-berlin.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+
+#include <stdlib.h>
+
+#include <common/types.h>
+#include <common/cdefs.h>
+#include <common/status.h>
+
+#include <psp-evtq.h>
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+
+/** Pointer to the internal event queue instance data. */
+typedef struct PSPEVTQINT *PPSPEVTQINT;
+
+/**
+ * Event queue timer instance data.
+ */
+typedef struct PSPEVTQTIMERINT
+{
+    /** The owning event queue. */
+    PPSPEVTQINT                 pEvtQ;
+    /** The callback to call when the timer expires. */
+    PFNPSPEVTQTIMER             pfnExpired;
+    /** Opaque user data to pass to the callback. */
+    void                        *pvUser;
+    /** Description of the timer. */
+    const char                  *pszDesc;
+    /** The virtual time in nanoseconds the timer expires at. */
+    uint64_t                    tsDeadlineNs;
+    /** Index in the deadline heap, UINT32_MAX if the timer is not armed. */
+    uint32_t                    idxHeap;
+} PSPEVTQTIMERINT;
+/** Pointer to the internal event queue timer instance data. */
+typedef PSPEVTQTIMERINT *PPSPEVTQTIMERINT;
+
+
+/**
+ * Event queue instance data.
+ */
+typedef struct PSPEVTQINT
+{
+    /** The PSP core providing the virtual clock. */
+    PSPCORE                     hPspCore;
+    /** Binary min heap of armed timers ordered by their deadline. */
+    PPSPEVTQTIMERINT            *papHeap;
+    /** Number of armed timers in the heap. */
+    uint32_t                    cTimersArmed;
+    /** Number of entries allocated for the heap. */
+    uint32_t                    cHeapMax;
+    /** Number of timers created. */
+    uint32_t                    cTimers;
+    /** Flag whether expired timers are being dispatched. */
+    bool                        fDispatching;
+    /** The virtual time in nanoseconds the expired timers are dispatched for. */
+    uint64_t                    tsDispatchNs;
+} PSPEVTQINT;
+
+
+/*********************************************************************************************************************************
+*   Internal Functions                                                                                                           *
+*********************************************************************************************************************************/
+
+/**
+ * Stores the given timer at the given heap index.
+ *
+ * @returns nothing.
+ * @param   pThis                   The event queue instance.
+ * @param   idx                     The heap index.
+ * @param   pTimer                  The timer to store.
+ */
+static inline void pspEmuEvtQHeapSet(PPSPEVTQINT pThis, uint32_t idx, PPSPEVTQTIMERINT pTimer)
+{
+    pThis->papHeap[idx] = pTimer;
+    pTimer->idxHeap     = idx;
+}
+
+
+/**
+ * Moves the timer at the given heap index up until the heap property is restored.
+ *
+ * @returns nothing.
+ * @param   pThis                   The event queue instance.
+ * @param   idx                     The heap index to start at.
+ */
+static void pspEmuEvtQHeapSiftUp(PPSPEVTQINT pThis, uint32_t idx)
+{
+    PPSPEVTQTIMERINT pTimer = pThis->papHeap[idx];
+
+    while (idx > 0)
+    {
+        uint32_t idxParent = (idx - 1) / 2;
+        PPSPEVTQTIMERINT pParent = pThis->papHeap[idxParent];
+
+        if (pParent->tsDeadlineNs <= pTimer->tsDeadlineNs)
+            break;
+
+        pspEmuEvtQHeapSet(pThis, idx, pParent);
+        idx = idxParent;
+    }
+
+    pspEmuEvtQHeapSet(pThis, idx, pTimer);
+}
+
+
+/**
+ * Moves the timer at the given heap index down until the heap property is restored.
+ *
+ * @returns nothing.
+ * @param   pThis                   The event queue instance.
+ * @param   idx                     The heap index to start at.
+ */
+static void pspEmuEvtQHeapSiftDown(PPSPEVTQINT pThis, uint32_t idx)
+{
+    PPSPEVTQTIMERINT pTimer = pThis->papHeap[idx];
+
+    for (;;)
+    {
+        uint32_t idxChild = idx * 2 + 1;
+        if (idxChild >= pThis->cTimersArmed)
+            break;
+
+        if (   idxChild + 1 < pThis->cTimersArmed
+            && pThis->papHeap[idxChild + 1]->tsDeadlineNs < pThis->papHeap[idxChild]->tsDeadlineNs)
+            idxChild++;
+
+        if (pTimer->tsDeadlineNs <= pThis->papHeap[idxChild]->tsDeadlineNs)
+            break;
+
+        pspEmuEvtQHeapSet(pThis, idx, pThis->papHeap[idxChild]);
+        idx = idxChild;
+    }
+
+    pspEmuEvtQHeapSet(pThis, idx, pTimer);
+}
+
+
+/**
+ * Removes the given armed timer from the heap.
+ *
+ * @returns nothing.
+ * @param   pThis                   The event queue instance.
+ * @param   pTimer                  The timer to remove.
+ */
+static void pspEmuEvtQHeapRemove(PPSPEVTQINT pThis, PPSPEVTQTIMERINT pTimer)
+{
+    uint32_t idx = pTimer->idxHeap;
+
+    pTimer->idxHeap = UINT32_MAX;
+    pThis->cTimersArmed--;
+    if (idx != pThis->cTimersArmed)
+    {
+        /* Move the last entry into the hole and restore the heap property in whatever direction is required. */
+        pspEmuEvtQHeapSet(pThis, idx, pThis->papHeap[pThis->cTimersArmed]);
+        if (   idx > 0
+            && pThis->papHeap[(idx - 1) / 2]->tsDeadlineNs > pThis->papHeap[idx]->tsDeadlineNs)
+            pspEmuEvtQHeapSiftUp(pThis, idx);
+        else
+            pspEmuEvtQHeapSiftDown(pThis, idx);
+    }
+    pThis->papHeap[pThis->cTimersArmed] = NULL;
+}
+
+
+/**
+ * Passes the earliest deadline on to the PSP core.
+ *
+ * @returns nothing.
+ * @param   pThis                   The event queue instance.
+ */
+static void pspEmuEvtQDeadlineUpdate(PPSPEVTQINT pThis)
+{
+    PSPEmuCoreDeadlineSet(pThis->hPspCore, PSPEmuEvtQNextDeadlineGet(pThis));
+}
+
+
+/**
+ * @copydoc{FNPSPCOREDEADLINE}
+ */
+static void pspEmuEvtQCoreDeadline(PSPCORE hCore, uint64_t tsNowNs, void *pvUser)
+{
+    PPSPEVTQINT pThis = (PPSPEVTQINT)pvUser;
+
+    (void)hCore;
+
+    /*
+     * The callbacks might re-arm timers, PSPEmuEvtQTimerArm() moves deadlines at or before the
+     * current time past it so every timer expires at most once here.
+     */
+    pThis->fDispatching = true;
+    pThis->tsDispatchNs = tsNowNs;
+    while (   pThis->cTimersArmed
+           && pThis->papHeap[0]->tsDeadlineNs <= tsNowNs)
+    {
+        PPSPEVTQTIMERINT pTimer = pThis->papHeap[0];
+
+        pspEmuEvtQHeapRemove(pThis, pTimer);
+        pTimer->pfnExpired(pTimer, tsNowNs, pTimer->pvUser);
+    }
+    pThis->fDispatching = false;
+
+    pspEmuEvtQDeadlineUpdate(pThis);
+}
+
+
+int PSPEmuEvtQCreate(PPSPEVTQ phEvtQ, PSPCORE hPspCore)
+{
+    int rc = 0;
+    PPSPEVTQINT pThis = (PPSPEVTQINT)calloc(1, sizeof(*pThis));
+    if (pThis)
+    {
+        pThis->hPspCore     = hPspCore;
+        pThis->papHeap      = NULL;
+        pThis->cTimersArmed = 0;
+        pThis->cHeapMax     = 0;
+        pThis->cTimers      = 0;
+        pThis->fDispatching = false;
+        pThis->tsDispatchNs = 0;
+
+        rc = PSPEmuCoreDeadlineCallbackSet(hPspCore, pspEmuEvtQCoreDeadline, pThis);
+        if (STS_SUCCESS(rc))
+        {
+            *phEvtQ = pThis;
+            return STS_INF_SUCCESS;
+        }
+
+        free(pThis);
+    }
+    else
+        rc = STS_ERR_NO_MEMORY;
+
+    return rc;
+}
+
+
+void PSPEmuEvtQDestroy(PSPEVTQ hEvtQ)
+{
+    PPSPEVTQINT pThis = hEvtQ;
+
+    PSPEmuCoreDeadlineSet(pThis->hPspCore, UINT64_MAX);
+    PSPEmuCoreDeadlineCallbackSet(pThis->hPspCore, NULL, NULL);
+
+    if (pThis->papHeap)
+        free(pThis->papHeap);
+    free(pThis);
+}
+
+
+int PSPEmuEvtQTimerCreate(PSPEVTQ hEvtQ, PFNPSPEVTQTIMER pfnExpired, void *pvUser, const char *pszDesc,
+                          PPSPEVTQTIMER phTimer)
+{
+    PPSPEVTQINT pThis = hEvtQ;
+
+    if (!pfnExpired)
+        return STS_ERR_INVALID_PARAMETER;
+
+    /* Make sure arming the timer later on can't fail. */
+    if (pThis->cTimers == pThis->cHeapMax)
+    {
+        uint32_t cHeapMaxNew = pThis->cHeapMax ? pThis->cHeapMax * 2 : 8;
+        PPSPEVTQTIMERINT *papHeapNew = (PPSPEVTQTIMERINT *)realloc(pThis->papHeap, cHeapMaxNew * sizeof(*papHeapNew));
+        if (!papHeapNew)
+            return STS_ERR_NO_MEMORY;
+
+        pThis->papHeap  = papHeapNew;
+        pThis->cHeapMax = cHeapMaxNew;
+    }
+
+    PPSPEVTQTIMERINT pTimer = (PPSPEVTQTIMERINT)calloc(1, sizeof(*pTimer));
+    if (!pTimer)
+        return STS_ERR_NO_MEMORY;
+
+    pTimer->pEvtQ        = pThis;
+    pTimer->pfnExpired   = pfnExpired;
+    pTimer->pvUser       = pvUser;
+    pTimer->pszDesc      = pszDesc;
+    pTimer->tsDeadlineNs = UINT64_MAX;
+    pTimer->idxHeap      = UINT32_MAX;
+    pThis->cTimers++;
+
+    *phTimer = pTimer;
+    return STS_INF_SUCCESS;
+}
+
+
+int PSPEmuEvtQTimerDestroy(PSPEVTQTIMER hTimer)
+{
+    PPSPEVTQTIMERINT pTimer = hTimer;
+    PPSPEVTQINT pThis = pTimer->pEvtQ;
+
+    PSPEmuEvtQTimerDisarm(hTimer);
+    pThis->cTimers--;
+    free(pTimer);
+    return STS_INF_SUCCESS;
+}
+
+
+int PSPEmuEvtQTimerArm(PSPEVTQTIMER hTimer, uint64_t tsDeadlineNs)
+{
+    PPSPEVTQTIMERINT pTimer = hTimer;
+    PPSPEVTQINT pThis = pTimer->pEvtQ;
+
+    if (pTimer->idxHeap != UINT32_MAX)
+        pspEmuEvtQHeapRemove(pThis, pTimer);
+
+    if (   pThis->fDispatching
+        && tsDeadlineNs <= pThis->tsDispatchNs)
+        tsDeadlineNs = pThis->tsDispatchNs + 1;
+
+    pTimer->tsDeadlineNs = tsDeadlineNs;
+    pThis->papHeap[pThis->cTimersArmed] = pTimer;
+    pTimer->idxHeap = pThis->cTimersArmed++;
+    pspEmuEvtQHeapSiftUp(pThis, pTimer->idxHeap);
+
+    pspEmuEvtQDeadlineUpdate(pThis);
+    return STS_INF_SUCCESS;
+}
+
+
+int PSPEmuEvtQTimerArmRelative(PSPEVTQTIMER hTimer, uint64_t cNs)
+{
+    PPSPEVTQTIMERINT pTimer = hTimer;
+    uint64_t tsNowNs = PSPEmuCoreQueryVirtTimeNs(pTimer->pEvtQ->hPspCore);
+
+    return PSPEmuEvtQTimerArm(hTimer, cNs < UINT64_MAX - tsNowNs ? tsNowNs + cNs : UINT64_MAX - 1);
+}
+
+
+int PSPEmuEvtQTimerDisarm(PSPEVTQTIMER hTimer)
+{
+    PPSPEVTQTIMERINT pTimer = hTimer;
+    PPSPEVTQINT pThis = pTimer->pEvtQ;
+
+    if (pTimer->idxHeap != UINT32_MAX)
+    {
+        pspEmuEvtQHeapRemove(pThis, pTimer);
+        pspEmuEvtQDeadlineUpdate(pThis);
+    }
+
+    return STS_INF_SUCCESS;
+}
+
+
+bool PSPEmuEvtQTimerIsArmed(PSPEVTQTIMER hTimer)
+{
+    PPSPEVTQTIMERINT pTimer = hTimer;
+
+    return pTimer->idxHeap != UINT32_MAX;
+}
+
+
+uint64_t PSPEmuEvtQTimerDeadlineGet(PSPEVTQTIMER hTimer)
+{
+    PPSPEVTQTIMERINT pTimer = hTimer;
+
+    return pTimer->idxHeap != UINT32_MAX ? pTimer->tsDeadlineNs : UINT64_MAX;
+}
+
+
+uint64_t PSPEmuEvtQNextDeadlineGet(PSPEVTQ hEvtQ)
+{
+    PPSPEVTQINT pThis = hEvtQ;
+
+    return pThis->cTimersArmed ? pThis->papHeap[0]->tsDeadlineNs : UINT64_MAX;
+}
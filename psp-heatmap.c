@@ -0,0 +1,469 @@
+/** @file
+ * PSP Emulator - Page access heatmap and working set profiler.
+ */
+
+/*
+ * Copyright (C) 2020 Alexander Eichner <alexander.eichner@campus.tu-berlin.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <common/status.h>
+
+#include <psp-heatmap.h>
+
+
+/** Page shift used for all address spaces. */
+#define PSP_HEATMAP_PAGE_SHIFT              12
+/** Number of hash buckets for the pages (must be a power of two). */
+#define PSP_HEATMAP_PAGE_BUCKETS            4096
+
+
+/**
+ * Address space a page belongs to.
+ */
+typedef enum PSPHEATMAPSPACE
+{
+    /** Memory (SRAM and everything else mapped directly) as seen from the core. */
+    PSPHEATMAPSPACE_MEM = 0,
+    /** MMIO space. */
+    PSPHEATMAPSPACE_MMIO,
+    /** SMN space. */
+    PSPHEATMAPSPACE_SMN,
+    /** x86 physical address space. */
+    PSPHEATMAPSPACE_X86,
+    /** Number of spaces. */
+    PSPHEATMAPSPACE_COUNT
+} PSPHEATMAPSPACE;
+
+
+/**
+ * A single page.
+ */
+typedef struct PSPHEATMAPPAGE
+{
+    /** Next page in the bucket. */
+    struct PSPHEATMAPPAGE           *pNext;
+    /** The address space. */
+    PSPHEATMAPSPACE                 enmSpace;
+    /** The page number. */
+    uint64_t                        idxPage;
+    /** Number of reads. */
+    uint64_t                        cReads;
+    /** Number of writes. */
+    uint64_t                        cWrites;
+    /** Number of instruction fetches. */
+    uint64_t                        cExecs;
+    /** Number of epochs the page was accessed in. */
+    uint32_t                        cEpochs;
+    /** The last epoch the page was accessed in. */
+    uint32_t                        idxEpochLast;
+} PSPHEATMAPPAGE;
+/** Pointer to a page. */
+typedef PSPHEATMAPPAGE *PPSPHEATMAPPAGE;
+/** Pointer to a const page. */
+typedef const PSPHEATMAPPAGE *PCPSPHEATMAPPAGE;
+
+
+/**
+ * Working set summary of a single epoch.
+ */
+typedef struct PSPHEATMAPEPOCH
+{
+    /** Virtual time at the end of the epoch. */
+    uint64_t                        tsEndNs;
+    /** Number of instructions retired at the end of the epoch. */
+    uint64_t                        cInsnsEnd;
+    /** Number of pages accessed during the epoch per address space. */
+    uint32_t                        acPagesActive[PSPHEATMAPSPACE_COUNT];
+    /** Number of pages accessed for the first time during the epoch. */
+    uint32_t                        cPagesNew;
+} PSPHEATMAPEPOCH;
+/** Pointer to an epoch summary. */
+typedef PSPHEATMAPEPOCH *PPSPHEATMAPEPOCH;
+/** Pointer to a const epoch summary. */
+typedef const PSPHEATMAPEPOCH *PCPSPHEATMAPEPOCH;
+
+
+/**
+ * The heatmap profiler instance data.
+ */
+typedef struct PSPHEATMAPINT
+{
+    /** The PSP core handle. */
+    PSPCORE                         hPspCore;
+    /** The event queue timer ending an epoch. */
+    PSPEVTQTIMER                    hTimerEpoch;
+    /** Length of an epoch in nanoseconds. */
+    uint64_t                        cNsEpoch;
+    /** MMIO trace point handle. */
+    PSPIOMTP                        hIoTpMmio;
+    /** SMN trace point handle. */
+    PSPIOMTP                        hIoTpSmn;
+    /** x86 trace point handle. */
+    PSPIOMTP                        hIoTpX86;
+    /** Total number of pages recorded. */
+    uint32_t                        cPages;
+    /** The current epoch summary being collected. */
+    PSPHEATMAPEPOCH                 EpochCur;
+    /** Number of finished epochs. */
+    uint32_t                        cEpochs;
+    /** Number of epoch summaries allocated. */
+    uint32_t                        cEpochsAlloc;
+    /** The finished epoch summaries. */
+    PPSPHEATMAPEPOCH                paEpochs;
+    /** Page hash buckets. */
+    PPSPHEATMAPPAGE                 apPages[PSP_HEATMAP_PAGE_BUCKETS];
+} PSPHEATMAPINT;
+/** Pointer to the heatmap profiler instance data. */
+typedef PSPHEATMAPINT *PPSPHEATMAPINT;
+
+
+/**
+ * Address space names as written to the heatmap.
+ */
+static const char *g_apszHeatmapSpaces[PSPHEATMAPSPACE_COUNT] =
+{
+    "mem",
+    "mmio",
+    "smn",
+    "x86"
+};
+
+
+/**
+ * Records an access to the given address.
+ *
+ * @returns nothing.
+ * @param   pThis                   The heatmap profiler instance.
+ * @param   enmSpace                The address space accessed.
+ * @param   uAddr                   The address accessed.
+ * @param   fAccess                 The PSPEMU_CORE_TRACE_F_XXX access type.
+ */
+static void pspEmuHeatmapAccess(PPSPHEATMAPINT pThis, PSPHEATMAPSPACE enmSpace, uint64_t uAddr, uint32_t fAccess)
+{
+    uint64_t idxPage = uAddr >> PSP_HEATMAP_PAGE_SHIFT;
+    PPSPHEATMAPPAGE *ppPage = &pThis->apPages[(idxPage ^ (uint64_t)enmSpace << 20) & (PSP_HEATMAP_PAGE_BUCKETS - 1)];
+    PPSPHEATMAPPAGE pPage = *ppPage;
+
+    while (   pPage
+           && (   pPage->idxPage != idxPage
+               || pPage->enmSpace != enmSpace))
+        pPage = pPage->pNext;
+
+    if (!pPage)
+    {
+        pPage = (PPSPHEATMAPPAGE)calloc(1, sizeof(*pPage));
+        if (!pPage)
+            return; /* The access is lost. */
+
+        pPage->enmSpace     = enmSpace;
+        pPage->idxPage      = idxPage;
+        pPage->idxEpochLast = UINT32_MAX;
+        pPage->pNext        = *ppPage;
+        *ppPage = pPage;
+        pThis->cPages++;
+        pThis->EpochCur.cPagesNew++;
+    }
+
+    if (fAccess & PSPEMU_CORE_TRACE_F_EXEC)
+        pPage->cExecs++;
+    else if (fAccess & PSPEMU_CORE_TRACE_F_WRITE)
+        pPage->cWrites++;
+    else
+        pPage->cReads++;
+
+    if (pPage->idxEpochLast != pThis->cEpochs)
+    {
+        pPage->idxEpochLast = pThis->cEpochs;
+        pPage->cEpochs++;
+        pThis->EpochCur.acPagesActive[enmSpace]++;
+    }
+}
+
+
+/**
+ * Ends the current epoch, recording the working set summary.
+ *
+ * @returns nothing.
+ * @param   pThis                   The heatmap profiler instance.
+ * @param   tsNowNs                 The current virtual time.
+ */
+static void pspEmuHeatmapEpochEnd(PPSPHEATMAPINT pThis, uint64_t tsNowNs)
+{
+    if (pThis->cEpochs == pThis->cEpochsAlloc)
+    {
+        uint32_t cEpochsAllocNew = pThis->cEpochsAlloc ? pThis->cEpochsAlloc * 2 : 256;
+        PPSPHEATMAPEPOCH paEpochsNew = (PPSPHEATMAPEPOCH)realloc(pThis->paEpochs, cEpochsAllocNew * sizeof(*paEpochsNew));
+        if (!paEpochsNew)
+            return; /* Keep accumulating into the current epoch. */
+
+        pThis->paEpochs     = paEpochsNew;
+        pThis->cEpochsAlloc = cEpochsAllocNew;
+    }
+
+    pThis->EpochCur.tsEndNs   = tsNowNs;
+    pThis->EpochCur.cInsnsEnd = PSPEmuCoreQueryInsnsRetired(pThis->hPspCore);
+    pThis->paEpochs[pThis->cEpochs++] = pThis->EpochCur;
+    memset(&pThis->EpochCur, 0, sizeof(pThis->EpochCur));
+}
+
+
+/**
+ * Epoch timer callback.
+ */
+static void pspEmuHeatmapEpochTimer(PSPEVTQTIMER hTimer, uint64_t tsNowNs, void *pvUser)
+{
+    PPSPHEATMAPINT pThis = (PPSPHEATMAPINT)pvUser;
+
+    pspEmuHeatmapEpochEnd(pThis, tsNowNs);
+
+    /* Revoke the page access so the pages touched in the next epoch fault again. */
+    PSPEmuCoreMemAccessRearm(pThis->hPspCore);
+    PSPEmuEvtQTimerArmRelative(hTimer, pThis->cNsEpoch);
+}
+
+
+/**
+ * Core page access callback.
+ */
+static void pspEmuHeatmapMemAccess(PSPCORE hCore, PSPPADDR PspPAddrPg, uint32_t fAccess, void *pvUser)
+{
+    (void)hCore;
+
+    pspEmuHeatmapAccess((PPSPHEATMAPINT)pvUser, PSPHEATMAPSPACE_MEM, PspPAddrPg, fAccess);
+}
+
+
+/**
+ * Converts the given I/O manager trace flags to the PSPEMU_CORE_TRACE_F_XXX access type.
+ *
+ * @returns PSPEMU_CORE_TRACE_F_XXX access type.
+ * @param   fFlags                  The PSPEMU_IOM_TRACE_F_XXX flags.
+ */
+static inline uint32_t pspEmuHeatmapIomFlagsToAccess(uint32_t fFlags)
+{
+    return (fFlags & PSPEMU_IOM_TRACE_F_WRITE) ? PSPEMU_CORE_TRACE_F_WRITE : PSPEMU_CORE_TRACE_F_READ;
+}
+
+
+/**
+ * MMIO trace point callback.
+ */
+static void pspEmuHeatmapMmioTrace(PSPADDR offMmioAbs, const char *pszDevId, PSPADDR offMmioDev, size_t cbAccess,
+                                   const void *pvVal, uint32_t fFlags, void *pvUser)
+{
+    (void)pszDevId;
+    (void)offMmioDev;
+    (void)cbAccess;
+    (void)pvVal;
+
+    pspEmuHeatmapAccess((PPSPHEATMAPINT)pvUser, PSPHEATMAPSPACE_MMIO, offMmioAbs, pspEmuHeatmapIomFlagsToAccess(fFlags));
+}
+
+
+/**
+ * SMN trace point callback.
+ */
+static void pspEmuHeatmapSmnTrace(SMNADDR offSmnAbs, const char *pszDevId, SMNADDR offSmnDev, size_t cbAccess,
+                                  const void *pvVal, uint32_t fFlags, void *pvUser)
+{
+    (void)pszDevId;
+    (void)offSmnDev;
+    (void)cbAccess;
+    (void)pvVal;
+
+    pspEmuHeatmapAccess((PPSPHEATMAPINT)pvUser, PSPHEATMAPSPACE_SMN, offSmnAbs, pspEmuHeatmapIomFlagsToAccess(fFlags));
+}
+
+
+/**
+ * x86 trace point callback.
+ */
+static void pspEmuHeatmapX86Trace(X86PADDR offX86Abs, const char *pszDevId, X86PADDR offX86Dev, size_t cbAccess,
+                                  const void *pvVal, uint32_t fFlags, void *pvUser)
+{
+    (void)pszDevId;
+    (void)offX86Dev;
+    (void)cbAccess;
+    (void)pvVal;
+
+    pspEmuHeatmapAccess((PPSPHEATMAPINT)pvUser, PSPHEATMAPSPACE_X86, offX86Abs, pspEmuHeatmapIomFlagsToAccess(fFlags));
+}
+
+
+/**
+ * Deregisters all trace points and callbacks.
+ *
+ * @returns nothing.
+ * @param   pThis                   The heatmap profiler instance.
+ */
+static void pspEmuHeatmapTpsDeregister(PPSPHEATMAPINT pThis)
+{
+    if (pThis->hIoTpMmio)
+        PSPEmuIoMgrTpDeregister(pThis->hIoTpMmio);
+    if (pThis->hIoTpSmn)
+        PSPEmuIoMgrTpDeregister(pThis->hIoTpSmn);
+    if (pThis->hIoTpX86)
+        PSPEmuIoMgrTpDeregister(pThis->hIoTpX86);
+    if (pThis->hTimerEpoch)
+        PSPEmuEvtQTimerDestroy(pThis->hTimerEpoch);
+    PSPEmuCoreMemAccessCallbackSet(pThis->hPspCore, NULL, NULL);
+
+    pThis->hIoTpMmio   = NULL;
+    pThis->hIoTpSmn    = NULL;
+    pThis->hIoTpX86    = NULL;
+    pThis->hTimerEpoch = NULL;
+}
+
+
+int PSPEmuHeatmapCreate(PPSPHEATMAP phHeatmap, PSPCORE hPspCore, PSPIOM hIoMgr, PSPEVTQ hEvtQ, uint64_t cNsEpoch)
+{
+    int rc = STS_INF_SUCCESS;
+    PPSPHEATMAPINT pThis = (PPSPHEATMAPINT)calloc(1, sizeof(*pThis));
+
+    if (pThis)
+    {
+        uint32_t fTpFlags = PSPEMU_IOM_TRACE_F_READ | PSPEMU_IOM_TRACE_F_WRITE | PSPEMU_IOM_TRACE_F_AFTER;
+
+        pThis->hPspCore = hPspCore;
+        pThis->cNsEpoch = cNsEpoch ? cNsEpoch : 1;
+
+        rc = PSPEmuIoMgrMmioTraceRegister(hIoMgr, 0 /*PspAddrMmioStart*/, 0xffffffff /*PspAddrMmioEnd*/,
+                                          0 /*cbAccess*/, fTpFlags, pspEmuHeatmapMmioTrace, pThis,
+                                          &pThis->hIoTpMmio);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuIoMgrSmnTraceRegister(hIoMgr, 0 /*SmnAddrStart*/, 0xffffffff /*SmnAddrEnd*/,
+                                             0 /*cbAccess*/, fTpFlags, pspEmuHeatmapSmnTrace, pThis,
+                                             &pThis->hIoTpSmn);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuIoMgrX86TraceRegister(hIoMgr, 0 /*PhysX86AddrStart*/, 0xffffffffffffffff /*PhysX86AddrEnd*/,
+                                             0 /*cbAccess*/, fTpFlags, pspEmuHeatmapX86Trace, pThis,
+                                             &pThis->hIoTpX86);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuEvtQTimerCreate(hEvtQ, pspEmuHeatmapEpochTimer, pThis, "Heatmap epoch", &pThis->hTimerEpoch);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuEvtQTimerArmRelative(pThis->hTimerEpoch, pThis->cNsEpoch);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuCoreMemAccessCallbackSet(hPspCore, pspEmuHeatmapMemAccess, pThis);
+        if (STS_SUCCESS(rc))
+        {
+            *phHeatmap = pThis;
+            return STS_INF_SUCCESS;
+        }
+
+        pspEmuHeatmapTpsDeregister(pThis);
+        free(pThis);
+    }
+    else
+        rc = STS_ERR_NO_MEMORY;
+
+    return rc;
+}
+
+
+void PSPEmuHeatmapDestroy(PSPHEATMAP hHeatmap)
+{
+    PPSPHEATMAPINT pThis = hHeatmap;
+
+    pspEmuHeatmapTpsDeregister(pThis);
+
+    for (uint32_t i = 0; i < ELEMENTS(pThis->apPages); i++)
+    {
+        PPSPHEATMAPPAGE pPage = pThis->apPages[i];
+        while (pPage)
+        {
+            PPSPHEATMAPPAGE pFree = pPage;
+            pPage = pPage->pNext;
+            free(pFree);
+        }
+    }
+
+    if (pThis->paEpochs)
+        free(pThis->paEpochs);
+    free(pThis);
+}
+
+
+int PSPEmuHeatmapDumpToFile(PSPHEATMAP hHeatmap, const char *pszHeatmap, const char *pszWorkingSet)
+{
+    PPSPHEATMAPINT pThis = hHeatmap;
+    int rc = STS_INF_SUCCESS;
+
+    FILE *pFile = fopen(pszHeatmap, "w");
+    if (!pFile)
+        return STS_ERR_NOT_FOUND;
+
+    fprintf(pFile, "space,page,reads,writes,execs,epochs\n");
+    for (uint32_t i = 0; i < ELEMENTS(pThis->apPages); i++)
+    {
+        PCPSPHEATMAPPAGE pPage = pThis->apPages[i];
+        while (pPage)
+        {
+            fprintf(pFile, "%s,%#llx,%llu,%llu,%llu,%u\n", g_apszHeatmapSpaces[pPage->enmSpace],
+                    pPage->idxPage << PSP_HEATMAP_PAGE_SHIFT, pPage->cReads, pPage->cWrites, pPage->cExecs,
+                    pPage->cEpochs);
+            pPage = pPage->pNext;
+        }
+    }
+
+    if (ferror(pFile))
+        rc = STS_ERR_GENERAL_ERROR;
+    fclose(pFile);
+
+    if (   STS_SUCCESS(rc)
+        && pszWorkingSet)
+    {
+        /* Close the epoch still in progress so the tail of the run shows up as well. */
+        if (pThis->EpochCur.cPagesNew)
+            pspEmuHeatmapEpochEnd(pThis, PSPEmuCoreQueryVirtTimeNs(pThis->hPspCore));
+        else
+        {
+            for (uint32_t i = 0; i < ELEMENTS(pThis->EpochCur.acPagesActive); i++)
+            {
+                if (pThis->EpochCur.acPagesActive[i])
+                {
+                    pspEmuHeatmapEpochEnd(pThis, PSPEmuCoreQueryVirtTimeNs(pThis->hPspCore));
+                    break;
+                }
+            }
+        }
+
+        pFile = fopen(pszWorkingSet, "w");
+        if (pFile)
+        {
+            fprintf(pFile, "epoch,ts_ns,insns,mem,mmio,smn,x86,new\n");
+            for (uint32_t i = 0; i < pThis->cEpochs; i++)
+            {
+                PCPSPHEATMAPEPOCH pEpoch = &pThis->paEpochs[i];
+                fprintf(pFile, "%u,%llu,%llu,%u,%u,%u,%u,%u\n", i, pEpoch->tsEndNs, pEpoch->cInsnsEnd,
+                        pEpoch->acPagesActive[PSPHEATMAPSPACE_MEM], pEpoch->acPagesActive[PSPHEATMAPSPACE_MMIO],
+                        pEpoch->acPagesActive[PSPHEATMAPSPACE_SMN], pEpoch->acPagesActive[PSPHEATMAPSPACE_X86],
+                        pEpoch->cPagesNew);
+            }
+
+            if (ferror(pFile))
+                rc = STS_ERR_GENERAL_ERROR;
+            fclose(pFile);
+        }
+        else
+            rc = STS_ERR_NOT_FOUND;
+    }
+
+    return rc;
+}
+
@@ -307,6 +307,17 @@ void PSPEmuIoLogWrDestroy(PSPIOLOGWR hIoLogWr)
 }
 
 
+int PSPEmuIoLogWrFlush(PSPIOLOGWR hIoLogWr)
+{
+    PPSPIOLOGWRINT pThis = hIoLogWr;
+
+    if (fflush(pThis->pFile))
+        return STS_ERR_GENERAL_ERROR;
+
+    return STS_INF_SUCCESS;
+}
+
+
 int PSPEmuIoLogWrSmnAccAdd(PSPIOLOGWR hIoLogWr, uint32_t idCcd, PSPADDR PspAddrPc, SMNADDR SmnAddr, bool fWrite, size_t cb, const void *pv)
 {
     PPSPIOLOGWRINT pThis = hIoLogWr;
@@ -26,6 +26,9 @@
 #include <common/cdefs.h>
 #include <common/status.h>
 
+#include <os/lock.h>
+#include <os/time.h>
+
 #include <psp-iom.h>
 #include <psp-trace.h>
 
@@ -71,6 +74,10 @@ typedef struct PSPIOMTPINT
     void                            *pvUser;
     /** Trace type. */
     PSPIOMTRACETYPE                 enmType;
+    /** Start address of the trace point in its address space, used by the index. */
+    uint64_t                        uAddrStart;
+    /** Last address covered by the trace point (inclusive), used by the index. */
+    uint64_t                        uAddrLast;
     /** Type dependent data. */
     union
     {
@@ -143,14 +150,22 @@ typedef struct PSPIOMREGIONHANDLEINT
     PPSPIOMINT                      pIoMgr;
     /** Region type. */
     PSPIOMREGIONTYPE                enmType;
-    /** Pointer to the next region. */
-    struct PSPIOMREGIONHANDLEINT    *pNext;
     /** Opaque user data to pass in the callbacks. */
     void                            *pvUser;
     /** Description for this region. */
     const char                      *pszDesc;
     /** Flags for this region. */
     uint32_t                        fFlags;
+    /** Trace point index generation the fTps flag was determined for. */
+    uint32_t                        uTpGen;
+    /** Flag whether any trace point of the matching type overlaps this region, valid if uTpGen matches. */
+    bool                            fTps;
+    /** Number of reads handled, only counted when statistics are enabled. */
+    uint64_t                        cReads;
+    /** Number of writes handled, only counted when statistics are enabled. */
+    uint64_t                        cWrites;
+    /** Host nanoseconds spent in the handlers, only counted when statistics are enabled. */
+    uint64_t                        cNsHost;
     /** Type dependent data. */
     union
     {
@@ -203,14 +218,12 @@ typedef struct PSPIOMREGIONHANDLEINT
                     struct PSPIOMREGIONHANDLEINT *pExecNext;
                     /** Fetch callback. */
                     PFNPSPIOMX86MEMFETCH         pfnFetch;
-                    /** Pointer to memory backing this region. */
-                    void                         *pvMapping;
-                    /** Amount of memory currently allocated. */
-                    size_t                       cbAlloc;
-                    /** Size of the region initialized with valid data so far. */
-                    size_t                       cbValid;
-                    /** Size of the highest written area so far (exclusive, defines range of memory to sync back). */
-                    size_t                       cbWritten;
+                    /** Page table of the memory backing this region, allocated on first access. */
+                    struct PSPIOMX86MEMPAGE      *paPages;
+                    /** Number of pages covering the region. */
+                    uint32_t                     cPages;
+                    /** Contiguous memory backing the whole region once it was mapped executable, NULL otherwise. */
+                    uint8_t                      *pbContig;
                     /** Flag whether the memory should be made executable to the core. */
                     bool                         fCanExec;
                 } Mem;
@@ -226,6 +239,92 @@ typedef PSPIOMREGIONHANDLEINT *PPSPIOMREGIONHANDLEINT;
 /** The region has a write handler. */
 #define PSP_IOM_REGION_F_WRITE          BIT(1)
 
+/** Maximum number of trace points collected at once for a single access. */
+#define PSP_IOM_TP_DISPATCH_MAX         32
+
+
+/** Page shift of the x86 memory backing. */
+#define PSP_IOM_X86_MEM_PAGE_SHIFT      12
+/** Page size of the x86 memory backing. */
+#define PSP_IOM_X86_MEM_PAGE_SIZE       (1 << PSP_IOM_X86_MEM_PAGE_SHIFT)
+/** Page offset mask of the x86 memory backing. */
+#define PSP_IOM_X86_MEM_PAGE_OFF_MASK   (PSP_IOM_X86_MEM_PAGE_SIZE - 1)
+
+/** The page content was fetched (or zeroed if there is no fetch callback). */
+#define PSP_IOM_X86_MEM_PAGE_F_FETCHED  BIT(0)
+/** The page was written to. */
+#define PSP_IOM_X86_MEM_PAGE_F_DIRTY    BIT(1)
+
+
+/**
+ * A page of x86 memory backing.
+ */
+typedef struct PSPIOMX86MEMPAGE
+{
+    /** The page content, NULL if not accessed so far. */
+    uint8_t                         *pbPage;
+    /** Page state, PSP_IOM_X86_MEM_PAGE_F_XXX. */
+    uint32_t                        fFlags;
+} PSPIOMX86MEMPAGE;
+/** Pointer to a page of x86 memory backing. */
+typedef PSPIOMX86MEMPAGE *PPSPIOMX86MEMPAGE;
+
+
+/**
+ * A region index entry.
+ */
+typedef struct PSPIOMREGIONIDXENTRY
+{
+    /** Start address of the region. */
+    uint64_t                        uAddrStart;
+    /** Last address covered by the region (inclusive). */
+    uint64_t                        uAddrLast;
+    /** The region. */
+    PPSPIOMREGIONHANDLEINT          pRegion;
+} PSPIOMREGIONIDXENTRY;
+/** Pointer to a region index entry. */
+typedef PSPIOMREGIONIDXENTRY *PPSPIOMREGIONIDXENTRY;
+/** Pointer to a const region index entry. */
+typedef const PSPIOMREGIONIDXENTRY *PCPSPIOMREGIONIDXENTRY;
+
+
+/**
+ * Interval index of non overlapping regions in one address space.
+ */
+typedef struct PSPIOMREGIONIDX
+{
+    /** Array of entries sorted by start address. */
+    PPSPIOMREGIONIDXENTRY           paEntries;
+    /** Number of entries in use. */
+    uint32_t                        cEntries;
+    /** Number of entries allocated. */
+    uint32_t                        cEntriesMax;
+    /** Copy of the entry found during the last lookup, pRegion is NULL if invalid. */
+    PSPIOMREGIONIDXENTRY            LastHit;
+} PSPIOMREGIONIDX;
+/** Pointer to a region index. */
+typedef PSPIOMREGIONIDX *PPSPIOMREGIONIDX;
+
+
+/**
+ * Interval index of the trace points in one address space.
+ */
+typedef struct PSPIOMTPIDX
+{
+    /** Trace points sorted by start address. */
+    PPSPIOMTPINT                    *papTps;
+    /** Maximum last address of all trace points up to and including the same index in papTps. */
+    uint64_t                        *pauAddrLastMax;
+    /** Number of trace points in the index. */
+    uint32_t                        cTps;
+    /** Maximum number of entries the arrays can hold. */
+    uint32_t                        cTpsMax;
+    /** Generation counter, incremented on every change to invalidate the region flags and revalidate dispatching. */
+    uint32_t                        uGen;
+} PSPIOMTPIDX;
+/** Pointer to a trace point index. */
+typedef PSPIOMTPIDX *PPSPIOMTPIDX;
+
 
 /** Forward declaration of a X86 mapping control slot pointer. */
 typedef struct PSPIOMX86MAPCTRLSLOT *PPSPIOMX86MAPCTRLSLOT;
@@ -293,26 +392,14 @@ typedef struct PSPIOMX86MAPCTRLSLOT
  */
 typedef struct PSPIOMINT
 {
-    /** The head of list of MMIO regions (@todo AVL tree?). */
-    PPSPIOMREGIONHANDLEINT      pMmioHead;
-    /** The head of list of SMN regions (@todo AVL tree?). */
-    PPSPIOMREGIONHANDLEINT      pSmnHead;
-    /** The head of list of X86 regions (@todo AVL tree?). */
-    PPSPIOMREGIONHANDLEINT      pX86Head;
+    /** The index of MMIO regions. */
+    PSPIOMREGIONIDX             IdxMmio;
+    /** The index of SMN regions. */
+    PSPIOMREGIONIDX             IdxSmn;
+    /** The index of X86 regions. */
+    PSPIOMREGIONIDX             IdxX86;
     /** The head of list of X86 memory regions with exec permissions. */
     PPSPIOMREGIONHANDLEINT      pX86MemExecHead;
-    /** Lowest MMIO address assigned to a region (for faster lookup). */
-    PSPADDR                     PspAddrMmioLowest;
-    /** Highes MMIO address assigned to a region (inclusive). */
-    PSPADDR                     PspAddrMmioHighest;
-    /** Lowest SMN address assigned to a device (for faster lookup). */
-    SMNADDR                     SmnAddrLowest;
-    /** Highes SMN address assigned to a device (inclusive). */
-    SMNADDR                     SmnAddrHighest;
-    /** Lowest X86 address assigned to a region (for faster lookup). */
-    X86PADDR                    PhysX86AddrLowest;
-    /** Highes X86 address assigned to a region (inclusive). */
-    X86PADDR                    PhysX86AddrHighest;
     /** The PSP core handle this I/O manager is assigned to. */
     PSPCORE                     hPspCore;
     /** The currently mapped SMN base address for each slot (written by the control interface). */
@@ -345,6 +432,12 @@ typedef struct PSPIOMINT
     void                        *pvUserSmnUnassigned;
     /** Description used for access tracing. */
     const char                  *pszSmnUnassignedDesc;
+    /** Callback routing SMN accesses to another I/O manager. */
+    PFNPSPIOMSMNROUTE           pfnSmnRoute;
+    /** Opaque user data for the SMN routing callback. */
+    void                        *pvUserSmnRoute;
+    /** Lock serializing SMN accesses, they might come from other I/O managers running on different threads. */
+    OSLOCK                      hLockSmn;
 
     /** Callback for unassigned x86 reads. */
     PFNPSPIOMX86READ            pfnX86UnassignedRead;
@@ -357,36 +450,210 @@ typedef struct PSPIOMINT
 
     /** Registered trace points. */
     PPSPIOMTPINT                pTpHead;
+    /** The index of MMIO trace points. */
+    PSPIOMTPIDX                 TpIdxMmio;
+    /** The index of SMN trace points. */
+    PSPIOMTPIDX                 TpIdxSmn;
+    /** The index of X86 trace points. */
+    PSPIOMTPIDX                 TpIdxX86;
     /** Flag whether to log all accesses or only ones to unassigned regions. */
     bool                        fLogAllAccesses;
+    /** Flag whether to collect per region access statistics. */
+    bool                        fStats;
 } PSPIOMINT;
 
 
 /**
- * Finds the device assigned to the given MMIO address or NULL if there is nothing assigned.
+ * Looks up the region containing the given address in the given index.
  *
- * @returns Pointer to the device assigned to the MMIO address or NULL if none was found.
- * @param   pThis                   The I/O manager.
- * @param   PspAddrMmio             The absolute MMIO address to look for.
+ * @returns Pointer to the region containing the address or NULL if none was found.
+ * @param   pIdx                    The region index to search.
+ * @param   uAddr                   The address to look for.
  */
-static PPSPIOMREGIONHANDLEINT pspEmuIomMmioFindRegion(PPSPIOMINT pThis, PSPADDR PspAddrMmio)
+static PPSPIOMREGIONHANDLEINT pspEmuIomRegionIdxLookup(PPSPIOMREGIONIDX pIdx, uint64_t uAddr)
+{
+    /* Devices tend to get polled, so check the last hit first. */
+    if (   pIdx->LastHit.pRegion
+        && uAddr >= pIdx->LastHit.uAddrStart
+        && uAddr <= pIdx->LastHit.uAddrLast)
+        return pIdx->LastHit.pRegion;
+
+    /* Search for the first entry starting above the given address, the candidate is the one before. */
+    uint32_t idxLow = 0;
+    uint32_t idxHigh = pIdx->cEntries;
+    while (idxLow < idxHigh)
+    {
+        uint32_t idxMid = idxLow + (idxHigh - idxLow) / 2;
+        if (pIdx->paEntries[idxMid].uAddrStart <= uAddr)
+            idxLow = idxMid + 1;
+        else
+            idxHigh = idxMid;
+    }
+
+    if (idxLow)
+    {
+        PCPSPIOMREGIONIDXENTRY pEntry = &pIdx->paEntries[idxLow - 1];
+        if (uAddr <= pEntry->uAddrLast)
+        {
+            pIdx->LastHit = *pEntry;
+            return pEntry->pRegion;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Inserts the given region into the given index.
+ *
+ * @returns Status code.
+ * @param   pIdx                    The region index to insert into.
+ * @param   pRegion                 The region to insert.
+ * @param   uAddrStart              Start address of the region.
+ * @param   cbRegion                Size of the region in bytes.
+ */
+static int pspEmuIomRegionIdxInsert(PPSPIOMREGIONIDX pIdx, PPSPIOMREGIONHANDLEINT pRegion, uint64_t uAddrStart, size_t cbRegion)
 {
-    if (   PspAddrMmio < pThis->PspAddrMmioLowest
-        || PspAddrMmio > pThis->PspAddrMmioHighest)
-        return NULL;
+    if (   !cbRegion
+        || uAddrStart + cbRegion - 1 < uAddrStart)
+        return STS_ERR_INVALID_PARAMETER;
 
-    /* Slow path. */
-    PPSPIOMREGIONHANDLEINT pCur = pThis->pMmioHead;
-    while (pCur)
+    uint64_t uAddrLast = uAddrStart + cbRegion - 1;
+
+    /* Find the insertion point. */
+    uint32_t idxLow = 0;
+    uint32_t idxHigh = pIdx->cEntries;
+    while (idxLow < idxHigh)
     {
-        if (   PspAddrMmio >= pCur->u.Mmio.PspAddrMmioStart
-            && PspAddrMmio < pCur->u.Mmio.PspAddrMmioStart + pCur->u.Mmio.cbMmio)
-            return pCur;
+        uint32_t idxMid = idxLow + (idxHigh - idxLow) / 2;
+        if (pIdx->paEntries[idxMid].uAddrStart <= uAddrStart)
+            idxLow = idxMid + 1;
+        else
+            idxHigh = idxMid;
+    }
 
-        pCur = pCur->pNext;
+    /* The new range must not overlap with the previous and next region. */
+    if (   (   idxLow > 0
+            && pIdx->paEntries[idxLow - 1].uAddrLast >= uAddrStart)
+        || (   idxLow < pIdx->cEntries
+            && pIdx->paEntries[idxLow].uAddrStart <= uAddrLast))
+        return STS_ERR_INVALID_PARAMETER;
+
+    if (pIdx->cEntries == pIdx->cEntriesMax)
+    {
+        uint32_t cEntriesNew = pIdx->cEntriesMax ? pIdx->cEntriesMax * 2 : 16;
+        PPSPIOMREGIONIDXENTRY paEntriesNew = (PPSPIOMREGIONIDXENTRY)realloc(pIdx->paEntries, cEntriesNew * sizeof(*paEntriesNew));
+        if (!paEntriesNew)
+            return STS_ERR_NO_MEMORY;
+
+        pIdx->paEntries   = paEntriesNew;
+        pIdx->cEntriesMax = cEntriesNew;
     }
 
-    return NULL;
+    if (idxLow < pIdx->cEntries)
+        memmove(&pIdx->paEntries[idxLow + 1], &pIdx->paEntries[idxLow], (pIdx->cEntries - idxLow) * sizeof(pIdx->paEntries[0]));
+
+    pIdx->paEntries[idxLow].uAddrStart = uAddrStart;
+    pIdx->paEntries[idxLow].uAddrLast  = uAddrLast;
+    pIdx->paEntries[idxLow].pRegion    = pRegion;
+    pIdx->cEntries++;
+    return STS_INF_SUCCESS;
+}
+
+
+/**
+ * Removes the given region from the given index.
+ *
+ * @returns Status code.
+ * @param   pIdx                    The region index to remove the region from.
+ * @param   pRegion                 The region to remove.
+ */
+static int pspEmuIomRegionIdxRemove(PPSPIOMREGIONIDX pIdx, PPSPIOMREGIONHANDLEINT pRegion)
+{
+    for (uint32_t i = 0; i < pIdx->cEntries; i++)
+    {
+        if (pIdx->paEntries[i].pRegion == pRegion)
+        {
+            if (i < pIdx->cEntries - 1)
+                memmove(&pIdx->paEntries[i], &pIdx->paEntries[i + 1], (pIdx->cEntries - i - 1) * sizeof(pIdx->paEntries[0]));
+            pIdx->cEntries--;
+
+            if (pIdx->LastHit.pRegion == pRegion)
+                pIdx->LastHit.pRegion = NULL;
+            return STS_INF_SUCCESS;
+        }
+    }
+
+    return STS_ERR_NOT_FOUND;
+}
+
+
+/**
+ * Frees the memory backing of the given x86 memory region.
+ *
+ * @returns nothing.
+ * @param   pX86Region              The x86 memory region.
+ */
+static void pspEmuIoMgrX86MemFree(PPSPIOMREGIONHANDLEINT pX86Region)
+{
+    if (pX86Region->u.X86.u.Mem.paPages)
+    {
+        /* Pages point into the contiguous backing once it exists. */
+        if (!pX86Region->u.X86.u.Mem.pbContig)
+        {
+            for (uint32_t i = 0; i < pX86Region->u.X86.u.Mem.cPages; i++)
+            {
+                if (pX86Region->u.X86.u.Mem.paPages[i].pbPage)
+                    free(pX86Region->u.X86.u.Mem.paPages[i].pbPage);
+            }
+        }
+
+        free(pX86Region->u.X86.u.Mem.paPages);
+        pX86Region->u.X86.u.Mem.paPages = NULL;
+    }
+
+    if (pX86Region->u.X86.u.Mem.pbContig)
+        free(pX86Region->u.X86.u.Mem.pbContig);
+    pX86Region->u.X86.u.Mem.pbContig = NULL;
+}
+
+
+/**
+ * Frees all regions in the given index and the index itself.
+ *
+ * @returns nothing.
+ * @param   pIdx                    The region index to destroy.
+ */
+static void pspEmuIomRegionIdxDestroy(PPSPIOMREGIONIDX pIdx)
+{
+    for (uint32_t i = 0; i < pIdx->cEntries; i++)
+    {
+        if (pIdx->paEntries[i].pRegion->enmType == PSPIOMREGIONTYPE_X86_MEM)
+            pspEmuIoMgrX86MemFree(pIdx->paEntries[i].pRegion);
+        free(pIdx->paEntries[i].pRegion);
+    }
+
+    if (pIdx->paEntries)
+        free(pIdx->paEntries);
+
+    pIdx->paEntries       = NULL;
+    pIdx->cEntries        = 0;
+    pIdx->cEntriesMax     = 0;
+    pIdx->LastHit.pRegion = NULL;
+}
+
+
+/**
+ * Finds the device assigned to the given MMIO address or NULL if there is nothing assigned.
+ *
+ * @returns Pointer to the device assigned to the MMIO address or NULL if none was found.
+ * @param   pThis                   The I/O manager.
+ * @param   PspAddrMmio             The absolute MMIO address to look for.
+ */
+static PPSPIOMREGIONHANDLEINT pspEmuIomMmioFindRegion(PPSPIOMINT pThis, PSPADDR PspAddrMmio)
+{
+    return pspEmuIomRegionIdxLookup(&pThis->IdxMmio, PspAddrMmio);
 }
 
 
@@ -399,51 +666,298 @@ static PPSPIOMREGIONHANDLEINT pspEmuIomMmioFindRegion(PPSPIOMINT pThis, PSPADDR
  */
 static PPSPIOMREGIONHANDLEINT pspEmuIomSmnFindRegion(PPSPIOMINT pThis, SMNADDR SmnAddr)
 {
-    if (   SmnAddr < pThis->SmnAddrLowest
-        || SmnAddr > pThis->SmnAddrHighest)
-        return NULL;
+    return pspEmuIomRegionIdxLookup(&pThis->IdxSmn, SmnAddr);
+}
 
-    /* Slow path. */
-    PPSPIOMREGIONHANDLEINT pCur = pThis->pSmnHead;
-    while (pCur)
+
+/**
+ * Returns the trace point index for the given trace point type.
+ *
+ * @returns Pointer to the trace point index.
+ * @param   pThis                   I/O manager instance.
+ * @param   enmType                 The trace point type.
+ */
+static PPSPIOMTPIDX pspEmuIomTpIdxGet(PPSPIOMINT pThis, PSPIOMTRACETYPE enmType)
+{
+    switch (enmType)
     {
-        if (   SmnAddr >= pCur->u.Smn.SmnAddrStart
-            && SmnAddr < pCur->u.Smn.SmnAddrStart + pCur->u.Smn.cbSmn)
-            return pCur;
+        case PSPIOMTRACETYPE_MMIO:
+            return &pThis->TpIdxMmio;
+        case PSPIOMTRACETYPE_SMN:
+            return &pThis->TpIdxSmn;
+        case PSPIOMTRACETYPE_X86:
+        default:
+            return &pThis->TpIdxX86;
+    }
+}
 
-        pCur = pCur->pNext;
+
+/**
+ * Recalculates the maximum last address prefix array of the given index starting at the given entry.
+ *
+ * @returns nothing.
+ * @param   pIdx                    The trace point index.
+ * @param   idxStart                The first entry to recalculate.
+ */
+static void pspEmuIomTpIdxLastMaxRecalc(PPSPIOMTPIDX pIdx, uint32_t idxStart)
+{
+    for (uint32_t i = idxStart; i < pIdx->cTps; i++)
+    {
+        uint64_t uAddrLast = pIdx->papTps[i]->uAddrLast;
+        if (i > 0 && pIdx->pauAddrLastMax[i - 1] > uAddrLast)
+            uAddrLast = pIdx->pauAddrLastMax[i - 1];
+        pIdx->pauAddrLastMax[i] = uAddrLast;
     }
+}
 
-    return NULL;
+
+/**
+ * Returns the number of trace points in the given index starting at or below the given address.
+ *
+ * @returns Number of entries, the candidates covering the address are below it.
+ * @param   pIdx                    The trace point index.
+ * @param   uAddr                   The address to look for.
+ */
+static uint32_t pspEmuIomTpIdxUpperBound(PPSPIOMTPIDX pIdx, uint64_t uAddr)
+{
+    uint32_t idxLow = 0;
+    uint32_t idxHigh = pIdx->cTps;
+    while (idxLow < idxHigh)
+    {
+        uint32_t idxMid = idxLow + (idxHigh - idxLow) / 2;
+        if (pIdx->papTps[idxMid]->uAddrStart <= uAddr)
+            idxLow = idxMid + 1;
+        else
+            idxHigh = idxMid;
+    }
+
+    return idxLow;
 }
 
 
 /**
- * Returns the next trace point from the given start matching the given parameters.
+ * Inserts the given trace point into its index and links it into the list of all trace points.
  *
- * @returns Pointer to matching trace point or NULL if none exists.
- * @param   pFirst                  The first trace pint record to check.
- * @param   enmType                 Trace point should match the given type.
+ * @returns Status code.
+ * @param   pThis                   I/O manager instance.
+ * @param   pTp                     The trace point to insert, the address range must be set.
+ */
+static int pspEmuIomTpIdxInsert(PPSPIOMINT pThis, PPSPIOMTPINT pTp)
+{
+    PPSPIOMTPIDX pIdx = pspEmuIomTpIdxGet(pThis, pTp->enmType);
+
+    if (pIdx->cTps == pIdx->cTpsMax)
+    {
+        uint32_t cTpsMaxNew = pIdx->cTpsMax + 16;
+        PPSPIOMTPINT *papTpsNew = (PPSPIOMTPINT *)realloc(pIdx->papTps, cTpsMaxNew * sizeof(*papTpsNew));
+        if (!papTpsNew)
+            return STS_ERR_NO_MEMORY;
+        pIdx->papTps = papTpsNew;
+
+        uint64_t *pauAddrLastMaxNew = (uint64_t *)realloc(pIdx->pauAddrLastMax, cTpsMaxNew * sizeof(*pauAddrLastMaxNew));
+        if (!pauAddrLastMaxNew)
+            return STS_ERR_NO_MEMORY;
+        pIdx->pauAddrLastMax = pauAddrLastMaxNew;
+        pIdx->cTpsMax        = cTpsMaxNew;
+    }
+
+    uint32_t idxIns = pIdx->cTps;
+    while (   idxIns > 0
+           && pIdx->papTps[idxIns - 1]->uAddrStart > pTp->uAddrStart)
+    {
+        pIdx->papTps[idxIns] = pIdx->papTps[idxIns - 1];
+        idxIns--;
+    }
+
+    pIdx->papTps[idxIns] = pTp;
+    pIdx->cTps++;
+    pIdx->uGen++;
+    pspEmuIomTpIdxLastMaxRecalc(pIdx, idxIns);
+
+    pTp->pNext = pThis->pTpHead;
+    pThis->pTpHead = pTp;
+    return STS_INF_SUCCESS;
+}
+
+
+/**
+ * Removes the given trace point from its index.
+ *
+ * @returns nothing.
+ * @param   pThis                   I/O manager instance.
+ * @param   pTp                     The trace point to remove.
+ */
+static void pspEmuIomTpIdxRemove(PPSPIOMINT pThis, PPSPIOMTPINT pTp)
+{
+    PPSPIOMTPIDX pIdx = pspEmuIomTpIdxGet(pThis, pTp->enmType);
+
+    for (uint32_t i = 0; i < pIdx->cTps; i++)
+    {
+        if (pIdx->papTps[i] == pTp)
+        {
+            for (uint32_t j = i + 1; j < pIdx->cTps; j++)
+                pIdx->papTps[j - 1] = pIdx->papTps[j];
+            pIdx->cTps--;
+            pIdx->uGen++;
+            pspEmuIomTpIdxLastMaxRecalc(pIdx, i);
+            break;
+        }
+    }
+}
+
+
+/**
+ * Frees the arrays of the given trace point index.
+ *
+ * @returns nothing.
+ * @param   pIdx                    The trace point index.
+ */
+static void pspEmuIomTpIdxDestroy(PPSPIOMTPIDX pIdx)
+{
+    if (pIdx->papTps)
+        free(pIdx->papTps);
+    if (pIdx->pauAddrLastMax)
+        free(pIdx->pauAddrLastMax);
+    pIdx->papTps         = NULL;
+    pIdx->pauAddrLastMax = NULL;
+    pIdx->cTps           = 0;
+    pIdx->cTpsMax        = 0;
+}
+
+
+/**
+ * Returns whether the given access might hit a trace point in the given index, using the flag cached
+ * in the accessed region.
+ *
+ * @returns Flag whether the trace points need to be searched.
+ * @param   pIdx                    The trace point index.
+ * @param   pRegion                 The region being accessed, NULL if unassigned.
+ * @param   uAddrStart              Start address of the region.
+ * @param   cbRegion                Size of the region.
+ */
+static inline bool pspEmuIomTpIdxRegionHasTps(PPSPIOMTPIDX pIdx, PPSPIOMREGIONHANDLEINT pRegion, uint64_t uAddrStart,
+                                              size_t cbRegion)
+{
+    if (!pIdx->cTps)
+        return false;
+    if (!pRegion)
+        return true;
+
+    if (pRegion->uTpGen != pIdx->uGen)
+    {
+        uint32_t idx = pspEmuIomTpIdxUpperBound(pIdx, uAddrStart + cbRegion - 1);
+
+        pRegion->fTps   = idx > 0 && pIdx->pauAddrLastMax[idx - 1] >= uAddrStart;
+        pRegion->uTpGen = pIdx->uGen;
+    }
+
+    return pRegion->fTps;
+}
+
+
+/**
+ * Returns whether the given trace point matches the given access.
+ *
+ * @returns Flag whether the trace point matches.
+ * @param   pTp                     The trace point to check.
+ * @param   uAddr                   The address being accessed.
  * @param   cbAccess                Access width, 1, 2 or 4 byte.
  * @param   fFlagsRw                Read/Write flags matching the trace point.
  * @param   fFlagsAp                Access point (before/after) flags matching the trace point.
  */
-static PCPSPIOMTPINT pspEmuIomTpFindNext(PCPSPIOMTPINT pFirst, PSPIOMTRACETYPE enmType, size_t cbAccess,
-                                         uint32_t fFlagsRw, uint32_t fFlagsAp)
+static inline bool pspEmuIomTpMatches(PCPSPIOMTPINT pTp, uint64_t uAddr, size_t cbAccess, uint32_t fFlagsRw, uint32_t fFlagsAp)
 {
-    while (pFirst)
+    return    uAddr <= pTp->uAddrLast
+           && (   pTp->cbAccess == cbAccess
+               || !pTp->cbAccess) /* 0 matches all access widths. */
+           && (pTp->fFlags & fFlagsRw) != 0
+           && (pTp->fFlags & fFlagsAp) != 0;
+}
+
+
+/**
+ * Calls all trace points in the given index matching the given access.
+ *
+ * The matching trace points are collected before calling any of them because the handlers might
+ * (de-)register trace points. Once that happened the remaining collected trace points are checked
+ * for still being registered before they get called.
+ *
+ * @returns nothing.
+ * @param   pThis                   The I/O manager.
+ * @param   pIdx                    The trace point index.
+ * @param   uAddr                   The address being accessed.
+ * @param   uAddrRegion             Start address of the region being accessed, only valid if fRegion is true.
+ * @param   fRegion                 Flag whether a region is assigned to the address.
+ * @param   cbAccess                Access width.
+ * @param   pvVal                   The value for the access.
+ * @param   fFlagsRw                Read/Write flags matching the trace point.
+ * @param   fFlagsAp                Access point (before/after) flags matching the trace point.
+ */
+static void pspEmuIomTpDispatch(PPSPIOMINT pThis, PPSPIOMTPIDX pIdx, uint64_t uAddr, uint64_t uAddrRegion, bool fRegion,
+                                size_t cbAccess, const void *pvVal, uint32_t fFlagsRw, uint32_t fFlagsAp)
+{
+    PPSPIOMTPINT apTps[PSP_IOM_TP_DISPATCH_MAX];
+    uint32_t cSkip = 0;
+    uint32_t cMatches = 0;
+    uint32_t cTps = 0;
+
+    do
     {
-        if (   pFirst->enmType == enmType
-            && (   pFirst->cbAccess == cbAccess
-                || !pFirst->cbAccess) /* 0 matches all access widths. */
-            && (pFirst->fFlags & fFlagsRw) != 0
-            && (pFirst->fFlags & fFlagsAp) != 0)
-            return pFirst;
+        uint32_t uGen = pIdx->uGen;
 
-        pFirst = pFirst->pNext;
-    }
+        cMatches = 0;
+        for (uint32_t i = pspEmuIomTpIdxUpperBound(pIdx, uAddr); i > 0 && pIdx->pauAddrLastMax[i - 1] >= uAddr; i--)
+        {
+            PPSPIOMTPINT pTp = pIdx->papTps[i - 1];
+            if (pspEmuIomTpMatches(pTp, uAddr, cbAccess, fFlagsRw, fFlagsAp))
+            {
+                if (cMatches >= cSkip && cMatches - cSkip < ELEMENTS(apTps))
+                    apTps[cMatches - cSkip] = pTp;
+                cMatches++;
+            }
+        }
 
-    return NULL;
+        cTps = cMatches > cSkip ? cMatches - cSkip : 0;
+        if (cTps > ELEMENTS(apTps))
+            cTps = ELEMENTS(apTps);
+        for (uint32_t i = 0; i < cTps; i++)
+        {
+            PCPSPIOMTPINT pTp = apTps[i];
+
+            if (pIdx->uGen != uGen)
+            {
+                PCPSPIOMTPINT pCur = pThis->pTpHead;
+                while (   pCur
+                       && pCur != pTp)
+                    pCur = pCur->pNext;
+                if (   !pCur
+                    || !pspEmuIomTpMatches(pTp, uAddr, cbAccess, fFlagsRw, fFlagsAp)
+                    || pTp->uAddrStart > uAddr)
+                    continue;
+            }
+
+            uint64_t offRegion = fRegion ? uAddr - uAddrRegion : 0;
+            switch (pTp->enmType)
+            {
+                case PSPIOMTRACETYPE_SMN:
+                    pTp->u.Smn.pfnTrace((SMNADDR)uAddr, NULL /** @todo Description */, (SMNADDR)offRegion,
+                                        cbAccess, pvVal, fFlagsRw | fFlagsAp, pTp->pvUser);
+                    break;
+                case PSPIOMTRACETYPE_MMIO:
+                    pTp->u.Mmio.pfnTrace((PSPADDR)uAddr, NULL /** @todo Description */, (PSPADDR)offRegion,
+                                         cbAccess, pvVal, fFlagsRw | fFlagsAp, pTp->pvUser);
+                    break;
+                case PSPIOMTRACETYPE_X86:
+                default:
+                    pTp->u.X86.pfnTrace((X86PADDR)uAddr, NULL /** @todo Description */, (X86PADDR)offRegion,
+                                        cbAccess, pvVal, fFlagsRw | fFlagsAp, pTp->pvUser);
+                    break;
+            }
+        }
+
+        cSkip += cTps;
+    } while (   cTps
+             && cSkip < cMatches);
 }
 
 
@@ -585,24 +1099,12 @@ static void pspEmuIomTraceRegionWrite(PPSPIOMINT pThis, PPSPIOMREGIONHANDLEINT p
 static void pspEmuIomSmnTpCall(PPSPIOMINT pThis, SMNADDR SmnAddr, PPSPIOMREGIONHANDLEINT pRegion, size_t cbAccess, const void *pvVal,
                                uint32_t fFlagsRw, uint32_t fFlagsAp)
 {
-    PCPSPIOMTPINT pTp = pThis->pTpHead;
-    for (;;)
-    {
-        pTp = pspEmuIomTpFindNext(pTp, PSPIOMTRACETYPE_SMN, cbAccess, fFlagsRw, fFlagsAp);
-        if (!pTp)
-            break;
-        if (   SmnAddr >= pTp->u.Smn.SmnAddrStart
-            && SmnAddr <= pTp->u.Smn.SmnAddrEnd)
-            pTp->u.Smn.pfnTrace(SmnAddr,
-                                pRegion ? NULL : NULL, /** @todo Description */
-                                pRegion ? SmnAddr - pRegion->u.Smn.SmnAddrStart : 0,
-                                cbAccess,
-                                pvVal,
-                                fFlagsRw | fFlagsAp,
-                                pTp->pvUser);
+    PPSPIOMTPIDX pIdx = &pThis->TpIdxSmn;
+    if (!pspEmuIomTpIdxRegionHasTps(pIdx, pRegion, pRegion ? pRegion->u.Smn.SmnAddrStart : 0, pRegion ? pRegion->u.Smn.cbSmn : 0))
+        return;
 
-        pTp = pTp->pNext;
-    }
+    pspEmuIomTpDispatch(pThis, pIdx, SmnAddr, pRegion ? pRegion->u.Smn.SmnAddrStart : 0, pRegion != NULL, cbAccess, pvVal,
+                        fFlagsRw, fFlagsAp);
 }
 
 
@@ -621,24 +1123,12 @@ static void pspEmuIomSmnTpCall(PPSPIOMINT pThis, SMNADDR SmnAddr, PPSPIOMREGIONH
 static void pspEmuIomMmioTpCall(PPSPIOMINT pThis, PSPADDR PspAddrMmio, PPSPIOMREGIONHANDLEINT pRegion, size_t cbAccess, const void *pvVal,
                                 uint32_t fFlagsRw, uint32_t fFlagsAp)
 {
-    PCPSPIOMTPINT pTp = pThis->pTpHead;
-    for (;;)
-    {
-        pTp = pspEmuIomTpFindNext(pTp, PSPIOMTRACETYPE_MMIO, cbAccess, fFlagsRw, fFlagsAp);
-        if (!pTp)
-            break;
-        if (   PspAddrMmio >= pTp->u.Mmio.PspAddrMmioStart
-            && PspAddrMmio <= pTp->u.Mmio.PspAddrMmioEnd)
-            pTp->u.Mmio.pfnTrace(PspAddrMmio,
-                                 pRegion ? NULL : NULL, /** @todo Description */
-                                 pRegion ? PspAddrMmio - pRegion->u.Mmio.PspAddrMmioStart : 0,
-                                 cbAccess,
-                                 pvVal,
-                                 fFlagsRw | fFlagsAp,
-                                 pTp->pvUser);
+    PPSPIOMTPIDX pIdx = &pThis->TpIdxMmio;
+    if (!pspEmuIomTpIdxRegionHasTps(pIdx, pRegion, pRegion ? pRegion->u.Mmio.PspAddrMmioStart : 0, pRegion ? pRegion->u.Mmio.cbMmio : 0))
+        return;
 
-        pTp = pTp->pNext;
-    }
+    pspEmuIomTpDispatch(pThis, pIdx, PspAddrMmio, pRegion ? pRegion->u.Mmio.PspAddrMmioStart : 0, pRegion != NULL, cbAccess, pvVal,
+                        fFlagsRw, fFlagsAp);
 }
 
 
@@ -657,70 +1147,128 @@ static void pspEmuIomMmioTpCall(PPSPIOMINT pThis, PSPADDR PspAddrMmio, PPSPIOMRE
 static void pspEmuIomX86TpCall(PPSPIOMINT pThis, X86PADDR PhysX86Addr, PPSPIOMREGIONHANDLEINT pRegion, size_t cbAccess, const void *pvVal,
                                uint32_t fFlagsRw, uint32_t fFlagsAp)
 {
-    PCPSPIOMTPINT pTp = pThis->pTpHead;
-    for (;;)
-    {
-        pTp = pspEmuIomTpFindNext(pTp, PSPIOMTRACETYPE_X86, cbAccess, fFlagsRw, fFlagsAp);
-        if (!pTp)
-            break;
-        if (   PhysX86Addr >= pTp->u.X86.PhysX86AddrStart
-            && PhysX86Addr <= pTp->u.X86.PhysX86AddrEnd)
-            pTp->u.X86.pfnTrace(PhysX86Addr,
-                                pRegion ? NULL : NULL, /** @todo Description */
-                                pRegion ? PhysX86Addr - pRegion->u.X86.PhysX86AddrStart : 0,
-                                cbAccess,
-                                pvVal,
-                                fFlagsRw | fFlagsAp,
-                                pTp->pvUser);
+    PPSPIOMTPIDX pIdx = &pThis->TpIdxX86;
+    if (!pspEmuIomTpIdxRegionHasTps(pIdx, pRegion, pRegion ? pRegion->u.X86.PhysX86AddrStart : 0, pRegion ? pRegion->u.X86.cbX86 : 0))
+        return;
 
-        pTp = pTp->pNext;
-    }
+    pspEmuIomTpDispatch(pThis, pIdx, PhysX86Addr, pRegion ? pRegion->u.X86.PhysX86AddrStart : 0, pRegion != NULL, cbAccess, pvVal,
+                        fFlagsRw, fFlagsAp);
+}
+
+
+/**
+ * Fetches the initial content of the given page.
+ *
+ * @returns nothing.
+ * @param   pX86Region              The region the page belongs to.
+ * @param   idxPage                 Index of the page in the region.
+ * @param   pbPage                  Where to store the page content.
+ */
+static void pspEmuIoMgrX86MemPageFetch(PPSPIOMREGIONHANDLEINT pX86Region, uint32_t idxPage, uint8_t *pbPage)
+{
+    X86PADDR offX86Mem = (X86PADDR)idxPage << PSP_IOM_X86_MEM_PAGE_SHIFT;
+    size_t cbFetch = MIN(PSP_IOM_X86_MEM_PAGE_SIZE, pX86Region->u.X86.cbX86 - offX86Mem);
+
+    /* Fetch initial memory content or just zero the memory if no callback is provided. */
+    if (pX86Region->u.X86.u.Mem.pfnFetch)
+        pX86Region->u.X86.u.Mem.pfnFetch(offX86Mem, cbFetch, pbPage, pX86Region->pvUser);
+    else
+        memset(pbPage, 0, cbFetch);
 }
 
 
 /**
- * Ensures that the mapping is initialized properly for the given access.
+ * Allocates the page table of the given region if not done already.
  *
  * @returns Status code.
+ * @param   pX86Region              The region.
+ */
+static int pspEmuIoMgrX86MemPageTableEnsure(PPSPIOMREGIONHANDLEINT pX86Region)
+{
+    if (pX86Region->u.X86.u.Mem.paPages)
+        return STS_INF_SUCCESS;
+
+    uint32_t cPages = (uint32_t)((pX86Region->u.X86.cbX86 + PSP_IOM_X86_MEM_PAGE_OFF_MASK) >> PSP_IOM_X86_MEM_PAGE_SHIFT);
+    pX86Region->u.X86.u.Mem.paPages = (PPSPIOMX86MEMPAGE)calloc(cPages, sizeof(*pX86Region->u.X86.u.Mem.paPages));
+    if (!pX86Region->u.X86.u.Mem.paPages)
+        return STS_ERR_NO_MEMORY;
+
+    pX86Region->u.X86.u.Mem.cPages = cPages;
+    return STS_INF_SUCCESS;
+}
+
+
+/**
+ * Returns the page containing the given offset, allocating and fetching it on first access.
+ *
+ * @returns Pointer to the page or NULL if out of memory.
  * @param   pX86Region              The region being acccessed.
- * @param   offX86Mem               Offset where the access starts.
- * @param   cbAccess                Number of bytes being accessed.
+ * @param   offX86Mem               Offset of the access.
  */
-static int pspEmuIoMgrX86MemEnsureMapping(PPSPIOMREGIONHANDLEINT pX86Region, X86PADDR offX86Mem, size_t cbAccess)
+static PPSPIOMX86MEMPAGE pspEmuIoMgrX86MemPageGet(PPSPIOMREGIONHANDLEINT pX86Region, X86PADDR offX86Mem)
 {
-    int rc = 0;
+    int rc = pspEmuIoMgrX86MemPageTableEnsure(pX86Region);
+    if (STS_FAILURE(rc))
+        return NULL;
 
-    /* Check whether the data at that address is already in memory and fetch it if required. */
-    if (offX86Mem + cbAccess > pX86Region->u.X86.u.Mem.cbValid)
+    uint32_t idxPage = (uint32_t)(offX86Mem >> PSP_IOM_X86_MEM_PAGE_SHIFT);
+    PPSPIOMX86MEMPAGE pPage = &pX86Region->u.X86.u.Mem.paPages[idxPage];
+    if (!(pPage->fFlags & PSP_IOM_X86_MEM_PAGE_F_FETCHED))
     {
-        /* We cache always at 1K aligned segments. */
-        size_t cbFetch = offX86Mem + cbAccess - pX86Region->u.X86.u.Mem.cbValid;
-        cbFetch = MIN((cbFetch + _1K) & ~(_1K - 1), pX86Region->u.X86.cbX86 - pX86Region->u.X86.u.Mem.cbValid);
+        pPage->pbPage = (uint8_t *)malloc(PSP_IOM_X86_MEM_PAGE_SIZE);
+        if (!pPage->pbPage)
+            return NULL;
 
-        /* Increase the mapping memory. */
-        void *pvNew = realloc(pX86Region->u.X86.u.Mem.pvMapping, pX86Region->u.X86.u.Mem.cbAlloc + cbFetch);
-        if (pvNew)
-        {
-            void *pvInit = (uint8_t *)pvNew + pX86Region->u.X86.u.Mem.cbValid;
+        pspEmuIoMgrX86MemPageFetch(pX86Region, idxPage, pPage->pbPage);
+        pPage->fFlags |= PSP_IOM_X86_MEM_PAGE_F_FETCHED;
+    }
+
+    return pPage;
+}
 
-            pX86Region->u.X86.u.Mem.pvMapping = pvNew;
-            pX86Region->u.X86.u.Mem.cbAlloc   += cbFetch;
 
-            /* Fetch initial memory content or just zero the memory if no callback is provided. */
-            if (pX86Region->u.X86.u.Mem.pfnFetch)
-                pX86Region->u.X86.u.Mem.pfnFetch(pX86Region->u.X86.u.Mem.cbValid, cbFetch, pvInit,
-                                                 pX86Region->pvUser);
-            else
-                memset(pvInit, 0, cbFetch);
+/**
+ * Makes the backing of the given region contiguous so it can be mapped into the core, fetching
+ * all pages not accessed so far.
+ *
+ * @returns Status code.
+ * @param   pX86Region              The region to map.
+ *
+ * @note The core accesses the contiguous backing directly afterwards, so all pages are considered dirty.
+ */
+static int pspEmuIoMgrX86MemMakeContiguous(PPSPIOMREGIONHANDLEINT pX86Region)
+{
+    if (pX86Region->u.X86.u.Mem.pbContig)
+        return STS_INF_SUCCESS;
 
-            pX86Region->u.X86.u.Mem.cbValid += cbFetch;
-            return rc;
+    int rc = pspEmuIoMgrX86MemPageTableEnsure(pX86Region);
+    if (STS_FAILURE(rc))
+        return rc;
+
+    uint8_t *pbContig = (uint8_t *)malloc(pX86Region->u.X86.cbX86);
+    if (!pbContig)
+        return STS_ERR_NO_MEMORY;
+
+    for (uint32_t i = 0; i < pX86Region->u.X86.u.Mem.cPages; i++)
+    {
+        PPSPIOMX86MEMPAGE pPage = &pX86Region->u.X86.u.Mem.paPages[i];
+        X86PADDR offX86Mem = (X86PADDR)i << PSP_IOM_X86_MEM_PAGE_SHIFT;
+        uint8_t *pbPage = pbContig + offX86Mem;
+
+        if (pPage->fFlags & PSP_IOM_X86_MEM_PAGE_F_FETCHED)
+        {
+            memcpy(pbPage, pPage->pbPage, MIN(PSP_IOM_X86_MEM_PAGE_SIZE, pX86Region->u.X86.cbX86 - offX86Mem));
+            free(pPage->pbPage);
         }
         else
-            rc = -1;
+            pspEmuIoMgrX86MemPageFetch(pX86Region, i, pbPage);
+
+        pPage->pbPage = pbPage;
+        pPage->fFlags |= PSP_IOM_X86_MEM_PAGE_F_FETCHED | PSP_IOM_X86_MEM_PAGE_F_DIRTY;
     }
 
-    return rc;
+    pX86Region->u.X86.u.Mem.pbContig = pbContig;
+    return STS_INF_SUCCESS;
 }
 
 
@@ -736,11 +1284,24 @@ static int pspEmuIoMgrX86MemEnsureMapping(PPSPIOMREGIONHANDLEINT pX86Region, X86
  */
 static int pspEmuIoMgrX86MemReadWorker(PPSPIOMINT pThis, PPSPIOMREGIONHANDLEINT pX86Region, X86PADDR offX86Mem, void *pvDst, size_t cbRead)
 {
-    int rc = pspEmuIoMgrX86MemEnsureMapping(pX86Region, offX86Mem, cbRead);
-    if (!rc)
-        memcpy(pvDst, (uint8_t *)pX86Region->u.X86.u.Mem.pvMapping + offX86Mem, cbRead);
+    uint8_t *pbDst = (uint8_t *)pvDst;
 
-    return rc;
+    while (cbRead)
+    {
+        PPSPIOMX86MEMPAGE pPage = pspEmuIoMgrX86MemPageGet(pX86Region, offX86Mem);
+        if (!pPage)
+            return -1;
+
+        uint32_t offPage = offX86Mem & PSP_IOM_X86_MEM_PAGE_OFF_MASK;
+        size_t cbThisRead = MIN(cbRead, PSP_IOM_X86_MEM_PAGE_SIZE - offPage);
+
+        memcpy(pbDst, pPage->pbPage + offPage, cbThisRead);
+        pbDst     += cbThisRead;
+        offX86Mem += cbThisRead;
+        cbRead    -= cbThisRead;
+    }
+
+    return 0;
 }
 
 
@@ -756,37 +1317,86 @@ static int pspEmuIoMgrX86MemReadWorker(PPSPIOMINT pThis, PPSPIOMREGIONHANDLEINT
  */
 static int pspEmuIoMgrX86MemWriteWorker(PPSPIOMINT pThis, PPSPIOMREGIONHANDLEINT pX86Region, X86PADDR offX86Mem, const void *pvSrc, size_t cbWrite)
 {
-    int rc = pspEmuIoMgrX86MemEnsureMapping(pX86Region, offX86Mem, cbWrite);
-    if (!rc)
+    const uint8_t *pbSrc = (const uint8_t *)pvSrc;
+
+    while (cbWrite)
     {
-        memcpy((uint8_t *)pX86Region->u.X86.u.Mem.pvMapping + offX86Mem, pvSrc, cbWrite);
-        if (offX86Mem + cbWrite > pX86Region->u.X86.u.Mem.cbWritten)
-            pX86Region->u.X86.u.Mem.cbWritten = offX86Mem + cbWrite;
+        /* Partially overwritten pages need their original content, so this fetches as well. */
+        PPSPIOMX86MEMPAGE pPage = pspEmuIoMgrX86MemPageGet(pX86Region, offX86Mem);
+        if (!pPage)
+            return -1;
+
+        uint32_t offPage = offX86Mem & PSP_IOM_X86_MEM_PAGE_OFF_MASK;
+        size_t cbThisWrite = MIN(cbWrite, PSP_IOM_X86_MEM_PAGE_SIZE - offPage);
+
+        memcpy(pPage->pbPage + offPage, pbSrc, cbThisWrite);
+        pPage->fFlags |= PSP_IOM_X86_MEM_PAGE_F_DIRTY;
+        pbSrc     += cbThisWrite;
+        offX86Mem += cbThisWrite;
+        cbWrite   -= cbThisWrite;
     }
 
-    return rc;
+    return 0;
+}
+
+
+/**
+ * Returns the host timestamp to account an access with if statistics are enabled.
+ *
+ * @returns Host timestamp in nanoseconds or 0 if statistics are disabled.
+ * @param   pThis                   The I/O manager instance data.
+ */
+static inline uint64_t pspEmuIomStatsStart(PPSPIOMINT pThis)
+{
+    return pThis->fStats ? OSTimeTsGetNano() : 0;
 }
 
 
 /**
- * Reads from the given SMN based region.
+ * Accounts an access handled by the given region if statistics are enabled.
+ *
+ * @returns nothing.
+ * @param   pThis                   The I/O manager instance data.
+ * @param   pRegion                 The region handling the access.
+ * @param   tsStart                 The timestamp returned by pspEmuIomStatsStart() before calling the handler.
+ * @param   fWrite                  Flag whether the access was a write.
+ */
+static inline void pspEmuIomStatsAccount(PPSPIOMINT pThis, PPSPIOMREGIONHANDLEINT pRegion, uint64_t tsStart, bool fWrite)
+{
+    if (!pThis->fStats)
+        return;
+
+    pRegion->cNsHost += OSTimeTsGetNano() - tsStart;
+    if (fWrite)
+        pRegion->cWrites++;
+    else
+        pRegion->cReads++;
+}
+
+
+/**
+ * Reads from the SMN region at the given address, worker doing the lookup and the actual access under the SMN lock.
  *
  * @returns nothing.
  * @param   pThis                   The I/O manager instance data.
- * @param   pRegion                 The region to read from.
  * @param   SmnAddr                 Absolute SMN address being read from.
  * @param   cbRead                  How much to read.
  * @param   pvDst                   Where to store the read data.
  */
-static void pspEmuIomSmnRegionRead(PPSPIOMINT pThis, PPSPIOMREGIONHANDLEINT pRegion, SMNADDR SmnAddr, size_t cbRead, void *pvDst)
+static void pspEmuIomSmnRegionReadWorker(PPSPIOMINT pThis, SMNADDR SmnAddr, size_t cbRead, void *pvDst)
 {
+    OSLockAcquire(pThis->hLockSmn);
+    /* The lookup updates the last hit cache of the index, so it must be done with the lock held. */
+    PPSPIOMREGIONHANDLEINT pRegion = pspEmuIomSmnFindRegion(pThis, SmnAddr);
     pspEmuIomSmnTpCall(pThis, SmnAddr, pRegion, cbRead, pvDst, PSPEMU_IOM_TRACE_F_READ, PSPEMU_IOM_TRACE_F_BEFORE);
     if (pRegion)
     {
+        uint64_t tsStart = pspEmuIomStatsStart(pThis);
         if (pRegion->u.Smn.pfnRead)
             pRegion->u.Smn.pfnRead(SmnAddr - pRegion->u.Smn.SmnAddrStart, cbRead, pvDst, pRegion->pvUser);
         else
             memset(pvDst, 0, cbRead);
+        pspEmuIomStatsAccount(pThis, pRegion, tsStart, false /*fWrite*/);
     }
     else if (pThis->pfnSmnUnassignedRead)
         pThis->pfnSmnUnassignedRead(SmnAddr, cbRead, pvDst, pThis->pvUserSmnUnassigned);
@@ -795,32 +1405,76 @@ static void pspEmuIomSmnRegionRead(PPSPIOMINT pThis, PPSPIOMREGIONHANDLEINT pReg
 
     pspEmuIomTraceRegionRead(pThis, pRegion, PSPTRACEEVTORIGIN_SMN, SmnAddr, pvDst, cbRead);
     pspEmuIomSmnTpCall(pThis, SmnAddr, pRegion, cbRead, pvDst, PSPEMU_IOM_TRACE_F_READ, PSPEMU_IOM_TRACE_F_AFTER);
+    OSLockRelease(pThis->hLockSmn);
 }
 
 
 /**
- * Writes to the given SMN based region.
+ * Reads from the SMN region at the given address, routing the access to another I/O manager if requested.
+ *
+ * @returns nothing.
+ * @param   pThis                   The I/O manager instance data.
+ * @param   SmnAddr                 Absolute SMN address being read from.
+ * @param   cbRead                  How much to read.
+ * @param   pvDst                   Where to store the read data.
+ */
+static void pspEmuIomSmnRegionRead(PPSPIOMINT pThis, SMNADDR SmnAddr, size_t cbRead, void *pvDst)
+{
+    if (   pThis->pfnSmnRoute
+        && pThis->pfnSmnRoute(SmnAddr, cbRead, pvDst, false /*fWrite*/, pThis->pvUserSmnRoute))
+        return;
+
+    pspEmuIomSmnRegionReadWorker(pThis, SmnAddr, cbRead, pvDst);
+}
+
+
+/**
+ * Writes to the SMN region at the given address, worker doing the lookup and the actual access under the SMN lock.
  *
  * @returns nothing.
  * @param   pThis                   The I/O manager instance data.
- * @param   pRegion                 The region to read from.
  * @param   SmnAddr                 Absolute SMN address being written to.
  * @param   cbWrite                 How much to write.
  * @param   pvSrc                   The data to write.
  */
-static void pspEmuIomSmnRegionWrite(PPSPIOMINT pThis, PPSPIOMREGIONHANDLEINT pRegion, SMNADDR SmnAddr, size_t cbWrite, const void *pvSrc)
+static void pspEmuIomSmnRegionWriteWorker(PPSPIOMINT pThis, SMNADDR SmnAddr, size_t cbWrite, const void *pvSrc)
 {
+    OSLockAcquire(pThis->hLockSmn);
+    /* The lookup updates the last hit cache of the index, so it must be done with the lock held. */
+    PPSPIOMREGIONHANDLEINT pRegion = pspEmuIomSmnFindRegion(pThis, SmnAddr);
     pspEmuIomTraceRegionWrite(pThis, pRegion, PSPTRACEEVTORIGIN_SMN, SmnAddr, pvSrc, cbWrite);
     pspEmuIomSmnTpCall(pThis, SmnAddr, pRegion, cbWrite, pvSrc, PSPEMU_IOM_TRACE_F_WRITE, PSPEMU_IOM_TRACE_F_BEFORE);
     if (pRegion)
     {
+        uint64_t tsStart = pspEmuIomStatsStart(pThis);
         if (pRegion->u.Smn.pfnWrite)
             pRegion->u.Smn.pfnWrite(SmnAddr - pRegion->u.Smn.SmnAddrStart, cbWrite, pvSrc, pRegion->pvUser);
+        pspEmuIomStatsAccount(pThis, pRegion, tsStart, true /*fWrite*/);
     }
     else if (pThis->pfnSmnUnassignedWrite)
         pThis->pfnSmnUnassignedWrite(SmnAddr, cbWrite, pvSrc, pThis->pvUserSmnUnassigned);
 
     pspEmuIomSmnTpCall(pThis, SmnAddr, pRegion, cbWrite, pvSrc, PSPEMU_IOM_TRACE_F_WRITE, PSPEMU_IOM_TRACE_F_AFTER);
+    OSLockRelease(pThis->hLockSmn);
+}
+
+
+/**
+ * Writes to the SMN region at the given address, routing the access to another I/O manager if requested.
+ *
+ * @returns nothing.
+ * @param   pThis                   The I/O manager instance data.
+ * @param   SmnAddr                 Absolute SMN address being written to.
+ * @param   cbWrite                 How much to write.
+ * @param   pvSrc                   The data to write.
+ */
+static void pspEmuIomSmnRegionWrite(PPSPIOMINT pThis, SMNADDR SmnAddr, size_t cbWrite, const void *pvSrc)
+{
+    if (   pThis->pfnSmnRoute
+        && pThis->pfnSmnRoute(SmnAddr, cbWrite, (void *)pvSrc, true /*fWrite*/, pThis->pvUserSmnRoute))
+        return;
+
+    pspEmuIomSmnRegionWriteWorker(pThis, SmnAddr, cbWrite, pvSrc);
 }
 
 
@@ -839,10 +1493,12 @@ static void pspEmuIomMmioRegionRead(PPSPIOMINT pThis, PPSPIOMREGIONHANDLEINT pRe
     pspEmuIomMmioTpCall(pThis, PspAddrMmio, pRegion, cbRead, pvDst, PSPEMU_IOM_TRACE_F_READ, PSPEMU_IOM_TRACE_F_BEFORE);
     if (pRegion)
     {
+        uint64_t tsStart = pspEmuIomStatsStart(pThis);
         if (pRegion->u.Mmio.pfnRead)
             pRegion->u.Mmio.pfnRead(PspAddrMmio - pRegion->u.Mmio.PspAddrMmioStart, cbRead, pvDst, pRegion->pvUser);
         else
             memset(pvDst, 0, cbRead);
+        pspEmuIomStatsAccount(pThis, pRegion, tsStart, false /*fWrite*/);
     }
     else if (pThis->pfnMmioUnassignedRead)
         pThis->pfnMmioUnassignedRead(PspAddrMmio, cbRead, pvDst, pThis->pvUserMmioUnassigned);
@@ -870,8 +1526,10 @@ static void pspEmuIomMmioRegionWrite(PPSPIOMINT pThis, PPSPIOMREGIONHANDLEINT pR
     pspEmuIomMmioTpCall(pThis, PspAddrMmio, pRegion, cbWrite, pvSrc, PSPEMU_IOM_TRACE_F_WRITE, PSPEMU_IOM_TRACE_F_BEFORE);
     if (pRegion)
     {
+        uint64_t tsStart = pspEmuIomStatsStart(pThis);
         if (pRegion->u.Mmio.pfnWrite)
             pRegion->u.Mmio.pfnWrite(PspAddrMmio - pRegion->u.Mmio.PspAddrMmioStart, cbWrite, pvSrc, pRegion->pvUser);
+        pspEmuIomStatsAccount(pThis, pRegion, tsStart, true /*fWrite*/);
     }
     else if (pThis->pfnMmioUnassignedWrite)
         pThis->pfnMmioUnassignedWrite(PspAddrMmio, cbWrite, pvSrc, pThis->pvUserMmioUnassigned);
@@ -899,6 +1557,7 @@ static void pspEmuIomX86RegionRead(PPSPIOMINT pThis, PPSPIOMX86MAPCTRLSLOT pX86M
     pspEmuIomX86TpCall(pThis, PhysX86Addr, pRegion, cbRead, pvDst, PSPEMU_IOM_TRACE_F_READ, PSPEMU_IOM_TRACE_F_BEFORE);
     if (pRegion)
     {
+        uint64_t tsStart = pspEmuIomStatsStart(pThis);
         if (pRegion->enmType == PSPIOMREGIONTYPE_X86_MMIO)
         {
             enmEvtOrigin = PSPTRACEEVTORIGIN_X86_MMIO;
@@ -913,6 +1572,7 @@ static void pspEmuIomX86RegionRead(PPSPIOMINT pThis, PPSPIOMX86MAPCTRLSLOT pX86M
             enmEvtOrigin = PSPTRACEEVTORIGIN_X86_MEM;
             pspEmuIoMgrX86MemReadWorker(pThis, pRegion, PhysX86Addr - pRegion->u.X86.PhysX86AddrStart, pvDst, cbRead);
         }
+        pspEmuIomStatsAccount(pThis, pRegion, tsStart, false /*fWrite*/);
     }
     else if (pThis->pfnX86UnassignedRead)
         pThis->pfnX86UnassignedRead(PhysX86Addr, cbRead, pvDst, pX86MapSlot->u32RegUnk2 == 6 ? true : false /*fMmio*/,
@@ -952,6 +1612,7 @@ static void pspEmuIomX86RegionWrite(PPSPIOMINT pThis, PPSPIOMX86MAPCTRLSLOT pX86
     pspEmuIomX86TpCall(pThis, PhysX86Addr, pRegion, cbWrite, pvSrc, PSPEMU_IOM_TRACE_F_WRITE, PSPEMU_IOM_TRACE_F_BEFORE);
     if (pRegion)
     {
+        uint64_t tsStart = pspEmuIomStatsStart(pThis);
         if (pRegion->enmType == PSPIOMREGIONTYPE_X86_MMIO)
         {
             if (pRegion->u.X86.u.Mmio.pfnWrite)
@@ -959,6 +1620,7 @@ static void pspEmuIomX86RegionWrite(PPSPIOMINT pThis, PPSPIOMX86MAPCTRLSLOT pX86
         }
         else if (pRegion->enmType == PSPIOMREGIONTYPE_X86_MEM)
             pspEmuIoMgrX86MemWriteWorker(pThis, pRegion, PhysX86Addr - pRegion->u.X86.PhysX86AddrStart, pvSrc, cbWrite);
+        pspEmuIomStatsAccount(pThis, pRegion, tsStart, true /*fWrite*/);
     }
     else if (pThis->pfnX86UnassignedWrite)
         pThis->pfnX86UnassignedWrite(PhysX86Addr, cbWrite, pvSrc,  pX86MapSlot->u32RegUnk2 == 6 ? true : false /*fMmio*/,
@@ -973,9 +1635,7 @@ static void pspEmuIomSmnSlotsRead(PSPCORE hCore, PSPADDR uPspAddr, size_t cbRead
     PPSPIOMINT pThis = (PPSPIOMINT)pvUser;
 
     SMNADDR SmnAddr = pspEmuIomGetSmnAddrFromSlotAndOffset(pThis, uPspAddr);
-    PPSPIOMREGIONHANDLEINT pRegion = pspEmuIomSmnFindRegion(pThis, SmnAddr);
-
-    pspEmuIomSmnRegionRead(pThis, pRegion, SmnAddr, cbRead, pvDst);
+    pspEmuIomSmnRegionRead(pThis, SmnAddr, cbRead, pvDst);
 }
 
 
@@ -984,9 +1644,7 @@ static void pspEmuIomSmnSlotsWrite(PSPCORE hCore, PSPADDR uPspAddr, size_t cbWri
     PPSPIOMINT pThis = (PPSPIOMINT)pvUser;
 
     SMNADDR SmnAddr = pspEmuIomGetSmnAddrFromSlotAndOffset(pThis, uPspAddr);
-    PPSPIOMREGIONHANDLEINT pRegion = pspEmuIomSmnFindRegion(pThis, SmnAddr);
-
-    pspEmuIomSmnRegionWrite(pThis, pRegion, SmnAddr, cbWrite, pvSrc);
+    pspEmuIomSmnRegionWrite(pThis, SmnAddr, cbWrite, pvSrc);
 }
 
 
@@ -1021,22 +1679,7 @@ static void pspEmuIomMmioWrite(PSPCORE hCore, PSPADDR uPspAddr, size_t cbWrite,
  */
 static PPSPIOMREGIONHANDLEINT pspEmuIomX86MapFindRegion(PPSPIOMINT pThis, X86PADDR PhysX86Addr)
 {
-    if (   PhysX86Addr < pThis->PhysX86AddrLowest
-        || PhysX86Addr > pThis->PhysX86AddrHighest)
-        return NULL;
-
-    /* Slow path. */
-    PPSPIOMREGIONHANDLEINT pCur = pThis->pX86Head;
-    while (pCur)
-    {
-        if (   PhysX86Addr >= pCur->u.X86.PhysX86AddrStart
-            && PhysX86Addr < pCur->u.X86.PhysX86AddrStart + pCur->u.X86.cbX86)
-            return pCur;
-
-        pCur = pCur->pNext;
-    }
-
-    return NULL;
+    return pspEmuIomRegionIdxLookup(&pThis->IdxX86, PhysX86Addr);
 }
 
 
@@ -1219,8 +1862,8 @@ static void pspEmuIoMgrX86MapExecMemoryRegionsMapMaybe(PPSPIOMINT pThis, PPSPIOM
     {
         /* Oh boy, here it goes... */
 
-        /* Ensure that the whole memory region is valid. */
-        int rc = pspEmuIoMgrX86MemEnsureMapping(pX86MemExec, 0, pX86MemExec->u.X86.cbX86);
+        /* Ensure that the whole memory region is valid and contiguous. */
+        int rc = pspEmuIoMgrX86MemMakeContiguous(pX86MemExec);
         if (!rc)
         {
             /* Unmap the default handler for this region first. */
@@ -1246,7 +1889,7 @@ static void pspEmuIoMgrX86MapExecMemoryRegionsMapMaybe(PPSPIOMINT pThis, PPSPIOM
             /* Now insert the executable memory region. */
             rc = PSPEmuCoreMemRegionAdd(pThis->hPspCore, pX86MapSlot->PspAddrMmioStart + offMemExec, cbMemExec,
                                         PSPEMU_CORE_MEM_REGION_PROT_F_EXEC | PSPEMU_CORE_MEM_REGION_PROT_F_READ | PSPEMU_CORE_MEM_REGION_PROT_F_WRITE,
-                                        pX86MemExec->u.X86.u.Mem.pvMapping);
+                                        pX86MemExec->u.X86.u.Mem.pbContig);
             if (STS_SUCCESS(rc))
             {
                 /* Register our read/write tracepoint for forwarding accesses to registered I/O trace points. */
@@ -1395,6 +2038,30 @@ static void pspEmuIoMgrX86MapCtrlRead(PSPADDR offMmio, size_t cbRead, void *pvDs
 }
 
 
+/**
+ * Sets a new x86 base address for the given mapping slot.
+ *
+ * @returns nothing.
+ * @param   pThis                   The I/O manager instance.
+ * @param   pX86Slot                The x86 mapping slot being changed.
+ * @param   u32RegX86BaseAddrNew    The new base address register value.
+ */
+static void pspEmuIoMgrX86MapSlotBaseSet(PPSPIOMINT pThis, PPSPIOMX86MAPCTRLSLOT pX86Slot, uint32_t u32RegX86BaseAddrNew)
+{
+    /* Restore the original mapping in case there is an executable memory region mapped right now. */
+    pspEmuIoMgrX86MapExecMemoryRegionsUnmap(pThis, pX86Slot);
+
+    pX86Slot->u32RegX86BaseAddr = u32RegX86BaseAddrNew;
+    pX86Slot->PhysX86Base = (X86PADDR)(pX86Slot->u32RegX86BaseAddr & 0x3f) << 26 | ((X86PADDR)(pX86Slot->u32RegX86BaseAddr >> 6)) << 32;
+
+    /*
+     * In case of executable memory regions in the covered range we have to re-arrange the mapping and
+     * map the executable memory directly.
+     */
+    pspEmuIoMgrX86MapExecMemoryRegionsMapMaybe(pThis, pX86Slot);
+}
+
+
 static void pspEmuIoMgrX86MapCtrlWrite(PSPADDR offMmio, size_t cbWrite, const void *pvVal, void *pvUser)
 {
     PPSPIOMINT pThis = (PPSPIOMINT)pvUser;
@@ -1413,19 +2080,7 @@ static void pspEmuIoMgrX86MapCtrlWrite(PSPADDR offMmio, size_t cbWrite, const vo
                 uint32_t u32RegX86BaseAddrNew = *(uint32_t *)pvVal;
 
                 if (u32RegX86BaseAddrNew != pX86Slot->u32RegX86BaseAddr)
-                {
-                    /* Restore the original mapping in case there is an executable memory region mapped right now. */
-                    pspEmuIoMgrX86MapExecMemoryRegionsUnmap(pThis, pX86Slot);
-
-                    pX86Slot->u32RegX86BaseAddr = u32RegX86BaseAddrNew;
-                    pX86Slot->PhysX86Base = (X86PADDR)(pX86Slot->u32RegX86BaseAddr & 0x3f) << 26 | ((X86PADDR)(pX86Slot->u32RegX86BaseAddr >> 6)) << 32;
-
-                    /*
-                     * In case of executable memory regions in the covered range we have to re-arrange the mapping and
-                     * map the executable memory directly.
-                     */
-                    pspEmuIoMgrX86MapExecMemoryRegionsMapMaybe(pThis, pX86Slot);
-                }
+                    pspEmuIoMgrX86MapSlotBaseSet(pThis, pX86Slot, u32RegX86BaseAddrNew);
                 break;
             }
             case 4:
@@ -1520,7 +2175,7 @@ static void pspEmuIoMgrX86MapCtrl3Write(PSPADDR offMmio, size_t cbWrite, const v
 
 
 /**
- * Creates and links a new trace point with the given config.
+ * Creates a new trace point with the given config, linked by pspEmuIomTpIdxInsert() once the address range is set.
  *
  * @returns Status code.
  * @param   pThis                   I/O manager instance.
@@ -1551,8 +2206,6 @@ static int pspEmuIomTpCreate(PPSPIOMINT pThis, PSPIOMTRACETYPE enmType, size_t c
         pTp->fFlags   = fFlags;
         pTp->pvUser   = pvUser;
         pTp->enmType  = enmType;
-        pTp->pNext = pThis->pTpHead;
-        pThis->pTpHead = pTp;
         *ppTp = pTp;
     }
     else
@@ -1584,41 +2237,12 @@ static int pspEmuIomMmioRegionRegister(PPSPIOMINT pThis, PSPADDR PspAddrMmioStar
         if (pfnWrite)
             pRegion->fFlags |= PSP_IOM_REGION_F_WRITE;
 
-        PPSPIOMREGIONHANDLEINT pPrev = NULL;
-        PPSPIOMREGIONHANDLEINT pCur = pThis->pMmioHead;
-
-        /* Search where to insert the new device, sorted by starting MMIO address. */
-        while (pCur)
-        {
-            if (pCur->u.Mmio.PspAddrMmioStart > PspAddrMmioStart)
-                break;
-            pPrev = pCur;
-            pCur = pCur->pNext;
-        }
-
-        /* Do some sanity checks, the new MMIO range must not overlap with the previous and current device. */
-        if (   (   !pPrev
-                || pPrev->u.Mmio.PspAddrMmioStart + cbMmio <= PspAddrMmioStart)
-            && (   !pCur
-                || PspAddrMmioStart + cbMmio <= pCur->u.Mmio.PspAddrMmioStart))
+        rc = pspEmuIomRegionIdxInsert(&pThis->IdxMmio, pRegion, PspAddrMmioStart, cbMmio);
+        if (STS_SUCCESS(rc))
         {
-            pRegion->pNext = pCur;
-            if (pPrev)
-                pPrev->pNext = pRegion;
-            else
-                pThis->pMmioHead = pRegion;
-
-            /* Adjust the lowest and highest device range. */
-            if (PspAddrMmioStart < pThis->PspAddrMmioLowest)
-                pThis->PspAddrMmioLowest = PspAddrMmioStart;
-            if (PspAddrMmioStart + cbMmio - 1 > pThis->PspAddrMmioHighest)
-                pThis->PspAddrMmioHighest = PspAddrMmioStart + cbMmio - 1;
-
             *ppMmio = pRegion;
             return 0;
         }
-        else
-            rc = -1;
 
         free(pRegion);
     }
@@ -1630,7 +2254,7 @@ static int pspEmuIomMmioRegionRegister(PPSPIOMINT pThis, PSPADDR PspAddrMmioStar
 
 
 /**
- * Inserts the given X86 region (MMIO or memory) into the list of X86 regions.
+ * Inserts the given X86 region (MMIO or memory) into the index of X86 regions.
  *
  * @returns Status code.
  * @param   pThis                   The I/O manager.
@@ -1638,44 +2262,7 @@ static int pspEmuIomMmioRegionRegister(PPSPIOMINT pThis, PSPADDR PspAddrMmioStar
  */
 static int pspEmuIomX86RegionInsert(PPSPIOMINT pThis, PPSPIOMREGIONHANDLEINT pRegion)
 {
-    X86PADDR PhysX86AddrStart = pRegion->u.X86.PhysX86AddrStart;
-    size_t cbX86 = pRegion->u.X86.cbX86;
-    int rc = 0;
-
-    PPSPIOMREGIONHANDLEINT pPrev = NULL;
-    PPSPIOMREGIONHANDLEINT pCur = pThis->pX86Head;
-
-    /* Search where to insert the new device, sorted by starting X86 address. */
-    while (pCur)
-    {
-        if (pCur->u.X86.PhysX86AddrStart > PhysX86AddrStart)
-            break;
-        pPrev = pCur;
-        pCur = pCur->pNext;
-    }
-
-    /* Do some sanity checks, the new X86 mapping range must not overlap with the previous and current device. */
-    if (   (   !pPrev
-            || pPrev->u.X86.PhysX86AddrStart + cbX86 <= PhysX86AddrStart)
-        && (   !pCur
-            || PhysX86AddrStart + cbX86 <= pCur->u.X86.PhysX86AddrStart))
-    {
-        pRegion->pNext = pCur;
-        if (pPrev)
-            pPrev->pNext = pRegion;
-        else
-            pThis->pX86Head = pRegion;
-
-        /* Adjust the lowest and highest device range. */
-        if (PhysX86AddrStart < pThis->PhysX86AddrLowest)
-            pThis->PhysX86AddrLowest = PhysX86AddrStart;
-        if (PhysX86AddrStart + cbX86 - 1 > pThis->PhysX86AddrHighest)
-            pThis->PhysX86AddrHighest = PhysX86AddrStart + cbX86 - 1;
-    }
-    else
-        rc = -1;
-
-    return rc;
+    return pspEmuIomRegionIdxInsert(&pThis->IdxX86, pRegion, pRegion->u.X86.PhysX86AddrStart, pRegion->u.X86.cbX86);
 }
 
 
@@ -1713,23 +2300,6 @@ static void pspEmuIomX86MemExecInsert(PPSPIOMINT pThis, PPSPIOMREGIONHANDLEINT p
 }
 
 
-/**
- * Frees the given region list.
- *
- * @returns nothing.
- * @param   pHead                   Head of the region list to destroy.
- */
-static void pspEmuIoMgrDestroyRegionList(PPSPIOMREGIONHANDLEINT pHead)
-{
-    while (pHead)
-    {
-        PPSPIOMREGIONHANDLEINT pFree = pHead;
-        pHead = pHead->pNext;
-        free(pFree);
-    }
-}
-
-
 /**
  * Checks whether the given PSP address is inside the SMN region and returns the proper region handle
  * if asked for and the absolute SMN address being accessed.
@@ -1830,16 +2400,7 @@ int PSPEmuIoMgrCreate(PPSPIOM phIoMgr, PSPCORE hPspCore)
 
     if (pThis)
     {
-        pThis->pMmioHead              = NULL;
-        pThis->pSmnHead               = NULL;
-        pThis->pX86Head               = NULL;
         pThis->pX86MemExecHead        = NULL;
-        pThis->PspAddrMmioLowest      = 0xffffffff;
-        pThis->PspAddrMmioHighest     = 0x00000000;
-        pThis->SmnAddrLowest          = 0xffffffff;
-        pThis->SmnAddrHighest         = 0x00000000;
-        pThis->PhysX86AddrLowest      = 0xffffffffffffffff;
-        pThis->PhysX86AddrHighest     = 0x0000000000000000;
         pThis->hPspCore               = hPspCore;
         pThis->pMmioRegionSmnCtrl     = NULL;
         pThis->pfnMmioUnassignedRead  = NULL;
@@ -1848,11 +2409,21 @@ int PSPEmuIoMgrCreate(PPSPIOM phIoMgr, PSPCORE hPspCore)
         pThis->pfnSmnUnassignedRead   = NULL;
         pThis->pfnSmnUnassignedWrite  = NULL;
         pThis->pvUserSmnUnassigned    = NULL;
+        pThis->pfnSmnRoute            = NULL;
+        pThis->pvUserSmnRoute         = NULL;
         pThis->pfnX86UnassignedRead   = NULL;
         pThis->pfnX86UnassignedWrite  = NULL;
         pThis->pvUserX86Unassigned    = NULL;
         pThis->pTpHead                = NULL;
         pThis->fLogAllAccesses        = false;
+        pThis->fStats                 = false;
+
+        rc = OSLockCreate(&pThis->hLockSmn);
+        if (STS_FAILURE(rc))
+        {
+            free(pThis);
+            return rc;
+        }
 
         /* Register the MMIO region, where the SMN devices get mapped to (32 slots each 1MiB wide). */
         rc = PSPEmuCoreMmioRegister(hPspCore, 0x01000000, 32 * _1M,
@@ -1943,6 +2514,7 @@ int PSPEmuIoMgrCreate(PPSPIOM phIoMgr, PSPCORE hPspCore)
             PSPEmuCoreMmioDeregister(pThis->hPspCore, 0x01000000, 32 * _1M);
         }
 
+        OSLockDestroy(pThis->hLockSmn);
         free(pThis);
     }
     else
@@ -1965,15 +2537,20 @@ int PSPEmuIoMgrDestroy(PSPIOM hIoMgr)
         free(pFree);
     }
 
-    pspEmuIoMgrDestroyRegionList(pThis->pMmioHead);
-    pspEmuIoMgrDestroyRegionList(pThis->pSmnHead);
-    pspEmuIoMgrDestroyRegionList(pThis->pX86Head);
-    /* pX86MemExecHead is already part of pX86Head, so freed already. */
+    pspEmuIomTpIdxDestroy(&pThis->TpIdxMmio);
+    pspEmuIomTpIdxDestroy(&pThis->TpIdxSmn);
+    pspEmuIomTpIdxDestroy(&pThis->TpIdxX86);
+
+    pspEmuIomRegionIdxDestroy(&pThis->IdxMmio);
+    pspEmuIomRegionIdxDestroy(&pThis->IdxSmn);
+    pspEmuIomRegionIdxDestroy(&pThis->IdxX86);
+    /* pX86MemExecHead is already part of IdxX86, so freed already. */
 
     int rc = PSPEmuCoreMmioDeregister(pThis->hPspCore, 0x01000000, 0x01000000 + 32 * _1M);
     if (!rc)
         rc = PSPEmuCoreMmioDeregister(pThis->hPspCore, 0x01000000 + 32 * _1M, 0x44000000);
     /** @todo Free devices. */
+    OSLockDestroy(pThis->hLockSmn);
     free(pThis);
     return rc;
 }
@@ -1988,6 +2565,15 @@ int PSPEmuIoMgrTraceAllAccessesSet(PSPIOM hIoMgr, bool fEnable)
 }
 
 
+int PSPEmuIoMgrStatsSet(PSPIOM hIoMgr, bool fEnable)
+{
+    PPSPIOMINT pThis = hIoMgr;
+
+    pThis->fStats = fEnable;
+    return 0;
+}
+
+
 int PSPEmuIoMgrMmioUnassignedSet(PSPIOM hIoMgr, PFNPSPIOMMMIOREAD pfnRead, PFNPSPIOMMMIOWRITE pfnWrite, const char *pszDesc,
                                  void *pvUser)
 {
@@ -2022,6 +2608,20 @@ int PSPEmuIoMgrSmnUnassignedSet(PSPIOM hIoMgr, PFNPSPIOMSMNREAD pfnRead, PFNPSPI
 }
 
 
+int PSPEmuIoMgrSmnRouteSet(PSPIOM hIoMgr, PFNPSPIOMSMNROUTE pfnRoute, void *pvUser)
+{
+    PPSPIOMINT pThis = hIoMgr;
+
+    /* Allow only one registration currently. */
+    if (pThis->pfnSmnRoute)
+        return -1;
+
+    pThis->pfnSmnRoute    = pfnRoute;
+    pThis->pvUserSmnRoute = pvUser;
+    return 0;
+}
+
+
 int PSPEmuIoMgrX86UnassignedSet(PSPIOM hIoMgr, PFNPSPIOMX86READ pfnRead, PFNPSPIOMX86WRITE pfnWrite, const char *pszDesc,
                                 void *pvUser)
 {
@@ -2066,7 +2666,14 @@ int PSPEmuIoMgrMmioTraceRegister(PSPIOM hIoMgr, PSPADDR PspAddrMmioStart, PSPADD
         pTp->u.Mmio.PspAddrMmioStart = PspAddrMmioStart;
         pTp->u.Mmio.PspAddrMmioEnd   = PspAddrMmioEnd;
         pTp->u.Mmio.pfnTrace         = pfnTrace;
-        *phIoTp = pTp;
+        pTp->uAddrStart              = PspAddrMmioStart;
+        pTp->uAddrLast               = PspAddrMmioEnd;
+
+        rc = pspEmuIomTpIdxInsert(pThis, pTp);
+        if (STS_SUCCESS(rc))
+            *phIoTp = pTp;
+        else
+            free(pTp);
     }
 
     return rc;
@@ -2096,41 +2703,12 @@ int PSPEmuIoMgrSmnRegister(PSPIOM hIoMgr, SMNADDR SmnAddrStart, size_t cbSmn,
         if (pfnWrite)
             pRegion->fFlags |= PSP_IOM_REGION_F_WRITE;
 
-        PPSPIOMREGIONHANDLEINT pPrev = NULL;
-        PPSPIOMREGIONHANDLEINT pCur = pThis->pSmnHead;
-
-        /* Search where to insert the new device, sorted by starting SMN address. */
-        while (pCur)
-        {
-            if (pCur->u.Smn.SmnAddrStart > SmnAddrStart)
-                break;
-            pPrev = pCur;
-            pCur = pCur->pNext;
-        }
-
-        /* Do some sanity checks, the new SMN range must not overlap with the previous and current device. */
-        if (   (   !pPrev
-                || pPrev->u.Smn.SmnAddrStart + cbSmn <= SmnAddrStart)
-            && (   !pCur
-                || SmnAddrStart + cbSmn <= pCur->u.Smn.SmnAddrStart))
+        rc = pspEmuIomRegionIdxInsert(&pThis->IdxSmn, pRegion, SmnAddrStart, cbSmn);
+        if (STS_SUCCESS(rc))
         {
-            pRegion->pNext = pCur;
-            if (pPrev)
-                pPrev->pNext = pRegion;
-            else
-                pThis->pSmnHead = pRegion;
-
-            /* Adjust the lowest and highest device range. */
-            if (SmnAddrStart < pThis->SmnAddrLowest)
-                pThis->SmnAddrLowest = SmnAddrStart;
-            if (SmnAddrStart + cbSmn - 1 > pThis->SmnAddrHighest)
-                pThis->SmnAddrHighest = SmnAddrStart + cbSmn - 1;
-
             *phSmn = pRegion;
             return 0;
         }
-        else
-            rc = -1;
 
         free(pRegion);
     }
@@ -2157,7 +2735,14 @@ int PSPEmuIoMgrSmnTraceRegister(PSPIOM hIoMgr, SMNADDR SmnAddrStart, SMNADDR Smn
         pTp->u.Smn.SmnAddrStart = SmnAddrStart;
         pTp->u.Smn.SmnAddrEnd   = SmnAddrEnd;
         pTp->u.Smn.pfnTrace     = pfnTrace;
-        *phIoTp = pTp;
+        pTp->uAddrStart         = SmnAddrStart;
+        pTp->uAddrLast          = SmnAddrEnd;
+
+        rc = pspEmuIomTpIdxInsert(pThis, pTp);
+        if (STS_SUCCESS(rc))
+            *phIoTp = pTp;
+        else
+            free(pTp);
     }
 
     return rc;
@@ -2223,10 +2808,9 @@ int PSPEmuIoMgrX86MemRegister(PSPIOM hIoMgr, X86PADDR PhysX86AddrMemStart, size_
         pRegion->u.X86.cbX86            = cbX86Mem;
         pRegion->u.X86.u.Mem.pExecNext  = NULL;
         pRegion->u.X86.u.Mem.pfnFetch   = pfnFetch;
-        pRegion->u.X86.u.Mem.pvMapping  = NULL;
-        pRegion->u.X86.u.Mem.cbAlloc    = 0;
-        pRegion->u.X86.u.Mem.cbValid    = 0;
-        pRegion->u.X86.u.Mem.cbWritten  = 0;
+        pRegion->u.X86.u.Mem.paPages    = NULL;
+        pRegion->u.X86.u.Mem.cPages     = 0;
+        pRegion->u.X86.u.Mem.pbContig   = NULL;
         pRegion->u.X86.u.Mem.fCanExec   = fCanExec;
 
         rc = pspEmuIomX86RegionInsert(pThis, pRegion);
@@ -2293,7 +2877,14 @@ int PSPEmuIoMgrX86TraceRegister(PSPIOM hIoMgr, X86PADDR PhysX86AddrStart, X86PAD
         pTp->u.X86.PhysX86AddrStart = PhysX86AddrStart;
         pTp->u.X86.PhysX86AddrEnd   = PhysX86AddrEnd;
         pTp->u.X86.pfnTrace         = pfnTrace;
-        *phIoTp = pTp;
+        pTp->uAddrStart             = PhysX86AddrStart;
+        pTp->uAddrLast              = PhysX86AddrEnd;
+
+        rc = pspEmuIomTpIdxInsert(pThis, pTp);
+        if (STS_SUCCESS(rc))
+            *phIoTp = pTp;
+        else
+            free(pTp);
     }
 
     return rc;
@@ -2304,56 +2895,40 @@ int PSPEmuIoMgrDeregister(PSPIOMREGIONHANDLE hRegion)
 {
     PPSPIOMREGIONHANDLEINT pRegion = hRegion;
     PPSPIOMINT pThis = pRegion->pIoMgr;
-    PPSPIOMREGIONHANDLEINT *ppList = NULL;
+    PPSPIOMREGIONIDX pIdx = NULL;
 
-    /* Get correct list head pointer from the region type. */
+    /* Get correct index from the region type. */
     switch (pRegion->enmType)
     {
         case PSPIOMREGIONTYPE_PSP_MMIO:
-            ppList = &pThis->pMmioHead;
+            pIdx = &pThis->IdxMmio;
             break;
         case PSPIOMREGIONTYPE_SMN:
-            ppList = &pThis->pSmnHead;
+            pIdx = &pThis->IdxSmn;
             break;
         case PSPIOMREGIONTYPE_X86_MMIO:
         case PSPIOMREGIONTYPE_X86_MEM:
-            ppList = &pThis->pX86Head;
+            pIdx = &pThis->IdxX86;
             break;
         default:
             return -1;
     }
 
-    /* Search for the region in the list and unlink it. */
-    PPSPIOMREGIONHANDLEINT pPrev = NULL;
-    PPSPIOMREGIONHANDLEINT pCur = *ppList;
-
-    while (   pCur
-           && pCur != pRegion)
-    {
-        pPrev = pCur;
-        pCur = pCur->pNext;
-    }
-
-    if (pCur)
+    /* Remove the region from the index. */
+    int rc = pspEmuIomRegionIdxRemove(pIdx, pRegion);
+    if (STS_SUCCESS(rc))
     {
-        /* Found */
-        if (pPrev)
-            pPrev->pNext = pCur->pNext;
-        else
-            *ppList = pCur->pNext;
-
         /* For X86 memory regions we have to destroy the backing memory. */
         /** @todo Sync mapping? */
         if (pRegion->enmType == PSPIOMREGIONTYPE_X86_MEM)
         {
-            if (pRegion->u.X86.u.Mem.pvMapping)
-                free(pRegion->u.X86.u.Mem.pvMapping);
+            pspEmuIoMgrX86MemFree(pRegion);
 
             /* Remove from executable list if required. */
             if (pRegion->u.X86.u.Mem.fCanExec)
             {
-                pPrev = NULL;
-                pCur = pThis->pX86MemExecHead;
+                PPSPIOMREGIONHANDLEINT pPrev = NULL;
+                PPSPIOMREGIONHANDLEINT pCur = pThis->pX86MemExecHead;
 
                 while (   pCur
                        && pCur != pRegion)
@@ -2406,6 +2981,7 @@ int PSPEmuIoMgrTpDeregister(PSPIOMTP hIoTp)
         else
             pThis->pTpHead = pCur->pNext;
 
+        pspEmuIomTpIdxRemove(pThis, pTp);
         free(pTp);
     }
     else /* Not found? */
@@ -2430,7 +3006,7 @@ int PSPEmuIoMgrPspAddrRead(PSPIOM hIoMgr, PSPADDR PspAddr, void *pvDst, size_t c
     }
     else if (pspEmuIoMgrAddrIsSmn(pThis, PspAddr, &pRegion, &SmnAddr))
     {
-        pspEmuIomSmnRegionRead(pThis, pRegion, SmnAddr, cbRead, pvDst);
+        pspEmuIomSmnRegionRead(pThis, SmnAddr, cbRead, pvDst);
         return 0;
     }
     else if (pspEmuIoMgrAddrIsX86(pThis, PspAddr, &pX86MapSlot, &pRegion, &PhysX86Addr))
@@ -2458,7 +3034,7 @@ int PSPEmuIoMgrPspAddrWrite(PSPIOM hIoMgr, PSPADDR PspAddr, const void *pvSrc, s
     }
     else if (pspEmuIoMgrAddrIsSmn(pThis, PspAddr, &pRegion, &SmnAddr))
     {
-        pspEmuIomSmnRegionWrite(pThis, pRegion, SmnAddr, cbWrite, pvSrc);
+        pspEmuIomSmnRegionWrite(pThis, SmnAddr, cbWrite, pvSrc);
         return 0;
     }
     else if (pspEmuIoMgrAddrIsX86(pThis, PspAddr, &pX86MapSlot, &pRegion, &PhysX86Addr))
@@ -2471,6 +3047,58 @@ int PSPEmuIoMgrPspAddrWrite(PSPIOM hIoMgr, PSPADDR PspAddr, const void *pvSrc, s
 }
 
 
+int PSPEmuIoMgrPspAddrQueryRegion(PSPIOM hIoMgr, PSPADDR PspAddr, PPSPIOMREGIONHANDLE phRegion, uint64_t *poffRegion)
+{
+    PPSPIOMINT pThis = hIoMgr;
+
+    PPSPIOMREGIONHANDLEINT pRegion = NULL;
+    SMNADDR SmnAddr;
+    X86PADDR PhysX86Addr;
+    PPSPIOMX86MAPCTRLSLOT pX86MapSlot;
+    uint64_t offRegion = 0;
+    if (pspEmuIoMgrAddrIsMmio(pThis, PspAddr, &pRegion))
+    {
+        if (pRegion)
+            offRegion = PspAddr - pRegion->u.Mmio.PspAddrMmioStart;
+    }
+    else if (pspEmuIoMgrAddrIsSmn(pThis, PspAddr, &pRegion, &SmnAddr))
+    {
+        if (pRegion)
+            offRegion = SmnAddr - pRegion->u.Smn.SmnAddrStart;
+    }
+    else if (pspEmuIoMgrAddrIsX86(pThis, PspAddr, &pX86MapSlot, &pRegion, &PhysX86Addr))
+    {
+        if (pRegion)
+            offRegion = PhysX86Addr - pRegion->u.X86.PhysX86AddrStart;
+    }
+
+    if (!pRegion)
+        return STS_ERR_NOT_FOUND;
+
+    *phRegion   = pRegion;
+    *poffRegion = offRegion;
+    return STS_INF_SUCCESS;
+}
+
+
+int PSPEmuIoMgrSmnRead(PSPIOM hIoMgr, SMNADDR SmnAddr, void *pvDst, size_t cbRead)
+{
+    PPSPIOMINT pThis = hIoMgr;
+
+    pspEmuIomSmnRegionReadWorker(pThis, SmnAddr, cbRead, pvDst);
+    return 0;
+}
+
+
+int PSPEmuIoMgrSmnWrite(PSPIOM hIoMgr, SMNADDR SmnAddr, const void *pvSrc, size_t cbWrite)
+{
+    PPSPIOMINT pThis = hIoMgr;
+
+    pspEmuIomSmnRegionWriteWorker(pThis, SmnAddr, cbWrite, pvSrc);
+    return 0;
+}
+
+
 int PSPEmuIoMgrX86AddrRead(PSPIOM hIoMgr, X86PADDR PhysX86Addr, void *pvDst, size_t cbRead)
 {
     PPSPIOMINT pThis = hIoMgr;
@@ -2568,3 +3196,88 @@ int PSPEmuIoMgrSmnMapSlotDump(PSPIOM hIoMgr, uint32_t idxSlotStart, uint32_t idx
     return STS_INF_SUCCESS;
 }
 
+
+int PSPEmuIoMgrStatsDump(PSPIOM hIoMgr)
+{
+    PPSPIOMINT pThis = hIoMgr;
+    static const char *s_apszSpaces[] = { "MMIO", "SMN", "X86" };
+    PPSPIOMREGIONIDX apIdx[] = { &pThis->IdxMmio, &pThis->IdxSmn, &pThis->IdxX86 };
+
+    printf("I/O manager statistics:\n");
+    for (uint32_t idxSpace = 0; idxSpace < ELEMENTS(apIdx); idxSpace++)
+    {
+        PPSPIOMREGIONIDX pIdx = apIdx[idxSpace];
+
+        for (uint32_t i = 0; i < pIdx->cEntries; i++)
+        {
+            PCPSPIOMREGIONIDXENTRY pEntry = &pIdx->paEntries[i];
+            PPSPIOMREGIONHANDLEINT pRegion = pEntry->pRegion;
+
+            if (pRegion->cReads || pRegion->cWrites)
+                printf("    %-4s %#014llx-%#014llx: %llu reads, %llu writes, %lluns (%s)\n",
+                       s_apszSpaces[idxSpace], pEntry->uAddrStart, pEntry->uAddrLast,
+                       pRegion->cReads, pRegion->cWrites, pRegion->cNsHost,
+                       pRegion->pszDesc ? pRegion->pszDesc : "<unknown>");
+        }
+    }
+
+    return STS_INF_SUCCESS;
+}
+
+
+int PSPEmuIoMgrStateSave(PSPIOM hIoMgr, PSPSNAPSHOT hSnap)
+{
+    PPSPIOMINT pThis = hIoMgr;
+
+    int rc = PSPEmuSnapshotPutData(hSnap, &pThis->aSmnAddrBaseSlots[0], sizeof(pThis->aSmnAddrBaseSlots));
+    for (uint32_t i = 0; i < ELEMENTS(pThis->aX86MapCtrlSlots) && STS_SUCCESS(rc); i++)
+    {
+        PPSPIOMX86MAPCTRLSLOT pX86Slot = &pThis->aX86MapCtrlSlots[i];
+
+        rc = PSPEmuSnapshotPutU32(hSnap, pX86Slot->u32RegX86BaseAddr);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU32(hSnap, pX86Slot->u32RegUnk1);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU32(hSnap, pX86Slot->u32RegUnk2);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU32(hSnap, pX86Slot->u32RegUnk3);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU32(hSnap, pX86Slot->u32RegUnk4);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotPutU32(hSnap, pX86Slot->u32RegUnk5);
+    }
+
+    return rc;
+}
+
+
+int PSPEmuIoMgrStateLoad(PSPIOM hIoMgr, PSPSNAPSHOT hSnap)
+{
+    PPSPIOMINT pThis = hIoMgr;
+
+    int rc = PSPEmuSnapshotGetData(hSnap, &pThis->aSmnAddrBaseSlots[0], sizeof(pThis->aSmnAddrBaseSlots));
+    for (uint32_t i = 0; i < ELEMENTS(pThis->aX86MapCtrlSlots) && STS_SUCCESS(rc); i++)
+    {
+        PPSPIOMX86MAPCTRLSLOT pX86Slot = &pThis->aX86MapCtrlSlots[i];
+        uint32_t u32RegX86BaseAddr = 0;
+
+        rc = PSPEmuSnapshotGetU32(hSnap, &u32RegX86BaseAddr);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotGetU32(hSnap, &pX86Slot->u32RegUnk1);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotGetU32(hSnap, &pX86Slot->u32RegUnk2);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotGetU32(hSnap, &pX86Slot->u32RegUnk3);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotGetU32(hSnap, &pX86Slot->u32RegUnk4);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotGetU32(hSnap, &pX86Slot->u32RegUnk5);
+
+        /* Go through the same path as a guest write so executable memory gets remapped properly. */
+        if (   STS_SUCCESS(rc)
+            && u32RegX86BaseAddr != pX86Slot->u32RegX86BaseAddr)
+            pspEmuIoMgrX86MapSlotBaseSet(pThis, pX86Slot, u32RegX86BaseAddr);
+    }
+
+    return rc;
+}
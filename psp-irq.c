@@ -261,3 +261,31 @@ int PSPIrqSet(PSPIRQ hIrq, uint32_t uPrioGrp, uint8_t uIrq, bool fAssert)
 
     return STS_ERR_INVALID_PARAMETER;
 }
+
+
+int PSPIrqStateSave(PSPIRQ hIrq, PSPSNAPSHOT hSnap)
+{
+    PPSPIRQINT pThis = hIrq;
+
+    int rc = PSPEmuSnapshotPutU32(hSnap, pThis->cGrpPending);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutData(hSnap, &pThis->abmGrpDev[0], sizeof(pThis->abmGrpDev));
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotPutData(hSnap, &pThis->abmGrpDevLast[0], sizeof(pThis->abmGrpDevLast));
+
+    return rc;
+}
+
+
+int PSPIrqStateLoad(PSPIRQ hIrq, PSPSNAPSHOT hSnap)
+{
+    PPSPIRQINT pThis = hIrq;
+
+    int rc = PSPEmuSnapshotGetU32(hSnap, &pThis->cGrpPending);
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetData(hSnap, &pThis->abmGrpDev[0], sizeof(pThis->abmGrpDev));
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuSnapshotGetData(hSnap, &pThis->abmGrpDevLast[0], sizeof(pThis->abmGrpDevLast));
+
+    return rc;
+}
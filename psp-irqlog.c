@@ -0,0 +1,287 @@
+/** @file
+ * PSP Emulator - Interrupt line record/replay.
+ */
+
+/*
+ * Copyright (C) 2020 Alexander Eichner <alexander.eichner@campus.tu-berlin.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <common/status.h>
+
+#include <psp-irqlog.h>
+#include <psp-trace.h>
+
+
+/** The interrupt log file magic. */
+#define PSP_IRQLOG_HDR_MAGIC                "PSPIRQL"
+/** The current interrupt log file version. */
+#define PSP_IRQLOG_HDR_VERSION              2
+
+/** The IRQ line is asserted. */
+#define PSP_IRQLOG_EVT_F_IRQ                BIT(0)
+/** The FIQ line is asserted. */
+#define PSP_IRQLOG_EVT_F_FIQ                BIT(1)
+
+
+/**
+ * The interrupt log file header.
+ */
+typedef struct PSPIRQLOGHDR
+{
+    /** Magic identifying the file, PSP_IRQLOG_HDR_MAGIC. */
+    char                            achMagic[8];
+    /** Version of the format, PSP_IRQLOG_HDR_VERSION. */
+    uint32_t                        u32Version;
+    /** Reserved. */
+    uint32_t                        u32Rsvd;
+} PSPIRQLOGHDR;
+
+
+/**
+ * A single interrupt line change as stored in the file.
+ */
+typedef struct PSPIRQLOGEVT
+{
+    /** Number of instructions retired when the change happened. */
+    uint64_t                        cInsns;
+    /** The virtual time in nanoseconds when the change happened. */
+    uint64_t                        tsVirtNs;
+    /** Start address of the last basic block executed, used to detect diverging replays. */
+    uint32_t                        PspAddrBb;
+    /** The new line states, PSP_IRQLOG_EVT_F_XXX. */
+    uint32_t                        fLines;
+} PSPIRQLOGEVT;
+/** Pointer to an interrupt line change. */
+typedef PSPIRQLOGEVT *PPSPIRQLOGEVT;
+/** Pointer to a const interrupt line change. */
+typedef const PSPIRQLOGEVT *PCPSPIRQLOGEVT;
+
+
+/**
+ * The interrupt log instance data.
+ */
+typedef struct PSPIRQLOGINT
+{
+    /** The PSP core handle. */
+    PSPCORE                         hPspCore;
+    /** Flag whether this replays a log. */
+    bool                            fReplay;
+    /** The file being recorded to, NULL when replaying. */
+    FILE                            *pFile;
+    /** Number of events recorded or replayed. */
+    uint64_t                        cEvts;
+    /** Number of replayed events which didn't hit at the recorded location. */
+    uint64_t                        cEvtsDiverged;
+    /** Number of events loaded for replay. */
+    size_t                          cEvtsReplay;
+    /** The events to replay. */
+    PPSPIRQLOGEVT                   paEvtsReplay;
+} PSPIRQLOGINT;
+/** Pointer to the interrupt log instance data. */
+typedef PSPIRQLOGINT *PPSPIRQLOGINT;
+
+
+/**
+ * Interrupt line record callback.
+ */
+static void pspEmuIrqLogRecord(PSPCORE hCore, uint64_t cInsns, uint64_t tsVirtNs, PSPADDR PspAddrBb, bool fIrq, bool fFiq,
+                               void *pvUser)
+{
+    PPSPIRQLOGINT pThis = (PPSPIRQLOGINT)pvUser;
+    PSPIRQLOGEVT Evt;
+
+    (void)hCore;
+
+    Evt.cInsns    = cInsns;
+    Evt.tsVirtNs  = tsVirtNs;
+    Evt.PspAddrBb = PspAddrBb;
+    Evt.fLines    =   (fIrq ? PSP_IRQLOG_EVT_F_IRQ : 0)
+                    | (fFiq ? PSP_IRQLOG_EVT_F_FIQ : 0);
+    if (fwrite(&Evt, sizeof(Evt), 1, pThis->pFile) == 1)
+        pThis->cEvts++;
+    else
+        PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_ERROR, PSPTRACEEVTORIGIN_CORE,
+                                "Writing the interrupt log failed at instruction %llu\n", cInsns);
+}
+
+
+/**
+ * Interrupt line replay callback.
+ */
+static uint64_t pspEmuIrqLogReplay(PSPCORE hCore, uint64_t cInsns, PSPADDR PspAddrBb, uint64_t *ptsVirtNs,
+                                   bool *pfIrq, bool *pfFiq, void *pvUser)
+{
+    PPSPIRQLOGINT pThis = (PPSPIRQLOGINT)pvUser;
+    PCPSPIRQLOGEVT pEvt = &pThis->paEvtsReplay[pThis->cEvts++];
+
+    (void)hCore;
+
+    if (   pEvt->cInsns != cInsns
+        || pEvt->PspAddrBb != PspAddrBb)
+    {
+        pThis->cEvtsDiverged++;
+        PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_WARNING, PSPTRACEEVTORIGIN_CORE,
+                                "Interrupt replay diverged: recorded at %llu/%#x, replayed at %llu/%#x\n",
+                                pEvt->cInsns, pEvt->PspAddrBb, cInsns, PspAddrBb);
+    }
+
+    *ptsVirtNs = pEvt->tsVirtNs;
+    *pfIrq = (pEvt->fLines & PSP_IRQLOG_EVT_F_IRQ) ? true : false;
+    *pfFiq = (pEvt->fLines & PSP_IRQLOG_EVT_F_FIQ) ? true : false;
+
+    return   pThis->cEvts < pThis->cEvtsReplay
+           ? pThis->paEvtsReplay[pThis->cEvts].cInsns
+           : UINT64_MAX;
+}
+
+
+int PSPEmuIrqLogRecordCreate(PPSPIRQLOG phIrqLog, PSPCORE hPspCore, const char *pszFilename)
+{
+    int rc = STS_INF_SUCCESS;
+    PPSPIRQLOGINT pThis = (PPSPIRQLOGINT)calloc(1, sizeof(*pThis));
+
+    if (pThis)
+    {
+        pThis->hPspCore = hPspCore;
+        pThis->fReplay  = false;
+        pThis->pFile    = fopen(pszFilename, "wb");
+        if (pThis->pFile)
+        {
+            PSPIRQLOGHDR Hdr;
+
+            memset(&Hdr, 0, sizeof(Hdr));
+            memcpy(&Hdr.achMagic[0], PSP_IRQLOG_HDR_MAGIC, sizeof(PSP_IRQLOG_HDR_MAGIC));
+            Hdr.u32Version = PSP_IRQLOG_HDR_VERSION;
+            if (fwrite(&Hdr, sizeof(Hdr), 1, pThis->pFile) == 1)
+            {
+                rc = PSPEmuCoreIrqRecordCallbackSet(hPspCore, pspEmuIrqLogRecord, pThis);
+                if (STS_SUCCESS(rc))
+                {
+                    *phIrqLog = pThis;
+                    return STS_INF_SUCCESS;
+                }
+            }
+            else
+                rc = STS_ERR_GENERAL_ERROR;
+
+            fclose(pThis->pFile);
+        }
+        else
+            rc = STS_ERR_NOT_FOUND;
+
+        free(pThis);
+    }
+    else
+        rc = STS_ERR_NO_MEMORY;
+
+    return rc;
+}
+
+
+int PSPEmuIrqLogReplayCreate(PPSPIRQLOG phIrqLog, PSPCORE hPspCore, const char *pszFilename)
+{
+    int rc = STS_INF_SUCCESS;
+    PPSPIRQLOGINT pThis = (PPSPIRQLOGINT)calloc(1, sizeof(*pThis));
+
+    if (!pThis)
+        return STS_ERR_NO_MEMORY;
+
+    pThis->hPspCore = hPspCore;
+    pThis->fReplay  = true;
+
+    FILE *pFile = fopen(pszFilename, "rb");
+    if (pFile)
+    {
+        PSPIRQLOGHDR Hdr;
+
+        if (   fread(&Hdr, sizeof(Hdr), 1, pFile) == 1
+            && !memcmp(&Hdr.achMagic[0], PSP_IRQLOG_HDR_MAGIC, sizeof(PSP_IRQLOG_HDR_MAGIC))
+            && Hdr.u32Version == PSP_IRQLOG_HDR_VERSION)
+        {
+            /* Load all events, the logs are small as only line changes are recorded. */
+            size_t cEvtsAlloc = 0;
+            PSPIRQLOGEVT Evt;
+
+            while (   STS_SUCCESS(rc)
+                   && fread(&Evt, sizeof(Evt), 1, pFile) == 1)
+            {
+                if (pThis->cEvtsReplay == cEvtsAlloc)
+                {
+                    size_t cEvtsAllocNew = cEvtsAlloc ? cEvtsAlloc * 2 : 1024;
+                    PPSPIRQLOGEVT paEvtsNew = (PPSPIRQLOGEVT)realloc(pThis->paEvtsReplay, cEvtsAllocNew * sizeof(*paEvtsNew));
+                    if (!paEvtsNew)
+                    {
+                        rc = STS_ERR_NO_MEMORY;
+                        break;
+                    }
+
+                    pThis->paEvtsReplay = paEvtsNew;
+                    cEvtsAlloc          = cEvtsAllocNew;
+                }
+
+                pThis->paEvtsReplay[pThis->cEvtsReplay++] = Evt;
+            }
+        }
+        else
+            rc = STS_ERR_INVALID_PARAMETER;
+
+        fclose(pFile);
+    }
+    else
+        rc = STS_ERR_NOT_FOUND;
+
+    if (STS_SUCCESS(rc))
+        rc = PSPEmuCoreIrqReplayCallbackSet(hPspCore, pspEmuIrqLogReplay, pThis,
+                                              pThis->cEvtsReplay
+                                            ? pThis->paEvtsReplay[0].cInsns
+                                            : UINT64_MAX);
+    if (STS_SUCCESS(rc))
+    {
+        *phIrqLog = pThis;
+        return STS_INF_SUCCESS;
+    }
+
+    if (pThis->paEvtsReplay)
+        free(pThis->paEvtsReplay);
+    free(pThis);
+    return rc;
+}
+
+
+void PSPEmuIrqLogDestroy(PSPIRQLOG hIrqLog)
+{
+    PPSPIRQLOGINT pThis = hIrqLog;
+
+    if (pThis->fReplay)
+    {
+        PSPEmuCoreIrqReplayCallbackSet(pThis->hPspCore, NULL, NULL, UINT64_MAX);
+        printf("Replayed %llu of %llu interrupt line changes, %llu diverged from the recording\n",
+               pThis->cEvts, (uint64_t)pThis->cEvtsReplay, pThis->cEvtsDiverged);
+        free(pThis->paEvtsReplay);
+    }
+    else
+    {
+        PSPEmuCoreIrqRecordCallbackSet(pThis->hPspCore, NULL, NULL);
+        printf("Recorded %llu interrupt line changes\n", pThis->cEvts);
+        fclose(pThis->pFile);
+    }
+
+    free(pThis);
+}
+
@@ -0,0 +1,108 @@
+/** @file
+ * PSP Emulator - Instruction trace decode tool.
+ */
+
+/*
+ * Copyright (C) 2020 Alexander Eichner <alexander.eichner@campus.tu-berlin.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/cdefs.h>
+#include <common/status.h>
+
+#include <psp-disasm.h>
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+
+/**
+ * Available options for the instruction trace tool.
+ */
+static struct option g_aOptions[] =
+{
+    {"itrace-input",                 required_argument, 0, 'i'},
+    {"output",                       required_argument, 0, 'o'},
+
+    {"help",                         no_argument,       0, 'H'},
+    {0, 0, 0, 0}
+};
+
+
+int main(int argc, char *argv[])
+{
+    int ch = 0;
+    int idxOption = 0;
+    const char *pszFilename = NULL;
+    const char *pszOutput = NULL;
+
+    while ((ch = getopt_long (argc, argv, "Hi:o:", &g_aOptions[0], &idxOption)) != -1)
+    {
+        switch (ch)
+        {
+            case 'h':
+            case 'H':
+                printf("%s: Instruction trace decode tool\n"
+                       "    --itrace-input <path/to/insn/trace>\n"
+                       "    --output <path/to/output> (defaults to stdout)\n",
+                       argv[0]);
+                return 0;
+            case 'i':
+                pszFilename = optarg;
+                break;
+            case 'o':
+                pszOutput = optarg;
+                break;
+
+            default:
+                fprintf(stderr, "Unrecognised option: -%c\n", optopt);
+                return 1;
+        }
+    }
+
+    if (!pszFilename)
+    {
+        fprintf(stderr, "A filepath to the instruction trace is required!\n");
+        return 1;
+    }
+
+    FILE *pOut = stdout;
+    if (pszOutput)
+    {
+        pOut = fopen(pszOutput, "w");
+        if (!pOut)
+        {
+            fprintf(stderr, "The output file '%s' could not be created\n", pszOutput);
+            return 1;
+        }
+    }
+
+    int rc = PSPEmuDisasmITraceDecode(pszFilename, pOut);
+    if (STS_FAILURE(rc))
+        fprintf(stderr, "Decoding the instruction trace '%s' failed with %d\n", pszFilename, rc);
+
+    if (pOut != stdout)
+        fclose(pOut);
+
+    return STS_SUCCESS(rc) ? 0 : 1;
+}
+
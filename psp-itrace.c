@@ -0,0 +1,350 @@
+/** @file
+ * PSP Emulator - Compact binary instruction trace writer.
+ */
+
+/*
+ * Copyright (C) 2020 Alexander Eichner <alexander.eichner@campus.tu-berlin.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <common/status.h>
+
+#include <psp-itrace.h>
+
+
+/** Size of the write buffer in bytes. */
+#define PSP_ITRACE_BUF_SZ                   _64K
+/** Number of entries in the code cache (must be a power of two). */
+#define PSP_ITRACE_CODE_CACHE_ENTRIES       4096
+/** Maximum number of code bytes recorded for a single basic block. */
+#define PSP_ITRACE_CODE_MAX                 _4K
+
+
+/**
+ * A code cache entry, remembering which basic blocks had their code written already.
+ */
+typedef struct PSPITRACECODEENTRY
+{
+    /** Start address of the basic block. */
+    PSPADDR                         PspAddr;
+    /** Physical start address of the basic block. */
+    PSPPADDR                        PspPAddr;
+    /** Size of the basic block, 0 if the entry is free. */
+    uint32_t                        cbBb;
+    /** Size of the code copy buffer in bytes. */
+    uint32_t                        cbCodeMax;
+    /** Copy of the code bytes written for the basic block, to detect modified code. */
+    uint8_t                         *pbCode;
+} PSPITRACECODEENTRY;
+/** Pointer to a code cache entry. */
+typedef PSPITRACECODEENTRY *PPSPITRACECODEENTRY;
+
+
+/**
+ * The instruction trace writer instance data.
+ */
+typedef struct PSPITRACEINT
+{
+    /** Pointer to the PSP core. */
+    PSPCORE                         hPspCore;
+    /** The core trace point handle. */
+    PSPCORETP                       hCoreTp;
+    /** The file being written to. */
+    FILE                            *pFile;
+    /** First error encountered while writing, the trace callback can't return errors. */
+    int                             rcWr;
+    /** Number of basic blocks recorded. */
+    uint64_t                        cBbs;
+    /** Number of code records written. */
+    uint64_t                        cCodeRecs;
+    /** Flag whether the register state below is valid (false until the first basic block was recorded). */
+    bool                            fRegsValid;
+    /** Register values as of the last basic block record. */
+    uint32_t                        au32Regs[PSP_ITRACE_REGS];
+    /** The code cache. */
+    PSPITRACECODEENTRY              aCodeCache[PSP_ITRACE_CODE_CACHE_ENTRIES];
+    /** Number of bytes used in the write buffer. */
+    size_t                          offBuf;
+    /** The write buffer. */
+    uint8_t                         abBuf[PSP_ITRACE_BUF_SZ];
+} PSPITRACEINT;
+/** Pointer to the instruction trace writer instance data. */
+typedef PSPITRACEINT *PPSPITRACEINT;
+
+
+/**
+ * The registers queried for every basic block, in the order of the register delta bitmap.
+ */
+static const PSPCOREREG g_aenmITraceRegs[PSP_ITRACE_REGS] =
+{
+    PSPCOREREG_R0,
+    PSPCOREREG_R1,
+    PSPCOREREG_R2,
+    PSPCOREREG_R3,
+    PSPCOREREG_R4,
+    PSPCOREREG_R5,
+    PSPCOREREG_R6,
+    PSPCOREREG_R7,
+    PSPCOREREG_R8,
+    PSPCOREREG_R9,
+    PSPCOREREG_R10,
+    PSPCOREREG_R11,
+    PSPCOREREG_R12,
+    PSPCOREREG_SP,
+    PSPCOREREG_LR,
+    PSPCOREREG_CPSR
+};
+
+
+/**
+ * Flushes the write buffer to the file.
+ *
+ * @returns Status code.
+ * @param   pThis                   The instruction trace writer instance.
+ */
+static int pspEmuITraceFlush(PPSPITRACEINT pThis)
+{
+    if (   pThis->offBuf
+        && STS_SUCCESS(pThis->rcWr))
+    {
+        size_t cWritten = fwrite(&pThis->abBuf[0], pThis->offBuf, 1, pThis->pFile);
+        if (cWritten != 1)
+            pThis->rcWr = STS_ERR_GENERAL_ERROR;
+    }
+
+    pThis->offBuf = 0;
+    return pThis->rcWr;
+}
+
+
+/**
+ * Makes sure there is room for the given amount of bytes in the write buffer, flushing it if required.
+ *
+ * @returns Pointer to the start of the free space in the write buffer.
+ * @param   pThis                   The instruction trace writer instance.
+ * @param   cbRec                   Number of bytes required, must not exceed the buffer size.
+ */
+static inline uint8_t *pspEmuITraceBufReserve(PPSPITRACEINT pThis, size_t cbRec)
+{
+    if (pThis->offBuf + cbRec > sizeof(pThis->abBuf))
+        pspEmuITraceFlush(pThis);
+
+    return &pThis->abBuf[pThis->offBuf];
+}
+
+
+/**
+ * Writes a code record for the given basic block if it wasn't recorded already.
+ *
+ * @returns nothing.
+ * @param   pThis                   The instruction trace writer instance.
+ * @param   PspAddr                 Start address of the basic block.
+ * @param   cbBb                    Size of the basic block in bytes.
+ *
+ * @note The cache is keyed by the physical address as well because the same virtual address can
+ *       map to different code. The code is read for every basic block and compared against the
+ *       copy in the cache so any modification, by the guest or the host, gets recorded again.
+ */
+static void pspEmuITraceCodeRecord(PPSPITRACEINT pThis, PSPADDR PspAddr, uint32_t cbBb)
+{
+    PSPPADDR PspPAddr = 0;
+    int rc = PSPEmuCoreQueryPAddrFromVAddr(pThis->hPspCore, PspAddr, &PspPAddr, NULL /*penmPgTblWalk*/);
+    if (STS_FAILURE(rc))
+        return; /* The decoder reports the code as missing. */
+
+    uint32_t cbCode = MIN(cbBb, PSP_ITRACE_CODE_MAX);
+    uint8_t *pbRec = pspEmuITraceBufReserve(pThis, sizeof(PSPITRACERECCODE) + cbCode);
+    PPSPITRACERECCODE pRec = (PPSPITRACERECCODE)pbRec;
+    uint8_t *pbCode = pbRec + sizeof(*pRec);
+
+    rc = PSPEmuCoreMemReadVirt(pThis->hPspCore, PspAddr, pbCode, cbCode);
+    if (STS_FAILURE(rc))
+        return; /* The decoder reports the code as missing. */
+
+    /* Instructions are at least two bytes apart (Thumb), so drop the lowest bit for the index. */
+    PPSPITRACECODEENTRY pEntry = &pThis->aCodeCache[(PspAddr >> 1) & (PSP_ITRACE_CODE_CACHE_ENTRIES - 1)];
+    if (   pEntry->cbBb == cbBb
+        && pEntry->PspAddr == PspAddr
+        && pEntry->PspPAddr == PspPAddr
+        && !memcmp(pEntry->pbCode, pbCode, cbCode))
+        return;
+
+    pRec->bType   = PSP_ITRACE_REC_TYPE_CODE;
+    pRec->PspAddr = PspAddr;
+    pRec->cbCode  = (uint16_t)cbCode;
+    pThis->offBuf += sizeof(*pRec) + cbCode;
+    pThis->cCodeRecs++;
+
+    /* Replace the entry, failing to remember the code only means it gets written again. */
+    if (cbCode > pEntry->cbCodeMax)
+    {
+        uint8_t *pbCodeNew = (uint8_t *)realloc(pEntry->pbCode, cbCode);
+        if (!pbCodeNew)
+        {
+            pEntry->cbBb = 0;
+            return;
+        }
+
+        pEntry->pbCode    = pbCodeNew;
+        pEntry->cbCodeMax = cbCode;
+    }
+
+    memcpy(pEntry->pbCode, pbCode, cbCode);
+    pEntry->PspAddr  = PspAddr;
+    pEntry->PspPAddr = PspPAddr;
+    pEntry->cbBb     = cbBb;
+}
+
+
+/**
+ * The PSP core tracing callback.
+ *
+ * @returns nothing.
+ * @param   hCore                   The PSP core handle causing the call.
+ * @param   hTp                     The trace point handle triggering.
+ * @param   fTpFlags                Flag indicating the access triggering the tracepoint, see PSPEMU_CORE_TRACE_F_XXX.
+ * @param   PspAddr                 The PSP address.
+ * @param   cbBb                    Size of the basic block.
+ * @param   pvVal                   Pointer to the value being written for write memory trace hooks, undefined otherwise.
+ * @param   pvUser                  Opaque user data passed during registration.
+ */
+static void pspEmuITraceBbTrace(PSPCORE hCore, PSPCORETP hTp, uint32_t fTpFlags, PSPADDR PspAddr, uint32_t cbBb, const void *pvVal, void *pvUser)
+{
+    PPSPITRACEINT pThis = (PPSPITRACEINT)pvUser;
+    uint32_t au32Regs[PSP_ITRACE_REGS];
+
+    (void)hTp;
+    (void)fTpFlags;
+    (void)pvVal;
+
+    if (STS_FAILURE(pThis->rcWr))
+        return;
+
+    pspEmuITraceCodeRecord(pThis, PspAddr, cbBb);
+
+    int rc = PSPEmuCoreQueryRegBatch(hCore, &g_aenmITraceRegs[0], ELEMENTS(g_aenmITraceRegs), &au32Regs[0]);
+    if (STS_FAILURE(rc))
+    {
+        pThis->rcWr = rc;
+        return;
+    }
+
+    uint8_t *pbRec = pspEmuITraceBufReserve(pThis, sizeof(PSPITRACERECBB) + sizeof(au32Regs));
+    PPSPITRACERECBB pRec = (PPSPITRACERECBB)pbRec;
+    uint8_t *pbVal = pbRec + sizeof(*pRec);
+    uint16_t bmRegsChanged = 0;
+
+    for (uint32_t i = 0; i < ELEMENTS(au32Regs); i++)
+    {
+        if (   !pThis->fRegsValid
+            || au32Regs[i] != pThis->au32Regs[i])
+        {
+            memcpy(pbVal, &au32Regs[i], sizeof(uint32_t));
+            pbVal += sizeof(uint32_t);
+            bmRegsChanged |= BIT(i);
+            pThis->au32Regs[i] = au32Regs[i];
+        }
+    }
+
+    pRec->bType         = PSP_ITRACE_REC_TYPE_BB;
+    pRec->PspAddr       = PspAddr;
+    pRec->cbBb          = (uint16_t)MIN(cbBb, UINT16_MAX);
+    pRec->bmRegsChanged = bmRegsChanged;
+    pThis->offBuf      += pbVal - pbRec;
+    pThis->fRegsValid   = true;
+    pThis->cBbs++;
+}
+
+
+int PSPEmuITraceCreate(PPSPITRACE phITrace, PSPCORE hPspCore, const char *pszFilename)
+{
+    int rc = STS_INF_SUCCESS;
+    PPSPITRACEINT pThis = (PPSPITRACEINT)calloc(1, sizeof(*pThis));
+
+    if (pThis)
+    {
+        pThis->hPspCore   = hPspCore;
+        pThis->rcWr       = STS_INF_SUCCESS;
+        pThis->fRegsValid = false;
+        pThis->offBuf     = 0;
+
+        pThis->pFile = fopen(pszFilename, "wb");
+        if (pThis->pFile)
+        {
+            PSPITRACEHDR Hdr;
+
+            memset(&Hdr, 0, sizeof(Hdr));
+            memcpy(&Hdr.achMagic[0], PSP_ITRACE_HDR_MAGIC, sizeof(PSP_ITRACE_HDR_MAGIC));
+            Hdr.u32Version = PSP_ITRACE_HDR_VERSION;
+            Hdr.cRegs      = PSP_ITRACE_REGS;
+            size_t cWritten = fwrite(&Hdr, sizeof(Hdr), 1, pThis->pFile);
+            if (cWritten == 1)
+            {
+                rc = PSPEmuCoreTraceRegister(hPspCore, 0 /*PspAddrBegin*/, 0xffffffff /*PspAddrEnd*/,
+                                             PSPEMU_CORE_TRACE_F_EXEC | PSPEMU_CORE_TRACE_F_EXEC_BASIC_BLOCK,
+                                             ARMASID_ANY, pspEmuITraceBbTrace, pThis, &pThis->hCoreTp);
+                if (STS_SUCCESS(rc))
+                {
+                    *phITrace = pThis;
+                    return STS_INF_SUCCESS;
+                }
+            }
+            else
+                rc = STS_ERR_GENERAL_ERROR;
+
+            fclose(pThis->pFile);
+        }
+        else
+            rc = STS_ERR_NOT_FOUND;
+
+        free(pThis);
+    }
+    else
+        rc = STS_ERR_NO_MEMORY;
+
+    return rc;
+}
+
+
+void PSPEmuITraceDestroy(PSPITRACE hITrace)
+{
+    PPSPITRACEINT pThis = hITrace;
+
+    PSPEmuCoreTraceDeregister(pThis->hCoreTp);
+    int rc = pspEmuITraceFlush(pThis);
+    if (STS_FAILURE(rc))
+        fprintf(stderr, "Writing the instruction trace failed with %d\n", rc);
+
+    for (uint32_t i = 0; i < ELEMENTS(pThis->aCodeCache); i++)
+    {
+        if (pThis->aCodeCache[i].pbCode)
+            free(pThis->aCodeCache[i].pbCode);
+    }
+
+    fclose(pThis->pFile);
+    free(pThis);
+}
+
+
+uint64_t PSPEmuITraceQueryBbCount(PSPITRACE hITrace)
+{
+    PPSPITRACEINT pThis = hITrace;
+
+    return pThis->cBbs;
+}
+
@@ -0,0 +1,552 @@
+/** @file
+ * PSP Emulator - PC sampling profiler.
+ */
+
+/*
+ * Copyright (C) 2020 Alexander Eichner <alexander.eichner@campus.tu-berlin.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <common/status.h>
+
+#include <psp-prof.h>
+
+
+/** Number of hash buckets for the aggregated stacks (must be a power of two). */
+#define PSP_PROF_STACK_BUCKETS              4096
+
+
+/**
+ * An aggregated stack.
+ */
+typedef struct PSPPROFSTACK
+{
+    /** Next stack in the bucket. */
+    struct PSPPROFSTACK             *pNext;
+    /** Hash of the stack. */
+    uint32_t                        uHash;
+    /** The ASID the stack was sampled in. */
+    ARMASID                         idAsid;
+    /** Number of samples hitting this stack. */
+    uint64_t                        cSamples;
+    /** Number of frames. */
+    uint32_t                        cFrames;
+    /** Flag whether the second frame is the LR which is only a caller if it lies outside the function of the PC. */
+    bool                            fLrCheck;
+    /** The frames, innermost (the PC) first - variable in size. */
+    PSPADDR                         aFrames[1];
+} PSPPROFSTACK;
+/** Pointer to an aggregated stack. */
+typedef PSPPROFSTACK *PPSPPROFSTACK;
+/** Pointer to a const aggregated stack. */
+typedef const PSPPROFSTACK *PCPSPPROFSTACK;
+
+
+/**
+ * A symbol from the symbol map.
+ */
+typedef struct PSPPROFSYM
+{
+    /** Start address of the symbol. */
+    PSPADDR                         PspAddr;
+    /** The symbol name. */
+    char                            *pszName;
+} PSPPROFSYM;
+/** Pointer to a symbol. */
+typedef PSPPROFSYM *PPSPPROFSYM;
+/** Pointer to a const symbol. */
+typedef const PSPPROFSYM *PCPSPPROFSYM;
+
+
+/**
+ * A symbol map sorted by address.
+ */
+typedef struct PSPPROFSYMMAP
+{
+    /** Number of symbols in the map. */
+    uint32_t                        cSyms;
+    /** Number of symbols allocated. */
+    uint32_t                        cSymsAlloc;
+    /** The symbols. */
+    PPSPPROFSYM                     paSyms;
+} PSPPROFSYMMAP;
+/** Pointer to a symbol map. */
+typedef PSPPROFSYMMAP *PPSPPROFSYMMAP;
+/** Pointer to a const symbol map. */
+typedef const PSPPROFSYMMAP *PCPSPPROFSYMMAP;
+
+
+/**
+ * The profiler instance data.
+ */
+typedef struct PSPPROFINT
+{
+    /** Pointer to the PSP core. */
+    PSPCORE                         hPspCore;
+    /** The core trace point handle. */
+    PSPCORETP                       hCoreTp;
+    /** Number of instructions between two samples. */
+    uint64_t                        cInsnsInterval;
+    /** Instruction count when the next sample is due. */
+    uint64_t                        cInsnsSampleNext;
+    /** Maximum number of frames to record per sample. */
+    uint32_t                        cFramesMax;
+    /** Number of samples taken. */
+    uint64_t                        cSamples;
+    /** Number of distinct stacks recorded. */
+    uint32_t                        cStacks;
+    /** Stack hash buckets. */
+    PPSPPROFSTACK                   apStacks[PSP_PROF_STACK_BUCKETS];
+} PSPPROFINT;
+/** Pointer to the profiler instance data. */
+typedef PSPPROFINT *PPSPPROFINT;
+
+
+/**
+ * Unwinds the stack of the core for a sample.
+ *
+ * @returns Number of frames recorded.
+ * @param   pThis                   The profiler instance.
+ * @param   PspAddrPc               The PC being sampled.
+ * @param   paFrames                Where to store the frames, innermost first.
+ * @param   pfLrCheck               Where to store whether the LR recorded as the second frame must be checked
+ *                                  against the function of the PC before it can be taken as the caller.
+ *
+ * @note This follows the frame layout GCC emits when frame pointers are used: in ARM mode R11 points to
+ *       the saved LR with the caller's R11 below it, in Thumb mode R7 points to the saved R7 with the
+ *       saved LR above it. Code built without frame pointers simply ends the stack early.
+ */
+static uint32_t pspEmuProfUnwind(PPSPPROFINT pThis, PSPADDR PspAddrPc, PSPADDR *paFrames, bool *pfLrCheck)
+{
+    static const PSPCOREREG s_aenmRegs[] = { PSPCOREREG_LR, PSPCOREREG_R7, PSPCOREREG_R11, PSPCOREREG_CPSR };
+    uint32_t au32Regs[ELEMENTS(s_aenmRegs)];
+    uint32_t cFrames = 0;
+
+    *pfLrCheck = false;
+    paFrames[cFrames++] = PspAddrPc;
+    if (   pThis->cFramesMax < 2
+        || STS_FAILURE(PSPEmuCoreQueryRegBatch(pThis->hPspCore, &s_aenmRegs[0], ELEMENTS(s_aenmRegs), &au32Regs[0])))
+        return cFrames;
+
+    /*
+     * The LR is the caller only in leaf functions (or before the first call), once a function called something
+     * it points back into the function itself. It is recorded here and decided on below and when dumping.
+     */
+    paFrames[cFrames++] = au32Regs[0] & ~(uint32_t)1;
+
+    bool fThumb = (au32Regs[3] & BIT(5)) ? true : false;
+    PSPADDR PspAddrFp = fThumb ? au32Regs[1] : au32Regs[2];
+    while (   cFrames < pThis->cFramesMax
+           && PspAddrFp
+           && !(PspAddrFp & 0x3))
+    {
+        uint32_t au32Frame[2];
+        PSPADDR PspAddrFrame = fThumb ? PspAddrFp : PspAddrFp - sizeof(uint32_t);
+
+        if (STS_FAILURE(PSPEmuCoreMemReadVirt(pThis->hPspCore, PspAddrFrame, &au32Frame[0], sizeof(au32Frame))))
+            break;
+
+        /* au32Frame[0] is the caller's frame pointer and au32Frame[1] the return address in both layouts. */
+        PSPADDR PspAddrRet = au32Frame[1] & ~(uint32_t)1;
+        if (!PspAddrRet)
+            break;
+
+        /*
+         * Skip the return address if it matches the LR recorded above (the function didn't call anything yet),
+         * otherwise the frame chain yields a caller and the LR is only one if it lies outside the current function.
+         */
+        if (   cFrames != 2
+            || paFrames[1] != PspAddrRet)
+        {
+            if (cFrames == 2)
+                *pfLrCheck = true;
+            paFrames[cFrames++] = PspAddrRet;
+        }
+
+        /* Stacks grow downwards, anything else is garbage. */
+        if (au32Frame[0] <= PspAddrFp)
+            break;
+        PspAddrFp = au32Frame[0];
+    }
+
+    return cFrames;
+}
+
+
+/**
+ * Records a sample for the given stack.
+ *
+ * @returns nothing.
+ * @param   pThis                   The profiler instance.
+ * @param   idAsid                  The ASID the sample was taken in.
+ * @param   paFrames                The frames, innermost first.
+ * @param   cFrames                 Number of frames.
+ * @param   fLrCheck                Flag whether the second frame is the LR which needs to be checked when dumping.
+ */
+static void pspEmuProfStackRecord(PPSPPROFINT pThis, ARMASID idAsid, const PSPADDR *paFrames, uint32_t cFrames,
+                                  bool fLrCheck)
+{
+    /* FNV-1a over the ASID, the LR check flag and the frames. */
+    uint32_t uHash = 2166136261U ^ idAsid;
+    uHash *= 16777619U;
+    uHash ^= fLrCheck ? 1 : 0;
+    uHash *= 16777619U;
+    for (uint32_t i = 0; i < cFrames; i++)
+    {
+        uHash ^= paFrames[i];
+        uHash *= 16777619U;
+    }
+
+    PPSPPROFSTACK *ppStack = &pThis->apStacks[uHash & (PSP_PROF_STACK_BUCKETS - 1)];
+    PPSPPROFSTACK pStack = *ppStack;
+    while (pStack)
+    {
+        if (   pStack->uHash == uHash
+            && pStack->idAsid == idAsid
+            && pStack->cFrames == cFrames
+            && pStack->fLrCheck == fLrCheck
+            && !memcmp(&pStack->aFrames[0], paFrames, cFrames * sizeof(PSPADDR)))
+        {
+            pStack->cSamples++;
+            return;
+        }
+
+        pStack = pStack->pNext;
+    }
+
+    pStack = (PPSPPROFSTACK)malloc(sizeof(*pStack) + cFrames * sizeof(PSPADDR));
+    if (pStack)
+    {
+        pStack->uHash    = uHash;
+        pStack->idAsid   = idAsid;
+        pStack->cSamples = 1;
+        pStack->cFrames  = cFrames;
+        pStack->fLrCheck = fLrCheck;
+        memcpy(&pStack->aFrames[0], paFrames, cFrames * sizeof(PSPADDR));
+        pStack->pNext    = *ppStack;
+        *ppStack = pStack;
+        pThis->cStacks++;
+    }
+    /* else: The sample is lost. */
+}
+
+
+/**
+ * The PSP core tracing callback.
+ *
+ * @returns nothing.
+ * @param   hCore                   The PSP core handle causing the call.
+ * @param   hTp                     The trace point handle triggering.
+ * @param   fTpFlags                Flag indicating the access triggering the tracepoint, see PSPEMU_CORE_TRACE_F_XXX.
+ * @param   PspAddr                 The PSP address.
+ * @param   cbBb                    Size of the basic block.
+ * @param   pvVal                   Pointer to the value being written for write memory trace hooks, undefined otherwise.
+ * @param   pvUser                  Opaque user data passed during registration.
+ */
+static void pspEmuProfBbTrace(PSPCORE hCore, PSPCORETP hTp, uint32_t fTpFlags, PSPADDR PspAddr, uint32_t cbBb, const void *pvVal, void *pvUser)
+{
+    PPSPPROFINT pThis = (PPSPPROFINT)pvUser;
+
+    (void)hTp;
+    (void)fTpFlags;
+    (void)cbBb;
+    (void)pvVal;
+
+    uint64_t cInsnsRetired = PSPEmuCoreQueryInsnsRetired(hCore);
+    if (cInsnsRetired < pThis->cInsnsSampleNext)
+        return;
+
+    PSPADDR aFrames[PSP_PROF_FRAMES_MAX];
+    bool fLrCheck = false;
+    uint32_t cFrames = pspEmuProfUnwind(pThis, PspAddr, &aFrames[0], &fLrCheck);
+
+    pspEmuProfStackRecord(pThis, PSPEmuCoreQueryAsid(hCore), &aFrames[0], cFrames, fLrCheck);
+    pThis->cSamples++;
+    pThis->cInsnsSampleNext = cInsnsRetired + pThis->cInsnsInterval;
+}
+
+
+/**
+ * Symbol map sort callback.
+ */
+static int pspEmuProfSymCmp(const void *pv1, const void *pv2)
+{
+    PCPSPPROFSYM pSym1 = (PCPSPPROFSYM)pv1;
+    PCPSPPROFSYM pSym2 = (PCPSPPROFSYM)pv2;
+
+    if (pSym1->PspAddr < pSym2->PspAddr)
+        return -1;
+    if (pSym1->PspAddr > pSym2->PspAddr)
+        return 1;
+    return 0;
+}
+
+
+/**
+ * Frees all resources of the given symbol map.
+ *
+ * @returns nothing.
+ * @param   pSymMap                 The symbol map to free.
+ */
+static void pspEmuProfSymMapFree(PPSPPROFSYMMAP pSymMap)
+{
+    for (uint32_t i = 0; i < pSymMap->cSyms; i++)
+        free(pSymMap->paSyms[i].pszName);
+
+    if (pSymMap->paSyms)
+        free(pSymMap->paSyms);
+
+    pSymMap->cSyms      = 0;
+    pSymMap->cSymsAlloc = 0;
+    pSymMap->paSyms     = NULL;
+}
+
+
+/**
+ * Loads the given symbol map.
+ *
+ * @returns Status code.
+ * @param   pSymMap                 The symbol map to load into.
+ * @param   pszSymMap               The symbol map file to load.
+ */
+static int pspEmuProfSymMapLoad(PPSPPROFSYMMAP pSymMap, const char *pszSymMap)
+{
+    int rc = STS_INF_SUCCESS;
+    char szLine[512];
+
+    FILE *pFile = fopen(pszSymMap, "r");
+    if (!pFile)
+        return STS_ERR_NOT_FOUND;
+
+    while (   STS_SUCCESS(rc)
+           && fgets(&szLine[0], sizeof(szLine), pFile))
+    {
+        unsigned long long uAddr = 0;
+        char *pszEnd = NULL;
+
+        /* Strip the trailing whitespace and take the last token as the symbol name. */
+        size_t cch = strlen(&szLine[0]);
+        while (   cch
+               && (szLine[cch - 1] == '\n' || szLine[cch - 1] == '\r' || szLine[cch - 1] == ' ' || szLine[cch - 1] == '\t'))
+            szLine[--cch] = '\0';
+
+        uAddr = strtoull(&szLine[0], &pszEnd, 16);
+        if (   pszEnd == &szLine[0]
+            || (*pszEnd != ' ' && *pszEnd != '\t'))
+            continue; /* Skip empty or malformed lines. */
+
+        const char *pszName = strrchr(pszEnd, ' ');
+        const char *pszTab  = strrchr(pszEnd, '\t');
+        if (!pszName || (pszTab && pszTab > pszName))
+            pszName = pszTab;
+        pszName++;
+        if (!*pszName)
+            continue;
+
+        if (pSymMap->cSyms == pSymMap->cSymsAlloc)
+        {
+            uint32_t cSymsAllocNew = pSymMap->cSymsAlloc ? pSymMap->cSymsAlloc * 2 : 256;
+            PPSPPROFSYM paSymsNew = (PPSPPROFSYM)realloc(pSymMap->paSyms, cSymsAllocNew * sizeof(*paSymsNew));
+            if (!paSymsNew)
+            {
+                rc = STS_ERR_NO_MEMORY;
+                break;
+            }
+
+            pSymMap->paSyms     = paSymsNew;
+            pSymMap->cSymsAlloc = cSymsAllocNew;
+        }
+
+        PPSPPROFSYM pSym = &pSymMap->paSyms[pSymMap->cSyms];
+        pSym->PspAddr = (PSPADDR)uAddr & ~(PSPADDR)1; /* Thumb function symbols have the lowest bit set. */
+        pSym->pszName = strdup(pszName);
+        if (pSym->pszName)
+            pSymMap->cSyms++;
+        else
+            rc = STS_ERR_NO_MEMORY;
+    }
+
+    fclose(pFile);
+
+    if (STS_SUCCESS(rc))
+        qsort(pSymMap->paSyms, pSymMap->cSyms, sizeof(*pSymMap->paSyms), pspEmuProfSymCmp);
+    else
+        pspEmuProfSymMapFree(pSymMap);
+
+    return rc;
+}
+
+
+/**
+ * Looks up the symbol covering the given address.
+ *
+ * @returns Pointer to the symbol or NULL if no symbol starts at or below the address.
+ * @param   pSymMap                 The symbol map.
+ * @param   PspAddr                 The address to look up.
+ */
+static PCPSPPROFSYM pspEmuProfSymMapLookup(PCPSPPROFSYMMAP pSymMap, PSPADDR PspAddr)
+{
+    uint32_t idxLow = 0;
+    uint32_t idxHigh = pSymMap->cSyms;
+
+    /* Find the first symbol starting above the address, the one before covers it. */
+    while (idxLow < idxHigh)
+    {
+        uint32_t idxMid = idxLow + (idxHigh - idxLow) / 2;
+        if (pSymMap->paSyms[idxMid].PspAddr <= PspAddr)
+            idxLow = idxMid + 1;
+        else
+            idxHigh = idxMid;
+    }
+
+    return idxLow ? &pSymMap->paSyms[idxLow - 1] : NULL;
+}
+
+
+int PSPEmuProfCreate(PPSPPROF phProf, PSPCORE hPspCore, uint64_t cInsnsInterval, uint32_t cFramesMax)
+{
+    int rc = STS_INF_SUCCESS;
+    PPSPPROFINT pThis = (PPSPPROFINT)calloc(1, sizeof(*pThis));
+
+    if (pThis)
+    {
+        pThis->hPspCore         = hPspCore;
+        pThis->cInsnsInterval   = cInsnsInterval ? cInsnsInterval : 1;
+        pThis->cInsnsSampleNext = PSPEmuCoreQueryInsnsRetired(hPspCore) + pThis->cInsnsInterval;
+        pThis->cFramesMax       = cFramesMax ? MIN(cFramesMax, PSP_PROF_FRAMES_MAX) : 1;
+        pThis->cSamples         = 0;
+        pThis->cStacks          = 0;
+
+        rc = PSPEmuCoreTraceRegister(hPspCore, 0 /*PspAddrBegin*/, 0xffffffff /*PspAddrEnd*/,
+                                     PSPEMU_CORE_TRACE_F_EXEC | PSPEMU_CORE_TRACE_F_EXEC_BASIC_BLOCK,
+                                     ARMASID_ANY, pspEmuProfBbTrace, pThis, &pThis->hCoreTp);
+        if (STS_SUCCESS(rc))
+        {
+            *phProf = pThis;
+            return STS_INF_SUCCESS;
+        }
+
+        free(pThis);
+    }
+    else
+        rc = STS_ERR_NO_MEMORY;
+
+    return rc;
+}
+
+
+void PSPEmuProfDestroy(PSPPROF hProf)
+{
+    PPSPPROFINT pThis = hProf;
+
+    PSPEmuCoreTraceDeregister(pThis->hCoreTp);
+
+    for (uint32_t i = 0; i < ELEMENTS(pThis->apStacks); i++)
+    {
+        PPSPPROFSTACK pStack = pThis->apStacks[i];
+        while (pStack)
+        {
+            PPSPPROFSTACK pFree = pStack;
+            pStack = pStack->pNext;
+            free(pFree);
+        }
+    }
+
+    free(pThis);
+}
+
+
+int PSPEmuProfDumpFolded(PSPPROF hProf, const char *pszFilename, const char *pszSymMap)
+{
+    PPSPPROFINT pThis = hProf;
+    PSPPROFSYMMAP SymMap;
+    int rc = STS_INF_SUCCESS;
+
+    SymMap.cSyms      = 0;
+    SymMap.cSymsAlloc = 0;
+    SymMap.paSyms     = NULL;
+    if (pszSymMap)
+    {
+        rc = pspEmuProfSymMapLoad(&SymMap, pszSymMap);
+        if (STS_FAILURE(rc))
+            return rc;
+    }
+
+    FILE *pFile = fopen(pszFilename, "w");
+    if (pFile)
+    {
+        for (uint32_t i = 0; i < ELEMENTS(pThis->apStacks); i++)
+        {
+            PCPSPPROFSTACK pStack = pThis->apStacks[i];
+            while (pStack)
+            {
+                /*
+                 * The frame chain yielded a caller already, so the LR only adds a frame if it resolves to a
+                 * different function than the PC, otherwise it points back into the sampled function.
+                 */
+                bool fLrSkip = false;
+                if (pStack->fLrCheck)
+                {
+                    PCPSPPROFSYM pSymPc = pspEmuProfSymMapLookup(&SymMap, pStack->aFrames[0]);
+                    PCPSPPROFSYM pSymLr = pspEmuProfSymMapLookup(&SymMap, pStack->aFrames[1]);
+                    fLrSkip =    !pSymPc
+                              || !pSymLr
+                              || pSymPc == pSymLr;
+                }
+
+                /* Folded stacks go from the outermost frame to the innermost one. */
+                fprintf(pFile, "asid_%#x", pStack->idAsid);
+                for (uint32_t idxFrame = pStack->cFrames; idxFrame > 0; idxFrame--)
+                {
+                    if (   idxFrame == 2
+                        && fLrSkip)
+                        continue;
+
+                    PSPADDR PspAddr = pStack->aFrames[idxFrame - 1];
+                    PCPSPPROFSYM pSym = pspEmuProfSymMapLookup(&SymMap, PspAddr);
+
+                    if (pSym)
+                        fprintf(pFile, ";%s", pSym->pszName);
+                    else
+                        fprintf(pFile, ";%#010x", PspAddr);
+                }
+                fprintf(pFile, " %llu\n", pStack->cSamples);
+
+                pStack = pStack->pNext;
+            }
+        }
+
+        if (ferror(pFile))
+            rc = STS_ERR_GENERAL_ERROR;
+        fclose(pFile);
+    }
+    else
+        rc = STS_ERR_NOT_FOUND;
+
+    pspEmuProfSymMapFree(&SymMap);
+    return rc;
+}
+
+
+uint64_t PSPEmuProfQuerySampleCount(PSPPROF hProf)
+{
+    PPSPPROFINT pThis = hProf;
+
+    return pThis->cSamples;
+}
+
@@ -35,6 +35,13 @@
 #include <psp-proxy.h>
 #include <psp-trace.h>
 #include <psp-iom.h>
+#include <psp-evtq.h>
+
+
+/** Virtual time in nanoseconds after a forwarded access until the interrupt state of the real PSP gets polled. */
+#define PSP_PROXY_IRQ_POLL_ACCESS_NS    UINT64_C(1000)
+/** Virtual time in nanoseconds between background polls of the interrupt state of the real PSP. */
+#define PSP_PROXY_IRQ_POLL_PERIOD_NS    UINT64_C(100000)
 
 
 /**
@@ -97,6 +104,10 @@ typedef struct PSPPROXYCCD
     PPSPPROXYINT                pThis;
     /** The CCD handle. */
     PSPCCD                      hCcd;
+    /** The emulation core handle of the CCD. */
+    PSPCORE                     hPspCore;
+    /** The timer polling the real PSP for interrupt line changes. */
+    PSPEVTQTIMER                hTmrIrqPoll;
     /** The trace point handle for secure OS handover. */
     PSPCORETP                   hTpSecureOsHandover;
     /** PSP Proxy start address. */
@@ -558,6 +569,73 @@ static PSPBLSTAGE pspEmuCcdDetermineBlStage(PSPCCD hCcd)
 }
 
 
+/**
+ * Polls the real PSP for a change of the interrupt lines and forwards them to the emulated core.
+ *
+ * @returns nothing.
+ * @param   pThis                   The proxy instance, the lock must be held by the caller.
+ * @param   pCcdRec                 The CCD record.
+ *
+ * @note Each poll is a round trip to the real hardware, so this doesn't get called after every forwarded
+ *       access but from the poll timer, see pspEmuProxyCcdIrqPollSchedule().
+ */
+static void pspEmuProxyCcdIrqPoll(PPSPPROXYINT pThis, PPSPPROXYCCD pCcdRec)
+{
+    uint32_t idCcd = 0; /** @todo Multiple CCD support. */
+    bool fIrq = false;
+    bool fFiq = false;
+
+    int rc = PSPProxyCtxPspWaitForIrq(pThis->hPspProxyCtx, &idCcd, &fIrq, &fFiq, 0);
+    if (STS_SUCCESS(rc))
+    {
+        PSPEmuCoreIrqSet(pCcdRec->hPspCore, fIrq);
+        PSPEmuCoreFiqSet(pCcdRec->hPspCore, fFiq);
+    }
+}
+
+
+/**
+ * Interrupt poll timer callback.
+ *
+ * @returns nothing.
+ * @param   hTimer                  The timer handle.
+ * @param   tsNowNs                 The current virtual time in nanoseconds.
+ * @param   pvUser                  The CCD record.
+ */
+static void pspEmuProxyCcdIrqPollTimerExpired(PSPEVTQTIMER hTimer, uint64_t tsNowNs, void *pvUser)
+{
+    PPSPPROXYCCD pCcdRec = (PPSPPROXYCCD)pvUser;
+    PPSPPROXYINT pThis = pCcdRec->pThis;
+
+    pspProxyLock(pThis);
+    pspEmuProxyCcdIrqPoll(pThis, pCcdRec);
+    pspProxyUnlock(pThis);
+
+    /* Keep a slow background poll going for interrupts not caused by any access of the emulated code. */
+    PSPEmuEvtQTimerArm(hTimer, tsNowNs + PSP_PROXY_IRQ_POLL_PERIOD_NS);
+}
+
+
+/**
+ * Makes sure the interrupt state of the real PSP gets polled shortly after an access was forwarded
+ * which might have changed it.
+ *
+ * @returns nothing.
+ * @param   pCcdRec                 The CCD record.
+ *
+ * @note Accesses in a burst are coalesced into a single poll instead of doing a round trip to the
+ *       real hardware for every one of them.
+ */
+static void pspEmuProxyCcdIrqPollSchedule(PPSPPROXYCCD pCcdRec)
+{
+    uint64_t tsPollNs = PSPEmuCoreQueryVirtTimeNs(pCcdRec->hPspCore) + PSP_PROXY_IRQ_POLL_ACCESS_NS;
+
+    if (   !PSPEmuEvtQTimerIsArmed(pCcdRec->hTmrIrqPoll)
+        || PSPEmuEvtQTimerDeadlineGet(pCcdRec->hTmrIrqPoll) > tsPollNs)
+        PSPEmuEvtQTimerArm(pCcdRec->hTmrIrqPoll, tsPollNs);
+}
+
+
 static void pspEmuProxyCcdPspMmioUnassignedRead(PSPADDR offMmio, size_t cbRead, void *pvVal, void *pvUser)
 {
     PPSPPROXYCCD pCcdRec = (PPSPPROXYCCD)pvUser;
@@ -581,6 +659,8 @@ static void pspEmuProxyCcdPspMmioUnassignedRead(PSPADDR offMmio, size_t cbRead,
         if (rc)
             PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_FATAL_ERROR, PSPTRACEEVTORIGIN_PROXY,
                                     "pspEmuProxyCcdPspMmioUnassignedRead() failed with %d\n", rc);
+
+        pspEmuProxyCcdIrqPollSchedule(pCcdRec);
     }
     else
         PSPEmuTraceEvtAddDevRead(NULL, PSPTRACEEVTSEVERITY_INFO, PSPTRACEEVTORIGIN_MMIO,
@@ -613,6 +693,8 @@ static void pspEmuProxyCcdPspMmioUnassignedWrite(PSPADDR offMmio, size_t cbWrite
         if (rc)
             PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_FATAL_ERROR, PSPTRACEEVTORIGIN_PROXY,
                                     "pspEmuProxyCcdPspMmioUnassignedWrite() failed with %d", rc);
+
+        pspEmuProxyCcdIrqPollSchedule(pCcdRec);
     }
     else
         PSPEmuTraceEvtAddDevWrite(NULL, PSPTRACEEVTSEVERITY_INFO, PSPTRACEEVTORIGIN_MMIO,
@@ -641,6 +723,8 @@ static void pspEmuProxyCcdPspSmnUnassignedRead(SMNADDR offSmn, size_t cbRead, vo
         if (rc)
             PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_FATAL_ERROR, PSPTRACEEVTORIGIN_PROXY,
                                     "pspEmuProxyCcdPspSmnUnassignedRead() failed with %d", rc);
+
+        pspEmuProxyCcdIrqPollSchedule(pCcdRec);
     }
     else
         PSPEmuTraceEvtAddDevRead(NULL, PSPTRACEEVTSEVERITY_INFO, PSPTRACEEVTORIGIN_SMN,
@@ -679,6 +763,8 @@ static void pspEmuProxyCcdPspSmnUnassignedWrite(SMNADDR offSmn, size_t cbWrite,
                 PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_FATAL_ERROR, PSPTRACEEVTORIGIN_PROXY,
                                         "pspEmuProxyCcdPspSmnUnassignedWrite() failed with %d", rc);
         }
+
+        pspEmuProxyCcdIrqPollSchedule(pCcdRec);
     }
     else
         PSPEmuTraceEvtAddDevWrite(NULL, PSPTRACEEVTSEVERITY_INFO, PSPTRACEEVTORIGIN_SMN,
@@ -713,6 +799,8 @@ static void pspEmuProxyCcdX86UnassignedRead(X86PADDR offX86Phys, size_t cbRead,
         if (rc)
             PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_FATAL_ERROR, PSPTRACEEVTORIGIN_PROXY,
                                     "pspEmuProxyCcdX86UnassignedRead() failed with %d", rc);
+
+        pspEmuProxyCcdIrqPollSchedule(pCcdRec);
     }
     else
         PSPEmuTraceEvtAddDevRead(NULL, PSPTRACEEVTSEVERITY_INFO, PSPTRACEEVTORIGIN_X86,
@@ -758,6 +846,8 @@ static void pspEmuProxyCcdX86UnassignedWrite(X86PADDR offX86Phys, size_t cbWrite
                 PSPEmuTraceEvtAddString(NULL, PSPTRACEEVTSEVERITY_FATAL_ERROR, PSPTRACEEVTORIGIN_PROXY,
                                         "pspEmuProxyCcdX86UnassignedWrite() failed with %d", rc);
         }
+
+        pspEmuProxyCcdIrqPollSchedule(pCcdRec);
     }
     else
         PSPEmuTraceEvtAddDevWrite(NULL, PSPTRACEEVTSEVERITY_INFO, PSPTRACEEVTORIGIN_X86,
@@ -2614,6 +2704,8 @@ void PSPProxyDestroy(PSPPROXY hProxy)
         PPSPPROXYCCD pFree = pCcdRec;
         pCcdRec = pCcdRec->pNext;
 
+        if (pFree->hTmrIrqPoll)
+            PSPEmuEvtQTimerDestroy(pFree->hTmrIrqPoll);
         free(pFree);
     }
 
@@ -2634,14 +2726,26 @@ int PSPProxyCcdRegister(PSPPROXY hProxy, PSPCCD hCcd)
     {
         PSPIOM hIoMgr;
         PSPCORE hPspCore;
+        PSPEVTQ hEvtQ;
         rc = PSPEmuCcdQueryIoMgr(hCcd, &hIoMgr);
         if (STS_SUCCESS(rc))
             rc = PSPEmuCcdQueryCore(hCcd, &hPspCore);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuCcdQueryEvtQ(hCcd, &hEvtQ);
         if (STS_SUCCESS(rc))
         {
+            pCcdRec->pThis    = pThis;
+            pCcdRec->hPspCore = hPspCore;
+
+            rc = PSPEmuEvtQTimerCreate(hEvtQ, pspEmuProxyCcdIrqPollTimerExpired, pCcdRec, "Proxy IRQ poll",
+                                       &pCcdRec->hTmrIrqPoll);
+            if (STS_SUCCESS(rc))
+                rc = PSPEmuEvtQTimerArmRelative(pCcdRec->hTmrIrqPoll, PSP_PROXY_IRQ_POLL_PERIOD_NS);
+
             /* Register the unassigned handlers for the various regions. */
-            rc = PSPEmuIoMgrMmioUnassignedSet(hIoMgr, pspEmuProxyCcdPspMmioUnassignedRead, pspEmuProxyCcdPspMmioUnassignedWrite,
-                                              "<PROXY>", pCcdRec);
+            if (STS_SUCCESS(rc))
+                rc = PSPEmuIoMgrMmioUnassignedSet(hIoMgr, pspEmuProxyCcdPspMmioUnassignedRead, pspEmuProxyCcdPspMmioUnassignedWrite,
+                                                  "<PROXY>", pCcdRec);
             if (STS_SUCCESS(rc))
                 rc = PSPEmuIoMgrSmnUnassignedSet(hIoMgr, pspEmuProxyCcdPspSmnUnassignedRead, pspEmuProxyCcdPspSmnUnassignedWrite,
                                                  "<PROXY>", pCcdRec);
@@ -2682,6 +2786,9 @@ int PSPProxyCcdRegister(PSPPROXY hProxy, PSPCCD hCcd)
 
                 return STS_INF_SUCCESS;
             }
+
+            if (pCcdRec->hTmrIrqPoll)
+                PSPEmuEvtQTimerDestroy(pCcdRec->hTmrIrqPoll);
         }
 
         free(pCcdRec);
@@ -0,0 +1,490 @@
+/** @file
+ * PSP Emulator - Snapshot (checkpoint) file API.
+ */
+
+/*
+ * Copyright (C) 2020 Alexander Eichner <alexander.eichner@campus.tu-berlin.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <common/types.h>
+#include <common/cdefs.h>
+#include <common/status.h>
+
+#include <os/file.h>
+
+#include <psp-snapshot.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+
+/** PSP snapshot header magic (sans the zero terminator). */
+#define PSP_SNAPSHOT_HDR_MAGIC              "PSPSNAPS"
+/** This defines the endianess of the snapshot. */
+#define PSP_SNAPSHOT_HDR_ENDIANESS          0xdeadc0de
+/** Snapshot file format version (1.0 currently). */
+#define PSP_SNAPSHOT_HDR_VERSION            0x00010000
+/** Alignment of page data inside the snapshot file. */
+#define PSP_SNAPSHOT_PAGE_ALIGNMENT         _4K
+/** Name of the terminating unit. */
+#define PSP_SNAPSHOT_UNIT_NAME_END          "__end__"
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+
+/**
+ * Snapshot file header.
+ */
+typedef struct PSPSNAPSHOTHDR
+{
+    /** Magic identifying the snapshot (PSPSNAPS). */
+    uint8_t                         achMagic[8];
+    /** Endianess of the snapshot. */
+    uint32_t                        u32Endianess;
+    /** Snapshot format version. */
+    uint32_t                        u32Version;
+} PSPSNAPSHOTHDR;
+/** Pointer to a snapshot header. */
+typedef PSPSNAPSHOTHDR *PPSPSNAPSHOTHDR;
+/** Pointer to a const snapshot header. */
+typedef const PSPSNAPSHOTHDR *PCPSPSNAPSHOTHDR;
+
+
+/**
+ * Data unit header, the unit data follows directly.
+ */
+typedef struct PSPSNAPSHOTUNITHDR
+{
+    /** Unit name (zero terminated). */
+    char                            achName[32];
+    /** Instance number of the unit. */
+    uint32_t                        u32Instance;
+    /** Unit version. */
+    uint32_t                        u32Version;
+    /** Size of the unit data following the header in bytes (including any alignment padding). */
+    uint64_t                        cbUnit;
+} PSPSNAPSHOTUNITHDR;
+/** Pointer to a unit header. */
+typedef PSPSNAPSHOTUNITHDR *PPSPSNAPSHOTUNITHDR;
+/** Pointer to a const unit header. */
+typedef const PSPSNAPSHOTUNITHDR *PCPSPSNAPSHOTUNITHDR;
+
+
+/**
+ * Internal snapshot instance data.
+ */
+typedef struct PSPSNAPSHOTINT
+{
+    /** Flag whether the snapshot was opened for writing. */
+    bool                            fWrite;
+    /** Flag whether a unit is currently open for writing. */
+    bool                            fUnitOpen;
+    /** File handle when writing. */
+    FILE                            *pFile;
+    /** File offset of the current unit header when writing. */
+    long                            offUnitHdr;
+    /** The mapped snapshot file when reading. */
+    uint8_t                         *pbMap;
+    /** Size of the mapping. */
+    size_t                          cbMap;
+    /** Current read offset. */
+    size_t                          offRead;
+    /** End of the current unit when reading (offset after the last byte). */
+    size_t                          offUnitEnd;
+} PSPSNAPSHOTINT;
+/** Pointer to the internal snapshot instance data. */
+typedef PSPSNAPSHOTINT *PPSPSNAPSHOTINT;
+
+
+/*********************************************************************************************************************************
+*   Internal Functions                                                                                                           *
+*********************************************************************************************************************************/
+
+/**
+ * Writes the given data to the snapshot file.
+ *
+ * @returns Status code.
+ * @param   pThis                   The snapshot instance.
+ * @param   pvData                  The data to write.
+ * @param   cbData                  Number of bytes to write.
+ */
+static int pspEmuSnapshotWrite(PPSPSNAPSHOTINT pThis, const void *pvData, size_t cbData)
+{
+    if (!cbData)
+        return STS_INF_SUCCESS;
+
+    size_t cWritten = fwrite(pvData, cbData, 1, pThis->pFile);
+    if (cWritten != 1)
+        return STS_ERR_GENERAL_ERROR;
+
+    return STS_INF_SUCCESS;
+}
+
+
+/**
+ * Pads the snapshot file with zeros up to the next page boundary.
+ *
+ * @returns Status code.
+ * @param   pThis                   The snapshot instance.
+ */
+static int pspEmuSnapshotWritePad(PPSPSNAPSHOTINT pThis)
+{
+    static const uint8_t s_abZero[PSP_SNAPSHOT_PAGE_ALIGNMENT] = { 0 };
+
+    long offCur = ftell(pThis->pFile);
+    if (offCur == -1)
+        return STS_ERR_GENERAL_ERROR;
+
+    size_t cbPad = (PSP_SNAPSHOT_PAGE_ALIGNMENT - (offCur % PSP_SNAPSHOT_PAGE_ALIGNMENT)) % PSP_SNAPSHOT_PAGE_ALIGNMENT;
+    return pspEmuSnapshotWrite(pThis, &s_abZero[0], cbPad);
+}
+
+
+/**
+ * Reads data from the current unit of the mapped snapshot.
+ *
+ * @returns Status code.
+ * @param   pThis                   The snapshot instance.
+ * @param   pvData                  Where to store the read data.
+ * @param   cbData                  Number of bytes to read.
+ */
+static int pspEmuSnapshotRead(PPSPSNAPSHOTINT pThis, void *pvData, size_t cbData)
+{
+    if (cbData > pThis->offUnitEnd - pThis->offRead)
+        return STS_ERR_BUFFER_OVERFLOW;
+
+    memcpy(pvData, pThis->pbMap + pThis->offRead, cbData);
+    pThis->offRead += cbData;
+    return STS_INF_SUCCESS;
+}
+
+
+int PSPEmuSnapshotCreate(PPSPSNAPSHOT phSnap, const char *pszFilename)
+{
+    int rc = STS_ERR_GENERAL_ERROR;
+    FILE *pSnapFile = fopen(pszFilename, "wb");
+    if (pSnapFile)
+    {
+        PPSPSNAPSHOTINT pThis = (PPSPSNAPSHOTINT)calloc(1, sizeof(*pThis));
+        if (pThis)
+        {
+            pThis->fWrite    = true;
+            pThis->fUnitOpen = false;
+            pThis->pFile     = pSnapFile;
+
+            /* Write the header. */
+            PSPSNAPSHOTHDR Hdr;
+            memcpy(&Hdr.achMagic[0], PSP_SNAPSHOT_HDR_MAGIC, sizeof(Hdr.achMagic));
+            Hdr.u32Endianess = PSP_SNAPSHOT_HDR_ENDIANESS;
+            Hdr.u32Version   = PSP_SNAPSHOT_HDR_VERSION;
+            rc = pspEmuSnapshotWrite(pThis, &Hdr, sizeof(Hdr));
+            if (STS_SUCCESS(rc))
+            {
+                *phSnap = pThis;
+                return STS_INF_SUCCESS;
+            }
+
+            free(pThis);
+        }
+        else
+            rc = STS_ERR_NO_MEMORY;
+
+        fclose(pSnapFile);
+    }
+
+    return rc;
+}
+
+
+int PSPEmuSnapshotOpen(PPSPSNAPSHOT phSnap, const char *pszFilename)
+{
+    int rc = STS_INF_SUCCESS;
+    PPSPSNAPSHOTINT pThis = (PPSPSNAPSHOTINT)calloc(1, sizeof(*pThis));
+    if (pThis)
+    {
+        void *pvMap = NULL;
+        size_t cbMap = 0;
+
+        rc = OSFileMapPrivate(pszFilename, &pvMap, &cbMap);
+        if (!rc)
+        {
+            PCPSPSNAPSHOTHDR pHdr = (PCPSPSNAPSHOTHDR)pvMap;
+
+            if (   cbMap >= sizeof(*pHdr)
+                && !memcmp(&pHdr->achMagic[0], PSP_SNAPSHOT_HDR_MAGIC, sizeof(pHdr->achMagic))
+                && pHdr->u32Endianess == PSP_SNAPSHOT_HDR_ENDIANESS
+                && pHdr->u32Version == PSP_SNAPSHOT_HDR_VERSION)
+            {
+                pThis->fWrite     = false;
+                pThis->pbMap      = (uint8_t *)pvMap;
+                pThis->cbMap      = cbMap;
+                pThis->offRead    = sizeof(*pHdr);
+                pThis->offUnitEnd = sizeof(*pHdr);
+                *phSnap = pThis;
+                return STS_INF_SUCCESS;
+            }
+            else
+                rc = STS_ERR_INVALID_PARAMETER;
+
+            OSFileUnmap(pvMap, cbMap);
+        }
+        else
+            rc = STS_ERR_NOT_FOUND;
+
+        free(pThis);
+    }
+    else
+        rc = STS_ERR_NO_MEMORY;
+
+    return rc;
+}
+
+
+int PSPEmuSnapshotClose(PSPSNAPSHOT hSnap)
+{
+    PPSPSNAPSHOTINT pThis = hSnap;
+    int rc = STS_INF_SUCCESS;
+
+    if (pThis->fWrite)
+    {
+        if (pThis->fUnitOpen)
+            rc = PSPEmuSnapshotUnitEnd(pThis);
+
+        /* Terminate the unit list. */
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotUnitBegin(pThis, PSP_SNAPSHOT_UNIT_NAME_END, 0 /*uInstance*/, 0 /*uVersion*/);
+        if (STS_SUCCESS(rc))
+            rc = PSPEmuSnapshotUnitEnd(pThis);
+
+        fflush(pThis->pFile);
+        fclose(pThis->pFile);
+    }
+    else
+        OSFileUnmap(pThis->pbMap, pThis->cbMap);
+
+    free(pThis);
+    return rc;
+}
+
+
+int PSPEmuSnapshotUnitBegin(PSPSNAPSHOT hSnap, const char *pszName, uint32_t uInstance, uint32_t uVersion)
+{
+    PPSPSNAPSHOTINT pThis = hSnap;
+
+    if (   !pThis->fWrite
+        || pThis->fUnitOpen
+        || strlen(pszName) >= sizeof(((PPSPSNAPSHOTUNITHDR)0)->achName))
+        return STS_ERR_INVALID_PARAMETER;
+
+    pThis->offUnitHdr = ftell(pThis->pFile);
+    if (pThis->offUnitHdr == -1)
+        return STS_ERR_GENERAL_ERROR;
+
+    /* The size gets filled in when the unit is finished. */
+    PSPSNAPSHOTUNITHDR UnitHdr;
+    memset(&UnitHdr, 0, sizeof(UnitHdr));
+    strcpy(&UnitHdr.achName[0], pszName);
+    UnitHdr.u32Instance = uInstance;
+    UnitHdr.u32Version  = uVersion;
+    UnitHdr.cbUnit      = 0;
+    int rc = pspEmuSnapshotWrite(pThis, &UnitHdr, sizeof(UnitHdr));
+    if (STS_SUCCESS(rc))
+        pThis->fUnitOpen = true;
+
+    return rc;
+}
+
+
+int PSPEmuSnapshotUnitEnd(PSPSNAPSHOT hSnap)
+{
+    PPSPSNAPSHOTINT pThis = hSnap;
+
+    if (   !pThis->fWrite
+        || !pThis->fUnitOpen)
+        return STS_ERR_INVALID_PARAMETER;
+
+    int rc = STS_INF_SUCCESS;
+    long offEnd = ftell(pThis->pFile);
+    if (offEnd != -1)
+    {
+        /* Go back and fill in the unit size. */
+        uint64_t cbUnit = offEnd - pThis->offUnitHdr - sizeof(PSPSNAPSHOTUNITHDR);
+        if (   !fseek(pThis->pFile, pThis->offUnitHdr + offsetof(PSPSNAPSHOTUNITHDR, cbUnit), SEEK_SET)
+            && fwrite(&cbUnit, sizeof(cbUnit), 1, pThis->pFile) == 1
+            && !fseek(pThis->pFile, offEnd, SEEK_SET))
+            pThis->fUnitOpen = false;
+        else
+            rc = STS_ERR_GENERAL_ERROR;
+    }
+    else
+        rc = STS_ERR_GENERAL_ERROR;
+
+    return rc;
+}
+
+
+int PSPEmuSnapshotUnitSeek(PSPSNAPSHOT hSnap, const char *pszName, uint32_t uInstance, uint32_t *puVersion)
+{
+    PPSPSNAPSHOTINT pThis = hSnap;
+
+    if (pThis->fWrite)
+        return STS_ERR_INVALID_PARAMETER;
+
+    /* Walk the unit list from the beginning. */
+    size_t offUnit = sizeof(PSPSNAPSHOTHDR);
+    while (offUnit + sizeof(PSPSNAPSHOTUNITHDR) <= pThis->cbMap)
+    {
+        PCPSPSNAPSHOTUNITHDR pUnitHdr = (PCPSPSNAPSHOTUNITHDR)(pThis->pbMap + offUnit);
+        size_t offData = offUnit + sizeof(*pUnitHdr);
+
+        if (   pUnitHdr->achName[sizeof(pUnitHdr->achName) - 1] != '\0'
+            || pUnitHdr->cbUnit > pThis->cbMap - offData)
+            break; /* Corrupted. */
+
+        if (!strcmp(&pUnitHdr->achName[0], PSP_SNAPSHOT_UNIT_NAME_END))
+            break;
+
+        if (   !strcmp(&pUnitHdr->achName[0], pszName)
+            && pUnitHdr->u32Instance == uInstance)
+        {
+            pThis->offRead    = offData;
+            pThis->offUnitEnd = offData + pUnitHdr->cbUnit;
+            if (puVersion)
+                *puVersion = pUnitHdr->u32Version;
+            return STS_INF_SUCCESS;
+        }
+
+        offUnit = offData + pUnitHdr->cbUnit;
+    }
+
+    return STS_ERR_NOT_FOUND;
+}
+
+
+int PSPEmuSnapshotPutData(PSPSNAPSHOT hSnap, const void *pvData, size_t cbData)
+{
+    PPSPSNAPSHOTINT pThis = hSnap;
+
+    if (!pThis->fUnitOpen)
+        return STS_ERR_INVALID_PARAMETER;
+
+    return pspEmuSnapshotWrite(pThis, pvData, cbData);
+}
+
+
+int PSPEmuSnapshotGetData(PSPSNAPSHOT hSnap, void *pvData, size_t cbData)
+{
+    PPSPSNAPSHOTINT pThis = hSnap;
+
+    if (pThis->fWrite)
+        return STS_ERR_INVALID_PARAMETER;
+
+    return pspEmuSnapshotRead(pThis, pvData, cbData);
+}
+
+
+int PSPEmuSnapshotPutU32(PSPSNAPSHOT hSnap, uint32_t u32)
+{
+    return PSPEmuSnapshotPutData(hSnap, &u32, sizeof(u32));
+}
+
+
+int PSPEmuSnapshotGetU32(PSPSNAPSHOT hSnap, uint32_t *pu32)
+{
+    return PSPEmuSnapshotGetData(hSnap, pu32, sizeof(*pu32));
+}
+
+
+int PSPEmuSnapshotPutU64(PSPSNAPSHOT hSnap, uint64_t u64)
+{
+    return PSPEmuSnapshotPutData(hSnap, &u64, sizeof(u64));
+}
+
+
+int PSPEmuSnapshotGetU64(PSPSNAPSHOT hSnap, uint64_t *pu64)
+{
+    return PSPEmuSnapshotGetData(hSnap, pu64, sizeof(*pu64));
+}
+
+
+int PSPEmuSnapshotPutBool(PSPSNAPSHOT hSnap, bool f)
+{
+    uint8_t u8 = f ? 1 : 0;
+    return PSPEmuSnapshotPutData(hSnap, &u8, sizeof(u8));
+}
+
+
+int PSPEmuSnapshotGetBool(PSPSNAPSHOT hSnap, bool *pf)
+{
+    uint8_t u8 = 0;
+    int rc = PSPEmuSnapshotGetData(hSnap, &u8, sizeof(u8));
+    if (STS_SUCCESS(rc))
+        *pf = u8 ? true : false;
+
+    return rc;
+}
+
+
+int PSPEmuSnapshotPutPages(PSPSNAPSHOT hSnap, const void *pvPages, size_t cbPages)
+{
+    PPSPSNAPSHOTINT pThis = hSnap;
+
+    int rc = PSPEmuSnapshotPutU64(hSnap, cbPages);
+    if (STS_SUCCESS(rc))
+        rc = pspEmuSnapshotWritePad(pThis);
+    if (STS_SUCCESS(rc))
+        rc = pspEmuSnapshotWrite(pThis, pvPages, cbPages);
+
+    return rc;
+}
+
+
+int PSPEmuSnapshotGetPages(PSPSNAPSHOT hSnap, void **ppvPages, size_t cbPages)
+{
+    PPSPSNAPSHOTINT pThis = hSnap;
+
+    uint64_t cbPagesSnap = 0;
+    int rc = PSPEmuSnapshotGetU64(hSnap, &cbPagesSnap);
+    if (STS_SUCCESS(rc))
+    {
+        if (cbPagesSnap == cbPages)
+        {
+            size_t offPages = (pThis->offRead + PSP_SNAPSHOT_PAGE_ALIGNMENT - 1) & ~(size_t)(PSP_SNAPSHOT_PAGE_ALIGNMENT - 1);
+            if (   offPages <= pThis->offUnitEnd
+                && cbPages <= pThis->offUnitEnd - offPages)
+            {
+                *ppvPages = pThis->pbMap + offPages;
+                pThis->offRead = offPages + cbPages;
+            }
+            else
+                rc = STS_ERR_BUFFER_OVERFLOW;
+        }
+        else
+            rc = STS_ERR_INVALID_PARAMETER;
+    }
+
+    return rc;
+}
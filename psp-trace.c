@@ -182,6 +182,8 @@ typedef struct PSPTRACEINT
     PFNPSPTRACEFLUSH                pfnFlush;
     /** Opaque user data to pass to the flush callback. */
     void                            *pvUser;
+    /** The file opened by PSPEmuTraceCreateForFile(), closed on destruction, NULL otherwise. */
+    FILE                            *pFile;
     /** Array of event severities what kind of events are logged for each event origin. */
     PSPTRACEEVTSEVERITY             aenmEvtTypesSeverity[PSPTRACEEVTORIGIN_LAST + 1];
     /** Number of bytes currently allocated for all stored trace events. */
@@ -199,8 +201,8 @@ typedef PSPTRACEINT *PPSPTRACEINT;
 typedef const PSPTRACEINT *PCPSPTRACEINT;
 
 
-/** Global default tracer instance used. */
-static PPSPTRACEINT g_pTraceDef = NULL;
+/** Default tracer instance used, per thread so every CCD running on its own thread traces into its own instance. */
+static __thread PPSPTRACEINT g_pTraceDef = NULL;
 
 
 /**
@@ -699,6 +701,29 @@ static int pspEmuTraceEvtDump(PPSPTRACEINT pThis, uint32_t fFlags, PCPSPTRACEEVT
 }
 
 
+/**
+ * Flushes all buffered events.
+ *
+ * @returns nothing.
+ * @param   pThis                   The trace log instance data.
+ */
+static void pspEmuTraceFlushAll(PPSPTRACEINT pThis)
+{
+    /* Walk the trace events and dump one by one. */
+    for (uint64_t i = 0; i < pThis->cTraceEvts; i++)
+    {
+        PCPSPTRACEEVT pEvt = pThis->papTraceEvts[i];
+
+        pThis->papTraceEvts[i] = NULL;
+        pspEmuTraceEvtDump(pThis, pThis->fFlags, pEvt);
+        pThis->cbEvtAlloc -= pEvt->cbAlloc;
+        free((void *)pEvt);
+    }
+
+    pThis->cTraceEvts = 0;
+}
+
+
 /**
  * Maybe flushes any buffered events.
  *
@@ -710,20 +735,7 @@ static int pspEmuTraceFlushMaybe(PPSPTRACEINT pThis)
     int rc = 0;
 
     if (pThis->cEvtsBuffer < pThis->cTraceEvts)
-    {
-        /* Walk the trace events and dump one by one. */
-        for (uint64_t i = 0; i < pThis->cTraceEvts; i++)
-        {
-            PCPSPTRACEEVT pEvt = pThis->papTraceEvts[i];
-
-            pThis->papTraceEvts[i] = NULL;
-            pspEmuTraceEvtDump(pThis, pThis->fFlags, pEvt);
-            pThis->cbEvtAlloc -= pEvt->cbAlloc;
-            free((void *)pEvt);
-        }
-
-        pThis->cTraceEvts = 0;
-    }
+        pspEmuTraceFlushAll(pThis);
 
     return rc;
 }
@@ -887,6 +899,7 @@ int PSPEmuTraceCreate(PPSPTRACE phTrace, uint32_t fFlags, PSPCORE hPspCore,
             pThis->cEvtsBuffer      = cEvtsBuffer;
             pThis->pfnFlush         = pfnFlush;
             pThis->pvUser           = pvUser;
+            pThis->pFile            = NULL;
             pThis->cbEvtAlloc       = 0;
             pThis->cTraceEvtsMax    = 0;
             pThis->cTraceEvts       = 0;
@@ -919,7 +932,16 @@ int PSPEmuTraceCreateForFile(PPSPTRACE phTrace, uint32_t fFlags, PSPCORE hPspCor
     int rc = 0;
     FILE *pTraceFile = fopen(pszFilename, "wb");
     if (pTraceFile)
+    {
         rc = PSPEmuTraceCreate(phTrace, fFlags, hPspCore, cEvtsBuffer, pspEmuTraceFileFlush, pTraceFile);
+        if (STS_SUCCESS(rc))
+        {
+            PPSPTRACEINT pThis = *phTrace;
+            pThis->pFile = pTraceFile;
+        }
+        else
+            fclose(pTraceFile);
+    }
     else
         rc = -1;
 
@@ -935,18 +957,30 @@ void PSPEmuTraceDestroy(PSPTRACE hTrace)
     if (g_pTraceDef == pThis)
         g_pTraceDef = NULL;
 
-    /* Free all trace events. */
+    /* Write out what is still buffered and free the event array. */
+    pspEmuTraceFlushAll(pThis);
     if (pThis->papTraceEvts)
-    {
-        for (uint32_t i = 0; i < pThis->cTraceEvts; i++)
-            free((void *)pThis->papTraceEvts[i]);
         free(pThis->papTraceEvts);
-    }
+    if (pThis->pFile)
+        fclose(pThis->pFile);
     OSLockDestroy(pThis->hLock);
     free(pThis);
 }
 
 
+int PSPEmuTraceFlush(PSPTRACE hTrace)
+{
+    PPSPTRACEINT pThis = pspEmuTraceGetInstance(hTrace);
+    if (!pThis)
+        return STS_INF_SUCCESS;
+
+    OSLockAcquire(pThis->hLock);
+    pspEmuTraceFlushAll(pThis);
+    OSLockRelease(pThis->hLock);
+    return STS_INF_SUCCESS;
+}
+
+
 int PSPEmuTraceSetDefault(PSPTRACE hTrace)
 {
     g_pTraceDef = hTrace;